@@ -0,0 +1,376 @@
+#include "allocator.h"
+
+#include <algorithm>
+#include <new>
+#include <string.h>
+#include <utility>
+
+namespace vulkan
+{
+
+static const size_t chunk_size = 64 * 1024;
+static const size_t min_alignment = 16;
+static const size_t size_class_count = 9; // 16 bytes to 4KB
+
+enum class AllocationKind : uint8_t
+{
+    ARENA,
+    SIZE_CLASS,
+    HEAP
+};
+
+/*  Sits right before every pointer handed to the driver. */
+struct alignas(16) AllocationHeader
+{
+    void* owner;
+    void* raw;
+    uint64_t size;
+    AllocationKind kind;
+    uint8_t scope;
+    uint8_t size_class;
+};
+
+struct HostAllocator::Arena
+{
+    std::vector<char*> chunks;
+    size_t chunk_index;
+    size_t offset;
+    std::atomic<int64_t> live;
+};
+
+struct HostAllocator::SizeClass
+{
+    size_t block_size;
+    std::mutex mutex;
+    std::vector<char*> chunks;
+    void* free_list;
+};
+
+static char* allocate_raw(size_t size)
+{
+    return static_cast<char*>(::operator new(size, std::align_val_t(min_alignment), std::nothrow));
+}
+
+static void free_raw(void* raw)
+{
+    ::operator delete(raw, std::align_val_t(min_alignment));
+}
+
+/*  Bytes to reserve so that a size byte block with the given alignment
+    and its header fit at any min_alignment aligned address. */
+static size_t get_reserved_size(size_t size, size_t alignment)
+{
+    return size + sizeof(AllocationHeader) + (alignment > min_alignment ? alignment - min_alignment : 0);
+}
+
+static void* place(char* raw, void* owner, AllocationKind kind, size_t size, size_t alignment,
+    VkSystemAllocationScope scope, uint8_t size_class)
+{
+    uintptr_t user = reinterpret_cast<uintptr_t>(raw) + sizeof(AllocationHeader);
+    user = (user + alignment - 1) & ~uintptr_t(alignment - 1);
+
+    AllocationHeader* header = reinterpret_cast<AllocationHeader*>(user) - 1;
+    header->owner = owner;
+    header->raw = raw;
+    header->size = size;
+    header->kind = kind;
+    header->scope = static_cast<uint8_t>(scope);
+    header->size_class = size_class;
+    return reinterpret_cast<void*>(user);
+}
+
+static AllocationHeader* get_header(void* memory)
+{
+    return static_cast<AllocationHeader*>(memory) - 1;
+}
+
+// Arenas of the current thread, one per allocator it has called into.
+static thread_local std::vector<std::pair<uint64_t, void*>> thread_arenas;
+static std::atomic<uint64_t> next_allocator_id(1);
+
+HostAllocator::HostAllocator()
+    : id(next_allocator_id.fetch_add(1))
+{
+    callbacks.pUserData = this;
+    callbacks.pfnAllocation = &HostAllocator::allocation_callback;
+    callbacks.pfnReallocation = &HostAllocator::reallocation_callback;
+    callbacks.pfnFree = &HostAllocator::free_callback;
+    callbacks.pfnInternalAllocation = &HostAllocator::internal_allocation_callback;
+    callbacks.pfnInternalFree = &HostAllocator::internal_free_callback;
+
+    for( size_t i = 0; i < size_class_count; ++i )
+    {
+        SizeClass* size_class = new SizeClass;
+        size_class->block_size = min_alignment << i;
+        size_class->free_list = nullptr;
+        size_classes.push_back(size_class);
+    }
+
+    for( ScopeCounters& scope_counters : counters )
+    {
+        scope_counters.allocations = 0;
+        scope_counters.reallocations = 0;
+        scope_counters.frees = 0;
+        scope_counters.bytes_live = 0;
+        scope_counters.bytes_peak = 0;
+        scope_counters.internal_allocations = 0;
+    }
+}
+
+HostAllocator::~HostAllocator()
+{
+    for( Arena* arena : arenas )
+    {
+        for( char* chunk : arena->chunks )
+        {
+            free_raw(chunk);
+        }
+        delete arena;
+    }
+    for( SizeClass* size_class : size_classes )
+    {
+        for( char* chunk : size_class->chunks )
+        {
+            free_raw(chunk);
+        }
+        delete size_class;
+    }
+}
+
+const VkAllocationCallbacks* HostAllocator::get_callbacks() const
+{
+    return &callbacks;
+}
+
+HostAllocationStatistics HostAllocator::get_statistics(VkSystemAllocationScope scope) const
+{
+    const ScopeCounters& scope_counters = counters[scope];
+
+    HostAllocationStatistics statistics;
+    statistics.allocations = scope_counters.allocations.load();
+    statistics.reallocations = scope_counters.reallocations.load();
+    statistics.frees = scope_counters.frees.load();
+    statistics.bytes_live = scope_counters.bytes_live.load();
+    statistics.bytes_peak = scope_counters.bytes_peak.load();
+    statistics.internal_allocations = scope_counters.internal_allocations.load();
+    return statistics;
+}
+
+VKAPI_ATTR void* VKAPI_CALL HostAllocator::allocation_callback(
+    void* user_data, size_t size, size_t alignment, VkSystemAllocationScope scope)
+{
+    return static_cast<HostAllocator*>(user_data)->allocate(size, alignment, scope);
+}
+
+VKAPI_ATTR void* VKAPI_CALL HostAllocator::reallocation_callback(
+    void* user_data, void* original, size_t size, size_t alignment, VkSystemAllocationScope scope)
+{
+    return static_cast<HostAllocator*>(user_data)->reallocate(original, size, alignment, scope);
+}
+
+VKAPI_ATTR void VKAPI_CALL HostAllocator::free_callback(void* user_data, void* memory)
+{
+    static_cast<HostAllocator*>(user_data)->free(memory);
+}
+
+VKAPI_ATTR void VKAPI_CALL HostAllocator::internal_allocation_callback(
+    void* user_data, size_t, VkInternalAllocationType, VkSystemAllocationScope scope)
+{
+    static_cast<HostAllocator*>(user_data)->counters[scope].internal_allocations++;
+}
+
+VKAPI_ATTR void VKAPI_CALL HostAllocator::internal_free_callback(
+    void*, size_t, VkInternalAllocationType, VkSystemAllocationScope)
+{
+}
+
+HostAllocator::Arena* HostAllocator::get_thread_arena()
+{
+    for( auto& entry : thread_arenas )
+    {
+        if( entry.first == id )
+        {
+            return static_cast<Arena*>(entry.second);
+        }
+    }
+
+    Arena* arena = new Arena;
+    arena->chunk_index = 0;
+    arena->offset = 0;
+    arena->live = 0;
+    {
+        std::lock_guard<std::mutex> lock(arenas_mutex);
+        arenas.push_back(arena);
+    }
+    thread_arenas.emplace_back(id, arena);
+    return arena;
+}
+
+void HostAllocator::count_allocation(VkSystemAllocationScope scope, size_t size)
+{
+    ScopeCounters& scope_counters = counters[scope];
+    scope_counters.allocations++;
+
+    uint64_t live = scope_counters.bytes_live.fetch_add(size) + size;
+    uint64_t peak = scope_counters.bytes_peak.load();
+    while( live > peak && !scope_counters.bytes_peak.compare_exchange_weak(peak, live) )
+    {
+    }
+}
+
+void* HostAllocator::allocate(size_t size, size_t alignment, VkSystemAllocationScope scope)
+{
+    if( size == 0 )
+    {
+        return nullptr;
+    }
+
+    alignment = std::max(alignment, min_alignment);
+    size_t reserved = get_reserved_size(size, alignment);
+    void* memory = nullptr;
+
+    if( scope == VK_SYSTEM_ALLOCATION_SCOPE_COMMAND && reserved <= chunk_size / 2 )
+    {
+        Arena* arena = get_thread_arena();
+
+        // Nothing handed out is still alive, start over at the beginning.
+        if( arena->live.load() == 0 )
+        {
+            arena->chunk_index = 0;
+            arena->offset = 0;
+        }
+
+        reserved = (reserved + min_alignment - 1) & ~(min_alignment - 1);
+        if( !arena->chunks.empty() && arena->offset + reserved > chunk_size )
+        {
+            arena->chunk_index++;
+            arena->offset = 0;
+        }
+        if( arena->chunk_index == arena->chunks.size() )
+        {
+            char* chunk = allocate_raw(chunk_size);
+            if( !chunk )
+            {
+                return nullptr;
+            }
+            arena->chunks.push_back(chunk);
+        }
+
+        char* raw = arena->chunks[arena->chunk_index] + arena->offset;
+        arena->offset += reserved;
+        arena->live++;
+        memory = place(raw, arena, AllocationKind::ARENA, size, alignment, scope, 0);
+    }
+    else if( reserved <= (min_alignment << (size_class_count - 1)) )
+    {
+        uint8_t index = 0;
+        while( (min_alignment << index) < reserved )
+        {
+            ++index;
+        }
+        SizeClass* size_class = size_classes[index];
+
+        char* raw;
+        {
+            std::lock_guard<std::mutex> lock(size_class->mutex);
+            if( !size_class->free_list )
+            {
+                char* chunk = allocate_raw(chunk_size);
+                if( !chunk )
+                {
+                    return nullptr;
+                }
+                size_class->chunks.push_back(chunk);
+                for( size_t offset = 0; offset + size_class->block_size <= chunk_size; offset += size_class->block_size )
+                {
+                    void** block = reinterpret_cast<void**>(chunk + offset);
+                    *block = size_class->free_list;
+                    size_class->free_list = block;
+                }
+            }
+            raw = static_cast<char*>(size_class->free_list);
+            size_class->free_list = *static_cast<void**>(size_class->free_list);
+        }
+        memory = place(raw, size_class, AllocationKind::SIZE_CLASS, size, alignment, scope, index);
+    }
+    else
+    {
+        char* raw = allocate_raw(reserved);
+        if( !raw )
+        {
+            return nullptr;
+        }
+        memory = place(raw, nullptr, AllocationKind::HEAP, size, alignment, scope, 0);
+    }
+
+    count_allocation(scope, size);
+    return memory;
+}
+
+void* HostAllocator::reallocate(void* original, size_t size, size_t alignment, VkSystemAllocationScope scope)
+{
+    if( !original )
+    {
+        return allocate(size, alignment, scope);
+    }
+    if( size == 0 )
+    {
+        free(original);
+        return nullptr;
+    }
+
+    AllocationHeader* header = get_header(original);
+    counters[header->scope].reallocations++;
+
+    // Shrinking in place keeps the block, which is big enough already.
+    if( size <= header->size && (reinterpret_cast<uintptr_t>(original) & (alignment - 1)) == 0 )
+    {
+        counters[header->scope].bytes_live -= header->size - size;
+        header->size = size;
+        return original;
+    }
+
+    void* memory = allocate(size, alignment, scope);
+    if( !memory )
+    {
+        return nullptr;
+    }
+    memcpy(memory, original, std::min<size_t>(header->size, size));
+    free(original);
+    return memory;
+}
+
+void HostAllocator::free(void* memory)
+{
+    if( !memory )
+    {
+        return;
+    }
+
+    AllocationHeader* header = get_header(memory);
+    ScopeCounters& scope_counters = counters[header->scope];
+    scope_counters.frees++;
+    scope_counters.bytes_live -= header->size;
+
+    switch( header->kind )
+    {
+        case AllocationKind::ARENA:
+            // The memory is reclaimed when the arena rewinds.
+            static_cast<Arena*>(header->owner)->live--;
+            break;
+        case AllocationKind::SIZE_CLASS:
+        {
+            SizeClass* size_class = static_cast<SizeClass*>(header->owner);
+            void** block = static_cast<void**>(header->raw);
+            std::lock_guard<std::mutex> lock(size_class->mutex);
+            *block = size_class->free_list;
+            size_class->free_list = block;
+            break;
+        }
+        case AllocationKind::HEAP:
+            free_raw(header->raw);
+            break;
+    }
+}
+
+}
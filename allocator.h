@@ -0,0 +1,90 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <atomic>
+#include <mutex>
+#include <stdint.h>
+#include <vector>
+
+namespace vulkan
+{
+
+/*  Driver host allocations seen in one VkSystemAllocationScope.
+    internal_allocations counts the driver's notifications of memory it
+    allocated itself, e.g. executable memory. */
+struct HostAllocationStatistics
+{
+    uint64_t allocations;
+    uint64_t reallocations;
+    uint64_t frees;
+    uint64_t bytes_live;
+    uint64_t bytes_peak;
+    uint64_t internal_allocations;
+};
+
+/*  Supplies the VkAllocationCallbacks the Instance and LogicalDevice pass
+    to every vkCreate* / vkAllocate* call.
+
+    COMMAND scope allocations only live for the duration of one Vulkan
+    call, so they come from a bump arena of the calling thread that
+    rewinds whenever everything in it has been freed.  Other allocations
+    up to 4KB come from free lists of power of two size classes, larger
+    ones from the heap.  Counters per scope show where the churn is.
+
+    Shared by the Instance and the devices created from it, and has to
+    outlive every Vulkan object created with its callbacks. */
+class HostAllocator
+{
+public:
+    HostAllocator();
+    ~HostAllocator();
+
+    HostAllocator(const HostAllocator&) = delete;
+    HostAllocator& operator=(const HostAllocator&) = delete;
+
+    const VkAllocationCallbacks* get_callbacks() const;
+
+    HostAllocationStatistics get_statistics(VkSystemAllocationScope scope) const;
+
+private:
+    struct Arena;
+    struct SizeClass;
+
+    struct ScopeCounters
+    {
+        std::atomic<uint64_t> allocations;
+        std::atomic<uint64_t> reallocations;
+        std::atomic<uint64_t> frees;
+        std::atomic<uint64_t> bytes_live;
+        std::atomic<uint64_t> bytes_peak;
+        std::atomic<uint64_t> internal_allocations;
+    };
+
+    static VKAPI_ATTR void* VKAPI_CALL allocation_callback(
+        void* user_data, size_t size, size_t alignment, VkSystemAllocationScope scope);
+    static VKAPI_ATTR void* VKAPI_CALL reallocation_callback(
+        void* user_data, void* original, size_t size, size_t alignment, VkSystemAllocationScope scope);
+    static VKAPI_ATTR void VKAPI_CALL free_callback(void* user_data, void* memory);
+    static VKAPI_ATTR void VKAPI_CALL internal_allocation_callback(
+        void* user_data, size_t size, VkInternalAllocationType type, VkSystemAllocationScope scope);
+    static VKAPI_ATTR void VKAPI_CALL internal_free_callback(
+        void* user_data, size_t size, VkInternalAllocationType type, VkSystemAllocationScope scope);
+
+    void* allocate(size_t size, size_t alignment, VkSystemAllocationScope scope);
+    void* reallocate(void* original, size_t size, size_t alignment, VkSystemAllocationScope scope);
+    void free(void* memory);
+
+    Arena* get_thread_arena();
+    void count_allocation(VkSystemAllocationScope scope, size_t size);
+
+    VkAllocationCallbacks callbacks;
+    uint64_t id;
+
+    std::mutex arenas_mutex;
+    std::vector<Arena*> arenas;
+    std::vector<SizeClass*> size_classes;
+    ScopeCounters counters[VK_SYSTEM_ALLOCATION_SCOPE_INSTANCE + 1];
+};
+
+}
@@ -0,0 +1,427 @@
+#include "autotune.h"
+#include "hash.h"
+#include "queue.h"
+#include "recycling.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+
+namespace vulkan
+{
+
+WorkgroupTuner::WorkgroupTuner(LogicalDevice& device, const std::string& database_path, uint32_t repetitions)
+    : device(device)
+    , database_path(database_path)
+    , repetitions(std::max(repetitions, 1u))
+    , timestamp_mask(0)
+{
+    load();
+}
+
+void WorkgroupTuner::register_kernel(const ComputeKernel& kernel)
+{
+    if( kernel.name.empty() || kernel.name.find_first_of(" \t\r\n") != std::string::npos )
+    {
+        throw std::invalid_argument("Kernel name '" + kernel.name + "' is empty or contains whitespace");
+    }
+    if( get_usable_candidates(kernel).empty() )
+    {
+        throw std::invalid_argument("Kernel '" + kernel.name + "' has no workgroup size within the device limits");
+    }
+    kernels[kernel.name] = kernel;
+}
+
+uint32_t WorkgroupTuner::tune()
+{
+    uint32_t family_count = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(device.get_physical_device(), &family_count, nullptr);
+    std::vector<VkQueueFamilyProperties> families(family_count);
+    vkGetPhysicalDeviceQueueFamilyProperties(device.get_physical_device(), &family_count, families.data());
+
+    uint32_t valid_bits = families[device.get_queue_family_index()].timestampValidBits;
+    if( valid_bits == 0 )
+    {
+        return 0;
+    }
+    timestamp_mask = valid_bits >= 64 ? ~uint64_t(0) : (uint64_t(1) << valid_bits) - 1;
+
+    VkQueryPoolCreateInfo pool_info;
+    pool_info.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+    pool_info.pNext = nullptr;
+    pool_info.flags = 0;
+    pool_info.queryType = VK_QUERY_TYPE_TIMESTAMP;
+    pool_info.queryCount = repetitions * 2;
+    pool_info.pipelineStatistics = 0;
+
+    VkQueryPool query_pool;
+    VkResult result = vkCreateQueryPool(device.get_device(), &pool_info, device.get_allocation_callbacks(), &query_pool);
+    if( result != VK_SUCCESS )
+    {
+        throw VulkanException(result, "Error while creating autotuner query pool");
+    }
+
+    CommandBufferPool command_pool(device);
+    uint32_t tuned = 0;
+
+    try
+    {
+        for( auto& named : kernels )
+        {
+            const ComputeKernel& kernel = named.second;
+            std::string key = get_key(kernel);
+            if( results.count(key) )
+            {
+                continue;
+            }
+
+            VkShaderModule module = create_shader_module(kernel);
+
+            // Any measured time beats no measurement, a 0 from a coarse
+            // timer included.
+            Result best;
+            best.size = get_usable_candidates(kernel).front();
+            best.ms = std::numeric_limits<double>::infinity();
+            for( const WorkgroupSize& size : get_usable_candidates(kernel) )
+            {
+                VkPipeline pipeline = create_pipeline(kernel, module, size);
+                double ms;
+                try
+                {
+                    ms = measure(kernel, pipeline, size, command_pool, query_pool);
+                }
+                catch( ... )
+                {
+                    vkDestroyPipeline(device.get_device(), pipeline, device.get_allocation_callbacks());
+                    vkDestroyShaderModule(device.get_device(), module, device.get_allocation_callbacks());
+                    throw;
+                }
+                vkDestroyPipeline(device.get_device(), pipeline, device.get_allocation_callbacks());
+
+                if( ms < best.ms )
+                {
+                    best.size = size;
+                    best.ms = ms;
+                }
+            }
+
+            vkDestroyShaderModule(device.get_device(), module, device.get_allocation_callbacks());
+
+            results[key] = best;
+            tuned++;
+        }
+    }
+    catch( ... )
+    {
+        vkDestroyQueryPool(device.get_device(), query_pool, device.get_allocation_callbacks());
+        throw;
+    }
+
+    vkDestroyQueryPool(device.get_device(), query_pool, device.get_allocation_callbacks());
+
+    if( tuned > 0 )
+    {
+        save();
+    }
+    return tuned;
+}
+
+bool WorkgroupTuner::is_tuned(const std::string& name) const
+{
+    return results.count(get_key(get_kernel(name))) > 0;
+}
+
+WorkgroupSize WorkgroupTuner::get_workgroup_size(const std::string& name) const
+{
+    const ComputeKernel& kernel = get_kernel(name);
+    auto found = results.find(get_key(kernel));
+    if( found != results.end() )
+    {
+        return found->second.size;
+    }
+    return get_usable_candidates(kernel).front();
+}
+
+double WorkgroupTuner::get_time(const std::string& name) const
+{
+    auto found = results.find(get_key(get_kernel(name)));
+    return found != results.end() ? found->second.ms : 0.0;
+}
+
+VkPipeline WorkgroupTuner::create_pipeline(const std::string& name) const
+{
+    const ComputeKernel& kernel = get_kernel(name);
+    VkShaderModule module = create_shader_module(kernel);
+
+    VkPipeline pipeline;
+    try
+    {
+        pipeline = create_pipeline(kernel, module, get_workgroup_size(name));
+    }
+    catch( ... )
+    {
+        vkDestroyShaderModule(device.get_device(), module, device.get_allocation_callbacks());
+        throw;
+    }
+
+    vkDestroyShaderModule(device.get_device(), module, device.get_allocation_callbacks());
+    return pipeline;
+}
+
+const ComputeKernel& WorkgroupTuner::get_kernel(const std::string& name) const
+{
+    auto found = kernels.find(name);
+    if( found == kernels.end() )
+    {
+        throw std::invalid_argument("Kernel '" + name + "' is not registered");
+    }
+    return found->second;
+}
+
+std::string WorkgroupTuner::get_key(const ComputeKernel& kernel) const
+{
+    const VkPhysicalDeviceProperties& properties = device.get_properties();
+
+    uint64_t code_hash = fnv1a(kernel.code.data(), kernel.code.size() * sizeof(uint32_t));
+    code_hash = fnv1a(kernel.entry_point.data(), kernel.entry_point.size(), code_hash);
+
+    char key[128];
+    snprintf(key, sizeof(key), "%08x %08x %08x %016llx",
+        properties.vendorID, properties.deviceID, properties.driverVersion,
+        static_cast<unsigned long long>(code_hash));
+    return std::string(key) + " " + kernel.name;
+}
+
+std::vector<WorkgroupSize> WorkgroupTuner::get_usable_candidates(const ComputeKernel& kernel) const
+{
+    const VkPhysicalDeviceLimits& limits = device.get_properties().limits;
+
+    std::vector<WorkgroupSize> usable;
+    for( const WorkgroupSize& size : kernel.candidates )
+    {
+        if( size.x == 0 || size.y == 0 || size.z == 0
+            || size.x > limits.maxComputeWorkGroupSize[0]
+            || size.y > limits.maxComputeWorkGroupSize[1]
+            || size.z > limits.maxComputeWorkGroupSize[2]
+            || uint64_t(size.x) * size.y * size.z > limits.maxComputeWorkGroupInvocations )
+        {
+            continue;
+        }
+        usable.push_back(size);
+    }
+    return usable;
+}
+
+VkShaderModule WorkgroupTuner::create_shader_module(const ComputeKernel& kernel) const
+{
+    VkShaderModuleCreateInfo create_info;
+    create_info.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+    create_info.pNext = nullptr;
+    create_info.flags = 0;
+    create_info.codeSize = kernel.code.size() * sizeof(uint32_t);
+    create_info.pCode = kernel.code.data();
+
+    VkShaderModule module;
+    VkResult result = vkCreateShaderModule(device.get_device(), &create_info, device.get_allocation_callbacks(), &module);
+    if( result != VK_SUCCESS )
+    {
+        throw VulkanException(result, "Error while creating shader module of kernel " + kernel.name);
+    }
+    return module;
+}
+
+VkPipeline WorkgroupTuner::create_pipeline(
+    const ComputeKernel& kernel,
+    VkShaderModule module,
+    const WorkgroupSize& size) const
+{
+    VkSpecializationMapEntry entries[3];
+    for( uint32_t i = 0; i < 3; ++i )
+    {
+        entries[i].constantID = i;
+        entries[i].offset = i * sizeof(uint32_t);
+        entries[i].size = sizeof(uint32_t);
+    }
+
+    VkSpecializationInfo specialization;
+    specialization.mapEntryCount = 3;
+    specialization.pMapEntries = entries;
+    specialization.dataSize = sizeof(WorkgroupSize);
+    specialization.pData = &size;
+
+    VkComputePipelineCreateInfo create_info;
+    create_info.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+    create_info.pNext = nullptr;
+    create_info.flags = 0;
+    create_info.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    create_info.stage.pNext = nullptr;
+    create_info.stage.flags = 0;
+    create_info.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+    create_info.stage.module = module;
+    create_info.stage.pName = kernel.entry_point.empty() ? "main" : kernel.entry_point.c_str();
+    create_info.stage.pSpecializationInfo = &specialization;
+    create_info.layout = kernel.layout;
+    create_info.basePipelineHandle = VK_NULL_HANDLE;
+    create_info.basePipelineIndex = -1;
+
+    VkPipeline pipeline;
+    VkResult result = vkCreateComputePipelines(
+        device.get_device(), VK_NULL_HANDLE, 1, &create_info, device.get_allocation_callbacks(), &pipeline);
+    if( result != VK_SUCCESS )
+    {
+        throw VulkanException(result, "Error while creating pipeline of kernel " + kernel.name);
+    }
+    return pipeline;
+}
+
+double WorkgroupTuner::measure(
+    const ComputeKernel& kernel,
+    VkPipeline pipeline,
+    const WorkgroupSize& size,
+    CommandBufferPool& command_pool,
+    VkQueryPool query_pool)
+{
+    command_pool.reset();
+    VkCommandBuffer command_buffer = command_pool.acquire();
+
+    VkCommandBufferBeginInfo begin_info;
+    begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    begin_info.pNext = nullptr;
+    begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    begin_info.pInheritanceInfo = nullptr;
+
+    VkResult result = vkBeginCommandBuffer(command_buffer, &begin_info);
+    if( result != VK_SUCCESS )
+    {
+        throw VulkanException(result, "Error while beginning autotuner command buffer");
+    }
+
+    VkMemoryBarrier barrier;
+    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    barrier.pNext = nullptr;
+    barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+
+    vkCmdResetQueryPool(command_buffer, query_pool, 0, repetitions * 2);
+    vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+
+    // One unmeasured run warms caches and clocks.
+    kernel.dispatch(command_buffer, size);
+
+    for( uint32_t i = 0; i < repetitions; ++i )
+    {
+        vkCmdPipelineBarrier(command_buffer,
+            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+            0, 1, &barrier, 0, nullptr, 0, nullptr);
+        // At the stage the barrier waits for, so the start is not taken
+        // while the previous run is still going.
+        vkCmdWriteTimestamp(command_buffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, query_pool, i * 2);
+        kernel.dispatch(command_buffer, size);
+        vkCmdWriteTimestamp(command_buffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, query_pool, i * 2 + 1);
+    }
+
+    result = vkEndCommandBuffer(command_buffer);
+    if( result != VK_SUCCESS )
+    {
+        throw VulkanException(result, "Error while ending autotuner command buffer");
+    }
+
+    VkSubmitInfo submit_info;
+    submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submit_info.pNext = nullptr;
+    submit_info.waitSemaphoreCount = 0;
+    submit_info.pWaitSemaphores = nullptr;
+    submit_info.pWaitDstStageMask = nullptr;
+    submit_info.commandBufferCount = 1;
+    submit_info.pCommandBuffers = &command_buffer;
+    submit_info.signalSemaphoreCount = 0;
+    submit_info.pSignalSemaphores = nullptr;
+
+    VkFence fence = device.get_fence_pool().acquire();
+    result = device.get_submit_queue().submit(submit_info, fence);
+    if( result == VK_SUCCESS )
+    {
+        result = vkWaitForFences(device.get_device(), 1, &fence, VK_TRUE, UINT64_MAX);
+    }
+    device.get_fence_pool().release(fence);
+    if( result != VK_SUCCESS )
+    {
+        throw VulkanException(result, "Error while running autotuner benchmark");
+    }
+
+    std::vector<uint64_t> timestamps(repetitions * 2);
+    result = vkGetQueryPoolResults(device.get_device(), query_pool, 0, repetitions * 2,
+        timestamps.size() * sizeof(uint64_t), timestamps.data(), sizeof(uint64_t),
+        VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT);
+    if( result != VK_SUCCESS )
+    {
+        throw VulkanException(result, "Error while reading autotuner timestamps");
+    }
+
+    // The median, which a preempted or throttled run does not skew.
+    std::vector<double> times;
+    for( uint32_t i = 0; i < repetitions; ++i )
+    {
+        uint64_t ticks = (timestamps[i * 2 + 1] - timestamps[i * 2]) & timestamp_mask;
+        times.push_back(ticks * device.get_properties().limits.timestampPeriod / 1e6);
+    }
+    std::nth_element(times.begin(), times.begin() + times.size() / 2, times.end());
+    return times[times.size() / 2];
+}
+
+void WorkgroupTuner::load()
+{
+    std::ifstream file(database_path);
+    std::string line;
+    while( std::getline(file, line) )
+    {
+        if( line.empty() || line[0] == '#' )
+        {
+            continue;
+        }
+
+        std::istringstream fields(line);
+        std::string vendor, device_id, driver, hash, name;
+        Result result;
+        if( fields >> vendor >> device_id >> driver >> hash >> name
+            >> result.size.x >> result.size.y >> result.size.z >> result.ms )
+        {
+            results[vendor + " " + device_id + " " + driver + " " + hash + " " + name] = result;
+        }
+    }
+}
+
+void WorkgroupTuner::save() const
+{
+    // Written aside and renamed, so a crash leaves the old database.
+    std::string temporary_path = database_path + ".tmp";
+    {
+        std::ofstream file(temporary_path, std::ios::trunc);
+        file << "# vendor device driver code_hash kernel x y z ms\n";
+        for( const auto& entry : results )
+        {
+            const Result& result = entry.second;
+            file << entry.first << " "
+                << result.size.x << " " << result.size.y << " " << result.size.z << " "
+                << result.ms << "\n";
+        }
+        if( !file )
+        {
+            throw std::runtime_error("Error while writing workgroup size database " + temporary_path);
+        }
+    }
+
+    // Unlike std::rename, replaces an existing database on Windows too.
+    std::error_code error;
+    std::filesystem::rename(temporary_path, database_path, error);
+    if( error )
+    {
+        throw std::runtime_error("Error while replacing workgroup size database " + database_path);
+    }
+}
+
+}
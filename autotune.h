@@ -0,0 +1,110 @@
+#pragma once
+
+#include "vulkan.h"
+
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace vulkan
+{
+
+class CommandBufferPool;
+
+struct WorkgroupSize
+{
+    uint32_t x;
+    uint32_t y;
+    uint32_t z;
+};
+
+/*  A compute kernel whose local size is set through specialization
+    constants 0, 1 and 2, as declared in GLSL with
+    layout(local_size_x_id = 0, local_size_y_id = 1, local_size_z_id = 2).
+    dispatch records the benchmark workload for a workgroup size, with the
+    pipeline already bound: it binds the descriptors and calls vkCmdDispatch
+    with the group count that covers the problem at that size.  It is
+    recorded several times in a row, with a compute to compute barrier in
+    between. */
+struct ComputeKernel
+{
+    std::string name;
+    std::vector<uint32_t> code;
+    std::string entry_point;
+    VkPipelineLayout layout;
+    std::vector<WorkgroupSize> candidates;
+    std::function<void(VkCommandBuffer, const WorkgroupSize&)> dispatch;
+};
+
+/*  Picks the fastest workgroup size of each registered kernel on this GPU.
+    Winners are kept in a text database, one line per kernel and device,
+    keyed by vendorID, deviceID, driverVersion, the kernel name and a hash
+    of its SPIR-V, so a driver update or a changed shader is tuned again
+    and other devices' lines survive.  Candidates beyond the device's
+    compute limits are skipped.
+
+    Register the kernels, call tune() once at startup, which benchmarks
+    only what the database lacks, then create the pipelines. */
+class WorkgroupTuner
+{
+public:
+    WorkgroupTuner(LogicalDevice& device, const std::string& database_path, uint32_t repetitions = 5);
+
+    WorkgroupTuner(const WorkgroupTuner&) = delete;
+    WorkgroupTuner& operator=(const WorkgroupTuner&) = delete;
+
+    /*  Kernel names may not contain whitespace. */
+    void register_kernel(const ComputeKernel& kernel);
+
+    /*  Benchmarks every kernel without a result for this device, on the
+        submit queue, and saves the database if anything was tuned.
+        Returns the number of kernels tuned, which is 0 without timestamp
+        support on the queue. */
+    uint32_t tune();
+
+    bool is_tuned(const std::string& name) const;
+
+    /*  The tuned size, or the first usable candidate while untuned. */
+    WorkgroupSize get_workgroup_size(const std::string& name) const;
+
+    /*  GPU time of the tuned size in milliseconds, 0 while untuned. */
+    double get_time(const std::string& name) const;
+
+    /*  A pipeline of the kernel at get_workgroup_size(), owned by the
+        caller. */
+    VkPipeline create_pipeline(const std::string& name) const;
+
+private:
+    struct Result
+    {
+        WorkgroupSize size;
+        double ms;
+    };
+
+    const ComputeKernel& get_kernel(const std::string& name) const;
+    std::string get_key(const ComputeKernel& kernel) const;
+    std::vector<WorkgroupSize> get_usable_candidates(const ComputeKernel& kernel) const;
+
+    VkShaderModule create_shader_module(const ComputeKernel& kernel) const;
+    VkPipeline create_pipeline(const ComputeKernel& kernel, VkShaderModule module, const WorkgroupSize& size) const;
+    double measure(
+        const ComputeKernel& kernel,
+        VkPipeline pipeline,
+        const WorkgroupSize& size,
+        CommandBufferPool& command_pool,
+        VkQueryPool query_pool);
+
+    void load();
+    void save() const;
+
+    LogicalDevice& device;
+    std::string database_path;
+    uint32_t repetitions;
+    uint64_t timestamp_mask;
+
+    std::map<std::string, ComputeKernel> kernels;
+    std::map<std::string, Result> results;
+};
+
+}
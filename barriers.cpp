@@ -0,0 +1,606 @@
+#include "barriers.h"
+#include "image.h"
+
+namespace vulkan
+{
+
+// Stage and access bits below 2^17 mean the same in both APIs.
+static const VkFlags64 legacy_bits = 0x1FFFF;
+
+// Only the programmable stages.  PRE_RASTERIZATION_SHADERS stands for the
+// vertex, tessellation and geometry shaders without needing the features
+// the separate bits need.
+static const VkPipelineStageFlags2KHR shader_stages =
+    VK_PIPELINE_STAGE_2_PRE_RASTERIZATION_SHADERS_BIT_KHR | VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT_KHR
+    | VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT_KHR;
+
+static bool is_ownership_transfer(uint32_t src_queue_family, uint32_t dst_queue_family)
+{
+    return src_queue_family != dst_queue_family;
+}
+
+static bool is_same_range(const VkImageSubresourceRange& a, const VkImageSubresourceRange& b)
+{
+    return a.aspectMask == b.aspectMask
+        && a.baseMipLevel == b.baseMipLevel
+        && a.levelCount == b.levelCount
+        && a.baseArrayLayer == b.baseArrayLayer
+        && a.layerCount == b.layerCount;
+}
+
+static bool has_remaining(const VkImageSubresourceRange& range)
+{
+    return range.levelCount == VK_REMAINING_MIP_LEVELS || range.layerCount == VK_REMAINING_ARRAY_LAYERS;
+}
+
+/*  True if b starts where a ends, along mips or along layers, with the
+    other dimension the same.  Ranges that still use REMAINING counts are
+    never followed, as their end is unknown here. */
+static bool is_followed_by(const VkImageSubresourceRange& a, const VkImageSubresourceRange& b)
+{
+    if( a.aspectMask != b.aspectMask || has_remaining(a) || has_remaining(b) )
+    {
+        return false;
+    }
+
+    if( a.baseArrayLayer == b.baseArrayLayer && a.layerCount == b.layerCount
+        && a.baseMipLevel + a.levelCount == b.baseMipLevel )
+    {
+        return true;
+    }
+
+    return a.baseMipLevel == b.baseMipLevel && a.levelCount == b.levelCount
+        && a.baseArrayLayer + a.layerCount == b.baseArrayLayer;
+}
+
+static void add_masks(VkImageMemoryBarrier2KHR& barrier, const VkImageMemoryBarrier2KHR& other)
+{
+    barrier.srcStageMask |= other.srcStageMask;
+    barrier.srcAccessMask |= other.srcAccessMask;
+    barrier.dstStageMask |= other.dstStageMask;
+    barrier.dstAccessMask |= other.dstAccessMask;
+}
+
+template<typename Barrier>
+static void narrow(Barrier& barrier)
+{
+    const VkPipelineStageFlags2KHR broad =
+        VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT_KHR | VK_PIPELINE_STAGE_2_ALL_GRAPHICS_BIT_KHR;
+
+    VkPipelineStageFlags2KHR src_stages = get_stages_for_access(barrier.srcAccessMask);
+    if( (barrier.srcStageMask & broad) && src_stages )
+    {
+        barrier.srcStageMask = (barrier.srcStageMask & ~broad) | src_stages;
+    }
+
+    VkPipelineStageFlags2KHR dst_stages = get_stages_for_access(barrier.dstAccessMask);
+    if( (barrier.dstStageMask & broad) && dst_stages )
+    {
+        barrier.dstStageMask = (barrier.dstStageMask & ~broad) | dst_stages;
+    }
+}
+
+BarrierBatch::BarrierBatch()
+    : stage_narrowing(false)
+{
+}
+
+void BarrierBatch::add_memory_barrier(
+    VkPipelineStageFlags2KHR src_stages, VkAccessFlags2KHR src_access,
+    VkPipelineStageFlags2KHR dst_stages, VkAccessFlags2KHR dst_access)
+{
+    VkMemoryBarrier2KHR barrier;
+    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2_KHR;
+    barrier.pNext = nullptr;
+    barrier.srcStageMask = src_stages;
+    barrier.srcAccessMask = src_access;
+    barrier.dstStageMask = dst_stages;
+    barrier.dstAccessMask = dst_access;
+    memory_barriers.push_back(barrier);
+}
+
+void BarrierBatch::add_buffer_barrier(
+    VkBuffer buffer, VkDeviceSize offset, VkDeviceSize size,
+    VkPipelineStageFlags2KHR src_stages, VkAccessFlags2KHR src_access,
+    VkPipelineStageFlags2KHR dst_stages, VkAccessFlags2KHR dst_access,
+    uint32_t src_queue_family, uint32_t dst_queue_family)
+{
+    VkBufferMemoryBarrier2KHR barrier;
+    barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER_2_KHR;
+    barrier.pNext = nullptr;
+    barrier.srcStageMask = src_stages;
+    barrier.srcAccessMask = src_access;
+    barrier.dstStageMask = dst_stages;
+    barrier.dstAccessMask = dst_access;
+    barrier.srcQueueFamilyIndex = src_queue_family;
+    barrier.dstQueueFamilyIndex = dst_queue_family;
+    barrier.buffer = buffer;
+    barrier.offset = offset;
+    barrier.size = size;
+    buffer_barriers.push_back(barrier);
+}
+
+void BarrierBatch::add_image_barrier(
+    VkImage image, const VkImageSubresourceRange& range,
+    VkImageLayout old_layout, VkImageLayout new_layout,
+    VkPipelineStageFlags2KHR src_stages, VkAccessFlags2KHR src_access,
+    VkPipelineStageFlags2KHR dst_stages, VkAccessFlags2KHR dst_access,
+    uint32_t src_queue_family, uint32_t dst_queue_family)
+{
+    VkImageMemoryBarrier2KHR barrier;
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2_KHR;
+    barrier.pNext = nullptr;
+    barrier.srcStageMask = src_stages;
+    barrier.srcAccessMask = src_access;
+    barrier.dstStageMask = dst_stages;
+    barrier.dstAccessMask = dst_access;
+    barrier.oldLayout = old_layout;
+    barrier.newLayout = new_layout;
+    barrier.srcQueueFamilyIndex = src_queue_family;
+    barrier.dstQueueFamilyIndex = dst_queue_family;
+    barrier.image = image;
+    barrier.subresourceRange = range;
+    image_barriers.push_back(barrier);
+}
+
+void BarrierBatch::add_image_barrier(
+    const Image& image, const VkImageSubresourceRange& range,
+    VkImageLayout old_layout, VkImageLayout new_layout,
+    VkPipelineStageFlags2KHR src_stages, VkAccessFlags2KHR src_access,
+    VkPipelineStageFlags2KHR dst_stages, VkAccessFlags2KHR dst_access,
+    uint32_t src_queue_family, uint32_t dst_queue_family)
+{
+    add_image_barrier(image.get_image(), resolve_range(range, image.get_mip_levels(), image.get_array_layers()),
+        old_layout, new_layout, src_stages, src_access, dst_stages, dst_access, src_queue_family, dst_queue_family);
+}
+
+void BarrierBatch::set_stage_narrowing(bool enabled)
+{
+    stage_narrowing = enabled;
+}
+
+void BarrierBatch::merge()
+{
+    chain_image_transitions();
+    fold_into_memory_barriers();
+    join_image_ranges();
+    if( stage_narrowing )
+    {
+        narrow_stages();
+    }
+}
+
+/*  A global memory barrier covers every buffer and image, so barriers that
+    only order memory accesses are folded into one. */
+void BarrierBatch::fold_into_memory_barriers()
+{
+    VkMemoryBarrier2KHR global;
+    global.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2_KHR;
+    global.pNext = nullptr;
+    global.srcStageMask = 0;
+    global.srcAccessMask = 0;
+    global.dstStageMask = 0;
+    global.dstAccessMask = 0;
+    bool needed = false;
+
+    for( auto& barrier : memory_barriers )
+    {
+        global.srcStageMask |= barrier.srcStageMask;
+        global.srcAccessMask |= barrier.srcAccessMask;
+        global.dstStageMask |= barrier.dstStageMask;
+        global.dstAccessMask |= barrier.dstAccessMask;
+        needed = true;
+    }
+
+    std::vector<VkBufferMemoryBarrier2KHR> kept_buffer_barriers;
+    for( auto& barrier : buffer_barriers )
+    {
+        if( is_ownership_transfer(barrier.srcQueueFamilyIndex, barrier.dstQueueFamilyIndex) )
+        {
+            kept_buffer_barriers.push_back(barrier);
+            continue;
+        }
+        global.srcStageMask |= barrier.srcStageMask;
+        global.srcAccessMask |= barrier.srcAccessMask;
+        global.dstStageMask |= barrier.dstStageMask;
+        global.dstAccessMask |= barrier.dstAccessMask;
+        needed = true;
+    }
+
+    std::vector<VkImageMemoryBarrier2KHR> kept_image_barriers;
+    for( auto& barrier : image_barriers )
+    {
+        if( barrier.oldLayout != barrier.newLayout
+            || is_ownership_transfer(barrier.srcQueueFamilyIndex, barrier.dstQueueFamilyIndex) )
+        {
+            kept_image_barriers.push_back(barrier);
+            continue;
+        }
+        global.srcStageMask |= barrier.srcStageMask;
+        global.srcAccessMask |= barrier.srcAccessMask;
+        global.dstStageMask |= barrier.dstStageMask;
+        global.dstAccessMask |= barrier.dstAccessMask;
+        needed = true;
+    }
+
+    memory_barriers.clear();
+    if( needed )
+    {
+        memory_barriers.push_back(global);
+    }
+    buffer_barriers.swap(kept_buffer_barriers);
+    image_barriers.swap(kept_image_barriers);
+}
+
+/*  Nothing runs between barriers of one batch, so the intermediate layout
+    of two transitions on the same subresources is never used and the pair
+    becomes one transition.  Identical transitions are combined the same
+    way. */
+void BarrierBatch::chain_image_transitions()
+{
+    std::vector<VkImageMemoryBarrier2KHR> chained;
+    for( auto& barrier : image_barriers )
+    {
+        bool merged = false;
+        if( !is_ownership_transfer(barrier.srcQueueFamilyIndex, barrier.dstQueueFamilyIndex) )
+        {
+            for( auto& earlier : chained )
+            {
+                if( earlier.image != barrier.image
+                    || !is_same_range(earlier.subresourceRange, barrier.subresourceRange)
+                    || is_ownership_transfer(earlier.srcQueueFamilyIndex, earlier.dstQueueFamilyIndex) )
+                {
+                    continue;
+                }
+
+                if( earlier.oldLayout == barrier.oldLayout && earlier.newLayout == barrier.newLayout )
+                {
+                    add_masks(earlier, barrier);
+                    merged = true;
+                }
+                else if( earlier.newLayout == barrier.oldLayout )
+                {
+                    add_masks(earlier, barrier);
+                    earlier.newLayout = barrier.newLayout;
+                    merged = true;
+                }
+                else if( barrier.oldLayout == VK_IMAGE_LAYOUT_UNDEFINED )
+                {
+                    // The contents are discarded anyway, the earlier
+                    // transition was wasted work.
+                    add_masks(earlier, barrier);
+                    earlier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+                    earlier.newLayout = barrier.newLayout;
+                    merged = true;
+                }
+
+                if( merged )
+                {
+                    break;
+                }
+            }
+        }
+
+        if( !merged )
+        {
+            chained.push_back(barrier);
+        }
+    }
+    image_barriers.swap(chained);
+}
+
+/*  Joins transitions of neighbouring mip levels or array layers, e.g. the
+    per-mip transitions left behind by mipmap generation. */
+void BarrierBatch::join_image_ranges()
+{
+    bool joined = true;
+    while( joined )
+    {
+        joined = false;
+        for( size_t i = 0; i < image_barriers.size() && !joined; ++i )
+        {
+            for( size_t j = 0; j < image_barriers.size() && !joined; ++j )
+            {
+                VkImageMemoryBarrier2KHR& a = image_barriers[i];
+                VkImageMemoryBarrier2KHR& b = image_barriers[j];
+                if( i == j
+                    || a.image != b.image
+                    || a.oldLayout != b.oldLayout
+                    || a.newLayout != b.newLayout
+                    || a.srcQueueFamilyIndex != b.srcQueueFamilyIndex
+                    || a.dstQueueFamilyIndex != b.dstQueueFamilyIndex
+                    || !is_followed_by(a.subresourceRange, b.subresourceRange) )
+                {
+                    continue;
+                }
+
+                if( a.subresourceRange.baseArrayLayer == b.subresourceRange.baseArrayLayer
+                    && a.subresourceRange.layerCount == b.subresourceRange.layerCount )
+                {
+                    a.subresourceRange.levelCount += b.subresourceRange.levelCount;
+                }
+                else
+                {
+                    a.subresourceRange.layerCount += b.subresourceRange.layerCount;
+                }
+                add_masks(a, b);
+                image_barriers.erase(image_barriers.begin() + j);
+                joined = true;
+            }
+        }
+    }
+}
+
+void BarrierBatch::narrow_stages()
+{
+    for( auto& barrier : memory_barriers )
+    {
+        narrow(barrier);
+    }
+    for( auto& barrier : buffer_barriers )
+    {
+        narrow(barrier);
+    }
+    for( auto& barrier : image_barriers )
+    {
+        narrow(barrier);
+    }
+}
+
+bool BarrierBatch::is_empty() const
+{
+    return memory_barriers.empty() && buffer_barriers.empty() && image_barriers.empty();
+}
+
+void BarrierBatch::clear()
+{
+    memory_barriers.clear();
+    buffer_barriers.clear();
+    image_barriers.clear();
+}
+
+const std::vector<VkMemoryBarrier2KHR>& BarrierBatch::get_memory_barriers() const
+{
+    return memory_barriers;
+}
+
+const std::vector<VkBufferMemoryBarrier2KHR>& BarrierBatch::get_buffer_barriers() const
+{
+    return buffer_barriers;
+}
+
+const std::vector<VkImageMemoryBarrier2KHR>& BarrierBatch::get_image_barriers() const
+{
+    return image_barriers;
+}
+
+void BarrierBatch::append(const BarrierBatch& other)
+{
+    memory_barriers.insert(memory_barriers.end(), other.memory_barriers.begin(), other.memory_barriers.end());
+    buffer_barriers.insert(buffer_barriers.end(), other.buffer_barriers.begin(), other.buffer_barriers.end());
+    image_barriers.insert(image_barriers.end(), other.image_barriers.begin(), other.image_barriers.end());
+}
+
+VkDependencyInfoKHR BarrierBatch::get_dependency_info() const
+{
+    VkDependencyInfoKHR dependency_info;
+    dependency_info.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO_KHR;
+    dependency_info.pNext = nullptr;
+    dependency_info.dependencyFlags = 0;
+    dependency_info.memoryBarrierCount = static_cast<uint32_t>(memory_barriers.size());
+    dependency_info.pMemoryBarriers = memory_barriers.data();
+    dependency_info.bufferMemoryBarrierCount = static_cast<uint32_t>(buffer_barriers.size());
+    dependency_info.pBufferMemoryBarriers = buffer_barriers.data();
+    dependency_info.imageMemoryBarrierCount = static_cast<uint32_t>(image_barriers.size());
+    dependency_info.pImageMemoryBarriers = image_barriers.data();
+    return dependency_info;
+}
+
+void BarrierBatch::append_legacy(LegacyBarriers& legacy_barriers) const
+{
+    for( auto& barrier : memory_barriers )
+    {
+        VkMemoryBarrier legacy;
+        legacy.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        legacy.pNext = nullptr;
+        legacy.srcAccessMask = to_legacy_access(barrier.srcAccessMask);
+        legacy.dstAccessMask = to_legacy_access(barrier.dstAccessMask);
+        legacy_barriers.memory_barriers.push_back(legacy);
+        legacy_barriers.src_stages |= barrier.srcStageMask;
+        legacy_barriers.dst_stages |= barrier.dstStageMask;
+    }
+
+    for( auto& barrier : buffer_barriers )
+    {
+        VkBufferMemoryBarrier legacy;
+        legacy.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+        legacy.pNext = nullptr;
+        legacy.srcAccessMask = to_legacy_access(barrier.srcAccessMask);
+        legacy.dstAccessMask = to_legacy_access(barrier.dstAccessMask);
+        legacy.srcQueueFamilyIndex = barrier.srcQueueFamilyIndex;
+        legacy.dstQueueFamilyIndex = barrier.dstQueueFamilyIndex;
+        legacy.buffer = barrier.buffer;
+        legacy.offset = barrier.offset;
+        legacy.size = barrier.size;
+        legacy_barriers.buffer_barriers.push_back(legacy);
+        legacy_barriers.src_stages |= barrier.srcStageMask;
+        legacy_barriers.dst_stages |= barrier.dstStageMask;
+    }
+
+    for( auto& barrier : image_barriers )
+    {
+        VkImageMemoryBarrier legacy;
+        legacy.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        legacy.pNext = nullptr;
+        legacy.srcAccessMask = to_legacy_access(barrier.srcAccessMask);
+        legacy.dstAccessMask = to_legacy_access(barrier.dstAccessMask);
+        legacy.oldLayout = barrier.oldLayout;
+        legacy.newLayout = barrier.newLayout;
+        legacy.srcQueueFamilyIndex = barrier.srcQueueFamilyIndex;
+        legacy.dstQueueFamilyIndex = barrier.dstQueueFamilyIndex;
+        legacy.image = barrier.image;
+        legacy.subresourceRange = barrier.subresourceRange;
+        legacy_barriers.image_barriers.push_back(legacy);
+        legacy_barriers.src_stages |= barrier.srcStageMask;
+        legacy_barriers.dst_stages |= barrier.dstStageMask;
+    }
+}
+
+void BarrierBatch::record(const LogicalDevice& device, VkCommandBuffer command_buffer)
+{
+    merge();
+    if( is_empty() )
+    {
+        return;
+    }
+
+    if( device.get_enabled_features().synchronization2 )
+    {
+        VkDependencyInfoKHR dependency_info = get_dependency_info();
+        device.get_functions().cmd_pipeline_barrier2(command_buffer, &dependency_info);
+        clear();
+        return;
+    }
+
+    // Vulkan 1.0 has one pair of stage masks for the whole command.
+    LegacyBarriers legacy = {};
+    append_legacy(legacy);
+
+    vkCmdPipelineBarrier(command_buffer,
+        to_legacy_stages(legacy.src_stages, true), to_legacy_stages(legacy.dst_stages, false), 0,
+        static_cast<uint32_t>(legacy.memory_barriers.size()), legacy.memory_barriers.data(),
+        static_cast<uint32_t>(legacy.buffer_barriers.size()), legacy.buffer_barriers.data(),
+        static_cast<uint32_t>(legacy.image_barriers.size()), legacy.image_barriers.data());
+
+    clear();
+}
+
+VkImageSubresourceRange resolve_range(const VkImageSubresourceRange& range, uint32_t mip_levels, uint32_t array_layers)
+{
+    VkImageSubresourceRange resolved = range;
+    if( resolved.levelCount == VK_REMAINING_MIP_LEVELS )
+    {
+        resolved.levelCount = mip_levels - range.baseMipLevel;
+    }
+    if( resolved.layerCount == VK_REMAINING_ARRAY_LAYERS )
+    {
+        resolved.layerCount = array_layers - range.baseArrayLayer;
+    }
+    return resolved;
+}
+
+VkPipelineStageFlags2KHR get_stages_for_access(VkAccessFlags2KHR access)
+{
+    if( access == 0 )
+    {
+        return 0;
+    }
+
+    struct AccessStages
+    {
+        VkAccessFlags2KHR access;
+        VkPipelineStageFlags2KHR stages;
+    };
+
+    static const AccessStages table[] = {
+        {VK_ACCESS_2_INDIRECT_COMMAND_READ_BIT_KHR, VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT_KHR},
+        {VK_ACCESS_2_INDEX_READ_BIT_KHR, VK_PIPELINE_STAGE_2_VERTEX_INPUT_BIT_KHR},
+        {VK_ACCESS_2_VERTEX_ATTRIBUTE_READ_BIT_KHR, VK_PIPELINE_STAGE_2_VERTEX_INPUT_BIT_KHR},
+        {VK_ACCESS_2_UNIFORM_READ_BIT_KHR, shader_stages},
+        {VK_ACCESS_2_INPUT_ATTACHMENT_READ_BIT_KHR, VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT_KHR},
+        {VK_ACCESS_2_SHADER_READ_BIT_KHR, shader_stages},
+        {VK_ACCESS_2_SHADER_WRITE_BIT_KHR, shader_stages},
+        {VK_ACCESS_2_SHADER_SAMPLED_READ_BIT_KHR, shader_stages},
+        {VK_ACCESS_2_SHADER_STORAGE_READ_BIT_KHR, shader_stages},
+        {VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT_KHR, shader_stages},
+        {VK_ACCESS_2_COLOR_ATTACHMENT_READ_BIT_KHR, VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT_KHR},
+        {VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT_KHR, VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT_KHR},
+        {VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_READ_BIT_KHR,
+            VK_PIPELINE_STAGE_2_EARLY_FRAGMENT_TESTS_BIT_KHR | VK_PIPELINE_STAGE_2_LATE_FRAGMENT_TESTS_BIT_KHR},
+        {VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT_KHR,
+            VK_PIPELINE_STAGE_2_EARLY_FRAGMENT_TESTS_BIT_KHR | VK_PIPELINE_STAGE_2_LATE_FRAGMENT_TESTS_BIT_KHR},
+        {VK_ACCESS_2_TRANSFER_READ_BIT_KHR, VK_PIPELINE_STAGE_2_TRANSFER_BIT_KHR},
+        {VK_ACCESS_2_TRANSFER_WRITE_BIT_KHR, VK_PIPELINE_STAGE_2_TRANSFER_BIT_KHR},
+        {VK_ACCESS_2_HOST_READ_BIT_KHR, VK_PIPELINE_STAGE_2_HOST_BIT_KHR},
+        {VK_ACCESS_2_HOST_WRITE_BIT_KHR, VK_PIPELINE_STAGE_2_HOST_BIT_KHR},
+    };
+
+    VkPipelineStageFlags2KHR stages = 0;
+    VkAccessFlags2KHR known = 0;
+    for( auto& entry : table )
+    {
+        if( access & entry.access )
+        {
+            stages |= entry.stages;
+            known |= entry.access;
+        }
+    }
+
+    // MEMORY_READ and friends can come from any stage.
+    if( access & ~known )
+    {
+        return 0;
+    }
+    return stages;
+}
+
+VkPipelineStageFlags to_legacy_stages(VkPipelineStageFlags2KHR stages, bool source)
+{
+    VkPipelineStageFlags legacy = static_cast<VkPipelineStageFlags>(stages & legacy_bits);
+
+    const VkPipelineStageFlags2KHR transfer_stages =
+        VK_PIPELINE_STAGE_2_COPY_BIT_KHR | VK_PIPELINE_STAGE_2_RESOLVE_BIT_KHR
+        | VK_PIPELINE_STAGE_2_BLIT_BIT_KHR | VK_PIPELINE_STAGE_2_CLEAR_BIT_KHR;
+    const VkPipelineStageFlags2KHR vertex_input_stages =
+        VK_PIPELINE_STAGE_2_INDEX_INPUT_BIT_KHR | VK_PIPELINE_STAGE_2_VERTEX_ATTRIBUTE_INPUT_BIT_KHR;
+    VkPipelineStageFlags2KHR known = legacy_bits | transfer_stages | vertex_input_stages;
+
+    if( stages & transfer_stages )
+    {
+        legacy |= VK_PIPELINE_STAGE_TRANSFER_BIT;
+    }
+    if( stages & vertex_input_stages )
+    {
+        legacy |= VK_PIPELINE_STAGE_VERTEX_INPUT_BIT;
+    }
+
+    // The tessellation and geometry bits are only valid with their
+    // features enabled, ALL_GRAPHICS is always valid.
+    if( stages & ~known )
+    {
+        legacy |= (stages & VK_PIPELINE_STAGE_2_PRE_RASTERIZATION_SHADERS_BIT_KHR) == (stages & ~known)
+            ? VK_PIPELINE_STAGE_ALL_GRAPHICS_BIT
+            : VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+    }
+
+    if( legacy == 0 )
+    {
+        legacy = source ? VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT : VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
+    }
+    return legacy;
+}
+
+VkAccessFlags to_legacy_access(VkAccessFlags2KHR access)
+{
+    VkAccessFlags legacy = static_cast<VkAccessFlags>(access & legacy_bits);
+
+    const VkAccessFlags2KHR read_access =
+        VK_ACCESS_2_SHADER_SAMPLED_READ_BIT_KHR | VK_ACCESS_2_SHADER_STORAGE_READ_BIT_KHR;
+    VkAccessFlags2KHR known = legacy_bits | read_access | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT_KHR;
+
+    if( access & read_access )
+    {
+        legacy |= VK_ACCESS_SHADER_READ_BIT;
+    }
+    if( access & VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT_KHR )
+    {
+        legacy |= VK_ACCESS_SHADER_WRITE_BIT;
+    }
+    if( access & ~known )
+    {
+        legacy |= VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+    }
+    return legacy;
+}
+
+}
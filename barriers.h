@@ -0,0 +1,123 @@
+#pragma once
+
+#include "vulkan.h"
+
+#include <vector>
+
+namespace vulkan
+{
+
+/*  Barriers converted for the Vulkan 1.0 commands, which take one pair of
+    stage masks for all of them. */
+struct LegacyBarriers
+{
+    std::vector<VkMemoryBarrier> memory_barriers;
+    std::vector<VkBufferMemoryBarrier> buffer_barriers;
+    std::vector<VkImageMemoryBarrier> image_barriers;
+    VkPipelineStageFlags2KHR src_stages;
+    VkPipelineStageFlags2KHR dst_stages;
+};
+
+/*  Collects memory, buffer and image barriers while a pass is being set up
+    and records them with a single vkCmdPipelineBarrier2KHR, or a single
+    vkCmdPipelineBarrier when VK_KHR_synchronization2 is not enabled.
+
+    Before recording, merge() simplifies the batch:
+     - buffer barriers, and image barriers that change no layout, become
+       one global memory barrier unless they transfer queue ownership
+     - two transitions of the same subresources chain A->B, B->C into A->C,
+       and a later transition from UNDEFINED replaces an earlier one
+     - identical image barriers are combined, and barriers on adjacent mip
+       levels or layers with the same layouts are joined into one range;
+       ranges with VK_REMAINING_* counts are only joined when added with
+       their Image, which resolves the counts
+     - with stage narrowing on, ALL_COMMANDS and ALL_GRAPHICS are narrowed
+       to the stages that perform the barrier's accesses */
+class BarrierBatch
+{
+public:
+    BarrierBatch();
+
+    void add_memory_barrier(
+        VkPipelineStageFlags2KHR src_stages, VkAccessFlags2KHR src_access,
+        VkPipelineStageFlags2KHR dst_stages, VkAccessFlags2KHR dst_access);
+
+    void add_buffer_barrier(
+        VkBuffer buffer, VkDeviceSize offset, VkDeviceSize size,
+        VkPipelineStageFlags2KHR src_stages, VkAccessFlags2KHR src_access,
+        VkPipelineStageFlags2KHR dst_stages, VkAccessFlags2KHR dst_access,
+        uint32_t src_queue_family = VK_QUEUE_FAMILY_IGNORED,
+        uint32_t dst_queue_family = VK_QUEUE_FAMILY_IGNORED);
+
+    void add_image_barrier(
+        VkImage image, const VkImageSubresourceRange& range,
+        VkImageLayout old_layout, VkImageLayout new_layout,
+        VkPipelineStageFlags2KHR src_stages, VkAccessFlags2KHR src_access,
+        VkPipelineStageFlags2KHR dst_stages, VkAccessFlags2KHR dst_access,
+        uint32_t src_queue_family = VK_QUEUE_FAMILY_IGNORED,
+        uint32_t dst_queue_family = VK_QUEUE_FAMILY_IGNORED);
+
+    /*  Same, with VK_REMAINING_MIP_LEVELS and VK_REMAINING_ARRAY_LAYERS in
+        the range replaced by the image's counts. */
+    void add_image_barrier(
+        const Image& image, const VkImageSubresourceRange& range,
+        VkImageLayout old_layout, VkImageLayout new_layout,
+        VkPipelineStageFlags2KHR src_stages, VkAccessFlags2KHR src_access,
+        VkPipelineStageFlags2KHR dst_stages, VkAccessFlags2KHR dst_access,
+        uint32_t src_queue_family = VK_QUEUE_FAMILY_IGNORED,
+        uint32_t dst_queue_family = VK_QUEUE_FAMILY_IGNORED);
+
+    /*  Narrowing is only correct when each barrier's access masks name
+        every access it has to order, so it is off by default. */
+    void set_stage_narrowing(bool enabled);
+
+    void merge();
+
+    /*  Adds all of other's barriers, unmerged. */
+    void append(const BarrierBatch& other);
+
+    bool is_empty() const;
+    void clear();
+
+    const std::vector<VkMemoryBarrier2KHR>& get_memory_barriers() const;
+    const std::vector<VkBufferMemoryBarrier2KHR>& get_buffer_barriers() const;
+    const std::vector<VkImageMemoryBarrier2KHR>& get_image_barriers() const;
+
+    /*  Points into the batch, valid until it changes. */
+    VkDependencyInfoKHR get_dependency_info() const;
+
+    /*  Converts the barriers for vkCmdPipelineBarrier or vkCmdWaitEvents,
+        adding them and their stages to legacy. */
+    void append_legacy(LegacyBarriers& legacy) const;
+
+    /*  Merges, records everything into the command buffer in one call, and
+        clears the batch. */
+    void record(const LogicalDevice& device, VkCommandBuffer command_buffer);
+
+private:
+    void fold_into_memory_barriers();
+    void chain_image_transitions();
+    void join_image_ranges();
+    void narrow_stages();
+
+    std::vector<VkMemoryBarrier2KHR> memory_barriers;
+    std::vector<VkBufferMemoryBarrier2KHR> buffer_barriers;
+    std::vector<VkImageMemoryBarrier2KHR> image_barriers;
+    bool stage_narrowing;
+};
+
+/*  The range with VK_REMAINING_MIP_LEVELS and VK_REMAINING_ARRAY_LAYERS
+    replaced by the counts they stand for in an image of that size. */
+VkImageSubresourceRange resolve_range(const VkImageSubresourceRange& range, uint32_t mip_levels, uint32_t array_layers);
+
+/*  Stages that can perform the given accesses, or 0 if some access (like
+    MEMORY_READ) could happen anywhere. */
+VkPipelineStageFlags2KHR get_stages_for_access(VkAccessFlags2KHR access);
+
+/*  Converts synchronization2 masks to their Vulkan 1.0 equivalents.  An
+    empty source mask becomes TOP_OF_PIPE, an empty destination mask
+    BOTTOM_OF_PIPE. */
+VkPipelineStageFlags to_legacy_stages(VkPipelineStageFlags2KHR stages, bool source);
+VkAccessFlags to_legacy_access(VkAccessFlags2KHR access);
+
+}
@@ -0,0 +1,489 @@
+#include "breadcrumbs.h"
+#include "pool.h"
+
+#include <algorithm>
+#include <stdio.h>
+#include <string.h>
+
+namespace vulkan
+{
+
+// Slots of a command list: the marker of the last pass begun, then of the
+// last pass ended.
+static const uint32_t slots_per_command_list = 2;
+
+BreadcrumbLog::BreadcrumbLog(uint32_t max_command_lists)
+    : command_lists(max_command_lists)
+    , next_command_list(0)
+{
+}
+
+uint32_t BreadcrumbLog::begin_command_list(const std::string& name)
+{
+    uint32_t index = next_command_list;
+    next_command_list = (next_command_list + 1) % command_lists.size();
+
+    CommandList& command_list = command_lists[index];
+    command_list.name = name;
+    command_list.passes.clear();
+    command_list.open.clear();
+    return index;
+}
+
+uint32_t BreadcrumbLog::begin_pass(uint32_t index, const std::string& name)
+{
+    CommandList& command_list = command_lists[index];
+    command_list.passes.push_back(name);
+    uint32_t marker = static_cast<uint32_t>(command_list.passes.size());
+    command_list.open.push_back(marker);
+    return marker;
+}
+
+bool BreadcrumbLog::end_pass(uint32_t index, uint32_t& marker)
+{
+    CommandList& command_list = command_lists[index];
+    if( command_list.open.empty() )
+    {
+        return false;
+    }
+    marker = command_list.open.back();
+    command_list.open.pop_back();
+    return true;
+}
+
+BreadcrumbTrail BreadcrumbLog::decode(uint32_t index, uint32_t last_begun, uint32_t last_ended) const
+{
+    const CommandList& command_list = command_lists[index];
+
+    BreadcrumbTrail trail;
+    trail.command_list = command_list.name;
+    trail.last_begun = last_begun;
+    trail.last_ended = last_ended;
+
+    if( last_ended > 0 && last_ended <= command_list.passes.size() )
+    {
+        trail.last_completed_pass = command_list.passes[last_ended - 1];
+    }
+    if( last_begun > last_ended && last_begun <= command_list.passes.size() )
+    {
+        trail.unfinished_pass = command_list.passes[last_begun - 1];
+    }
+    return trail;
+}
+
+static bool has_memory_type(const LogicalDevice& device, uint32_t memory_type_bits, VkMemoryPropertyFlags properties)
+{
+    const VkPhysicalDeviceMemoryProperties& memory_properties = device.get_memory_properties();
+    for( uint32_t i = 0; i < memory_properties.memoryTypeCount; ++i )
+    {
+        if( (memory_type_bits & (1u << i))
+            && (memory_properties.memoryTypes[i].propertyFlags & properties) == properties )
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+Breadcrumbs::Breadcrumbs(LogicalDevice& device, uint32_t max_command_lists)
+    : device(device)
+    , buffer_markers(device.get_enabled_features().buffer_marker)
+    , log(max_command_lists)
+{
+    VkBufferCreateInfo buffer_info;
+    buffer_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    buffer_info.pNext = nullptr;
+    buffer_info.flags = 0;
+    buffer_info.size = max_command_lists * slots_per_command_list * sizeof(uint32_t);
+    buffer_info.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+    buffer_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    buffer_info.queueFamilyIndexCount = 0;
+    buffer_info.pQueueFamilyIndices = nullptr;
+
+    VkResult result = vkCreateBuffer(device.get_device(), &buffer_info, device.get_allocation_callbacks(), &buffer);
+    if( result != VK_SUCCESS )
+    {
+        throw VulkanException(result, "Error while creating breadcrumb buffer");
+    }
+
+    VkMemoryRequirements requirements;
+    vkGetBufferMemoryRequirements(device.get_device(), buffer, &requirements);
+
+    // Ordinary memory may hold the last markers in a GPU cache that is
+    // never flushed once the device is lost.
+    VkMemoryPropertyFlags properties = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+    if( device.get_enabled_features().device_coherent_memory )
+    {
+        VkMemoryPropertyFlags uncached = properties
+            | VK_MEMORY_PROPERTY_DEVICE_COHERENT_BIT_AMD | VK_MEMORY_PROPERTY_DEVICE_UNCACHED_BIT_AMD;
+        if( has_memory_type(device, requirements.memoryTypeBits, uncached) )
+        {
+            properties = uncached;
+        }
+    }
+
+    // No move listener: the defragmenter must leave the markers where the
+    // recorded commands write them.
+    allocation = device.allocate(requirements, properties, AllocationPriority::CRITICAL);
+
+    result = vkBindBufferMemory(device.get_device(), buffer, allocation->get_memory(), allocation->get_offset());
+    if( result != VK_SUCCESS )
+    {
+        throw VulkanException(result, "Error while binding breadcrumb buffer memory");
+    }
+
+    markers = static_cast<volatile uint32_t*>(device.map(allocation));
+    for( uint32_t i = 0; i < max_command_lists * slots_per_command_list; ++i )
+    {
+        markers[i] = 0;
+    }
+}
+
+Breadcrumbs::~Breadcrumbs()
+{
+    vkDestroyBuffer(device.get_device(), buffer, device.get_allocation_callbacks());
+    device.free(allocation);
+}
+
+uint32_t Breadcrumbs::begin_command_list(const std::string& name)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    uint32_t index = log.begin_command_list(name);
+    markers[index * slots_per_command_list] = 0;
+    markers[index * slots_per_command_list + 1] = 0;
+    return index;
+}
+
+void Breadcrumbs::begin_pass(VkCommandBuffer command_buffer, uint32_t index, const std::string& name)
+{
+    uint32_t marker;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        marker = log.begin_pass(index, name);
+    }
+
+    write_marker(command_buffer, index, 0, marker, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT);
+}
+
+void Breadcrumbs::end_pass(VkCommandBuffer command_buffer, uint32_t index)
+{
+    uint32_t marker;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if( !log.end_pass(index, marker) )
+        {
+            return;
+        }
+    }
+
+    write_marker(command_buffer, index, 1, marker, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT);
+}
+
+void Breadcrumbs::write_marker(VkCommandBuffer command_buffer, uint32_t index, uint32_t slot,
+    uint32_t marker, VkPipelineStageFlagBits stage)
+{
+    VkDeviceSize offset = (index * slots_per_command_list + slot) * sizeof(uint32_t);
+    if( buffer_markers )
+    {
+        device.get_functions().cmd_write_buffer_marker(command_buffer, stage, buffer, offset, marker);
+    }
+    else
+    {
+        // Fills are transfers like any other: an end marker would not wait
+        // for the pass to finish, and two fills of the same slot could land
+        // in either order.
+        VkMemoryBarrier barrier;
+        barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        barrier.pNext = nullptr;
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        vkCmdPipelineBarrier(command_buffer,
+            stage == VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT
+                ? VK_PIPELINE_STAGE_ALL_COMMANDS_BIT : VK_PIPELINE_STAGE_TRANSFER_BIT,
+            VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+            1, &barrier, 0, nullptr, 0, nullptr);
+        vkCmdFillBuffer(command_buffer, buffer, offset, sizeof(uint32_t), marker);
+    }
+}
+
+BreadcrumbTrail Breadcrumbs::read(uint32_t index)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return log.decode(index,
+        markers[index * slots_per_command_list],
+        markers[index * slots_per_command_list + 1]);
+}
+
+bool Breadcrumbs::uses_buffer_markers() const
+{
+    return buffer_markers;
+}
+
+Watchdog::Watchdog(LogicalDevice& device, Breadcrumbs& breadcrumbs, std::chrono::milliseconds deadline)
+    : device(device)
+    , breadcrumbs(breadcrumbs)
+    , deadline(deadline)
+    , listener(nullptr)
+    , stopping(false)
+    , hung(false)
+    , device_lost(false)
+{
+    thread = std::thread(&Watchdog::run, this);
+}
+
+Watchdog::~Watchdog()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake_condition.notify_one();
+    thread.join();
+}
+
+void Watchdog::watch(VkFence fence, const std::vector<uint32_t>& command_lists)
+{
+    Watched entry;
+    entry.fence = fence;
+    entry.command_lists = command_lists;
+    entry.submitted = std::chrono::steady_clock::now();
+    entry.reported = false;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    watched.push_back(entry);
+}
+
+void Watchdog::retire(VkFence fence)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    watched.erase(std::remove_if(watched.begin(), watched.end(),
+        [&](const Watched& entry) { return entry.fence == fence; }), watched.end());
+}
+
+void Watchdog::report_device_lost()
+{
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    double waited_ms = 0.0;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if( device_lost )
+        {
+            return;
+        }
+        for( Watched& entry : watched )
+        {
+            waited_ms = std::max(waited_ms,
+                std::chrono::duration<double, std::milli>(now - entry.submitted).count());
+            entry.reported = true;
+        }
+        device_lost = true;
+    }
+    report(true, waited_ms);
+}
+
+void Watchdog::set_hang_listener(IHangListener* listener)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    this->listener = listener;
+}
+
+bool Watchdog::has_hung() const
+{
+    return hung.load();
+}
+
+void Watchdog::run()
+{
+    std::chrono::milliseconds poll_interval =
+        std::min(std::chrono::milliseconds(100), std::max(deadline / 4, std::chrono::milliseconds(1)));
+
+    std::unique_lock<std::mutex> lock(mutex);
+    while( !stopping )
+    {
+        wake_condition.wait_for(lock, poll_interval, [&] { return stopping; });
+        if( stopping || device_lost )
+        {
+            continue;
+        }
+
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        bool lost = false;
+        bool overdue = false;
+        double waited_ms = 0.0;
+
+        for( size_t i = 0; i < watched.size(); )
+        {
+            Watched& entry = watched[i];
+            VkResult result = vkGetFenceStatus(device.get_device(), entry.fence);
+            if( result == VK_SUCCESS )
+            {
+                watched.erase(watched.begin() + i);
+                continue;
+            }
+
+            double waited = std::chrono::duration<double, std::milli>(now - entry.submitted).count();
+            if( result == VK_ERROR_DEVICE_LOST )
+            {
+                lost = true;
+            }
+            else if( !entry.reported && now - entry.submitted > deadline )
+            {
+                overdue = true;
+            }
+            if( lost || overdue )
+            {
+                waited_ms = std::max(waited_ms, waited);
+            }
+            ++i;
+        }
+
+        if( lost || overdue )
+        {
+            for( Watched& entry : watched )
+            {
+                entry.reported = true;
+            }
+            device_lost = lost;
+
+            lock.unlock();
+            report(lost, waited_ms);
+            lock.lock();
+        }
+    }
+}
+
+void Watchdog::report(bool device_lost, double waited_ms)
+{
+    HangReport report;
+    report.device_lost = device_lost;
+    report.waited_ms = waited_ms;
+
+    IHangListener* current_listener;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        current_listener = listener;
+
+        // In submission order, the first unfinished pass is the suspect.
+        std::vector<uint32_t> seen;
+        for( const Watched& entry : watched )
+        {
+            for( uint32_t command_list : entry.command_lists )
+            {
+                if( std::find(seen.begin(), seen.end(), command_list) == seen.end() )
+                {
+                    seen.push_back(command_list);
+                    report.trails.push_back(breadcrumbs.read(command_list));
+                }
+            }
+        }
+    }
+
+    if( device_lost )
+    {
+        read_device_fault(report);
+    }
+    hung = true;
+
+    if( current_listener )
+    {
+        current_listener->on_hang(report);
+    }
+    else
+    {
+        print_report(report);
+    }
+}
+
+void Watchdog::read_device_fault(HangReport& report)
+{
+    if( !device.get_enabled_features().device_fault )
+    {
+        return;
+    }
+
+    VkDeviceFaultCountsEXT counts;
+    counts.sType = VK_STRUCTURE_TYPE_DEVICE_FAULT_COUNTS_EXT;
+    counts.pNext = nullptr;
+    counts.addressInfoCount = 0;
+    counts.vendorInfoCount = 0;
+    counts.vendorBinarySize = 0;
+
+    VkResult result = device.get_functions().get_device_fault_info(device.get_device(), &counts, nullptr);
+    if( result != VK_SUCCESS )
+    {
+        return;
+    }
+
+    std::vector<VkDeviceFaultAddressInfoEXT> address_infos(counts.addressInfoCount);
+    std::vector<VkDeviceFaultVendorInfoEXT> vendor_infos(counts.vendorInfoCount);
+    counts.vendorBinarySize = 0;
+
+    VkDeviceFaultInfoEXT fault_info;
+    fault_info.sType = VK_STRUCTURE_TYPE_DEVICE_FAULT_INFO_EXT;
+    fault_info.pNext = nullptr;
+    fault_info.description[0] = '\0';
+    fault_info.pAddressInfos = address_infos.data();
+    fault_info.pVendorInfos = vendor_infos.data();
+    fault_info.pVendorBinaryData = nullptr;
+
+    result = device.get_functions().get_device_fault_info(device.get_device(), &counts, &fault_info);
+    if( result != VK_SUCCESS && result != VK_INCOMPLETE )
+    {
+        return;
+    }
+
+    report.fault_description = std::string(fault_info.description,
+        strnlen(fault_info.description, sizeof(fault_info.description)));
+
+    static const char* address_types[] = {
+        "none", "invalid read", "invalid write", "invalid execute",
+        "instruction pointer unknown", "instruction pointer invalid", "instruction pointer fault"};
+
+    char line[384];
+    for( uint32_t i = 0; i < counts.addressInfoCount; ++i )
+    {
+        const VkDeviceFaultAddressInfoEXT& info = address_infos[i];
+        snprintf(line, sizeof(line), "%s at 0x%llx (+-0x%llx)",
+            info.addressType <= VK_DEVICE_FAULT_ADDRESS_TYPE_INSTRUCTION_POINTER_FAULT_EXT
+                ? address_types[info.addressType] : "unknown",
+            static_cast<unsigned long long>(info.reportedAddress),
+            static_cast<unsigned long long>(info.addressPrecision));
+        report.fault_details.push_back(line);
+    }
+    for( uint32_t i = 0; i < counts.vendorInfoCount; ++i )
+    {
+        const VkDeviceFaultVendorInfoEXT& info = vendor_infos[i];
+        snprintf(line, sizeof(line), "%.*s (code 0x%llx, data 0x%llx)",
+            static_cast<int>(strnlen(info.description, sizeof(info.description))), info.description,
+            static_cast<unsigned long long>(info.vendorFaultCode),
+            static_cast<unsigned long long>(info.vendorFaultData));
+        report.fault_details.push_back(line);
+    }
+}
+
+void Watchdog::print_report(const HangReport& report)
+{
+    printf("GPU %s after %.0f ms, command lists in flight:\n",
+        report.device_lost ? "device lost" : "hang", report.waited_ms);
+    for( const BreadcrumbTrail& trail : report.trails )
+    {
+        printf(" - %s: last completed pass %u (%s)", trail.command_list.c_str(),
+            trail.last_ended, trail.last_completed_pass.empty() ? "none" : trail.last_completed_pass.c_str());
+        if( !trail.unfinished_pass.empty() )
+        {
+            printf(", stuck in pass %u (%s)", trail.last_begun, trail.unfinished_pass.c_str());
+        }
+        printf("\n");
+    }
+    if( !report.fault_description.empty() )
+    {
+        printf("Device fault: %s\n", report.fault_description.c_str());
+    }
+    for( const std::string& detail : report.fault_details )
+    {
+        printf(" - %s\n", detail.c_str());
+    }
+}
+
+}
@@ -0,0 +1,192 @@
+#pragma once
+
+#include "vulkan.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace vulkan
+{
+
+/*  What the markers of one command list say after a hang: the last pass
+    the GPU finished, and the pass it had started but not finished, if
+    any.  Markers count passes from 1, 0 means none. */
+struct BreadcrumbTrail
+{
+    std::string command_list;
+    uint32_t last_begun;
+    uint32_t last_ended;
+    std::string last_completed_pass;
+    std::string unfinished_pass;
+};
+
+/*  The host side of the breadcrumbs: the passes recorded into each
+    command list, and the markers their begin and end write.  Decodes the
+    markers read back after a hang.  Needs no device, and is not thread
+    safe; Breadcrumbs locks around it. */
+class BreadcrumbLog
+{
+public:
+    explicit BreadcrumbLog(uint32_t max_command_lists);
+
+    /*  Reuses the oldest command list, round robin. */
+    uint32_t begin_command_list(const std::string& name);
+
+    /*  Returns the marker to write when the pass begins and ends. */
+    uint32_t begin_pass(uint32_t command_list, const std::string& name);
+
+    /*  Closes the innermost open pass and sets marker to its marker.
+        Returns false when no pass is open. */
+    bool end_pass(uint32_t command_list, uint32_t& marker);
+
+    /*  Names the passes behind the two markers of a command list.  Marker
+        values that do not belong to a recorded pass are ignored. */
+    BreadcrumbTrail decode(uint32_t command_list, uint32_t last_begun, uint32_t last_ended) const;
+
+private:
+    struct CommandList
+    {
+        std::string name;
+        std::vector<std::string> passes;
+        std::vector<uint32_t> open;
+    };
+
+    std::vector<CommandList> command_lists;
+    uint32_t next_command_list;
+};
+
+/*  Writes a marker into a host-visible buffer before and after each pass,
+    so that after a hang the host can read how far the GPU got.  With
+    VK_AMD_buffer_marker the markers are written at the top and bottom of
+    the pipe and can go anywhere.  Otherwise they are written with
+    vkCmdFillBuffer, which has to be outside render passes, and the end
+    marker waits for all earlier work, which serializes the passes; only
+    enable breadcrumbs for debugging then.
+
+    Each command buffer gets a command list with two marker slots.  Slots
+    are reused round robin, so at most max_command_lists may be in flight.
+
+    With VK_AMD_device_coherent_memory the markers live in device coherent,
+    uncached memory, so the last ones written reach the host even when the
+    device is lost before its caches are flushed. */
+class Breadcrumbs
+{
+public:
+    explicit Breadcrumbs(LogicalDevice& device, uint32_t max_command_lists = 64);
+    ~Breadcrumbs();
+
+    Breadcrumbs(const Breadcrumbs&) = delete;
+    Breadcrumbs& operator=(const Breadcrumbs&) = delete;
+
+    /*  Starts the trail of a command buffer about to be recorded.  Returns
+        the command list to pass to the other calls. */
+    uint32_t begin_command_list(const std::string& name);
+
+    void begin_pass(VkCommandBuffer command_buffer, uint32_t command_list, const std::string& name);
+    void end_pass(VkCommandBuffer command_buffer, uint32_t command_list);
+
+    BreadcrumbTrail read(uint32_t command_list);
+
+    bool uses_buffer_markers() const;
+
+private:
+    void write_marker(VkCommandBuffer command_buffer, uint32_t command_list, uint32_t slot,
+        uint32_t marker, VkPipelineStageFlagBits stage);
+
+    LogicalDevice& device;
+    VkBuffer buffer;
+    MemoryAllocation* allocation;
+    volatile uint32_t* markers;
+    bool buffer_markers;
+
+    std::mutex mutex;
+    BreadcrumbLog log;
+};
+
+/*  Everything known about a hang: the trails of the command lists still in
+    flight, and what VK_EXT_device_fault could tell after the device was
+    lost. */
+struct HangReport
+{
+    bool device_lost;
+    double waited_ms;
+    std::vector<BreadcrumbTrail> trails;
+    std::string fault_description;
+    std::vector<std::string> fault_details;
+};
+
+class IHangListener
+{
+public:
+    virtual ~IHangListener() {}
+
+    /*  Called from the watchdog thread, or from report_device_lost(). */
+    virtual void on_hang(const HangReport& report) = 0;
+};
+
+/*  Watches submitted fences from a thread of its own.  A fence that has
+    not signaled deadline after it was submitted, or a lost device, is
+    reported with the breadcrumbs of every command list still in flight.
+    Each submission is reported once. */
+class Watchdog
+{
+public:
+    Watchdog(
+        LogicalDevice& device,
+        Breadcrumbs& breadcrumbs,
+        std::chrono::milliseconds deadline = std::chrono::milliseconds(2000));
+    ~Watchdog();
+
+    Watchdog(const Watchdog&) = delete;
+    Watchdog& operator=(const Watchdog&) = delete;
+
+    /*  Watches a submitted fence, which signals when the command lists
+        have completed. */
+    void watch(VkFence fence, const std::vector<uint32_t>& command_lists);
+
+    /*  Stops watching the fence.  Call after waiting for it and before
+        resetting or destroying it. */
+    void retire(VkFence fence);
+
+    /*  Reports right away, for a call that returned VK_ERROR_DEVICE_LOST. */
+    void report_device_lost();
+
+    /*  Without a listener, reports are printed to stdout. */
+    void set_hang_listener(IHangListener* listener);
+
+    bool has_hung() const;
+
+private:
+    struct Watched
+    {
+        VkFence fence;
+        std::vector<uint32_t> command_lists;
+        std::chrono::steady_clock::time_point submitted;
+        bool reported;
+    };
+
+    void run();
+    void report(bool device_lost, double waited_ms);
+    void read_device_fault(HangReport& report);
+    static void print_report(const HangReport& report);
+
+    LogicalDevice& device;
+    Breadcrumbs& breadcrumbs;
+    std::chrono::milliseconds deadline;
+    IHangListener* listener;
+
+    std::mutex mutex;
+    std::condition_variable wake_condition;
+    std::vector<Watched> watched;
+    bool stopping;
+    std::atomic<bool> hung;
+    bool device_lost;
+    std::thread thread;
+};
+
+}
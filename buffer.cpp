@@ -0,0 +1,136 @@
+#include "buffer.h"
+
+namespace vulkan
+{
+
+Buffer::Buffer(LogicalDevice& device, VkDeviceSize size, VkBufferUsageFlags usage)
+    : device(device)
+    , buffer(VK_NULL_HANDLE)
+    , size(size)
+    , usage(usage)
+    , allocation(nullptr)
+    , generation(0)
+    , device_address(0)
+{
+    create_handle();
+}
+
+Buffer::~Buffer()
+{
+    vkDestroyBuffer(device.get_device(), buffer, device.get_allocation_callbacks());
+    if( allocation )
+    {
+        device.free(allocation);
+    }
+}
+
+void Buffer::create_handle()
+{
+    VkBufferCreateInfo create_info;
+    create_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    create_info.pNext = nullptr;
+    create_info.flags = 0;
+    create_info.size = size;
+    create_info.usage = usage;
+    create_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    create_info.queueFamilyIndexCount = 0;
+    create_info.pQueueFamilyIndices = nullptr;
+
+    VkResult result = vkCreateBuffer(device.get_device(), &create_info, device.get_allocation_callbacks(), &buffer);
+    if( result != VK_SUCCESS )
+    {
+        throw VulkanException(result, "Error while creating buffer");
+    }
+}
+
+bool Buffer::bind(VkMemoryPropertyFlags properties, AllocationPriority priority)
+{
+    VkMemoryRequirements requirements;
+    vkGetBufferMemoryRequirements(device.get_device(), buffer, &requirements);
+
+    // Device addresses handed out stay stored in other buffers and push
+    // constants where a move cannot update them, so those buffers stay put.
+    bool pinned = (usage & VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT_KHR) != 0;
+    allocation = device.allocate(requirements, properties, priority, pinned ? nullptr : this);
+    if( !allocation )
+    {
+        return false;
+    }
+
+    VkResult result = vkBindBufferMemory(
+        device.get_device(), buffer, allocation->get_memory(), allocation->get_offset());
+    if( result != VK_SUCCESS )
+    {
+        throw VulkanException(result, "Error while binding buffer memory");
+    }
+
+    return true;
+}
+
+void Buffer::on_allocation_moved(MemoryAllocation& moved)
+{
+    // Memory bindings are immutable, so the only way to follow the data is
+    // a new VkBuffer.
+    vkDestroyBuffer(device.get_device(), buffer, device.get_allocation_callbacks());
+    create_handle();
+
+    VkResult result = vkBindBufferMemory(
+        device.get_device(), buffer, moved.get_memory(), moved.get_offset());
+    if( result != VK_SUCCESS )
+    {
+        throw VulkanException(result, "Error while rebinding moved buffer memory");
+    }
+
+    device_address = 0;
+    generation++;
+}
+
+VkBuffer Buffer::get_buffer() const
+{
+    return buffer;
+}
+
+VkDeviceSize Buffer::get_size() const
+{
+    return size;
+}
+
+VkBufferUsageFlags Buffer::get_usage() const
+{
+    return usage;
+}
+
+MemoryAllocation* Buffer::get_allocation() const
+{
+    return allocation;
+}
+
+uint32_t Buffer::get_generation() const
+{
+    return generation;
+}
+
+VkDeviceAddress Buffer::get_device_address()
+{
+    if( device_address != 0 )
+    {
+        return device_address;
+    }
+
+    if( !device.get_enabled_features().buffer_device_address
+        || !(usage & VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT_KHR) )
+    {
+        throw VulkanException(VK_ERROR_FEATURE_NOT_PRESENT,
+            "Buffer was not created for device address access");
+    }
+
+    VkBufferDeviceAddressInfoKHR address_info;
+    address_info.sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO_KHR;
+    address_info.pNext = nullptr;
+    address_info.buffer = buffer;
+
+    device_address = device.get_functions().get_buffer_device_address(device.get_device(), &address_info);
+    return device_address;
+}
+
+}
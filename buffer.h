@@ -0,0 +1,51 @@
+#pragma once
+
+#include "vulkan.h"
+#include "pool.h"
+
+namespace vulkan
+{
+
+/*  Wrapper for VkBuffer with its memory, generated by the LogicalDevice by
+    calling create_buffer().  The defragmenter may move the memory, in which
+    case the VkBuffer is recreated and the generation goes up; anything
+    holding the old handle (descriptors) has to be written again.  Buffers
+    created for device address access are never moved. */
+class Buffer : public IAllocationMoveListener
+{
+    friend class LogicalDevice;
+
+public:
+    Buffer(const Buffer&) = delete;
+    Buffer& operator=(const Buffer&) = delete;
+    virtual ~Buffer();
+
+    VkBuffer get_buffer() const;
+    VkDeviceSize get_size() const;
+    VkBufferUsageFlags get_usage() const;
+    MemoryAllocation* get_allocation() const;
+    uint32_t get_generation() const;
+
+    /*  GPU virtual address of the start of the buffer, for shaders that read
+        through buffer references instead of descriptors.  Needs the buffer
+        device address feature and VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT. */
+    VkDeviceAddress get_device_address();
+
+    virtual void on_allocation_moved(MemoryAllocation& allocation);
+
+private:
+    Buffer(LogicalDevice& device, VkDeviceSize size, VkBufferUsageFlags usage);
+
+    bool bind(VkMemoryPropertyFlags properties, AllocationPriority priority);
+    void create_handle();
+
+    LogicalDevice& device;
+    VkBuffer buffer;
+    VkDeviceSize size;
+    VkBufferUsageFlags usage;
+    MemoryAllocation* allocation;
+    uint32_t generation;
+    VkDeviceAddress device_address;
+};
+
+}
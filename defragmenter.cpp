@@ -0,0 +1,407 @@
+#include "defragmenter.h"
+#include "queue.h"
+
+#include <algorithm>
+
+namespace vulkan
+{
+
+Defragmenter::Defragmenter(LogicalDevice& device)
+    : device(device)
+    , submitted(false)
+    , statistics()
+{
+    VkResult result;
+
+    VkCommandPoolCreateInfo pool_info;
+    pool_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    pool_info.pNext = nullptr;
+    pool_info.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+    pool_info.queueFamilyIndex = device.get_queue_family_index();
+
+    result = vkCreateCommandPool(device.get_device(), &pool_info, device.get_allocation_callbacks(), &command_pool);
+    if( result != VK_SUCCESS )
+    {
+        throw VulkanException(result, "Error while creating defragmenter command pool");
+    }
+
+    VkCommandBufferAllocateInfo allocate_info;
+    allocate_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    allocate_info.pNext = nullptr;
+    allocate_info.commandPool = command_pool;
+    allocate_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    allocate_info.commandBufferCount = 1;
+
+    result = vkAllocateCommandBuffers(device.get_device(), &allocate_info, &command_buffer);
+    if( result != VK_SUCCESS )
+    {
+        throw VulkanException(result, "Error while allocating defragmenter command buffer");
+    }
+
+    VkFenceCreateInfo fence_info;
+    fence_info.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+    fence_info.pNext = nullptr;
+    fence_info.flags = 0;
+
+    result = vkCreateFence(device.get_device(), &fence_info, device.get_allocation_callbacks(), &fence);
+    if( result != VK_SUCCESS )
+    {
+        throw VulkanException(result, "Error while creating defragmenter fence");
+    }
+}
+
+Defragmenter::~Defragmenter()
+{
+    if( submitted )
+    {
+        vkWaitForFences(device.get_device(), 1, &fence, VK_TRUE, UINT64_MAX);
+        finish_moves();
+    }
+
+    vkDestroyFence(device.get_device(), fence, device.get_allocation_callbacks());
+    vkDestroyCommandPool(device.get_device(), command_pool, device.get_allocation_callbacks());
+}
+
+PoolStatistics Defragmenter::get_pool_statistics()
+{
+    std::vector<PoolStatistics> pools;
+    for( MemoryPool* pool : device.get_memory_pools() )
+    {
+        pools.push_back(pool->get_statistics());
+    }
+    return sum_pool_statistics(pools);
+}
+
+void Defragmenter::begin()
+{
+    for( std::pair<MemoryPool* const, std::vector<MemoryBlock*>>& entry : victims )
+    {
+        std::unique_lock<std::mutex> lock(entry.first->mutex);
+        for( MemoryBlock* block : entry.second )
+        {
+            block->draining = false;
+        }
+    }
+
+    statistics = DefragmentationStatistics();
+    statistics.before = get_pool_statistics();
+    statistics.after = statistics.before;
+
+    victims.clear();
+    for( MemoryPool* pool : device.get_memory_pools() )
+    {
+        choose_victims(pool);
+    }
+}
+
+void Defragmenter::choose_victims(MemoryPool* pool)
+{
+    std::unique_lock<std::mutex> lock(pool->mutex);
+
+    std::vector<MemoryBlock*> candidates;
+    VkDeviceSize total_free = 0;
+    for( std::unique_ptr<MemoryBlock>& block : pool->blocks )
+    {
+        if( block->dedicated || block->buffer == VK_NULL_HANDLE )
+        {
+            continue;
+        }
+
+        total_free += block->memory.size - block->used;
+
+        bool movable = true;
+        for( MemoryAllocation* allocation : block->allocations )
+        {
+            movable = movable && allocation->is_movable();
+        }
+
+        if( movable )
+        {
+            candidates.push_back(block.get());
+        }
+    }
+
+    std::sort(candidates.begin(), candidates.end(),
+        [](MemoryBlock* a, MemoryBlock* b) { return a->used < b->used; });
+
+    // Take the emptiest blocks for as long as what is left can hold their
+    // contents.  Keep some slack because the remaining free space is itself
+    // fragmented.
+    std::vector<MemoryBlock*>& chosen = victims[pool];
+    VkDeviceSize victim_used = 0;
+    VkDeviceSize victim_free = 0;
+    for( MemoryBlock* block : candidates )
+    {
+        VkDeviceSize used = victim_used + block->used;
+        VkDeviceSize remaining_free = total_free - victim_free - (block->memory.size - block->used);
+        if( used > remaining_free / 4 * 3 )
+        {
+            break;
+        }
+
+        chosen.push_back(block);
+        block->draining = true;
+        victim_used = used;
+        victim_free += block->memory.size - block->used;
+    }
+
+    if( chosen.empty() )
+    {
+        victims.erase(pool);
+    }
+}
+
+bool Defragmenter::step(VkDeviceSize byte_budget)
+{
+    if( submitted )
+    {
+        VkResult result = vkWaitForFences(device.get_device(), 1, &fence, VK_TRUE, UINT64_MAX);
+        if( result != VK_SUCCESS )
+        {
+            throw VulkanException(result, "Error while waiting for defragmentation copies");
+        }
+
+        finish_moves();
+    }
+
+    release_empty_victims();
+    plan_moves(byte_budget);
+    submit_moves();
+
+    statistics.after = get_pool_statistics();
+    return !is_done();
+}
+
+bool Defragmenter::is_done() const
+{
+    return victims.empty() && moves.empty() && !submitted;
+}
+
+void Defragmenter::plan_moves(VkDeviceSize byte_budget)
+{
+    VkDeviceSize planned = 0;
+
+    for( std::map<MemoryPool*, std::vector<MemoryBlock*>>::iterator itr = victims.begin();
+        itr != victims.end(); ++itr )
+    {
+        MemoryPool* pool = itr->first;
+        std::vector<MemoryBlock*>& pool_victims = itr->second;
+        std::unique_lock<std::mutex> lock(pool->mutex);
+
+        std::vector<MemoryBlock*> stuck;
+        for( MemoryBlock* victim : pool_victims )
+        {
+            for( MemoryAllocation* allocation : victim->allocations )
+            {
+                if( allocation->moving )
+                {
+                    continue;
+                }
+
+                if( planned > 0 && planned + allocation->size > byte_budget )
+                {
+                    return;
+                }
+
+                MemoryBlock* destination = nullptr;
+                VkDeviceSize offset = 0;
+                for( std::unique_ptr<MemoryBlock>& block : pool->blocks )
+                {
+                    if( !block->dedicated && !block->draining && block->buffer != VK_NULL_HANDLE
+                        && pool->find_range(block.get(), allocation->size, allocation->alignment, offset) )
+                    {
+                        destination = block.get();
+                        break;
+                    }
+                }
+
+                if( !destination )
+                {
+                    stuck.push_back(victim);
+                    break;
+                }
+
+                pool->reserve_range(destination, offset, allocation->size);
+                allocation->moving = true;
+                moves.push_back(Move{pool, allocation, destination, offset});
+                planned += allocation->size;
+            }
+        }
+
+        // Blocks whose contents no longer fit anywhere stay where they are.
+        for( MemoryBlock* block : stuck )
+        {
+            block->draining = false;
+            pool_victims.erase(std::find(pool_victims.begin(), pool_victims.end(), block));
+        }
+    }
+}
+
+void Defragmenter::submit_moves()
+{
+    if( moves.empty() )
+    {
+        return;
+    }
+
+    VkResult result;
+
+    VkCommandBufferBeginInfo begin_info;
+    begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    begin_info.pNext = nullptr;
+    begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    begin_info.pInheritanceInfo = nullptr;
+
+    result = vkBeginCommandBuffer(command_buffer, &begin_info);
+    if( result != VK_SUCCESS )
+    {
+        throw VulkanException(result, "Error while beginning defragmentation command buffer");
+    }
+
+    // Earlier work on the queue may still be writing the data being moved,
+    // and later work has to see it at its new place.
+    VkMemoryBarrier barrier;
+    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    barrier.pNext = nullptr;
+    barrier.srcAccessMask = VK_ACCESS_MEMORY_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+    vkCmdPipelineBarrier(command_buffer,
+        VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+        1, &barrier, 0, nullptr, 0, nullptr);
+
+    for( Move& move : moves )
+    {
+        VkBufferCopy region;
+        region.srcOffset = move.allocation->offset;
+        region.dstOffset = move.destination_offset;
+        region.size = move.allocation->size;
+        vkCmdCopyBuffer(command_buffer,
+            move.allocation->block->buffer, move.destination->buffer, 1, &region);
+    }
+
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+    vkCmdPipelineBarrier(command_buffer,
+        VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0,
+        1, &barrier, 0, nullptr, 0, nullptr);
+
+    result = vkEndCommandBuffer(command_buffer);
+    if( result != VK_SUCCESS )
+    {
+        throw VulkanException(result, "Error while ending defragmentation command buffer");
+    }
+
+    VkSubmitInfo submit_info;
+    submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submit_info.pNext = nullptr;
+    submit_info.waitSemaphoreCount = 0;
+    submit_info.pWaitSemaphores = nullptr;
+    submit_info.pWaitDstStageMask = nullptr;
+    submit_info.commandBufferCount = 1;
+    submit_info.pCommandBuffers = &command_buffer;
+    submit_info.signalSemaphoreCount = 0;
+    submit_info.pSignalSemaphores = nullptr;
+
+    result = vkResetFences(device.get_device(), 1, &fence);
+    if( result != VK_SUCCESS )
+    {
+        throw VulkanException(result, "Error while resetting defragmentation fence");
+    }
+
+    result = device.get_submit_queue().submit(submit_info, fence);
+    if( result != VK_SUCCESS )
+    {
+        throw VulkanException(result, "Error while submitting defragmentation copies");
+    }
+
+    submitted = true;
+}
+
+void Defragmenter::finish_moves()
+{
+    std::vector<MemoryAllocation*> moved;
+
+    for( Move& move : moves )
+    {
+        std::unique_lock<std::mutex> lock(move.pool->mutex);
+
+        MemoryAllocation* allocation = move.allocation;
+        MemoryBlock* source = allocation->block;
+
+        move.pool->release_range(source, allocation->offset, allocation->size);
+        source->allocations.erase(
+            std::find(source->allocations.begin(), source->allocations.end(), allocation));
+
+        allocation->block = move.destination;
+        allocation->offset = move.destination_offset;
+        allocation->moving = false;
+        move.destination->allocations.push_back(allocation);
+
+        statistics.bytes_moved += allocation->size;
+        statistics.allocations_moved++;
+
+        if( allocation->freed )
+        {
+            // Freed while the copy was in flight, nobody to tell.
+            move.pool->release_range(move.destination, allocation->offset, allocation->size);
+            move.destination->allocations.pop_back();
+            delete allocation;
+        }
+        else
+        {
+            moved.push_back(allocation);
+        }
+    }
+
+    moves.clear();
+    submitted = false;
+
+    // Listeners recreate buffers and may allocate, so call them without
+    // holding any pool lock.
+    for( MemoryAllocation* allocation : moved )
+    {
+        allocation->listener->on_allocation_moved(*allocation);
+    }
+}
+
+void Defragmenter::release_empty_victims()
+{
+    for( std::map<MemoryPool*, std::vector<MemoryBlock*>>::iterator itr = victims.begin();
+        itr != victims.end(); )
+    {
+        MemoryPool* pool = itr->first;
+        std::vector<MemoryBlock*>& pool_victims = itr->second;
+        std::unique_lock<std::mutex> lock(pool->mutex);
+
+        for( std::vector<MemoryBlock*>::iterator block = pool_victims.begin();
+            block != pool_victims.end(); )
+        {
+            if( (*block)->allocations.empty() )
+            {
+                pool->destroy_block(*block);
+                statistics.blocks_released++;
+                block = pool_victims.erase(block);
+            }
+            else
+            {
+                ++block;
+            }
+        }
+
+        if( pool_victims.empty() )
+        {
+            itr = victims.erase(itr);
+        }
+        else
+        {
+            ++itr;
+        }
+    }
+}
+
+const DefragmentationStatistics& Defragmenter::get_statistics() const
+{
+    return statistics;
+}
+
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include "vulkan.h"
+#include "pool.h"
+
+#include <map>
+#include <vector>
+
+namespace vulkan
+{
+
+/*  Pool statistics summed over all pools of a device, taken when a
+    defragmentation pass begins and updated as it goes. */
+struct DefragmentationStatistics
+{
+    PoolStatistics before;
+    PoolStatistics after;
+    VkDeviceSize bytes_moved;
+    uint32_t allocations_moved;
+    uint32_t blocks_released;
+};
+
+/*  Compacts the memory pools of a LogicalDevice a little at a time.  begin()
+    picks the emptiest blocks as victims, then each call to step() copies at
+    most byte_budget bytes of live allocations out of them on the device
+    queue, patches the moved allocations, tells their listeners, and frees
+    victim blocks once they are empty.  Call step() once per frame.
+
+    An allocation must not be written by the GPU or host between the step()
+    that starts moving it and the step() that finishes, which is the next
+    one. */
+class Defragmenter
+{
+public:
+    explicit Defragmenter(LogicalDevice& device);
+    ~Defragmenter();
+
+    void begin();
+
+    /*  Returns true while there is work left. */
+    bool step(VkDeviceSize byte_budget);
+
+    bool is_done() const;
+
+    const DefragmentationStatistics& get_statistics() const;
+
+private:
+    struct Move
+    {
+        MemoryPool* pool;
+        MemoryAllocation* allocation;
+        MemoryBlock* destination;
+        VkDeviceSize destination_offset;
+    };
+
+    void choose_victims(MemoryPool* pool);
+    void plan_moves(VkDeviceSize byte_budget);
+    void submit_moves();
+    void finish_moves();
+    void release_empty_victims();
+    PoolStatistics get_pool_statistics();
+
+    LogicalDevice& device;
+    VkCommandPool command_pool;
+    VkCommandBuffer command_buffer;
+    VkFence fence;
+    bool submitted;
+
+    std::map<MemoryPool*, std::vector<MemoryBlock*>> victims;
+    std::vector<Move> moves;
+    DefragmentationStatistics statistics;
+};
+
+}
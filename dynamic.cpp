@@ -0,0 +1,327 @@
+#include "dynamic.h"
+#include "hash.h"
+
+namespace vulkan
+{
+
+/*  Dynamic topology still has to stay within the class of the pipeline's
+    topology. */
+static uint64_t get_topology_class(VkPrimitiveTopology topology)
+{
+    switch( topology )
+    {
+    case VK_PRIMITIVE_TOPOLOGY_POINT_LIST:
+        return 0;
+    case VK_PRIMITIVE_TOPOLOGY_LINE_LIST:
+    case VK_PRIMITIVE_TOPOLOGY_LINE_STRIP:
+    case VK_PRIMITIVE_TOPOLOGY_LINE_LIST_WITH_ADJACENCY:
+    case VK_PRIMITIVE_TOPOLOGY_LINE_STRIP_WITH_ADJACENCY:
+        return 1;
+    case VK_PRIMITIVE_TOPOLOGY_PATCH_LIST:
+        return 3;
+    default:
+        return 2;
+    }
+}
+
+RasterState get_default_raster_state()
+{
+    RasterState state;
+    state.cull_mode = VK_CULL_MODE_BACK_BIT;
+    state.front_face = VK_FRONT_FACE_COUNTER_CLOCKWISE;
+    state.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+    state.primitive_restart = false;
+    state.depth_test = true;
+    state.depth_write = true;
+    state.depth_compare = VK_COMPARE_OP_LESS_OR_EQUAL;
+    state.blend = false;
+    state.src_color_factor = VK_BLEND_FACTOR_ONE;
+    state.dst_color_factor = VK_BLEND_FACTOR_ZERO;
+    state.color_op = VK_BLEND_OP_ADD;
+    state.src_alpha_factor = VK_BLEND_FACTOR_ONE;
+    state.dst_alpha_factor = VK_BLEND_FACTOR_ZERO;
+    state.alpha_op = VK_BLEND_OP_ADD;
+    state.color_write_mask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT
+        | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+    return state;
+}
+
+PipelineStateConfig::PipelineStateConfig(LogicalDevice& device, PipelineStateMode mode)
+    : device(device)
+    , mode(mode)
+    , dynamic_rasterization(false)
+    , dynamic_primitive_restart(false)
+    , dynamic_blend(false)
+    , dynamic_vertex_input(false)
+{
+    if( mode == PipelineStateMode::DYNAMIC )
+    {
+        const DeviceFeatures& features = device.get_enabled_features();
+        dynamic_rasterization = features.extended_dynamic_state;
+        dynamic_primitive_restart = features.extended_dynamic_state2;
+        dynamic_blend = features.extended_dynamic_state3;
+        dynamic_vertex_input = features.vertex_input_dynamic_state;
+    }
+}
+
+PipelineStateMode PipelineStateConfig::get_mode() const
+{
+    return mode;
+}
+
+bool PipelineStateConfig::has_dynamic_rasterization() const
+{
+    return dynamic_rasterization;
+}
+
+bool PipelineStateConfig::has_dynamic_primitive_restart() const
+{
+    return dynamic_primitive_restart;
+}
+
+bool PipelineStateConfig::has_dynamic_blend() const
+{
+    return dynamic_blend;
+}
+
+bool PipelineStateConfig::has_dynamic_vertex_input() const
+{
+    return dynamic_vertex_input;
+}
+
+uint64_t PipelineStateConfig::get_pipeline_key(const RasterState& state) const
+{
+    Hasher key;
+
+    if( dynamic_rasterization )
+    {
+        key.add(get_topology_class(state.topology));
+    }
+    else
+    {
+        key.add(state.cull_mode);
+        key.add(state.front_face);
+        key.add(state.topology);
+        key.add(state.depth_test);
+        key.add(state.depth_test && state.depth_write);
+        key.add(state.depth_test ? state.depth_compare : 0);
+    }
+
+    if( !dynamic_primitive_restart )
+    {
+        key.add(state.primitive_restart);
+    }
+
+    if( !dynamic_blend )
+    {
+        key.add(state.color_write_mask);
+        key.add(state.blend);
+        if( state.blend )
+        {
+            key.add(state.src_color_factor);
+            key.add(state.dst_color_factor);
+            key.add(state.color_op);
+            key.add(state.src_alpha_factor);
+            key.add(state.dst_alpha_factor);
+            key.add(state.alpha_op);
+        }
+    }
+
+    if( !dynamic_vertex_input )
+    {
+        for( const VkVertexInputBindingDescription& binding : state.vertex_layout.bindings )
+        {
+            key.add(binding.binding);
+            key.add(binding.stride);
+            key.add(binding.inputRate);
+        }
+        key.add(~0ull);
+        for( const VkVertexInputAttributeDescription& attribute : state.vertex_layout.attributes )
+        {
+            key.add(attribute.location);
+            key.add(attribute.binding);
+            key.add(attribute.format);
+            key.add(attribute.offset);
+        }
+    }
+
+    return key.get_hash();
+}
+
+void PipelineStateConfig::describe(
+    const RasterState& state,
+    PipelineStateInfo& info,
+    VkGraphicsPipelineCreateInfo& create_info) const
+{
+    // Baked or not, the structs are filled in, the dynamic values in them
+    // are ignored.
+    info.vertex_layout = state.vertex_layout;
+
+    info.vertex_input.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+    info.vertex_input.pNext = nullptr;
+    info.vertex_input.flags = 0;
+    info.vertex_input.vertexBindingDescriptionCount = static_cast<uint32_t>(info.vertex_layout.bindings.size());
+    info.vertex_input.pVertexBindingDescriptions = info.vertex_layout.bindings.data();
+    info.vertex_input.vertexAttributeDescriptionCount = static_cast<uint32_t>(info.vertex_layout.attributes.size());
+    info.vertex_input.pVertexAttributeDescriptions = info.vertex_layout.attributes.data();
+
+    info.input_assembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+    info.input_assembly.pNext = nullptr;
+    info.input_assembly.flags = 0;
+    info.input_assembly.topology = state.topology;
+    info.input_assembly.primitiveRestartEnable = state.primitive_restart;
+
+    info.rasterization.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+    info.rasterization.pNext = nullptr;
+    info.rasterization.flags = 0;
+    info.rasterization.depthClampEnable = VK_FALSE;
+    info.rasterization.rasterizerDiscardEnable = VK_FALSE;
+    info.rasterization.polygonMode = VK_POLYGON_MODE_FILL;
+    info.rasterization.cullMode = state.cull_mode;
+    info.rasterization.frontFace = state.front_face;
+    info.rasterization.depthBiasEnable = VK_FALSE;
+    info.rasterization.depthBiasConstantFactor = 0.0f;
+    info.rasterization.depthBiasClamp = 0.0f;
+    info.rasterization.depthBiasSlopeFactor = 0.0f;
+    info.rasterization.lineWidth = 1.0f;
+
+    info.depth_stencil = {};
+    info.depth_stencil.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+    info.depth_stencil.depthTestEnable = state.depth_test;
+    info.depth_stencil.depthWriteEnable = state.depth_write;
+    info.depth_stencil.depthCompareOp = state.depth_compare;
+    info.depth_stencil.depthBoundsTestEnable = VK_FALSE;
+    info.depth_stencil.stencilTestEnable = VK_FALSE;
+    info.depth_stencil.minDepthBounds = 0.0f;
+    info.depth_stencil.maxDepthBounds = 1.0f;
+
+    info.blend_attachment.blendEnable = state.blend;
+    info.blend_attachment.srcColorBlendFactor = state.src_color_factor;
+    info.blend_attachment.dstColorBlendFactor = state.dst_color_factor;
+    info.blend_attachment.colorBlendOp = state.color_op;
+    info.blend_attachment.srcAlphaBlendFactor = state.src_alpha_factor;
+    info.blend_attachment.dstAlphaBlendFactor = state.dst_alpha_factor;
+    info.blend_attachment.alphaBlendOp = state.alpha_op;
+    info.blend_attachment.colorWriteMask = state.color_write_mask;
+
+    info.color_blend.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+    info.color_blend.pNext = nullptr;
+    info.color_blend.flags = 0;
+    info.color_blend.logicOpEnable = VK_FALSE;
+    info.color_blend.logicOp = VK_LOGIC_OP_COPY;
+    info.color_blend.attachmentCount = 1;
+    info.color_blend.pAttachments = &info.blend_attachment;
+    for( float& constant : info.color_blend.blendConstants )
+    {
+        constant = 0.0f;
+    }
+
+    if( dynamic_rasterization )
+    {
+        info.dynamic_states.push_back(VK_DYNAMIC_STATE_CULL_MODE_EXT);
+        info.dynamic_states.push_back(VK_DYNAMIC_STATE_FRONT_FACE_EXT);
+        info.dynamic_states.push_back(VK_DYNAMIC_STATE_PRIMITIVE_TOPOLOGY_EXT);
+        info.dynamic_states.push_back(VK_DYNAMIC_STATE_DEPTH_TEST_ENABLE_EXT);
+        info.dynamic_states.push_back(VK_DYNAMIC_STATE_DEPTH_WRITE_ENABLE_EXT);
+        info.dynamic_states.push_back(VK_DYNAMIC_STATE_DEPTH_COMPARE_OP_EXT);
+    }
+    if( dynamic_primitive_restart )
+    {
+        info.dynamic_states.push_back(VK_DYNAMIC_STATE_PRIMITIVE_RESTART_ENABLE_EXT);
+    }
+    if( dynamic_blend )
+    {
+        info.dynamic_states.push_back(VK_DYNAMIC_STATE_COLOR_BLEND_ENABLE_EXT);
+        info.dynamic_states.push_back(VK_DYNAMIC_STATE_COLOR_BLEND_EQUATION_EXT);
+        info.dynamic_states.push_back(VK_DYNAMIC_STATE_COLOR_WRITE_MASK_EXT);
+    }
+    if( dynamic_vertex_input )
+    {
+        info.dynamic_states.push_back(VK_DYNAMIC_STATE_VERTEX_INPUT_EXT);
+    }
+
+    info.dynamic.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+    info.dynamic.pNext = nullptr;
+    info.dynamic.flags = 0;
+    info.dynamic.dynamicStateCount = static_cast<uint32_t>(info.dynamic_states.size());
+    info.dynamic.pDynamicStates = info.dynamic_states.data();
+
+    create_info.pVertexInputState = &info.vertex_input;
+    create_info.pInputAssemblyState = &info.input_assembly;
+    create_info.pRasterizationState = &info.rasterization;
+    create_info.pDepthStencilState = &info.depth_stencil;
+    create_info.pColorBlendState = &info.color_blend;
+    create_info.pDynamicState = info.dynamic_states.empty() ? nullptr : &info.dynamic;
+}
+
+void PipelineStateConfig::record(VkCommandBuffer command_buffer, const RasterState& state) const
+{
+    const DeviceFunctions& functions = device.get_functions();
+
+    if( dynamic_rasterization )
+    {
+        functions.cmd_set_cull_mode(command_buffer, state.cull_mode);
+        functions.cmd_set_front_face(command_buffer, state.front_face);
+        functions.cmd_set_primitive_topology(command_buffer, state.topology);
+        functions.cmd_set_depth_test_enable(command_buffer, state.depth_test);
+        functions.cmd_set_depth_write_enable(command_buffer, state.depth_write);
+        functions.cmd_set_depth_compare_op(command_buffer, state.depth_compare);
+    }
+
+    if( dynamic_primitive_restart )
+    {
+        functions.cmd_set_primitive_restart_enable(command_buffer, state.primitive_restart);
+    }
+
+    if( dynamic_blend )
+    {
+        VkBool32 blend = state.blend;
+        functions.cmd_set_color_blend_enable(command_buffer, 0, 1, &blend);
+
+        VkColorBlendEquationEXT equation;
+        equation.srcColorBlendFactor = state.src_color_factor;
+        equation.dstColorBlendFactor = state.dst_color_factor;
+        equation.colorBlendOp = state.color_op;
+        equation.srcAlphaBlendFactor = state.src_alpha_factor;
+        equation.dstAlphaBlendFactor = state.dst_alpha_factor;
+        equation.alphaBlendOp = state.alpha_op;
+        functions.cmd_set_color_blend_equation(command_buffer, 0, 1, &equation);
+
+        functions.cmd_set_color_write_mask(command_buffer, 0, 1, &state.color_write_mask);
+    }
+
+    if( dynamic_vertex_input )
+    {
+        std::vector<VkVertexInputBindingDescription2EXT> bindings;
+        for( const VkVertexInputBindingDescription& description : state.vertex_layout.bindings )
+        {
+            VkVertexInputBindingDescription2EXT binding;
+            binding.sType = VK_STRUCTURE_TYPE_VERTEX_INPUT_BINDING_DESCRIPTION_2_EXT;
+            binding.pNext = nullptr;
+            binding.binding = description.binding;
+            binding.stride = description.stride;
+            binding.inputRate = description.inputRate;
+            binding.divisor = 1;
+            bindings.push_back(binding);
+        }
+
+        std::vector<VkVertexInputAttributeDescription2EXT> attributes;
+        for( const VkVertexInputAttributeDescription& description : state.vertex_layout.attributes )
+        {
+            VkVertexInputAttributeDescription2EXT attribute;
+            attribute.sType = VK_STRUCTURE_TYPE_VERTEX_INPUT_ATTRIBUTE_DESCRIPTION_2_EXT;
+            attribute.pNext = nullptr;
+            attribute.location = description.location;
+            attribute.binding = description.binding;
+            attribute.format = description.format;
+            attribute.offset = description.offset;
+            attributes.push_back(attribute);
+        }
+
+        functions.cmd_set_vertex_input(command_buffer,
+            static_cast<uint32_t>(bindings.size()), bindings.data(),
+            static_cast<uint32_t>(attributes.size()), attributes.data());
+    }
+}
+
+}
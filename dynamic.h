@@ -0,0 +1,111 @@
+#pragma once
+
+#include "vulkan.h"
+
+#include <vector>
+
+namespace vulkan
+{
+
+struct VertexLayout
+{
+    std::vector<VkVertexInputBindingDescription> bindings;
+    std::vector<VkVertexInputAttributeDescription> attributes;
+};
+
+/*  The fixed-function state that varies between the materials and draws
+    of a renderer, for one color attachment.  Which of it is baked into
+    pipelines depends on the PipelineStateConfig. */
+struct RasterState
+{
+    VkCullModeFlags cull_mode;
+    VkFrontFace front_face;
+    VkPrimitiveTopology topology;
+    bool primitive_restart;
+
+    bool depth_test;
+    bool depth_write;
+    VkCompareOp depth_compare;
+
+    bool blend;
+    VkBlendFactor src_color_factor;
+    VkBlendFactor dst_color_factor;
+    VkBlendOp color_op;
+    VkBlendFactor src_alpha_factor;
+    VkBlendFactor dst_alpha_factor;
+    VkBlendOp alpha_op;
+    VkColorComponentFlags color_write_mask;
+
+    VertexLayout vertex_layout;
+};
+
+/*  Back face culled triangle lists, depth tested and written, opaque. */
+RasterState get_default_raster_state();
+
+/*  The create info structs PipelineStateConfig::describe() points a
+    pipeline at, which have to live until the pipeline is created.  Fill
+    dynamic_states beforehand with any dynamic state of your own, like the
+    viewport and scissor. */
+struct PipelineStateInfo
+{
+    VkPipelineVertexInputStateCreateInfo vertex_input;
+    VkPipelineInputAssemblyStateCreateInfo input_assembly;
+    VkPipelineRasterizationStateCreateInfo rasterization;
+    VkPipelineDepthStencilStateCreateInfo depth_stencil;
+    VkPipelineColorBlendAttachmentState blend_attachment;
+    VkPipelineColorBlendStateCreateInfo color_blend;
+    VkPipelineDynamicStateCreateInfo dynamic;
+    std::vector<VkDynamicState> dynamic_states;
+    VertexLayout vertex_layout;
+};
+
+enum class PipelineStateMode
+{
+    BAKED,      // every RasterState field is compiled into the pipeline
+    DYNAMIC     // whatever the device can set at record time is
+};
+
+/*  Decides which RasterState fields are pipeline state and which are set
+    while recording:
+     - VK_EXT_extended_dynamic_state: cull mode, front face, topology
+       within its class, depth test, write and compare op.
+     - VK_EXT_extended_dynamic_state2: primitive restart.
+     - VK_EXT_extended_dynamic_state3: blend enable, equation and color
+       write mask.
+     - VK_EXT_vertex_input_dynamic_state: the vertex layout.
+    States whose RasterStates get equal pipeline keys can share a pipeline,
+    with record() setting the rest after binding it. */
+class PipelineStateConfig
+{
+public:
+    PipelineStateConfig(LogicalDevice& device, PipelineStateMode mode = PipelineStateMode::DYNAMIC);
+
+    PipelineStateMode get_mode() const;
+    bool has_dynamic_rasterization() const;
+    bool has_dynamic_primitive_restart() const;
+    bool has_dynamic_blend() const;
+    bool has_dynamic_vertex_input() const;
+
+    /*  Covers only the fields baked into pipelines. */
+    uint64_t get_pipeline_key(const RasterState& state) const;
+
+    /*  Points the vertex input, input assembly, rasterization, depth
+        stencil, color blend and dynamic state of the create info at info,
+        filled from state.  Viewport, multisample, stages, layout and
+        render pass are left to the caller. */
+    void describe(const RasterState& state, PipelineStateInfo& info, VkGraphicsPipelineCreateInfo& create_info) const;
+
+    /*  Sets the dynamic fields of state, after binding a pipeline created
+        with describe(). */
+    void record(VkCommandBuffer command_buffer, const RasterState& state) const;
+
+private:
+    LogicalDevice& device;
+    PipelineStateMode mode;
+    bool dynamic_rasterization;
+    bool dynamic_primitive_restart;
+    bool dynamic_blend;
+    bool dynamic_vertex_input;
+};
+
+}
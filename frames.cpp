@@ -0,0 +1,247 @@
+#include "frames.h"
+
+#include <algorithm>
+#include <stdio.h>
+
+namespace vulkan
+{
+
+// Frames averaged for the baseline a spike is measured against.
+static const size_t baseline_frames = 8;
+
+void FrameTimeHistogram::add(double milliseconds)
+{
+    size_t bucket = static_cast<size_t>(std::max(milliseconds, 0.0) / bucket_width);
+    buckets[std::min(bucket, bucket_count - 1)]++;
+    count++;
+    total += milliseconds;
+    max = std::max(max, milliseconds);
+}
+
+double FrameTimeHistogram::get_average() const
+{
+    return count ? total / count : 0.0;
+}
+
+double FrameTimeHistogram::get_percentile(double fraction) const
+{
+    uint64_t wanted = static_cast<uint64_t>(fraction * count);
+    uint64_t seen = 0;
+    for( size_t bucket = 0; bucket < bucket_count; ++bucket )
+    {
+        seen += buckets[bucket];
+        if( seen > wanted || seen == count )
+        {
+            return std::min((bucket + 1) * bucket_width, max);
+        }
+    }
+    return max;
+}
+
+FrameStatistics::FrameStatistics(uint32_t trace_length)
+    : trace_length(trace_length)
+    , jank_factor(2.0)
+    , min_spike(4.0)
+    , listener(nullptr)
+    , frame_number(0)
+    , presents_seen(false)
+    , last_present_time(0)
+    , cpu_histogram()
+    , frame_interval_histogram()
+    , gpu_histogram()
+    , present_histogram()
+    , fence_wait_histogram()
+    , jank_count(0)
+{
+}
+
+void FrameStatistics::set_jank_threshold(double jank_factor, double min_spike)
+{
+    this->jank_factor = jank_factor;
+    this->min_spike = min_spike;
+}
+
+void FrameStatistics::set_jank_listener(IJankListener* listener)
+{
+    this->listener = listener;
+}
+
+uint64_t FrameStatistics::begin_frame()
+{
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+
+    // The previous frame lasted until now.
+    if( !trace.empty() )
+    {
+        FrameRecord& previous = trace.back();
+        previous.frame_interval = std::chrono::duration<double, std::milli>(now - frame_start).count();
+        frame_interval_histogram.add(previous.frame_interval);
+        if( !presents_seen )
+        {
+            detect_jank(previous, previous.frame_interval, recent_frame_intervals);
+        }
+    }
+    frame_start = now;
+
+    FrameRecord record = {};
+    record.number = frame_number;
+    trace.push_back(record);
+
+    // One more than the trace, the newest frame is not part of it.
+    if( trace.size() > trace_length + 1 )
+    {
+        trace.pop_front();
+    }
+    return frame_number++;
+}
+
+void FrameStatistics::end_frame()
+{
+    // Nothing to end before the first begin_frame().
+    if( trace.empty() )
+    {
+        return;
+    }
+
+    FrameRecord& record = trace.back();
+    record.cpu_time = std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now() - frame_start).count();
+    cpu_histogram.add(record.cpu_time);
+}
+
+void FrameStatistics::record_fence_wait(double milliseconds)
+{
+    if( !trace.empty() )
+    {
+        trace.back().fence_wait += milliseconds;
+    }
+    fence_wait_histogram.add(milliseconds);
+}
+
+void FrameStatistics::record_gpu_time(uint64_t frame_number, double milliseconds)
+{
+    gpu_histogram.add(milliseconds);
+    if( FrameRecord* record = find_record(frame_number) )
+    {
+        record->gpu_time = milliseconds;
+    }
+}
+
+void FrameStatistics::record_present(uint64_t frame_number, uint64_t present_time_ns)
+{
+    bool first = !presents_seen;
+    presents_seen = true;
+
+    uint64_t previous = last_present_time;
+    last_present_time = present_time_ns;
+    if( first || present_time_ns <= previous )
+    {
+        return;
+    }
+
+    double interval = (present_time_ns - previous) / 1e6;
+    present_histogram.add(interval);
+    if( FrameRecord* record = find_record(frame_number) )
+    {
+        record->present_interval = interval;
+        detect_jank(*record, interval, recent_present_intervals);
+    }
+}
+
+FrameRecord* FrameStatistics::find_record(uint64_t frame_number)
+{
+    if( trace.empty() || frame_number < trace.front().number || frame_number > trace.back().number )
+    {
+        return nullptr;
+    }
+    return &trace[frame_number - trace.front().number];
+}
+
+void FrameStatistics::detect_jank(FrameRecord& record, double interval, std::deque<double>& recent)
+{
+    if( recent.size() == baseline_frames )
+    {
+        double average = 0.0;
+        for( double value : recent )
+        {
+            average += value;
+        }
+        average /= recent.size();
+
+        // Spikes stay out of the baseline, so that one does not hide the
+        // next.
+        if( interval > average * jank_factor && interval > average + min_spike )
+        {
+            record.jank = true;
+            jank_count++;
+
+            std::vector<FrameRecord> spike_trace;
+            for( FrameRecord& frame : trace )
+            {
+                if( frame.number <= record.number )
+                {
+                    spike_trace.push_back(frame);
+                }
+            }
+
+            if( listener )
+            {
+                listener->on_jank(spike_trace);
+            }
+            else
+            {
+                print_trace(spike_trace);
+            }
+            return;
+        }
+        recent.pop_front();
+    }
+    recent.push_back(interval);
+}
+
+void FrameStatistics::print_trace(const std::vector<FrameRecord>& trace)
+{
+    printf("Jank at frame %llu, preceding frames (ms):\n",
+        static_cast<unsigned long long>(trace.back().number));
+    printf("   frame      cpu  interval      gpu  present    fence\n");
+    for( const FrameRecord& frame : trace )
+    {
+        printf(" %7llu %8.2f %9.2f %8.2f %8.2f %8.2f%s\n",
+            static_cast<unsigned long long>(frame.number),
+            frame.cpu_time, frame.frame_interval, frame.gpu_time,
+            frame.present_interval, frame.fence_wait,
+            frame.jank ? "  <-" : "");
+    }
+}
+
+const FrameTimeHistogram& FrameStatistics::get_cpu_histogram() const
+{
+    return cpu_histogram;
+}
+
+const FrameTimeHistogram& FrameStatistics::get_frame_interval_histogram() const
+{
+    return frame_interval_histogram;
+}
+
+const FrameTimeHistogram& FrameStatistics::get_gpu_histogram() const
+{
+    return gpu_histogram;
+}
+
+const FrameTimeHistogram& FrameStatistics::get_present_histogram() const
+{
+    return present_histogram;
+}
+
+const FrameTimeHistogram& FrameStatistics::get_fence_wait_histogram() const
+{
+    return fence_wait_histogram;
+}
+
+uint64_t FrameStatistics::get_jank_count() const
+{
+    return jank_count;
+}
+
+}
@@ -0,0 +1,121 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <deque>
+#include <stdint.h>
+#include <vector>
+
+namespace vulkan
+{
+
+/*  Millisecond durations in 0.25ms buckets up to 64ms; the last bucket
+    holds everything longer. */
+struct FrameTimeHistogram
+{
+    static const size_t bucket_count = 257;
+    static constexpr double bucket_width = 0.25;
+
+    std::array<uint32_t, bucket_count> buckets;
+    uint64_t count;
+    double total;
+    double max;
+
+    void add(double milliseconds);
+
+    double get_average() const;
+
+    /*  Upper edge of the bucket holding the given fraction of samples,
+        e.g. 0.99 for the 99th percentile. */
+    double get_percentile(double fraction) const;
+};
+
+/*  Timings of one frame in milliseconds.  Those a source was not
+    available for stay 0. */
+struct FrameRecord
+{
+    uint64_t number;
+    double cpu_time;
+    double frame_interval;
+    double gpu_time;
+    double present_interval;
+    double fence_wait;
+    bool jank;
+};
+
+class IJankListener
+{
+public:
+    virtual ~IJankListener() {}
+
+    /*  Called from the frame thread with the spiking frame last, preceded
+        by up to trace_length earlier frames. */
+    virtual void on_jank(const std::vector<FrameRecord>& trace) = 0;
+};
+
+/*  Collects per-frame timings into histograms and watches them for jank:
+    a frame taking more than jank_factor times the average of the frames
+    before it, and at least min_spike milliseconds longer.
+
+    The interval judged is present-to-present once any present time has
+    been recorded, and otherwise the CPU time from a frame's begin_frame()
+    to the next one, so it works headless too.  Present times come from
+    whatever the swapchain offers: VK_GOOGLE_display_timing's
+    actualPresentTime, or the moment vkWaitForPresentKHR returns.  GPU
+    times arrive a few frames late from a QueryManager and are attached to
+    the frame they belong to. */
+class FrameStatistics
+{
+public:
+    explicit FrameStatistics(uint32_t trace_length = 120);
+
+    void set_jank_threshold(double jank_factor, double min_spike);
+
+    /*  Without a listener, traces are printed to stdout. */
+    void set_jank_listener(IJankListener* listener);
+
+    /*  Returns the new frame's number. */
+    uint64_t begin_frame();
+    void end_frame();
+
+    void record_fence_wait(double milliseconds);
+    void record_gpu_time(uint64_t frame_number, double milliseconds);
+    void record_present(uint64_t frame_number, uint64_t present_time_ns);
+
+    const FrameTimeHistogram& get_cpu_histogram() const;
+    const FrameTimeHistogram& get_frame_interval_histogram() const;
+    const FrameTimeHistogram& get_gpu_histogram() const;
+    const FrameTimeHistogram& get_present_histogram() const;
+    const FrameTimeHistogram& get_fence_wait_histogram() const;
+
+    uint64_t get_jank_count() const;
+
+private:
+    FrameRecord* find_record(uint64_t frame_number);
+    void detect_jank(FrameRecord& record, double interval, std::deque<double>& recent);
+    void print_trace(const std::vector<FrameRecord>& trace);
+
+    uint32_t trace_length;
+    double jank_factor;
+    double min_spike;
+    IJankListener* listener;
+
+    std::deque<FrameRecord> trace;
+    std::chrono::steady_clock::time_point frame_start;
+    uint64_t frame_number;
+    bool presents_seen;
+    uint64_t last_present_time;
+
+    // Intervals of the last few frames, the baseline for spikes.
+    std::deque<double> recent_frame_intervals;
+    std::deque<double> recent_present_intervals;
+
+    FrameTimeHistogram cpu_histogram;
+    FrameTimeHistogram frame_interval_histogram;
+    FrameTimeHistogram gpu_histogram;
+    FrameTimeHistogram present_histogram;
+    FrameTimeHistogram fence_wait_histogram;
+    uint64_t jank_count;
+};
+
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <algorithm>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+namespace vulkan
+{
+
+static const uint64_t fnv_offset_basis = 14695981039346656037ull;
+static const uint64_t fnv_prime = 1099511628211ull;
+
+/*  64-bit FNV-1a of size bytes, continuing from hash, so that several
+    pieces of data can be hashed one after the other. */
+inline uint64_t fnv1a(const void* data, size_t size, uint64_t hash = fnv_offset_basis)
+{
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    for( size_t i = 0; i < size; ++i )
+    {
+        hash ^= bytes[i];
+        hash *= fnv_prime;
+    }
+    return hash;
+}
+
+/*  Value of a Vulkan handle, which is a pointer or a 64-bit integer
+    depending on the platform. */
+template<typename Handle>
+uint64_t get_handle_value(Handle handle)
+{
+    uint64_t value = 0;
+    memcpy(&value, &handle, std::min(sizeof(handle), sizeof(value)));
+    return value;
+}
+
+/*  fnv1a() over a sequence of values, for keys of caches. */
+class Hasher
+{
+public:
+    Hasher()
+        : hash(fnv_offset_basis)
+    {
+    }
+
+    void add(uint64_t value)
+    {
+        add_data(&value, sizeof(value));
+    }
+
+    void add_data(const void* data, size_t size)
+    {
+        hash = fnv1a(data, size, hash);
+    }
+
+    template<typename Handle>
+    void add_handle(Handle handle)
+    {
+        add(get_handle_value(handle));
+    }
+
+    uint64_t get_hash() const
+    {
+        return hash;
+    }
+
+private:
+    uint64_t hash;
+};
+
+}
@@ -0,0 +1,187 @@
+#include "image.h"
+
+#include <algorithm>
+#include <atomic>
+
+namespace vulkan
+{
+
+static std::atomic<uint32_t> next_generation(0);
+
+Image::Image(
+    LogicalDevice& device,
+    VkFormat format,
+    VkExtent3D extent,
+    uint32_t mip_levels,
+    uint32_t array_layers,
+    VkImageUsageFlags usage
+)
+: device(device)
+, image(VK_NULL_HANDLE)
+, format(format)
+, extent(extent)
+, mip_levels(mip_levels)
+, array_layers(array_layers)
+, usage(usage)
+, allocation(nullptr)
+, generation(next_generation++)
+, states(mip_levels * array_layers, ImageSubresourceState{VK_IMAGE_LAYOUT_UNDEFINED, 0, 0})
+{
+    VkImageCreateInfo create_info;
+    create_info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+    create_info.pNext = nullptr;
+    create_info.flags = 0;
+    create_info.imageType = extent.depth > 1 ? VK_IMAGE_TYPE_3D : VK_IMAGE_TYPE_2D;
+    create_info.format = format;
+    create_info.extent = extent;
+    create_info.mipLevels = mip_levels;
+    create_info.arrayLayers = array_layers;
+    create_info.samples = VK_SAMPLE_COUNT_1_BIT;
+    create_info.tiling = VK_IMAGE_TILING_OPTIMAL;
+    create_info.usage = usage;
+    create_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    create_info.queueFamilyIndexCount = 0;
+    create_info.pQueueFamilyIndices = nullptr;
+    create_info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+    VkResult result = vkCreateImage(device.get_device(), &create_info, device.get_allocation_callbacks(), &image);
+    if( result != VK_SUCCESS )
+    {
+        throw VulkanException(result, "Error while creating image");
+    }
+}
+
+Image::~Image()
+{
+    vkDestroyImage(device.get_device(), image, device.get_allocation_callbacks());
+    if( allocation )
+    {
+        device.free(allocation);
+    }
+}
+
+bool Image::bind(VkMemoryPropertyFlags properties, AllocationPriority priority)
+{
+    VkMemoryRequirements requirements;
+    vkGetImageMemoryRequirements(device.get_device(), image, &requirements);
+
+    // Keep linear buffers and optimal images in the same block apart.
+    VkDeviceSize granularity = device.get_properties().limits.bufferImageGranularity;
+    requirements.alignment = std::max(requirements.alignment, granularity);
+    requirements.size = (requirements.size + granularity - 1) / granularity * granularity;
+
+    allocation = device.allocate(requirements, properties, priority);
+    if( !allocation )
+    {
+        return false;
+    }
+
+    VkResult result = vkBindImageMemory(
+        device.get_device(), image, allocation->get_memory(), allocation->get_offset());
+    if( result != VK_SUCCESS )
+    {
+        throw VulkanException(result, "Error while binding image memory");
+    }
+
+    return true;
+}
+
+VkImage Image::get_image() const
+{
+    return image;
+}
+
+VkFormat Image::get_format() const
+{
+    return format;
+}
+
+VkExtent3D Image::get_extent() const
+{
+    return extent;
+}
+
+uint32_t Image::get_mip_levels() const
+{
+    return mip_levels;
+}
+
+uint32_t Image::get_array_layers() const
+{
+    return array_layers;
+}
+
+VkImageUsageFlags Image::get_usage() const
+{
+    return usage;
+}
+
+MemoryAllocation* Image::get_allocation() const
+{
+    return allocation;
+}
+
+uint32_t Image::get_generation() const
+{
+    return generation;
+}
+
+VkImageSubresourceRange Image::get_full_range() const
+{
+    VkImageSubresourceRange range;
+    switch( format )
+    {
+        case VK_FORMAT_D16_UNORM:
+        case VK_FORMAT_D32_SFLOAT:
+            range.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
+            break;
+        case VK_FORMAT_D16_UNORM_S8_UINT:
+        case VK_FORMAT_D24_UNORM_S8_UINT:
+        case VK_FORMAT_D32_SFLOAT_S8_UINT:
+            range.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT | VK_IMAGE_ASPECT_STENCIL_BIT;
+            break;
+        default:
+            range.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+            break;
+    }
+    range.baseMipLevel = 0;
+    range.levelCount = mip_levels;
+    range.baseArrayLayer = 0;
+    range.layerCount = array_layers;
+    return range;
+}
+
+ImageSubresourceState Image::get_state(uint32_t mip_level, uint32_t array_layer)
+{
+    std::lock_guard<std::mutex> lock(state_mutex);
+    return states[mip_level * array_layers + array_layer];
+}
+
+void Image::set_state(const VkImageSubresourceRange& range, const ImageSubresourceState& state)
+{
+    uint32_t level_count = range.levelCount == VK_REMAINING_MIP_LEVELS
+        ? mip_levels - range.baseMipLevel : range.levelCount;
+    uint32_t layer_count = range.layerCount == VK_REMAINING_ARRAY_LAYERS
+        ? array_layers - range.baseArrayLayer : range.layerCount;
+
+    std::lock_guard<std::mutex> lock(state_mutex);
+    for( uint32_t mip = range.baseMipLevel; mip < range.baseMipLevel + level_count; ++mip )
+    {
+        for( uint32_t layer = range.baseArrayLayer; layer < range.baseArrayLayer + layer_count; ++layer )
+        {
+            states[mip * array_layers + layer] = state;
+        }
+    }
+}
+
+std::mutex& Image::get_state_mutex()
+{
+    return state_mutex;
+}
+
+std::vector<ImageSubresourceState>& Image::get_states()
+{
+    return states;
+}
+
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include "vulkan.h"
+#include "pool.h"
+
+#include <mutex>
+#include <vector>
+
+namespace vulkan
+{
+
+/*  Layout of one mip level / array layer of an Image, and the stages and
+    accesses that used it since its last barrier. */
+struct ImageSubresourceState
+{
+    VkImageLayout layout;
+    VkPipelineStageFlags2KHR stages;
+    VkAccessFlags2KHR access;
+};
+
+/*  Wrapper for an optimally tiled VkImage with its memory, generated by the
+    LogicalDevice by calling create_image().  Keeps the state of each mip
+    level and layer as of the last submitted work, as published by a
+    LayoutTracker or the Uploader.  Aspects are not tracked separately. */
+class Image
+{
+    friend class LogicalDevice;
+
+public:
+    Image(const Image&) = delete;
+    Image& operator=(const Image&) = delete;
+    ~Image();
+
+    VkImage get_image() const;
+    VkFormat get_format() const;
+    VkExtent3D get_extent() const;
+    uint32_t get_mip_levels() const;
+    uint32_t get_array_layers() const;
+    VkImageUsageFlags get_usage() const;
+    MemoryAllocation* get_allocation() const;
+
+    /*  Tells apart images that were given the same handle, as the driver
+        may reuse the handle of a destroyed one.  Every Image takes the next
+        value of a counter shared by all of them. */
+    uint32_t get_generation() const;
+
+    /*  Range covering every mip level and layer of the color, or depth and
+        stencil, aspect. */
+    VkImageSubresourceRange get_full_range() const;
+
+    ImageSubresourceState get_state(uint32_t mip_level, uint32_t array_layer);
+    void set_state(const VkImageSubresourceRange& range, const ImageSubresourceState& state);
+
+    /*  Locks the subresource states, so that a LayoutTracker can read and
+        update several without other submits getting in between. */
+    std::mutex& get_state_mutex();
+    std::vector<ImageSubresourceState>& get_states();
+
+private:
+    Image(
+        LogicalDevice& device,
+        VkFormat format,
+        VkExtent3D extent,
+        uint32_t mip_levels,
+        uint32_t array_layers,
+        VkImageUsageFlags usage);
+
+    bool bind(VkMemoryPropertyFlags properties, AllocationPriority priority);
+
+    LogicalDevice& device;
+    VkImage image;
+    VkFormat format;
+    VkExtent3D extent;
+    uint32_t mip_levels;
+    uint32_t array_layers;
+    VkImageUsageFlags usage;
+    MemoryAllocation* allocation;
+    uint32_t generation;
+
+    // Indexed by mip_level * array_layers + array_layer.
+    std::vector<ImageSubresourceState> states;
+    std::mutex state_mutex;
+};
+
+}
@@ -0,0 +1,112 @@
+#include "latch.h"
+#include "pool.h"
+#include "queue.h"
+
+namespace vulkan
+{
+
+LateLatch::LateLatch(LogicalDevice& device, SDL_Window* window, VkDeviceSize constants_size, uint32_t frames_in_flight)
+    : device(device)
+    , window(window)
+    , constants_size(constants_size)
+    , frames_in_flight(frames_in_flight)
+    , recording_start_ns(0)
+    , latched_input()
+    , statistics()
+{
+    VkDeviceSize alignment = device.get_properties().limits.minUniformBufferOffsetAlignment;
+    slot_size = (constants_size + alignment - 1) / alignment * alignment;
+
+    VkBufferCreateInfo buffer_info;
+    buffer_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    buffer_info.pNext = nullptr;
+    buffer_info.flags = 0;
+    buffer_info.size = slot_size * frames_in_flight;
+    buffer_info.usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT;
+    buffer_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    buffer_info.queueFamilyIndexCount = 0;
+    buffer_info.pQueueFamilyIndices = nullptr;
+
+    VkResult result = vkCreateBuffer(device.get_device(), &buffer_info, device.get_allocation_callbacks(), &buffer);
+    if( result != VK_SUCCESS )
+    {
+        throw VulkanException(result, "Error while creating late latch buffer");
+    }
+
+    VkMemoryRequirements requirements;
+    vkGetBufferMemoryRequirements(device.get_device(), buffer, &requirements);
+
+    // Coherent, so that nothing but the write stands between the latch and
+    // the submit.  No move listener, descriptors keep pointing at it.
+    allocation = device.allocate(requirements,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+        AllocationPriority::CRITICAL);
+
+    result = vkBindBufferMemory(device.get_device(), buffer, allocation->get_memory(), allocation->get_offset());
+    if( result != VK_SUCCESS )
+    {
+        throw VulkanException(result, "Error while binding late latch buffer memory");
+    }
+
+    mapped = static_cast<char*>(device.map(allocation));
+}
+
+LateLatch::~LateLatch()
+{
+    vkDestroyBuffer(device.get_device(), buffer, device.get_allocation_callbacks());
+    device.free(allocation);
+}
+
+VkBuffer LateLatch::get_buffer() const
+{
+    return buffer;
+}
+
+VkDeviceSize LateLatch::get_constants_size() const
+{
+    return constants_size;
+}
+
+VkDeviceSize LateLatch::get_offset(uint32_t frame_slot) const
+{
+    return (frame_slot % frames_in_flight) * slot_size;
+}
+
+void LateLatch::begin_recording()
+{
+    recording_start_ns = sdl::get_time_ns();
+}
+
+VkResult LateLatch::submit(uint32_t frame_slot, const Writer& writer, const VkSubmitInfo& submit_info, VkFence fence)
+{
+    latched_input = sdl::sample_input(window);
+    writer(latched_input, mapped + get_offset(frame_slot));
+
+    VkResult result = device.get_submit_queue().submit(submit_info, fence);
+
+    uint64_t submitted_ns = sdl::get_time_ns();
+    uint64_t record_start_ns = recording_start_ns ? recording_start_ns : latched_input.timestamp_ns;
+    recording_start_ns = 0;
+
+    // Running averages over all frames.
+    statistics.frames++;
+    double weight = 1.0 / statistics.frames;
+    statistics.input_age_ms += weight
+        * ((submitted_ns - latched_input.timestamp_ns) / 1e6 - statistics.input_age_ms);
+    statistics.record_time_input_age_ms += weight
+        * ((submitted_ns - record_start_ns) / 1e6 - statistics.record_time_input_age_ms);
+
+    return result;
+}
+
+const sdl::InputState& LateLatch::get_latched_input() const
+{
+    return latched_input;
+}
+
+const LateLatchStatistics& LateLatch::get_statistics() const
+{
+    return statistics;
+}
+
+}
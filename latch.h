@@ -0,0 +1,74 @@
+#pragma once
+
+#include "vulkan.h"
+#include "sdl.h"
+
+#include <functional>
+
+namespace vulkan
+{
+
+/*  Ages of the latched input, averaged over all frames: from the input
+    sample to the submit, and from where recording began, which is when
+    the constants would have been written without late latching. */
+struct LateLatchStatistics
+{
+    uint64_t frames;
+    double input_age_ms;
+    double record_time_input_age_ms;
+};
+
+/*  Writes input dependent constants (camera, cursor) into a persistently
+    mapped buffer right before vkQueueSubmit, once all recording is done,
+    instead of when the commands reading them are recorded.  The input the
+    GPU sees is then younger by the recording time.
+
+    Each frame in flight has its own slot, bind it with get_offset() as a
+    dynamic uniform buffer offset.  Host writes before vkQueueSubmit are
+    visible to the submitted work without a barrier. */
+class LateLatch
+{
+public:
+    /*  Called right before the submit with fresh input, to fill in the
+        frame's constants. */
+    typedef std::function<void(const sdl::InputState& input, void* constants)> Writer;
+
+    LateLatch(LogicalDevice& device, SDL_Window* window, VkDeviceSize constants_size, uint32_t frames_in_flight = 3);
+    ~LateLatch();
+
+    LateLatch(const LateLatch&) = delete;
+    LateLatch& operator=(const LateLatch&) = delete;
+
+    VkBuffer get_buffer() const;
+    VkDeviceSize get_constants_size() const;
+    VkDeviceSize get_offset(uint32_t frame_slot) const;
+
+    /*  Marks the start of recording for the latency statistics. */
+    void begin_recording();
+
+    /*  Samples input, lets writer fill the slot's constants, and submits
+        through the device's submit queue.  The frame's previous use of the
+        slot must have completed.  Returns the result of vkQueueSubmit. */
+    VkResult submit(uint32_t frame_slot, const Writer& writer, const VkSubmitInfo& submit_info, VkFence fence);
+
+    /*  The input latched for the last submit. */
+    const sdl::InputState& get_latched_input() const;
+
+    const LateLatchStatistics& get_statistics() const;
+
+private:
+    LogicalDevice& device;
+    SDL_Window* window;
+    VkDeviceSize constants_size;
+    VkDeviceSize slot_size;
+    uint32_t frames_in_flight;
+    VkBuffer buffer;
+    MemoryAllocation* allocation;
+    char* mapped;
+
+    uint64_t recording_start_ns;
+    sdl::InputState latched_input;
+    LateLatchStatistics statistics;
+};
+
+}
@@ -0,0 +1,232 @@
+#include "layouts.h"
+
+namespace vulkan
+{
+
+static const VkAccessFlags2KHR write_access =
+    VK_ACCESS_2_SHADER_WRITE_BIT_KHR
+    | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT_KHR
+    | VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT_KHR
+    | VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT_KHR
+    | VK_ACCESS_2_TRANSFER_WRITE_BIT_KHR
+    | VK_ACCESS_2_HOST_WRITE_BIT_KHR
+    | VK_ACCESS_2_MEMORY_WRITE_BIT_KHR;
+
+/*  A barrier on consecutive layers of one mip level that all start from
+    the same state.  Built up layer by layer, then added as one. */
+struct PendingBarrier
+{
+    bool active;
+    uint32_t base_layer;
+    uint32_t layer_count;
+    VkImageLayout old_layout;
+    VkPipelineStageFlags2KHR src_stages;
+    VkAccessFlags2KHR src_access;
+};
+
+static void add_pending(
+    BarrierBatch& barriers,
+    Image& image,
+    VkImageAspectFlags aspect,
+    uint32_t mip_level,
+    const ImageSubresourceState& to,
+    PendingBarrier& pending)
+{
+    if( !pending.active )
+    {
+        return;
+    }
+
+    VkImageSubresourceRange range;
+    range.aspectMask = aspect;
+    range.baseMipLevel = mip_level;
+    range.levelCount = 1;
+    range.baseArrayLayer = pending.base_layer;
+    range.layerCount = pending.layer_count;
+
+    barriers.add_image_barrier(image.get_image(), range, pending.old_layout, to.layout,
+        pending.src_stages, pending.src_access, to.stages, to.access);
+    pending.active = false;
+}
+
+/*  Adds the layer to the pending barrier, or flushes that and starts a new
+    one, if going from one state to the other needs a barrier.  Returns
+    false if it does not: a read after reads in the same layout. */
+static bool plan_barrier(
+    BarrierBatch& barriers,
+    Image& image,
+    VkImageAspectFlags aspect,
+    uint32_t mip_level,
+    uint32_t array_layer,
+    const ImageSubresourceState& from,
+    const ImageSubresourceState& to,
+    bool discard,
+    PendingBarrier& pending)
+{
+    if( from.layout == to.layout && !(from.access & write_access) && !(to.access & write_access) )
+    {
+        add_pending(barriers, image, aspect, mip_level, to, pending);
+        return false;
+    }
+
+    // Only a real layout change may discard; UNDEFINED -> X when the
+    // subresource already is in X would throw its contents away for nothing.
+    VkImageLayout old_layout = discard && from.layout != to.layout
+        ? VK_IMAGE_LAYOUT_UNDEFINED
+        : from.layout;
+
+    // Reads need only an execution dependency, writes must be made
+    // available.
+    VkAccessFlags2KHR src_access = from.access & write_access;
+
+    if( pending.active
+        && pending.base_layer + pending.layer_count == array_layer
+        && pending.old_layout == old_layout
+        && pending.src_stages == from.stages
+        && pending.src_access == src_access )
+    {
+        ++pending.layer_count;
+        return true;
+    }
+
+    add_pending(barriers, image, aspect, mip_level, to, pending);
+    pending.active = true;
+    pending.base_layer = array_layer;
+    pending.layer_count = 1;
+    pending.old_layout = old_layout;
+    pending.src_stages = from.stages;
+    pending.src_access = src_access;
+    return true;
+}
+
+void LayoutTracker::use(
+    Image& image,
+    const VkImageSubresourceRange& range,
+    VkImageLayout layout,
+    VkPipelineStageFlags2KHR stages,
+    VkAccessFlags2KHR access,
+    BarrierBatch& barriers,
+    bool discard)
+{
+    uint32_t array_layers = image.get_array_layers();
+    uint32_t level_count = range.levelCount == VK_REMAINING_MIP_LEVELS
+        ? image.get_mip_levels() - range.baseMipLevel : range.levelCount;
+    uint32_t layer_count = range.layerCount == VK_REMAINING_ARRAY_LAYERS
+        ? array_layers - range.baseArrayLayer : range.layerCount;
+
+    std::vector<Subresource>& subresources = images[&image];
+    if( subresources.empty() )
+    {
+        subresources.resize(image.get_mip_levels() * array_layers, Subresource());
+    }
+
+    ImageSubresourceState to = {layout, stages, access};
+
+    for( uint32_t mip = range.baseMipLevel; mip < range.baseMipLevel + level_count; ++mip )
+    {
+        PendingBarrier pending = {};
+        for( uint32_t layer = range.baseArrayLayer; layer < range.baseArrayLayer + layer_count; ++layer )
+        {
+            Subresource& subresource = subresources[mip * array_layers + layer];
+            if( !subresource.used )
+            {
+                // Left for resolve().
+                subresource.used = true;
+                subresource.ordered = false;
+                subresource.discard_first = discard;
+                subresource.first = to;
+                subresource.current = to;
+                add_pending(barriers, image, range.aspectMask, mip, to, pending);
+                continue;
+            }
+
+            if( plan_barrier(barriers, image, range.aspectMask, mip, layer,
+                subresource.current, to, discard, pending) )
+            {
+                subresource.current = to;
+                subresource.ordered = true;
+            }
+            else
+            {
+                subresource.current.stages |= stages;
+                subresource.current.access |= access;
+            }
+        }
+        add_pending(barriers, image, range.aspectMask, mip, to, pending);
+    }
+}
+
+void LayoutTracker::resolve(BarrierBatch& prelude)
+{
+    for( auto& entry : images )
+    {
+        Image& image = *entry.first;
+        std::vector<Subresource>& subresources = entry.second;
+        uint32_t mip_levels = image.get_mip_levels();
+        uint32_t array_layers = image.get_array_layers();
+        VkImageAspectFlags aspect = image.get_full_range().aspectMask;
+
+        std::lock_guard<std::mutex> lock(image.get_state_mutex());
+        std::vector<ImageSubresourceState>& states = image.get_states();
+
+        for( uint32_t mip = 0; mip < mip_levels; ++mip )
+        {
+            // Layers expecting different states end the run, so pending
+            // is flushed against the state of the layer that started it.
+            PendingBarrier pending = {};
+            ImageSubresourceState pending_to = {};
+            for( uint32_t layer = 0; layer < array_layers; ++layer )
+            {
+                uint32_t index = mip * array_layers + layer;
+                Subresource& subresource = subresources[index];
+                if( !subresource.used )
+                {
+                    add_pending(prelude, image, aspect, mip, pending_to, pending);
+                    continue;
+                }
+
+                const ImageSubresourceState& to = subresource.first;
+                if( pending.active
+                    && (pending_to.layout != to.layout
+                        || pending_to.stages != to.stages
+                        || pending_to.access != to.access) )
+                {
+                    add_pending(prelude, image, aspect, mip, pending_to, pending);
+                }
+
+                if( plan_barrier(prelude, image, aspect, mip, layer,
+                    states[index], to, subresource.discard_first, pending) )
+                {
+                    pending_to = to;
+                    states[index] = subresource.current;
+                }
+                else if( !subresource.ordered )
+                {
+                    // Only reads alongside the earlier reads, so a later
+                    // writer has to wait for all of them.
+                    states[index].stages |= subresource.current.stages;
+                    states[index].access |= subresource.current.access;
+                }
+                else
+                {
+                    // The command buffer's own barrier only waits for its
+                    // own reads, the earlier readers have to finish first.
+                    if( states[index].stages )
+                    {
+                        prelude.add_memory_barrier(states[index].stages, 0, to.stages, 0);
+                    }
+                    states[index] = subresource.current;
+                }
+            }
+            add_pending(prelude, image, aspect, mip, pending_to, pending);
+        }
+    }
+    reset();
+}
+
+void LayoutTracker::reset()
+{
+    images.clear();
+}
+
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include "vulkan.h"
+#include "image.h"
+#include "barriers.h"
+
+#include <map>
+#include <vector>
+
+namespace vulkan
+{
+
+/*  Tracks the layout and last accesses of every image subresource used by
+    one command buffer, so that barriers are only added where a layout
+    changes or a write has to be ordered, and only for the subresources
+    that need them.
+
+    A tracker belongs to one command buffer and is used by one thread at a
+    time, so recording takes no locks.  The first use of each subresource
+    cannot know what earlier command buffers will have done to it by the
+    time this one runs, so that barrier is left for resolve(), which is
+    called when the command buffer is submitted. */
+class LayoutTracker
+{
+public:
+    /*  Makes the range usable in the given layout by the given stages and
+        accesses.  With discard set, the current contents are not needed and
+        a layout change may start from UNDEFINED. */
+    void use(
+        Image& image,
+        const VkImageSubresourceRange& range,
+        VkImageLayout layout,
+        VkPipelineStageFlags2KHR stages,
+        VkAccessFlags2KHR access,
+        BarrierBatch& barriers,
+        bool discard = false);
+
+    /*  Merges into the images at submit time.  Adds to prelude the barriers
+        that bring each subresource from the state left by earlier submits
+        to the one this command buffer starts with, and publishes the state
+        it ends with.  Reads in the layout earlier submits left need no
+        barrier and are published together with the earlier accesses, so
+        that a later writer waits for both.  Record prelude into a command
+        buffer submitted right before this one, and resolve trackers in
+        submission order. */
+    void resolve(BarrierBatch& prelude);
+
+    void reset();
+
+private:
+    struct Subresource
+    {
+        bool used;
+        bool ordered;           // a barrier in the command buffer came after the first use
+        bool discard_first;
+        ImageSubresourceState first;
+        ImageSubresourceState current;
+    };
+
+    std::map<Image*, std::vector<Subresource>> images;
+};
+
+}
@@ -0,0 +1,307 @@
+#include "limiter.h"
+#include "queue.h"
+#include "recycling.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <thread>
+
+namespace vulkan
+{
+
+// Started this much before the latest estimated start time, to absorb
+// jitter in the frame time.
+static const double start_margin_ms = 1.0;
+
+// Intervals between displayed frames longer than this are hitches or
+// pauses, not the refresh rate.
+static const double max_display_interval_ms = 100.0;
+
+PresentPacer::PresentPacer(uint32_t max_queued_frames, const WaitFunction& wait, const Clock& clock)
+    : max_queued_frames(max_queued_frames)
+    , wait(wait)
+    , clock(clock)
+    , display_interval_ms(0.0)
+    , frame_to_display_ms(0.0)
+{
+}
+
+void PresentPacer::add_present(uint64_t present_id, std::chrono::steady_clock::time_point begun)
+{
+    Present present;
+    present.present_id = present_id;
+    present.begun = begun;
+    queued.push_back(present);
+}
+
+void PresentPacer::reset()
+{
+    queued.clear();
+    last_displayed = std::chrono::steady_clock::time_point();
+}
+
+uint32_t PresentPacer::wait_for_presents()
+{
+    // Waiting on the oldest present with and without a timeout: first to
+    // count what is already on screen, then to block.
+    uint32_t queue_depth = 0;
+    bool measured = false;
+    while( !queued.empty() )
+    {
+        if( measured && queued.size() <= max_queued_frames )
+        {
+            break;
+        }
+
+        VkResult result = wait(queued.front().present_id, measured ? UINT64_MAX : 0);
+
+        if( result == VK_SUCCESS || result == VK_SUBOPTIMAL_KHR )
+        {
+            on_displayed(queued.front());
+            queued.pop_front();
+            continue;
+        }
+
+        if( result == VK_TIMEOUT )
+        {
+            if( !measured )
+            {
+                queue_depth = static_cast<uint32_t>(queued.size());
+                measured = true;
+            }
+            // Not on screen yet, but still queued: dropping it would let
+            // the CPU run ahead of the frames that are.
+            continue;
+        }
+
+        if( result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_ERROR_SURFACE_LOST_KHR )
+        {
+            queued.clear();
+            break;
+        }
+
+        throw VulkanException(result, "Error while waiting for present");
+    }
+    return queue_depth;
+}
+
+double PresentPacer::get_start_delay_ms() const
+{
+    if( display_interval_ms <= 0.0 || frame_to_display_ms <= 0.0
+        || last_displayed == std::chrono::steady_clock::time_point() )
+    {
+        return 0.0;
+    }
+
+    double since_displayed = std::chrono::duration<double, std::milli>(clock() - last_displayed).count();
+
+    // The new frame is displayed after the ones still queued, on the
+    // first vblank it can make.
+    double vblank = display_interval_ms * (queued.size() + 1);
+    while( vblank < since_displayed + frame_to_display_ms )
+    {
+        vblank += display_interval_ms;
+    }
+
+    return std::max(vblank - frame_to_display_ms - start_margin_ms - since_displayed, 0.0);
+}
+
+double PresentPacer::get_display_interval_ms() const
+{
+    return display_interval_ms;
+}
+
+double PresentPacer::get_frame_to_display_ms() const
+{
+    return frame_to_display_ms;
+}
+
+size_t PresentPacer::get_queued_count() const
+{
+    return queued.size();
+}
+
+void PresentPacer::on_displayed(const Present& present)
+{
+    std::chrono::steady_clock::time_point now = clock();
+    if( last_displayed != std::chrono::steady_clock::time_point() )
+    {
+        double interval = std::chrono::duration<double, std::milli>(now - last_displayed).count();
+        if( interval < max_display_interval_ms )
+        {
+            display_interval_ms = display_interval_ms > 0.0
+                ? display_interval_ms + 0.1 * (interval - display_interval_ms)
+                : interval;
+        }
+    }
+    last_displayed = now;
+
+    // Rises at once and falls slowly: a frame that missed its vblank
+    // pulls the next starts earlier right away.
+    double frame_to_display = std::chrono::duration<double, std::milli>(now - present.begun).count();
+    frame_to_display_ms = frame_to_display > frame_to_display_ms
+        ? frame_to_display
+        : frame_to_display_ms + 0.05 * (frame_to_display - frame_to_display_ms);
+}
+
+LatencyLimiter::LatencyLimiter(LogicalDevice& device, VkSwapchainKHR swapchain, uint32_t max_queued_frames)
+    : device(device)
+    , swapchain(swapchain)
+    , max_queued_frames(max_queued_frames)
+    , mode(LatencyMode::FENCE)
+    , next_present_id(1)
+    , present_id(0)
+    , frame_begun(std::chrono::steady_clock::now())
+    , pacer(max_queued_frames, [this](uint64_t id, uint64_t timeout_ns)
+        {
+            return this->device.get_functions().wait_for_present(
+                this->device.get_device(), this->swapchain, id, timeout_ns);
+        })
+    , queue_depth(0)
+    , frames(0)
+    , total_queue_depth(0.0)
+    , last_wait_ms(0.0)
+{
+    const DeviceFeatures& features = device.get_enabled_features();
+    if( features.present_id && features.present_wait && device.get_functions().wait_for_present )
+    {
+        mode = LatencyMode::PRESENT_WAIT;
+    }
+}
+
+LatencyLimiter::~LatencyLimiter()
+{
+    // The fences go back to the pool, which hands out unsignaled ones
+    // only after they were reset, but they must not be pending any more.
+    for( VkFence fence : pending_fences )
+    {
+        vkWaitForFences(device.get_device(), 1, &fence, VK_TRUE, UINT64_MAX);
+        device.get_fence_pool().release(fence);
+    }
+}
+
+void LatencyLimiter::set_swapchain(VkSwapchainKHR swapchain)
+{
+    this->swapchain = swapchain;
+    if( mode == LatencyMode::PRESENT_WAIT )
+    {
+        pacer.reset();
+    }
+}
+
+void LatencyLimiter::begin_frame()
+{
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    if( mode == LatencyMode::PRESENT_WAIT )
+    {
+        wait_for_presents();
+
+        double delay_ms = pacer.get_start_delay_ms();
+        if( delay_ms > 0.0 )
+        {
+            std::this_thread::sleep_for(std::chrono::duration<double, std::milli>(delay_ms));
+        }
+    }
+    else
+    {
+        wait_for_fences();
+    }
+
+    frame_begun = std::chrono::steady_clock::now();
+    last_wait_ms = std::chrono::duration<double, std::milli>(frame_begun - start).count();
+}
+
+void LatencyLimiter::end_frame(VkPresentInfoKHR& present_info)
+{
+    if( mode == LatencyMode::PRESENT_WAIT )
+    {
+        if( present_info.swapchainCount != 1 )
+        {
+            throw std::invalid_argument("Latency limiter needs a present of its swapchain only");
+        }
+
+        present_id = next_present_id++;
+
+        // A present_info reused from the last frame is chained already.
+        if( present_info.pNext != &present_id_info )
+        {
+            present_id_info.sType = VK_STRUCTURE_TYPE_PRESENT_ID_KHR;
+            present_id_info.pNext = present_info.pNext;
+            present_id_info.swapchainCount = 1;
+            present_id_info.pPresentIds = &present_id;
+            present_info.pNext = &present_id_info;
+        }
+
+        pacer.add_present(present_id, frame_begun);
+    }
+    else
+    {
+        // An empty submit signals once all work submitted before it is done.
+        VkFence fence = device.get_fence_pool().acquire();
+
+        VkSubmitInfo submit_info = {};
+        submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+
+        VkResult result = device.get_submit_queue().submit(submit_info, fence);
+        if( result != VK_SUCCESS )
+        {
+            device.get_fence_pool().release(fence);
+            throw VulkanException(result, "Error while submitting latency limiter fence");
+        }
+        pending_fences.push_back(fence);
+    }
+}
+
+LatencyMode LatencyLimiter::get_mode() const
+{
+    return mode;
+}
+
+uint32_t LatencyLimiter::get_queue_depth() const
+{
+    return queue_depth;
+}
+
+double LatencyLimiter::get_average_queue_depth() const
+{
+    return frames > 0 ? total_queue_depth / frames : 0.0;
+}
+
+double LatencyLimiter::get_last_wait_ms() const
+{
+    return last_wait_ms;
+}
+
+void LatencyLimiter::wait_for_presents()
+{
+    queue_depth = pacer.wait_for_presents();
+    frames++;
+    total_queue_depth += queue_depth;
+}
+
+void LatencyLimiter::wait_for_fences()
+{
+    while( !pending_fences.empty() && vkGetFenceStatus(device.get_device(), pending_fences.front()) == VK_SUCCESS )
+    {
+        device.get_fence_pool().release(pending_fences.front());
+        pending_fences.pop_front();
+    }
+
+    queue_depth = static_cast<uint32_t>(pending_fences.size());
+    frames++;
+    total_queue_depth += queue_depth;
+
+    while( pending_fences.size() > max_queued_frames )
+    {
+        VkResult result = vkWaitForFences(device.get_device(), 1, &pending_fences.front(), VK_TRUE, UINT64_MAX);
+        if( result != VK_SUCCESS )
+        {
+            throw VulkanException(result, "Error while waiting for latency limiter fence");
+        }
+        device.get_fence_pool().release(pending_fences.front());
+        pending_fences.pop_front();
+    }
+}
+
+}
@@ -0,0 +1,137 @@
+#pragma once
+
+#include "vulkan.h"
+
+#include <chrono>
+#include <deque>
+#include <functional>
+
+namespace vulkan
+{
+
+enum class LatencyMode
+{
+    PRESENT_WAIT,   // VK_KHR_present_id + VK_KHR_present_wait
+    FENCE           // waits for the GPU to finish earlier frames
+};
+
+/*  The present wait half of a LatencyLimiter, apart from the device: the
+    presents not yet on screen, the display interval and the time from
+    frame start to display estimated from them, and how long to hold back
+    the next frame.  wait stands in for vkWaitForPresentKHR on the
+    limiter's swapchain, and clock for the time. */
+class PresentPacer
+{
+public:
+    typedef std::function<VkResult(uint64_t present_id, uint64_t timeout_ns)> WaitFunction;
+    typedef std::function<std::chrono::steady_clock::time_point()> Clock;
+
+    PresentPacer(uint32_t max_queued_frames, const WaitFunction& wait,
+        const Clock& clock = std::chrono::steady_clock::now);
+
+    /*  The frame begun at begun was presented with present_id. */
+    void add_present(uint64_t present_id, std::chrono::steady_clock::time_point begun);
+
+    /*  Forgets the presents, for a recreated swapchain. */
+    void reset();
+
+    /*  Blocks until at most max_queued_frames presents are not yet on
+        screen, and returns how many were not when called.  A present
+        that is slow to show, as while the window is minimized, stays
+        queued; only an out of date or lost surface drops them all. */
+    uint32_t wait_for_presents();
+
+    /*  How long to wait before starting the next frame for it to be
+        displayed on the first vblank it can make.  0 until there are
+        estimates. */
+    double get_start_delay_ms() const;
+
+    double get_display_interval_ms() const;
+    double get_frame_to_display_ms() const;
+    size_t get_queued_count() const;
+
+private:
+    struct Present
+    {
+        uint64_t present_id;
+        std::chrono::steady_clock::time_point begun;
+    };
+
+    void on_displayed(const Present& present);
+
+    uint32_t max_queued_frames;
+    WaitFunction wait;
+    Clock clock;
+    std::deque<Present> queued;
+
+    std::chrono::steady_clock::time_point last_displayed;
+    double display_interval_ms;
+    double frame_to_display_ms;
+};
+
+/*  Keeps the CPU from running ahead of the display, so that input sampled
+    at the start of a frame is shown as early as possible.
+
+    With present wait, begin_frame() blocks until all but max_queued_frames
+    of the frames presented so far are on screen, then sleeps until the
+    latest time the next frame can start and still make the following
+    vblank, as estimated from how long earlier frames took from
+    begin_frame() to being displayed.  Without it, it blocks on fences
+    submitted after each frame's work, which keeps the queue short but
+    cannot see the display.
+
+    Call begin_frame() before sampling input, and end_frame() after
+    submitting the frame's work and before vkQueuePresentKHR. */
+class LatencyLimiter
+{
+public:
+    LatencyLimiter(LogicalDevice& device, VkSwapchainKHR swapchain, uint32_t max_queued_frames = 1);
+    ~LatencyLimiter();
+
+    LatencyLimiter(const LatencyLimiter&) = delete;
+    LatencyLimiter& operator=(const LatencyLimiter&) = delete;
+
+    /*  For a recreated swapchain.  Presents of the old one are forgotten. */
+    void set_swapchain(VkSwapchainKHR swapchain);
+
+    void begin_frame();
+
+    /*  Chains the frame's present id into present_info, which has to
+        present the limiter's swapchain only, or submits the fence the
+        next frames wait for. */
+    void end_frame(VkPresentInfoKHR& present_info);
+
+    LatencyMode get_mode() const;
+
+    /*  Frames submitted or presented but not yet on screen (or, with
+        fences, not yet finished) when the last frame began, and the
+        average over all frames. */
+    uint32_t get_queue_depth() const;
+    double get_average_queue_depth() const;
+
+    /*  Time begin_frame() last spent blocked and sleeping. */
+    double get_last_wait_ms() const;
+
+private:
+    void wait_for_presents();
+    void wait_for_fences();
+
+    LogicalDevice& device;
+    VkSwapchainKHR swapchain;
+    uint32_t max_queued_frames;
+    LatencyMode mode;
+
+    uint64_t next_present_id;
+    VkPresentIdKHR present_id_info;
+    uint64_t present_id;
+    std::chrono::steady_clock::time_point frame_begun;
+    PresentPacer pacer;
+    std::deque<VkFence> pending_fences;
+
+    uint32_t queue_depth;
+    uint64_t frames;
+    double total_queue_depth;
+    double last_wait_ms;
+};
+
+}
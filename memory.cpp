@@ -0,0 +1,262 @@
+#include "memory.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace vulkan
+{
+
+DeviceHeapBudgetSource::DeviceHeapBudgetSource(
+    VkPhysicalDevice physical_device,
+    bool memory_budget_enabled
+)
+: physical_device(physical_device)
+, memory_budget_enabled(memory_budget_enabled)
+{
+}
+
+std::vector<HeapBudget> DeviceHeapBudgetSource::get_heap_budgets()
+{
+    VkPhysicalDeviceMemoryBudgetPropertiesEXT budget_properties = {};
+    budget_properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT;
+    budget_properties.pNext = nullptr;
+
+    VkPhysicalDeviceMemoryProperties2 memory_properties = {};
+    memory_properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2;
+    memory_properties.pNext = &budget_properties;
+
+    if( memory_budget_enabled )
+    {
+        vkGetPhysicalDeviceMemoryProperties2(physical_device, &memory_properties);
+    }
+    else
+    {
+        vkGetPhysicalDeviceMemoryProperties(physical_device, &memory_properties.memoryProperties);
+    }
+
+    std::vector<HeapBudget> budgets;
+    for( uint32_t i = 0; i < memory_properties.memoryProperties.memoryHeapCount; ++i )
+    {
+        HeapBudget budget;
+        budget.size = memory_properties.memoryProperties.memoryHeaps[i].size;
+        if( memory_budget_enabled )
+        {
+            budget.budget = budget_properties.heapBudget[i];
+            budget.usage = budget_properties.heapUsage[i];
+        }
+        else
+        {
+            budget.budget = budget.size / 10 * 8;
+            budget.usage = 0;
+        }
+        budgets.push_back(budget);
+    }
+
+    return budgets;
+}
+
+MemoryGovernor::MemoryGovernor(std::unique_ptr<IHeapBudgetSource> source)
+    : source(std::move(source))
+    , soft_limit_fraction(0.9f)
+    , deferred_count(0)
+    , denied_count(0)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    refresh_locked();
+}
+
+void MemoryGovernor::refresh_locked()
+{
+    std::vector<HeapBudget> budgets = source->get_heap_budgets();
+    heaps.resize(budgets.size(), HeapState{HeapBudget{0, 0, 0}, 0, 0, 0});
+    for( size_t i = 0; i < budgets.size(); ++i )
+    {
+        heaps[i].reported = budgets[i];
+        heaps[i].tracked_at_refresh = heaps[i].tracked;
+    }
+}
+
+void MemoryGovernor::refresh_budgets()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    refresh_locked();
+}
+
+VkDeviceSize MemoryGovernor::estimated_usage(const HeapState& heap) const
+{
+    // The reported usage goes stale as we allocate, so correct it by what
+    // we have allocated since.  Without VK_EXT_memory_budget the reported
+    // usage is zero and our own tracking is all there is.
+    VkDeviceSize corrected = heap.reported.usage;
+    if( heap.tracked >= heap.tracked_at_refresh )
+    {
+        corrected += heap.tracked - heap.tracked_at_refresh;
+    }
+    else
+    {
+        VkDeviceSize freed = heap.tracked_at_refresh - heap.tracked;
+        corrected = corrected > freed ? corrected - freed : 0;
+    }
+    return std::max(corrected, heap.tracked) + heap.reserved;
+}
+
+VkDeviceSize MemoryGovernor::soft_limit(const HeapState& heap) const
+{
+    return static_cast<VkDeviceSize>(heap.reported.budget * soft_limit_fraction);
+}
+
+Admission MemoryGovernor::admit(uint32_t heap_index, VkDeviceSize size, AllocationPriority priority)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    if( heap_index >= heaps.size() )
+    {
+        throw std::out_of_range("Memory heap index out of range");
+    }
+
+    if( estimated_usage(heaps[heap_index]) + size <= soft_limit(heaps[heap_index]) )
+    {
+        heaps[heap_index].reserved += size;
+        return Admission::ADMITTED;
+    }
+
+    // Near the limit the estimate matters, so get fresh numbers before
+    // acting on it.
+    refresh_locked();
+    VkDeviceSize usage = estimated_usage(heaps[heap_index]);
+    if( usage + size <= soft_limit(heaps[heap_index]) )
+    {
+        heaps[heap_index].reserved += size;
+        return Admission::ADMITTED;
+    }
+
+    if( priority == AllocationPriority::DEFERRABLE )
+    {
+        deferred_count++;
+        return Admission::DEFERRED;
+    }
+
+    VkDeviceSize excess = usage + size - soft_limit(heaps[heap_index]);
+    relieve_unlocked(lock, heap_index, excess);
+
+    usage = estimated_usage(heaps[heap_index]);
+    if( usage + size <= heaps[heap_index].reported.budget
+        || priority == AllocationPriority::CRITICAL )
+    {
+        heaps[heap_index].reserved += size;
+        return Admission::ADMITTED;
+    }
+
+    denied_count++;
+    return Admission::DENIED;
+}
+
+VkDeviceSize MemoryGovernor::relieve_pressure(uint32_t heap_index, VkDeviceSize size)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    return relieve_unlocked(lock, heap_index, size);
+}
+
+VkDeviceSize MemoryGovernor::relieve_unlocked(
+    std::unique_lock<std::mutex>& lock, uint32_t heap_index, VkDeviceSize size)
+{
+    // Responders free memory through on_freed(), so the lock has to be
+    // released while they run.  The responder lock keeps them registered,
+    // and alive, until they are done.
+    lock.unlock();
+    VkDeviceSize freed = 0;
+    {
+        std::unique_lock<std::mutex> responder_lock(responder_mutex);
+        std::vector<Responder> ordered = responders;
+        std::stable_sort(ordered.begin(), ordered.end(),
+            [](const Responder& a, const Responder& b) { return a.stage < b.stage; });
+
+        for( const Responder& r : ordered )
+        {
+            if( freed >= size )
+            {
+                break;
+            }
+            freed += r.responder->relieve_pressure(heap_index, size - freed);
+        }
+    }
+    lock.lock();
+
+    return freed;
+}
+
+void MemoryGovernor::on_allocated(uint32_t heap_index, VkDeviceSize size)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    HeapState& heap = heaps.at(heap_index);
+    heap.reserved -= std::min(heap.reserved, size);
+    heap.tracked += size;
+}
+
+void MemoryGovernor::cancel_admission(uint32_t heap_index, VkDeviceSize size)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    HeapState& heap = heaps.at(heap_index);
+    heap.reserved -= std::min(heap.reserved, size);
+}
+
+void MemoryGovernor::on_freed(uint32_t heap_index, VkDeviceSize size)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    HeapState& heap = heaps.at(heap_index);
+    heap.tracked = heap.tracked > size ? heap.tracked - size : 0;
+}
+
+std::vector<HeapBudget> MemoryGovernor::get_budgets()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    std::vector<HeapBudget> budgets;
+    for( const HeapState& heap : heaps )
+    {
+        HeapBudget budget = heap.reported;
+        budget.usage = estimated_usage(heap);
+        budgets.push_back(budget);
+    }
+    return budgets;
+}
+
+VkDeviceSize MemoryGovernor::get_available(uint32_t heap_index)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    const HeapState& heap = heaps.at(heap_index);
+    VkDeviceSize usage = estimated_usage(heap);
+    VkDeviceSize limit = soft_limit(heap);
+    return usage < limit ? limit - usage : 0;
+}
+
+void MemoryGovernor::set_soft_limit(float fraction)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    soft_limit_fraction = fraction;
+}
+
+void MemoryGovernor::add_responder(PressureStage stage, IMemoryPressureResponder* responder)
+{
+    std::unique_lock<std::mutex> lock(responder_mutex);
+    responders.push_back(Responder{stage, responder});
+}
+
+void MemoryGovernor::remove_responder(IMemoryPressureResponder* responder)
+{
+    std::unique_lock<std::mutex> lock(responder_mutex);
+    responders.erase(
+        std::remove_if(responders.begin(), responders.end(),
+            [responder](const Responder& r) { return r.responder == responder; }),
+        responders.end());
+}
+
+uint32_t MemoryGovernor::get_deferred_count() const
+{
+    return deferred_count;
+}
+
+uint32_t MemoryGovernor::get_denied_count() const
+{
+    return denied_count;
+}
+
+}
@@ -0,0 +1,166 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace vulkan
+{
+
+/*  Snapshot of one memory heap.  size is the physical size of the heap,
+    budget is how much of it this process can reasonably use and usage is
+    how much of it this process is using at the time of the snapshot. */
+struct HeapBudget
+{
+    VkDeviceSize size;
+    VkDeviceSize budget;
+    VkDeviceSize usage;
+};
+
+/*  Subclass this to supply heap budgets to a MemoryGovernor.  The device
+    implementation below asks the driver, a test can substitute fake heaps
+    and drive the governor under synthetic pressure. */
+class IHeapBudgetSource
+{
+public:
+    virtual ~IHeapBudgetSource() {}
+    virtual std::vector<HeapBudget> get_heap_budgets() = 0;
+};
+
+/*  Reads budgets from VK_EXT_memory_budget when it was enabled on the
+    device.  Otherwise reports 80% of each heap as the budget and leaves
+    usage at zero, so the governor falls back on its own tracking. */
+class DeviceHeapBudgetSource : public IHeapBudgetSource
+{
+public:
+    DeviceHeapBudgetSource(VkPhysicalDevice physical_device, bool memory_budget_enabled);
+
+    virtual std::vector<HeapBudget> get_heap_budgets();
+
+private:
+    VkPhysicalDevice physical_device;
+    bool memory_budget_enabled;
+};
+
+/*  How badly an allocation is needed.  Critical allocations are attempted
+    even over budget, normal ones fail if the budget cannot be made room
+    for, deferrable ones (streamed textures, see TextureStreamer) are
+    postponed instead of putting pressure on the heap. */
+enum class AllocationPriority
+{
+    CRITICAL,
+    NORMAL,
+    DEFERRABLE,
+};
+
+enum class Admission
+{
+    ADMITTED,
+    DEFERRED,
+    DENIED,
+};
+
+/*  Order in which responders are asked to give memory back.  Dropping
+    cached data is cheapest, lowering texture quality comes next. */
+enum class PressureStage
+{
+    EVICT_CACHES,
+    DOWNGRADE_MIPS,
+};
+
+/*  Subclass this in a subsystem that holds device memory it can give up
+    (caches, high-resolution mips).  relieve_pressure should free what it
+    can on the given heap, up to bytes_needed, and return how much it freed.
+    It may be called from any thread, and must not allocate device memory
+    or add or remove responders. */
+class IMemoryPressureResponder
+{
+public:
+    virtual ~IMemoryPressureResponder() {}
+    virtual VkDeviceSize relieve_pressure(uint32_t heap_index, VkDeviceSize bytes_needed) = 0;
+};
+
+/*  Tracks per-heap usage of device memory and decides whether a new
+    allocation should go ahead.  Before a heap runs over budget it asks the
+    registered responders to free memory, so allocations fail in the
+    governor rather than with VK_ERROR_OUT_OF_DEVICE_MEMORY from the driver. */
+class MemoryGovernor
+{
+public:
+    explicit MemoryGovernor(std::unique_ptr<IHeapBudgetSource> source);
+
+    /*  Requests room for size bytes on the heap.  On ADMITTED the bytes are
+        reserved, so that concurrent requests do not count on the same
+        headroom, and the caller goes ahead with the allocation and reports
+        it with on_allocated(), or with cancel_admission() if it failed. */
+    Admission admit(uint32_t heap_index, VkDeviceSize size, AllocationPriority priority);
+
+    void on_allocated(uint32_t heap_index, VkDeviceSize size);
+    void cancel_admission(uint32_t heap_index, VkDeviceSize size);
+    void on_freed(uint32_t heap_index, VkDeviceSize size);
+
+    /*  Asks the responders to free at least size bytes on the heap regardless
+        of budget.  Used when the driver reports out of memory anyway. */
+    VkDeviceSize relieve_pressure(uint32_t heap_index, VkDeviceSize size);
+
+    /*  Re-reads budgets from the source.  Call once per frame, the governor
+        also refreshes on its own when a heap nears its budget. */
+    void refresh_budgets();
+
+    std::vector<HeapBudget> get_budgets();
+
+    /*  Bytes that can still be allocated on the heap before reaching the
+        soft limit. */
+    VkDeviceSize get_available(uint32_t heap_index);
+
+    /*  Fraction of the budget above which non-critical allocations trigger
+        responders.  Defaults to 0.9. */
+    void set_soft_limit(float fraction);
+
+    void add_responder(PressureStage stage, IMemoryPressureResponder* responder);
+
+    /*  Waits for relief in progress on other threads, so the responder can
+        be destroyed once this returns. */
+    void remove_responder(IMemoryPressureResponder* responder);
+
+    uint32_t get_deferred_count() const;
+    uint32_t get_denied_count() const;
+
+private:
+    struct HeapState
+    {
+        HeapBudget reported;
+        VkDeviceSize tracked;
+        VkDeviceSize tracked_at_refresh;
+        VkDeviceSize reserved;
+    };
+
+    struct Responder
+    {
+        PressureStage stage;
+        IMemoryPressureResponder* responder;
+    };
+
+    void refresh_locked();
+    VkDeviceSize estimated_usage(const HeapState& heap) const;
+    VkDeviceSize soft_limit(const HeapState& heap) const;
+    VkDeviceSize relieve_unlocked(
+        std::unique_lock<std::mutex>& lock, uint32_t heap_index, VkDeviceSize size);
+
+    std::unique_ptr<IHeapBudgetSource> source;
+    std::vector<HeapState> heaps;
+    float soft_limit_fraction;
+    std::atomic<uint32_t> deferred_count;
+    std::atomic<uint32_t> denied_count;
+    std::mutex mutex;
+
+    // Held while responders run, apart from the mutex above as they free
+    // memory through on_freed().
+    std::vector<Responder> responders;
+    std::mutex responder_mutex;
+};
+
+}
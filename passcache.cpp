@@ -0,0 +1,283 @@
+#include "passcache.h"
+#include "buffer.h"
+#include "image.h"
+
+#include <chrono>
+
+namespace vulkan
+{
+
+PassKey::PassKey()
+    : hash(fnv_offset_basis)
+{
+}
+
+void PassKey::add_buffer(const Buffer& buffer)
+{
+    add_resource(buffer.get_buffer());
+    add(buffer.get_generation());
+}
+
+void PassKey::add_image(const Image& image)
+{
+    add_resource(image.get_image());
+    add(image.get_generation());
+}
+
+void PassKey::add(uint64_t value)
+{
+    add_data(&value, sizeof(value));
+}
+
+void PassKey::add_data(const void* data, size_t size)
+{
+    hash = fnv1a(data, size, hash);
+}
+
+uint64_t PassKey::get_hash() const
+{
+    return hash;
+}
+
+const std::vector<uint64_t>& PassKey::get_resources() const
+{
+    return resources;
+}
+
+PassRecordings::PassRecordings(uint32_t frames_in_flight)
+    : frames_in_flight(frames_in_flight)
+    , frame(0)
+{
+    statistics = PassCacheStatistics();
+}
+
+std::vector<VkCommandBuffer> PassRecordings::begin_frame()
+{
+    ++frame;
+
+    std::vector<VkCommandBuffer> done;
+    for( size_t i = 0; i < retired.size(); )
+    {
+        if( frame - retired[i].frame > frames_in_flight )
+        {
+            done.push_back(retired[i].command_buffer);
+            retired[i] = retired.back();
+            retired.pop_back();
+            continue;
+        }
+        ++i;
+    }
+    return done;
+}
+
+VkCommandBuffer PassRecordings::find(const std::string& pass, uint64_t hash)
+{
+    auto found = entries.find(pass);
+    if( found != entries.end() )
+    {
+        if( found->second.hash == hash )
+        {
+            statistics.hits++;
+            statistics.saved_ms += found->second.recording_ms;
+            return found->second.command_buffer;
+        }
+        retire(found->second);
+        entries.erase(found);
+    }
+
+    statistics.misses++;
+    return VK_NULL_HANDLE;
+}
+
+void PassRecordings::add(const std::string& pass, uint64_t hash, const std::vector<uint64_t>& resources,
+    VkCommandBuffer command_buffer, double recording_ms)
+{
+    Entry entry;
+    entry.hash = hash;
+    entry.resources = resources;
+    entry.command_buffer = command_buffer;
+    entry.recording_ms = recording_ms;
+    statistics.recording_ms += recording_ms;
+
+    entries[pass] = entry;
+}
+
+void PassRecordings::invalidate_resource(uint64_t resource)
+{
+    for( auto it = entries.begin(); it != entries.end(); )
+    {
+        const std::vector<uint64_t>& resources = it->second.resources;
+        if( std::find(resources.begin(), resources.end(), resource) != resources.end() )
+        {
+            statistics.invalidations++;
+            retire(it->second);
+            it = entries.erase(it);
+            continue;
+        }
+        ++it;
+    }
+}
+
+void PassRecordings::clear()
+{
+    for( auto& entry : entries )
+    {
+        retire(entry.second);
+    }
+    statistics.invalidations += entries.size();
+    entries.clear();
+}
+
+const PassCacheStatistics& PassRecordings::get_statistics() const
+{
+    return statistics;
+}
+
+double PassRecordings::get_reuse_rate() const
+{
+    uint64_t requests = statistics.hits + statistics.misses;
+    return requests > 0 ? static_cast<double>(statistics.hits) / requests : 0.0;
+}
+
+void PassRecordings::retire(Entry& entry)
+{
+    Retired old;
+    old.command_buffer = entry.command_buffer;
+    old.frame = frame;
+    retired.push_back(old);
+}
+
+PassCache::PassCache(LogicalDevice& device, uint32_t frames_in_flight)
+    : device(device)
+    , recordings(frames_in_flight)
+{
+    VkCommandPoolCreateInfo pool_info;
+    pool_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    pool_info.pNext = nullptr;
+    pool_info.flags = 0;
+    pool_info.queueFamilyIndex = device.get_queue_family_index();
+
+    VkResult result = vkCreateCommandPool(device.get_device(), &pool_info,
+        device.get_allocation_callbacks(), &command_pool);
+    if( result != VK_SUCCESS )
+    {
+        throw VulkanException(result, "Error while creating pass cache command pool");
+    }
+}
+
+PassCache::~PassCache()
+{
+    vkDestroyCommandPool(device.get_device(), command_pool, device.get_allocation_callbacks());
+}
+
+void PassCache::begin_frame()
+{
+    std::vector<VkCommandBuffer> done = recordings.begin_frame();
+    if( !done.empty() )
+    {
+        vkFreeCommandBuffers(device.get_device(), command_pool, static_cast<uint32_t>(done.size()), done.data());
+    }
+}
+
+VkCommandBuffer PassCache::get(
+    const std::string& pass,
+    const PassKey& key,
+    const VkCommandBufferInheritanceInfo& inheritance,
+    const std::function<void(VkCommandBuffer)>& record)
+{
+    // Secondary command buffers are only valid in the render pass and
+    // subpass they were recorded for.
+    PassKey full_key = key;
+    full_key.add(get_handle_value(inheritance.renderPass));
+    full_key.add(inheritance.subpass);
+    full_key.add(get_handle_value(inheritance.framebuffer));
+    full_key.add(inheritance.occlusionQueryEnable);
+    full_key.add(inheritance.queryFlags);
+    full_key.add(inheritance.pipelineStatistics);
+
+    VkCommandBuffer cached = recordings.find(pass, full_key.get_hash());
+    if( cached != VK_NULL_HANDLE )
+    {
+        return cached;
+    }
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    VkCommandBufferAllocateInfo allocate_info;
+    allocate_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    allocate_info.pNext = nullptr;
+    allocate_info.commandPool = command_pool;
+    allocate_info.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+    allocate_info.commandBufferCount = 1;
+
+    VkCommandBuffer command_buffer;
+    VkResult result = vkAllocateCommandBuffers(device.get_device(), &allocate_info, &command_buffer);
+    if( result != VK_SUCCESS )
+    {
+        throw VulkanException(result, "Error while allocating cached pass command buffer");
+    }
+
+    VkCommandBufferBeginInfo begin_info;
+    begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    begin_info.pNext = nullptr;
+    begin_info.flags = VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT;
+    if( inheritance.renderPass != VK_NULL_HANDLE )
+    {
+        begin_info.flags |= VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+    }
+    begin_info.pInheritanceInfo = &inheritance;
+
+    result = vkBeginCommandBuffer(command_buffer, &begin_info);
+    if( result != VK_SUCCESS )
+    {
+        vkFreeCommandBuffers(device.get_device(), command_pool, 1, &command_buffer);
+        throw VulkanException(result, "Error while beginning cached pass command buffer");
+    }
+
+    // The command buffer was never submitted, it can go right away.  The
+    // pass's old recording is already retired, so the pass is left with
+    // none and the next get() records it again.
+    try
+    {
+        record(command_buffer);
+    }
+    catch(...)
+    {
+        vkFreeCommandBuffers(device.get_device(), command_pool, 1, &command_buffer);
+        throw;
+    }
+
+    result = vkEndCommandBuffer(command_buffer);
+    if( result != VK_SUCCESS )
+    {
+        vkFreeCommandBuffers(device.get_device(), command_pool, 1, &command_buffer);
+        throw VulkanException(result, "Error while ending cached pass command buffer");
+    }
+
+    double recording_ms = std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now() - start).count();
+    recordings.add(pass, full_key.get_hash(), key.get_resources(), command_buffer, recording_ms);
+    return command_buffer;
+}
+
+void PassCache::invalidate_resource(uint64_t resource)
+{
+    recordings.invalidate_resource(resource);
+}
+
+void PassCache::clear()
+{
+    recordings.clear();
+}
+
+const PassCacheStatistics& PassCache::get_statistics() const
+{
+    return recordings.get_statistics();
+}
+
+double PassCache::get_reuse_rate() const
+{
+    return recordings.get_reuse_rate();
+}
+
+}
@@ -0,0 +1,164 @@
+#pragma once
+
+#include "vulkan.h"
+#include "hash.h"
+
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace vulkan
+{
+
+/*  Hash of everything a pass's commands depend on: pipelines, descriptor
+    sets, buffers, images and the draw list.  Handles added with
+    add_resource() are also remembered, so that destroying one can
+    invalidate the passes that used it. */
+class PassKey
+{
+public:
+    PassKey();
+
+    template<typename Handle>
+    void add_resource(Handle handle)
+    {
+        uint64_t value = get_handle_value(handle);
+        add(value);
+        resources.push_back(value);
+    }
+
+    /*  Adds the buffer's handle and generation, which changes when the
+        defragmenter moves the buffer and recreates its handle. */
+    void add_buffer(const Buffer& buffer);
+
+    /*  Adds the image's handle and generation, which differs from that of
+        a destroyed image whose handle was reused. */
+    void add_image(const Image& image);
+
+    void add(uint64_t value);
+    void add_data(const void* data, size_t size);
+
+    uint64_t get_hash() const;
+    const std::vector<uint64_t>& get_resources() const;
+
+private:
+    uint64_t hash;
+    std::vector<uint64_t> resources;
+};
+
+struct PassCacheStatistics
+{
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t invalidations;
+    double recording_ms;    // spent recording on misses
+    double saved_ms;        // recording time the hits did not spend again
+};
+
+/*  The bookkeeping of a PassCache, apart from its command pool: the
+    recording each pass has, the resources it used, and the recordings
+    retired until no frame can still be executing them.  Needs no device. */
+class PassRecordings
+{
+public:
+    explicit PassRecordings(uint32_t frames_in_flight);
+
+    /*  Advances the frame.  Returns the command buffers retired
+        frames_in_flight frames ago, for the caller to free. */
+    std::vector<VkCommandBuffer> begin_frame();
+
+    /*  Returns the pass's command buffer and counts a hit when it was
+        recorded with the hash.  Otherwise retires the pass's recording, if
+        any, counts a miss and returns VK_NULL_HANDLE. */
+    VkCommandBuffer find(const std::string& pass, uint64_t hash);
+
+    /*  Keeps a new recording of a pass that find() missed. */
+    void add(const std::string& pass, uint64_t hash, const std::vector<uint64_t>& resources,
+        VkCommandBuffer command_buffer, double recording_ms);
+
+    void invalidate_resource(uint64_t resource);
+    void clear();
+
+    const PassCacheStatistics& get_statistics() const;
+    double get_reuse_rate() const;
+
+private:
+    struct Entry
+    {
+        uint64_t hash;
+        std::vector<uint64_t> resources;
+        VkCommandBuffer command_buffer;
+        double recording_ms;
+    };
+
+    struct Retired
+    {
+        VkCommandBuffer command_buffer;
+        uint64_t frame;
+    };
+
+    void retire(Entry& entry);
+
+    uint32_t frames_in_flight;
+    uint64_t frame;
+    std::map<std::string, Entry> entries;
+    std::vector<Retired> retired;
+    PassCacheStatistics statistics;
+};
+
+/*  Keeps the secondary command buffer each named pass recorded last, and
+    hands it out again while the pass's key stays the same, so that static
+    geometry and UI are not recorded every frame.  A pass whose key changed
+    is recorded again; the old command buffer is freed frames_in_flight
+    frames later, when no frame can still be executing it.
+
+    Command buffers are recorded with SIMULTANEOUS_USE, as the same one may
+    be pending in several frames.  Like its VkCommandPool, the cache
+    belongs to one thread. */
+class PassCache
+{
+public:
+    explicit PassCache(LogicalDevice& device, uint32_t frames_in_flight = 3);
+    ~PassCache();
+
+    PassCache(const PassCache&) = delete;
+    PassCache& operator=(const PassCache&) = delete;
+
+    /*  Frees the command buffers retired frames_in_flight frames ago. */
+    void begin_frame();
+
+    /*  Returns the pass's secondary command buffer for vkCmdExecuteCommands.
+        When the key or the inheritance differ from the cached recording,
+        begins a new one with inheritance, calls record on it and ends it.
+        If record throws, the new command buffer is freed and the pass has
+        no recording. */
+    VkCommandBuffer get(
+        const std::string& pass,
+        const PassKey& key,
+        const VkCommandBufferInheritanceInfo& inheritance,
+        const std::function<void(VkCommandBuffer)>& record);
+
+    /*  Drops every recording that used the resource, for when it is
+        destroyed or recreated and its handle may come back. */
+    template<typename Handle>
+    void invalidate(Handle handle)
+    {
+        invalidate_resource(get_handle_value(handle));
+    }
+
+    void invalidate_resource(uint64_t resource);
+    void clear();
+
+    const PassCacheStatistics& get_statistics() const;
+
+    /*  Fraction of get() calls that reused a recording. */
+    double get_reuse_rate() const;
+
+private:
+    LogicalDevice& device;
+    VkCommandPool command_pool;
+    PassRecordings recordings;
+};
+
+}
@@ -0,0 +1,360 @@
+#include "pipelines.h"
+#include "hash.h"
+
+#include <chrono>
+
+namespace vulkan
+{
+
+static const VkGraphicsPipelineLibraryFlagsEXT part_flags[pipeline_part_count] = {
+    VK_GRAPHICS_PIPELINE_LIBRARY_VERTEX_INPUT_INTERFACE_BIT_EXT,
+    VK_GRAPHICS_PIPELINE_LIBRARY_PRE_RASTERIZATION_SHADERS_BIT_EXT,
+    VK_GRAPHICS_PIPELINE_LIBRARY_FRAGMENT_SHADER_BIT_EXT,
+    VK_GRAPHICS_PIPELINE_LIBRARY_FRAGMENT_OUTPUT_INTERFACE_BIT_EXT
+};
+
+static double get_elapsed_ms(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+GraphicsPipelineLibrary::GraphicsPipelineLibrary(LogicalDevice& device, uint32_t frames_in_flight, bool use_libraries)
+    : device(device)
+    , frames_in_flight(frames_in_flight)
+    , libraries(use_libraries && device.get_enabled_features().graphics_pipeline_library)
+    , pipeline_cache(VK_NULL_HANDLE)
+    , frame(0)
+    , busy(false)
+    , stopping(false)
+    , statistics()
+{
+    VkPipelineCacheCreateInfo cache_info;
+    cache_info.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+    cache_info.pNext = nullptr;
+    cache_info.flags = 0;
+    cache_info.initialDataSize = 0;
+    cache_info.pInitialData = nullptr;
+
+    VkResult result = vkCreatePipelineCache(device.get_device(), &cache_info, device.get_allocation_callbacks(), &pipeline_cache);
+    if( result != VK_SUCCESS )
+    {
+        throw VulkanException(result, "Error while creating pipeline library cache");
+    }
+
+    if( libraries )
+    {
+        worker = std::thread(&GraphicsPipelineLibrary::optimize, this);
+    }
+}
+
+GraphicsPipelineLibrary::~GraphicsPipelineLibrary()
+{
+    if( worker.joinable() )
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_one();
+        worker.join();
+    }
+
+    for( Optimized& optimized : finished )
+    {
+        vkDestroyPipeline(device.get_device(), optimized.pipeline, device.get_allocation_callbacks());
+    }
+    for( Retired& old : retired )
+    {
+        vkDestroyPipeline(device.get_device(), old.pipeline, device.get_allocation_callbacks());
+    }
+    for( auto& entry : pipelines )
+    {
+        vkDestroyPipeline(device.get_device(), entry.second.pipeline, device.get_allocation_callbacks());
+    }
+    for( auto& entry : parts )
+    {
+        vkDestroyPipeline(device.get_device(), entry.second, device.get_allocation_callbacks());
+    }
+    vkDestroyPipelineCache(device.get_device(), pipeline_cache, device.get_allocation_callbacks());
+}
+
+bool GraphicsPipelineLibrary::uses_libraries() const
+{
+    return libraries;
+}
+
+VkPipeline GraphicsPipelineLibrary::get(const GraphicsPipelineDescription& description)
+{
+    Hasher key;
+    for( const PipelinePartState& part : description.parts )
+    {
+        key.add(part.key);
+    }
+    key.add_handle(description.layout);
+
+    auto found = pipelines.find(key.get_hash());
+    if( found != pipelines.end() )
+    {
+        return found->second.pipeline;
+    }
+
+    Linked linked;
+    linked.optimized = !libraries;
+
+    if( !libraries )
+    {
+        linked.pipeline = create_monolithic(description);
+        pipelines[key.get_hash()] = linked;
+        return linked.pipeline;
+    }
+
+    Job job;
+    job.key = key.get_hash();
+    job.layout = description.layout;
+    for( uint32_t i = 0; i < pipeline_part_count; ++i )
+    {
+        job.libraries[i] = get_part(static_cast<PipelinePart>(i), description.parts[i], description.layout);
+    }
+
+    linked.pipeline = link(job.libraries, description.layout, false);
+    pipelines[key.get_hash()] = linked;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        jobs.push_back(job);
+    }
+    wake.notify_one();
+
+    return linked.pipeline;
+}
+
+void GraphicsPipelineLibrary::begin_frame()
+{
+    ++frame;
+
+    std::vector<Optimized> swapped;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        swapped.swap(finished);
+    }
+
+    for( Optimized& optimized : swapped )
+    {
+        Linked& linked = pipelines[optimized.key];
+
+        Retired old;
+        old.pipeline = linked.pipeline;
+        old.frame = frame;
+        retired.push_back(old);
+
+        linked.pipeline = optimized.pipeline;
+        linked.optimized = true;
+    }
+
+    for( size_t i = 0; i < retired.size(); )
+    {
+        if( frame - retired[i].frame > frames_in_flight )
+        {
+            vkDestroyPipeline(device.get_device(), retired[i].pipeline, device.get_allocation_callbacks());
+            retired[i] = retired.back();
+            retired.pop_back();
+            continue;
+        }
+        ++i;
+    }
+}
+
+void GraphicsPipelineLibrary::wait_for_optimization()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    idle.wait(lock, [this]() { return jobs.empty() && !busy; });
+}
+
+VkPipelineCache GraphicsPipelineLibrary::get_pipeline_cache() const
+{
+    return pipeline_cache;
+}
+
+PipelineLibraryStatistics GraphicsPipelineLibrary::get_statistics() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return statistics;
+}
+
+VkPipeline GraphicsPipelineLibrary::get_part(PipelinePart part, const PipelinePartState& state, VkPipelineLayout layout)
+{
+    // Only the shader parts are compiled against the layout.
+    Hasher key;
+    key.add(static_cast<uint64_t>(part));
+    key.add(state.key);
+    if( part == PipelinePart::PRE_RASTERIZATION || part == PipelinePart::FRAGMENT_SHADER )
+    {
+        key.add_handle(layout);
+    }
+
+    auto found = parts.find(key.get_hash());
+    if( found != parts.end() )
+    {
+        return found->second;
+    }
+
+    VkGraphicsPipelineLibraryCreateInfoEXT library_info;
+    library_info.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_LIBRARY_CREATE_INFO_EXT;
+    library_info.pNext = nullptr;
+    library_info.flags = part_flags[static_cast<uint32_t>(part)];
+
+    VkGraphicsPipelineCreateInfo create_info = {};
+    create_info.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+    create_info.pNext = &library_info;
+    create_info.flags = VK_PIPELINE_CREATE_LIBRARY_BIT_KHR
+        | VK_PIPELINE_CREATE_RETAIN_LINK_TIME_OPTIMIZATION_INFO_BIT_EXT;
+    create_info.basePipelineHandle = VK_NULL_HANDLE;
+    create_info.basePipelineIndex = -1;
+
+    std::vector<VkPipelineShaderStageCreateInfo> stages;
+    state.describe(create_info, stages);
+    create_info.stageCount = static_cast<uint32_t>(stages.size());
+    create_info.pStages = stages.data();
+    if( part == PipelinePart::PRE_RASTERIZATION || part == PipelinePart::FRAGMENT_SHADER )
+    {
+        create_info.layout = layout;
+    }
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    VkPipeline library = create(create_info);
+    double ms = get_elapsed_ms(start);
+
+    parts[key.get_hash()] = library;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    statistics.parts_compiled++;
+    statistics.part_ms += ms;
+    return library;
+}
+
+VkPipeline GraphicsPipelineLibrary::link(const VkPipeline* libraries, VkPipelineLayout layout, bool optimize)
+{
+    VkPipelineLibraryCreateInfoKHR library_info;
+    library_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LIBRARY_CREATE_INFO_KHR;
+    library_info.pNext = nullptr;
+    library_info.libraryCount = pipeline_part_count;
+    library_info.pLibraries = libraries;
+
+    VkGraphicsPipelineCreateInfo create_info = {};
+    create_info.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+    create_info.pNext = &library_info;
+    create_info.flags = optimize ? VK_PIPELINE_CREATE_LINK_TIME_OPTIMIZATION_BIT_EXT : 0;
+    create_info.layout = layout;
+    create_info.basePipelineHandle = VK_NULL_HANDLE;
+    create_info.basePipelineIndex = -1;
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    VkPipeline pipeline = create(create_info);
+    double ms = get_elapsed_ms(start);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if( optimize )
+    {
+        statistics.optimized++;
+        statistics.optimize_ms += ms;
+    }
+    else
+    {
+        statistics.fast_links++;
+        statistics.fast_link_ms += ms;
+    }
+    return pipeline;
+}
+
+VkPipeline GraphicsPipelineLibrary::create_monolithic(const GraphicsPipelineDescription& description)
+{
+    VkGraphicsPipelineCreateInfo create_info = {};
+    create_info.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+    create_info.pNext = nullptr;
+    create_info.flags = 0;
+    create_info.basePipelineHandle = VK_NULL_HANDLE;
+    create_info.basePipelineIndex = -1;
+
+    std::vector<VkPipelineShaderStageCreateInfo> stages;
+    for( const PipelinePartState& part : description.parts )
+    {
+        part.describe(create_info, stages);
+    }
+    create_info.stageCount = static_cast<uint32_t>(stages.size());
+    create_info.pStages = stages.data();
+    create_info.layout = description.layout;
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    VkPipeline pipeline = create(create_info);
+    double ms = get_elapsed_ms(start);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    statistics.monolithic++;
+    statistics.monolithic_ms += ms;
+    return pipeline;
+}
+
+VkPipeline GraphicsPipelineLibrary::create(const VkGraphicsPipelineCreateInfo& create_info)
+{
+    VkPipeline pipeline;
+    VkResult result = vkCreateGraphicsPipelines(
+        device.get_device(), pipeline_cache, 1, &create_info, device.get_allocation_callbacks(), &pipeline);
+    if( result != VK_SUCCESS )
+    {
+        throw VulkanException(result, "Error while creating graphics pipeline");
+    }
+    return pipeline;
+}
+
+void GraphicsPipelineLibrary::optimize()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    while( true )
+    {
+        wake.wait(lock, [this]() { return stopping || !jobs.empty(); });
+        if( stopping )
+        {
+            break;
+        }
+
+        Job job = jobs.front();
+        jobs.pop_front();
+        busy = true;
+        lock.unlock();
+
+        // The parts outlive every job, they are destroyed only after this
+        // thread has stopped.
+        Optimized optimized;
+        optimized.key = job.key;
+        optimized.pipeline = VK_NULL_HANDLE;
+        try
+        {
+            optimized.pipeline = link(job.libraries, job.layout, true);
+        }
+        catch( const VulkanException& )
+        {
+            // The fast-linked pipeline stays in use.
+        }
+
+        lock.lock();
+        busy = false;
+        if( optimized.pipeline != VK_NULL_HANDLE )
+        {
+            finished.push_back(optimized);
+        }
+        else
+        {
+            statistics.failed_optimizations++;
+        }
+        if( jobs.empty() )
+        {
+            idle.notify_all();
+        }
+    }
+
+    // Wakes anyone waiting, the dropped jobs keep their fast-linked pipelines.
+    jobs.clear();
+    idle.notify_all();
+}
+
+}
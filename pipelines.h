@@ -0,0 +1,152 @@
+#pragma once
+
+#include "vulkan.h"
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace vulkan
+{
+
+/*  The independently compiled parts of a graphics pipeline, in the order
+    of the VK_EXT_graphics_pipeline_library flags. */
+enum class PipelinePart
+{
+    VERTEX_INPUT,       // vertex input and input assembly
+    PRE_RASTERIZATION,  // vertex to geometry shaders, viewport, rasterization
+    FRAGMENT_SHADER,    // fragment shader, depth/stencil, multisample
+    FRAGMENT_OUTPUT     // color blend, multisample, render pass
+};
+
+static const uint32_t pipeline_part_count = 4;
+
+/*  One part of a pipeline.  describe fills in the part's state on the
+    create info and appends its shader stages, and leaves everything else
+    alone: with libraries it is called on its own, without them all four
+    are called on one create info.  pDynamicState goes with the
+    pre-rasterization part.  Parts with equal keys are interchangeable, so
+    the key has to cover everything describe sets, including the render
+    pass. */
+struct PipelinePartState
+{
+    uint64_t key;
+    std::function<void(VkGraphicsPipelineCreateInfo&, std::vector<VkPipelineShaderStageCreateInfo>&)> describe;
+};
+
+struct GraphicsPipelineDescription
+{
+    PipelinePartState parts[pipeline_part_count];
+    VkPipelineLayout layout;
+};
+
+struct PipelineLibraryStatistics
+{
+    uint64_t parts_compiled;
+    uint64_t fast_links;
+    uint64_t optimized;
+    uint64_t failed_optimizations;
+    uint64_t monolithic;
+    double part_ms;
+    double fast_link_ms;
+    double optimize_ms;
+    double monolithic_ms;
+};
+
+/*  Creates graphics pipelines without first-use hitches.  With
+    VK_EXT_graphics_pipeline_library each part is compiled once and cached,
+    and a new combination is fast-linked from the parts right away, which
+    takes a fraction of a full compile.  A background thread then links it
+    again with link time optimization, and begin_frame() swaps the
+    optimized pipeline in, destroying the fast-linked one frames_in_flight
+    frames later.  Without the extension, which the device features
+    decide, or with use_libraries false, as to compare the two, get()
+    compiles complete pipelines.
+
+    get() and begin_frame() belong to one thread, the one recording
+    draws; the parts' describe functions are only called from it. */
+class GraphicsPipelineLibrary
+{
+public:
+    explicit GraphicsPipelineLibrary(LogicalDevice& device, uint32_t frames_in_flight = 3, bool use_libraries = true);
+    ~GraphicsPipelineLibrary();
+
+    GraphicsPipelineLibrary(const GraphicsPipelineLibrary&) = delete;
+    GraphicsPipelineLibrary& operator=(const GraphicsPipelineLibrary&) = delete;
+
+    bool uses_libraries() const;
+
+    /*  The best pipeline there is for the description so far.  The handle
+        stays valid for frames_in_flight frames after it is replaced. */
+    VkPipeline get(const GraphicsPipelineDescription& description);
+
+    /*  Swaps in the pipelines optimized since the last call, and destroys
+        the ones they replaced frames_in_flight frames ago. */
+    void begin_frame();
+
+    /*  Blocks until the background thread has nothing left to optimize,
+        as before capturing a benchmark. */
+    void wait_for_optimization();
+
+    VkPipelineCache get_pipeline_cache() const;
+    PipelineLibraryStatistics get_statistics() const;
+
+private:
+    struct Linked
+    {
+        VkPipeline pipeline;
+        bool optimized;
+    };
+
+    struct Job
+    {
+        uint64_t key;
+        VkPipeline libraries[pipeline_part_count];
+        VkPipelineLayout layout;
+    };
+
+    struct Optimized
+    {
+        uint64_t key;
+        VkPipeline pipeline;
+    };
+
+    struct Retired
+    {
+        VkPipeline pipeline;
+        uint64_t frame;
+    };
+
+    VkPipeline get_part(PipelinePart part, const PipelinePartState& state, VkPipelineLayout layout);
+    VkPipeline link(const VkPipeline* libraries, VkPipelineLayout layout, bool optimize);
+    VkPipeline create_monolithic(const GraphicsPipelineDescription& description);
+    VkPipeline create(const VkGraphicsPipelineCreateInfo& create_info);
+    void optimize();
+
+    LogicalDevice& device;
+    uint32_t frames_in_flight;
+    bool libraries;
+    VkPipelineCache pipeline_cache;
+
+    std::map<uint64_t, VkPipeline> parts;
+    std::map<uint64_t, Linked> pipelines;
+    std::vector<Retired> retired;
+    uint64_t frame;
+
+    // Shared with the optimizing thread.
+    mutable std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable idle;
+    std::deque<Job> jobs;
+    std::vector<Optimized> finished;
+    bool busy;
+    bool stopping;
+    PipelineLibraryStatistics statistics;
+    std::thread worker;
+};
+
+}
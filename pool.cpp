@@ -0,0 +1,382 @@
+#include "pool.h"
+
+#include <algorithm>
+
+namespace vulkan
+{
+
+static VkDeviceSize align_up(VkDeviceSize value, VkDeviceSize alignment)
+{
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+MemoryAllocation::MemoryAllocation(
+    MemoryBlock* block,
+    VkDeviceSize offset,
+    VkDeviceSize size,
+    VkDeviceSize alignment,
+    IAllocationMoveListener* listener
+)
+: block(block)
+, offset(offset)
+, size(size)
+, alignment(alignment)
+, listener(listener)
+, moving(false)
+, freed(false)
+{
+}
+
+VkDeviceMemory MemoryAllocation::get_memory() const
+{
+    return block->memory.memory;
+}
+
+VkDeviceSize MemoryAllocation::get_offset() const
+{
+    return offset;
+}
+
+VkDeviceSize MemoryAllocation::get_size() const
+{
+    return size;
+}
+
+uint32_t MemoryAllocation::get_memory_type_index() const
+{
+    return block->memory.memory_type_index;
+}
+
+bool MemoryAllocation::is_movable() const
+{
+    return listener != nullptr;
+}
+
+MemoryPool::MemoryPool(LogicalDevice& device, uint32_t memory_type_index, VkDeviceSize block_size)
+    : device(device)
+    , memory_type_index(memory_type_index)
+    , block_size(block_size)
+{
+}
+
+MemoryPool::~MemoryPool()
+{
+    while( !blocks.empty() )
+    {
+        MemoryBlock* block = blocks.back().get();
+        for( MemoryAllocation* allocation : block->allocations )
+        {
+            delete allocation;
+        }
+        block->allocations.clear();
+        destroy_block(block);
+    }
+}
+
+MemoryBlock* MemoryPool::create_block(const DeviceMemory& memory)
+{
+    VkDeviceSize size = memory.size;
+    MemoryBlock* block = new MemoryBlock();
+    block->memory = memory;
+    block->buffer = VK_NULL_HANDLE;
+    block->dedicated = false;
+    block->draining = false;
+    block->mapped = nullptr;
+    block->used = 0;
+    block->free_ranges[0] = size;
+
+    // A buffer over the whole block lets the defragmenter move data with
+    // vkCmdCopyBuffer.  Memory types that cannot back buffers (some image-only
+    // types) just stay unmovable.
+    VkBufferCreateInfo buffer_info;
+    buffer_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    buffer_info.pNext = nullptr;
+    buffer_info.flags = 0;
+    buffer_info.size = size;
+    buffer_info.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+    buffer_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    buffer_info.queueFamilyIndexCount = 0;
+    buffer_info.pQueueFamilyIndices = nullptr;
+
+    VkBuffer buffer;
+    if( vkCreateBuffer(device.get_device(), &buffer_info, device.get_allocation_callbacks(), &buffer) == VK_SUCCESS )
+    {
+        VkMemoryRequirements requirements;
+        vkGetBufferMemoryRequirements(device.get_device(), buffer, &requirements);
+        if( (requirements.memoryTypeBits & (1u << memory_type_index))
+            && requirements.size <= size
+            && vkBindBufferMemory(device.get_device(), buffer, memory.memory, 0) == VK_SUCCESS )
+        {
+            block->buffer = buffer;
+        }
+        else
+        {
+            vkDestroyBuffer(device.get_device(), buffer, device.get_allocation_callbacks());
+        }
+    }
+
+    blocks.emplace_back(block);
+    return block;
+}
+
+void MemoryPool::destroy_block(MemoryBlock* block)
+{
+    if( block->buffer != VK_NULL_HANDLE )
+    {
+        vkDestroyBuffer(device.get_device(), block->buffer, device.get_allocation_callbacks());
+    }
+    if( block->mapped )
+    {
+        vkUnmapMemory(device.get_device(), block->memory.memory);
+    }
+    device.free_memory(block->memory);
+
+    blocks.erase(
+        std::remove_if(blocks.begin(), blocks.end(),
+            [block](const std::unique_ptr<MemoryBlock>& b) { return b.get() == block; }),
+        blocks.end());
+}
+
+bool MemoryPool::find_range(
+    MemoryBlock* block,
+    VkDeviceSize size,
+    VkDeviceSize alignment,
+    VkDeviceSize& offset)
+{
+    for( const std::pair<const VkDeviceSize, VkDeviceSize>& range : block->free_ranges )
+    {
+        VkDeviceSize aligned = align_up(range.first, alignment);
+        if( aligned + size <= range.first + range.second )
+        {
+            offset = aligned;
+            return true;
+        }
+    }
+    return false;
+}
+
+void MemoryPool::reserve_range(MemoryBlock* block, VkDeviceSize offset, VkDeviceSize size)
+{
+    std::map<VkDeviceSize, VkDeviceSize>::iterator itr = block->free_ranges.upper_bound(offset);
+    --itr;
+
+    VkDeviceSize range_start = itr->first;
+    VkDeviceSize range_end = itr->first + itr->second;
+    block->free_ranges.erase(itr);
+
+    if( range_start < offset )
+    {
+        block->free_ranges[range_start] = offset - range_start;
+    }
+    if( offset + size < range_end )
+    {
+        block->free_ranges[offset + size] = range_end - offset - size;
+    }
+
+    block->used += size;
+}
+
+void MemoryPool::release_range(MemoryBlock* block, VkDeviceSize offset, VkDeviceSize size)
+{
+    VkDeviceSize start = offset;
+    VkDeviceSize end = offset + size;
+
+    std::map<VkDeviceSize, VkDeviceSize>::iterator next = block->free_ranges.lower_bound(end);
+    if( next != block->free_ranges.end() && next->first == end )
+    {
+        end += next->second;
+        block->free_ranges.erase(next);
+    }
+
+    std::map<VkDeviceSize, VkDeviceSize>::iterator prev = block->free_ranges.lower_bound(start);
+    if( prev != block->free_ranges.begin() )
+    {
+        --prev;
+        if( prev->first + prev->second == start )
+        {
+            start = prev->first;
+            block->free_ranges.erase(prev);
+        }
+    }
+
+    block->free_ranges[start] = end - start;
+    block->used -= size;
+}
+
+MemoryAllocation* MemoryPool::allocate(
+    VkDeviceSize size,
+    VkDeviceSize alignment,
+    AllocationPriority priority,
+    IAllocationMoveListener* listener)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+
+    if( alignment == 0 )
+    {
+        alignment = 1;
+    }
+
+    MemoryBlock* block = nullptr;
+    VkDeviceSize offset = 0;
+
+    // Anything over half a block gets its own VkDeviceMemory, otherwise
+    // it would strand most of a fresh block.
+    bool dedicated = size > block_size / 2;
+    if( !dedicated )
+    {
+        for( std::unique_ptr<MemoryBlock>& candidate : blocks )
+        {
+            if( !candidate->dedicated && !candidate->draining && find_range(candidate.get(), size, alignment, offset) )
+            {
+                block = candidate.get();
+                break;
+            }
+        }
+    }
+
+    if( !block )
+    {
+        // The governor may ask responders to free memory before admitting
+        // the new block, and they free through this pool, so it must not
+        // be locked meanwhile.
+        lock.unlock();
+        DeviceMemory memory = device.allocate_memory(dedicated ? size : block_size, memory_type_index, priority);
+        lock.lock();
+        if( memory.memory == VK_NULL_HANDLE )
+        {
+            return nullptr;
+        }
+
+        block = create_block(memory);
+        block->dedicated = dedicated;
+        offset = 0;
+    }
+
+    reserve_range(block, offset, size);
+
+    MemoryAllocation* allocation = new MemoryAllocation(block, offset, size, alignment, listener);
+    block->allocations.push_back(allocation);
+    return allocation;
+}
+
+void MemoryPool::free(MemoryAllocation* allocation)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+
+    // The defragmenter still has a copy in flight, it finishes the free
+    // once the copy is done.
+    if( allocation->moving )
+    {
+        allocation->freed = true;
+        return;
+    }
+
+    MemoryBlock* block = allocation->block;
+    release_range(block, allocation->offset, allocation->size);
+    block->allocations.erase(
+        std::find(block->allocations.begin(), block->allocations.end(), allocation));
+    delete allocation;
+
+    if( block->dedicated && block->allocations.empty() )
+    {
+        destroy_block(block);
+    }
+}
+
+void* MemoryPool::map(MemoryAllocation* allocation)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+
+    MemoryBlock* block = allocation->block;
+    if( !block->mapped )
+    {
+        VkResult result = vkMapMemory(
+            device.get_device(), block->memory.memory, 0, VK_WHOLE_SIZE, 0, &block->mapped);
+        if( result != VK_SUCCESS )
+        {
+            throw VulkanException(result, "Error while mapping memory block");
+        }
+    }
+
+    return static_cast<char*>(block->mapped) + allocation->offset;
+}
+
+void MemoryPool::flush(MemoryAllocation* allocation)
+{
+    const VkPhysicalDeviceMemoryProperties& memory_properties = device.get_memory_properties();
+    if( memory_properties.memoryTypes[memory_type_index].propertyFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT )
+    {
+        return;
+    }
+
+    std::unique_lock<std::mutex> lock(mutex);
+
+    // Flushed ranges have to be aligned to nonCoherentAtomSize, or reach
+    // the end of the memory.
+    VkDeviceSize atom = device.get_properties().limits.nonCoherentAtomSize;
+    VkDeviceSize start = allocation->offset / atom * atom;
+    VkDeviceSize end = align_up(allocation->offset + allocation->size, atom);
+
+    VkMappedMemoryRange range;
+    range.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+    range.pNext = nullptr;
+    range.memory = allocation->block->memory.memory;
+    range.offset = start;
+    range.size = end < allocation->block->memory.size ? end - start : VK_WHOLE_SIZE;
+
+    VkResult result = vkFlushMappedMemoryRanges(device.get_device(), 1, &range);
+    if( result != VK_SUCCESS )
+    {
+        throw VulkanException(result, "Error while flushing mapped memory");
+    }
+}
+
+PoolStatistics MemoryPool::get_statistics()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+
+    PoolStatistics statistics = {};
+    VkDeviceSize bytes_free = 0;
+
+    for( std::unique_ptr<MemoryBlock>& block : blocks )
+    {
+        statistics.block_count++;
+        statistics.allocation_count += block->allocations.size();
+        statistics.bytes_reserved += block->memory.size;
+        statistics.bytes_used += block->used;
+
+        for( const std::pair<const VkDeviceSize, VkDeviceSize>& range : block->free_ranges )
+        {
+            bytes_free += range.second;
+            statistics.largest_free_range = std::max(statistics.largest_free_range, range.second);
+        }
+    }
+
+    statistics.fragmentation = bytes_free == 0 ? 0.0f :
+        1.0f - static_cast<float>(statistics.largest_free_range) / bytes_free;
+
+    return statistics;
+}
+
+PoolStatistics sum_pool_statistics(const std::vector<PoolStatistics>& pools)
+{
+    PoolStatistics total = {};
+    VkDeviceSize bytes_free = 0;
+
+    for( const PoolStatistics& statistics : pools )
+    {
+        total.block_count += statistics.block_count;
+        total.allocation_count += statistics.allocation_count;
+        total.bytes_reserved += statistics.bytes_reserved;
+        total.bytes_used += statistics.bytes_used;
+        total.largest_free_range = std::max(total.largest_free_range, statistics.largest_free_range);
+        bytes_free += statistics.bytes_reserved - statistics.bytes_used;
+    }
+
+    total.fragmentation = bytes_free == 0 ? 0.0f :
+        1.0f - static_cast<float>(total.largest_free_range) / bytes_free;
+
+    return total;
+}
+
+}
@@ -0,0 +1,144 @@
+#pragma once
+
+#include "vulkan.h"
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace vulkan
+{
+
+class MemoryAllocation;
+struct MemoryBlock;
+
+/*  Subclass this in whatever owns a movable allocation (a buffer, say).
+    After the defragmenter moves the allocation it calls
+    on_allocation_moved(), and the owner recreates its handle on the new
+    memory / offset and rewrites any descriptors that referenced it. */
+class IAllocationMoveListener
+{
+public:
+    virtual ~IAllocationMoveListener() {}
+    virtual void on_allocation_moved(MemoryAllocation& allocation) = 0;
+};
+
+/*  A range suballocated from a MemoryBlock.  The pointer stays valid for the
+    life of the allocation, but its memory and offset change if the
+    defragmenter moves it, so read them again after on_allocation_moved(). */
+class MemoryAllocation
+{
+    friend class MemoryPool;
+    friend class Defragmenter;
+
+public:
+    VkDeviceMemory get_memory() const;
+    VkDeviceSize get_offset() const;
+    VkDeviceSize get_size() const;
+    uint32_t get_memory_type_index() const;
+
+    /*  Only allocations with a listener are moved by the defragmenter. */
+    bool is_movable() const;
+
+private:
+    MemoryAllocation(
+        MemoryBlock* block,
+        VkDeviceSize offset,
+        VkDeviceSize size,
+        VkDeviceSize alignment,
+        IAllocationMoveListener* listener);
+
+    MemoryBlock* block;
+    VkDeviceSize offset;
+    VkDeviceSize size;
+    VkDeviceSize alignment;
+    IAllocationMoveListener* listener;
+    bool moving;
+    bool freed;
+};
+
+/*  One VkDeviceMemory allocation carved up by a MemoryPool.  Blocks whose
+    memory type supports transfer buffers get a buffer spanning the whole
+    block so the defragmenter can copy between them.  New allocations are
+    not placed in a block the defragmenter is draining. */
+struct MemoryBlock
+{
+    DeviceMemory memory;
+    VkBuffer buffer;
+    bool dedicated;
+    bool draining;
+    void* mapped;
+    VkDeviceSize used;
+    std::map<VkDeviceSize, VkDeviceSize> free_ranges;
+    std::vector<MemoryAllocation*> allocations;
+};
+
+/*  Numbers describing how well a pool is packed.  fragmentation is
+    1 - largest_free_range / bytes_free, so 0 means all free space is in
+    one range. */
+struct PoolStatistics
+{
+    uint32_t block_count;
+    uint32_t allocation_count;
+    VkDeviceSize bytes_reserved;
+    VkDeviceSize bytes_used;
+    VkDeviceSize largest_free_range;
+    float fragmentation;
+};
+
+/*  Statistics of several pools taken as one: counts and bytes add up, and
+    fragmentation is over the free space of all of them. */
+PoolStatistics sum_pool_statistics(const std::vector<PoolStatistics>& pools);
+
+/*  Suballocates device memory of one memory type out of large blocks,
+    so the driver sees few vkAllocateMemory calls.  Created on demand by
+    LogicalDevice::allocate(). */
+class MemoryPool
+{
+    friend class Defragmenter;
+
+public:
+    MemoryPool(LogicalDevice& device, uint32_t memory_type_index, VkDeviceSize block_size);
+    ~MemoryPool();
+
+    /*  Returns nullptr if a deferrable allocation was postponed by the
+        memory governor. */
+    MemoryAllocation* allocate(
+        VkDeviceSize size,
+        VkDeviceSize alignment,
+        AllocationPriority priority,
+        IAllocationMoveListener* listener);
+
+    void free(MemoryAllocation* allocation);
+
+    /*  Returns a host pointer to the allocation.  The whole block is mapped
+        once and stays mapped until the block is freed. */
+    void* map(MemoryAllocation* allocation);
+
+    /*  Flushes host writes to the allocation, unless the memory is coherent. */
+    void flush(MemoryAllocation* allocation);
+
+    PoolStatistics get_statistics();
+
+private:
+    MemoryBlock* create_block(const DeviceMemory& memory);
+    void destroy_block(MemoryBlock* block);
+
+    bool find_range(
+        MemoryBlock* block,
+        VkDeviceSize size,
+        VkDeviceSize alignment,
+        VkDeviceSize& offset);
+
+    void reserve_range(MemoryBlock* block, VkDeviceSize offset, VkDeviceSize size);
+    void release_range(MemoryBlock* block, VkDeviceSize offset, VkDeviceSize size);
+
+    LogicalDevice& device;
+    uint32_t memory_type_index;
+    VkDeviceSize block_size;
+    std::vector<std::unique_ptr<MemoryBlock>> blocks;
+    std::mutex mutex;
+};
+
+}
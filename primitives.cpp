@@ -0,0 +1,982 @@
+#include "primitives.h"
+#include "buffer.h"
+#include "reflection.h"
+
+#include <algorithm>
+#include <functional>
+#include <numeric>
+#include <stdexcept>
+#include <string>
+
+namespace vulkan
+{
+
+// Every kernel runs 256 invocations, one per radix digit in the sort.
+static const uint32_t workgroup_size = 256;
+
+// Elements per invocation, which sets each kernel's tile size.  Larger
+// tiles amortize the per-workgroup atomics and look-back, smaller ones keep
+// the sort's shared memory within the 16KB every device has.
+static const uint32_t reduce_items = 16;
+static const uint32_t scan_items = 8;
+static const uint32_t histogram_items = 16;
+static const uint32_t radix_histogram_items = 16;
+static const uint32_t onesweep_items = 4;
+
+static const uint32_t radix_digits = 256;
+static const uint32_t radix_passes = 4;
+
+static const char* kernel_prelude = R"(#version 450
+#extension GL_EXT_buffer_reference : require
+
+layout(local_size_x = WORKGROUP_SIZE) in;
+
+layout(buffer_reference, std430, buffer_reference_align = 4) buffer Words
+{
+    uint data[];
+};
+
+// State that other workgroups of the same dispatch write while this one
+// reads it.
+layout(buffer_reference, std430, buffer_reference_align = 4) coherent buffer SharedWords
+{
+    uint data[];
+};
+
+const uint TILE_SIZE = WORKGROUP_SIZE * ITEMS_PER_THREAD;
+
+shared uint scratch[WORKGROUP_SIZE];
+
+// Exclusive prefix sum of value over the workgroup, and its total.  Every
+// invocation has to call it.
+uint workgroup_exclusive_sum(uint value, out uint total)
+{
+    uint lid = gl_LocalInvocationID.x;
+    scratch[lid] = value;
+    barrier();
+    for( uint offset = 1; offset < WORKGROUP_SIZE; offset <<= 1 )
+    {
+        uint add = lid >= offset ? scratch[lid - offset] : 0;
+        barrier();
+        scratch[lid] += add;
+        barrier();
+    }
+    uint inclusive = scratch[lid];
+    total = scratch[WORKGROUP_SIZE - 1];
+    barrier();
+    return inclusive - value;
+}
+)";
+
+static const char* reduce_source = R"(
+layout(push_constant) uniform Parameters
+{
+    Words source;
+    Words result;
+    uint count;
+};
+
+#if REDUCE_OPERATION == 0
+#define IDENTITY 0u
+#define COMBINE(a, b) ((a) + (b))
+#define ATOMIC_COMBINE atomicAdd
+#elif REDUCE_OPERATION == 1
+#define IDENTITY 0xffffffffu
+#define COMBINE(a, b) min(a, b)
+#define ATOMIC_COMBINE atomicMin
+#else
+#define IDENTITY 0u
+#define COMBINE(a, b) max(a, b)
+#define ATOMIC_COMBINE atomicMax
+#endif
+
+void main()
+{
+    uint lid = gl_LocalInvocationID.x;
+    uint base = gl_WorkGroupID.x * TILE_SIZE + lid;
+
+    uint value = IDENTITY;
+    for( uint i = 0; i < ITEMS_PER_THREAD; ++i )
+    {
+        uint index = base + i * WORKGROUP_SIZE;
+        if( index < count )
+        {
+            value = COMBINE(value, source.data[index]);
+        }
+    }
+
+    scratch[lid] = value;
+    barrier();
+    for( uint stride = WORKGROUP_SIZE / 2; stride > 0; stride >>= 1 )
+    {
+        if( lid < stride )
+        {
+            scratch[lid] = COMBINE(scratch[lid], scratch[lid + stride]);
+        }
+        barrier();
+    }
+
+    if( lid == 0 )
+    {
+        ATOMIC_COMBINE(result.data[0], scratch[0]);
+    }
+}
+)";
+
+static const char* scan_source = R"(
+layout(push_constant) uniform Parameters
+{
+    Words source;
+    Words destination;
+    SharedWords state;
+    uint count;
+    uint inclusive;
+};
+
+// state.data[0] hands out tile indices, then each tile has a flag, its own
+// total (the aggregate) and the total up to and including it (the inclusive
+// prefix), in separate words so that a reader never sees one half-replaced
+// by the other.
+const uint FLAG_AGGREGATE = 1;
+const uint FLAG_PREFIX = 2;
+
+shared uint tile_values[TILE_SIZE];
+shared uint tile_index;
+shared uint tile_prefix;
+
+void publish(uint tile, uint word, uint value, uint flag)
+{
+    state.data[1 + tile * 3 + word] = value;
+    memoryBarrierBuffer();
+    atomicExchange(state.data[1 + tile * 3], flag);
+}
+
+void main()
+{
+    uint lid = gl_LocalInvocationID.x;
+    if( lid == 0 )
+    {
+        tile_index = atomicAdd(state.data[0], 1);
+    }
+    barrier();
+    uint tile = tile_index;
+    uint tile_base = tile * TILE_SIZE;
+
+    // Loaded across the workgroup for coalescing, then summed in runs of
+    // consecutive elements per invocation.
+    for( uint i = 0; i < ITEMS_PER_THREAD; ++i )
+    {
+        uint slot = i * WORKGROUP_SIZE + lid;
+        uint index = tile_base + slot;
+        tile_values[slot] = index < count ? source.data[index] : 0;
+    }
+    barrier();
+
+    uint thread_total = 0;
+    for( uint i = 0; i < ITEMS_PER_THREAD; ++i )
+    {
+        thread_total += tile_values[lid * ITEMS_PER_THREAD + i];
+    }
+    uint tile_total;
+    uint thread_prefix = workgroup_exclusive_sum(thread_total, tile_total);
+
+    if( lid == 0 )
+    {
+        uint prefix = 0;
+        if( tile != 0 )
+        {
+            publish(tile, 1, tile_total, FLAG_AGGREGATE);
+
+            uint look = tile - 1;
+            while( true )
+            {
+                uint flag = atomicOr(state.data[1 + look * 3], 0);
+                if( flag == 0 )
+                {
+                    continue;
+                }
+                memoryBarrierBuffer();
+                if( flag == FLAG_PREFIX )
+                {
+                    prefix += state.data[1 + look * 3 + 2];
+                    break;
+                }
+                prefix += state.data[1 + look * 3 + 1];
+                look--;
+            }
+        }
+        publish(tile, 2, prefix + tile_total, FLAG_PREFIX);
+        tile_prefix = prefix;
+    }
+    barrier();
+
+    uint running = tile_prefix + thread_prefix;
+    for( uint i = 0; i < ITEMS_PER_THREAD; ++i )
+    {
+        uint slot = lid * ITEMS_PER_THREAD + i;
+        uint value = tile_values[slot];
+        tile_values[slot] = inclusive != 0 ? running + value : running;
+        running += value;
+    }
+    barrier();
+
+    for( uint i = 0; i < ITEMS_PER_THREAD; ++i )
+    {
+        uint slot = i * WORKGROUP_SIZE + lid;
+        uint index = tile_base + slot;
+        if( index < count )
+        {
+            destination.data[index] = tile_values[slot];
+        }
+    }
+}
+)";
+
+static const char* histogram_source = R"(
+layout(push_constant) uniform Parameters
+{
+    Words source;
+    Words bins;
+    uint count;
+    uint shift;
+    uint bin_count;
+};
+
+shared uint local_bins[MAX_BINS];
+
+void main()
+{
+    uint lid = gl_LocalInvocationID.x;
+    for( uint bin = lid; bin < bin_count; bin += WORKGROUP_SIZE )
+    {
+        local_bins[bin] = 0;
+    }
+    barrier();
+
+    uint base = gl_WorkGroupID.x * TILE_SIZE + lid;
+    for( uint i = 0; i < ITEMS_PER_THREAD; ++i )
+    {
+        uint index = base + i * WORKGROUP_SIZE;
+        if( index < count )
+        {
+            atomicAdd(local_bins[(source.data[index] >> shift) % bin_count], 1);
+        }
+    }
+    barrier();
+
+    for( uint bin = lid; bin < bin_count; bin += WORKGROUP_SIZE )
+    {
+        if( local_bins[bin] != 0 )
+        {
+            atomicAdd(bins.data[bin], local_bins[bin]);
+        }
+    }
+}
+)";
+
+static const char* radix_histogram_source = R"(
+layout(push_constant) uniform Parameters
+{
+    Words keys;
+    Words histograms;
+    uint count;
+};
+
+// The digit histograms of all four passes, from one read of the keys.
+shared uint local_histograms[4 * 256];
+
+void main()
+{
+    uint lid = gl_LocalInvocationID.x;
+    for( uint bin = lid; bin < 4 * 256; bin += WORKGROUP_SIZE )
+    {
+        local_histograms[bin] = 0;
+    }
+    barrier();
+
+    uint base = gl_WorkGroupID.x * TILE_SIZE + lid;
+    for( uint i = 0; i < ITEMS_PER_THREAD; ++i )
+    {
+        uint index = base + i * WORKGROUP_SIZE;
+        if( index < count )
+        {
+            uint key = keys.data[index];
+            for( uint pass = 0; pass < 4; ++pass )
+            {
+                atomicAdd(local_histograms[pass * 256 + ((key >> (pass * 8)) & 0xff)], 1);
+            }
+        }
+    }
+    barrier();
+
+    for( uint bin = lid; bin < 4 * 256; bin += WORKGROUP_SIZE )
+    {
+        if( local_histograms[bin] != 0 )
+        {
+            atomicAdd(histograms.data[bin], local_histograms[bin]);
+        }
+    }
+}
+)";
+
+static const char* radix_prefix_source = R"(
+layout(push_constant) uniform Parameters
+{
+    Words histograms;
+};
+
+// One workgroup per pass turns its digit counts into the digits' starting
+// offsets.
+void main()
+{
+    uint index = gl_WorkGroupID.x * 256 + gl_LocalInvocationID.x;
+    uint total;
+    histograms.data[index] = workgroup_exclusive_sum(histograms.data[index], total);
+}
+)";
+
+static const char* radix_onesweep_source = R"(
+layout(push_constant) uniform Parameters
+{
+    Words keys_in;
+    Words keys_out;
+    Words values_in;
+    Words values_out;
+    Words offsets;          // the pass's 256 digit offsets
+    SharedWords state;      // the pass's tile counter and look-back words
+    uint count;
+    uint shift;
+    uint has_values;
+};
+
+// Look-back words hold a flag in the top two bits and a count below, which
+// limits a sort to 2^30 keys but lets one atomic publish both.
+const uint COUNT_MASK = 0x3fffffff;
+const uint FLAG_MASK = 0xc0000000;
+const uint FLAG_AGGREGATE = 0x40000000;
+const uint FLAG_PREFIX = 0x80000000;
+
+// The tile's entries as digit << 16 | slot, in two buffers for the split
+// passes of the local sort.
+shared uint entries[2][TILE_SIZE];
+shared uint digit_counts[256];
+shared uint digit_starts[256];
+shared uint digit_bases[256];
+shared uint tile_index;
+
+void main()
+{
+    uint lid = gl_LocalInvocationID.x;
+    if( lid == 0 )
+    {
+        tile_index = atomicAdd(state.data[0], 1);
+    }
+    digit_counts[lid] = 0;
+    barrier();
+    uint tile = tile_index;
+    uint tile_base = tile * TILE_SIZE;
+    uint valid = min(TILE_SIZE, count - tile_base);
+
+    // Slots past the end get digit 255 and, as the stable sort keeps them
+    // behind the real 255s, end up past the valid entries.
+    for( uint i = 0; i < ITEMS_PER_THREAD; ++i )
+    {
+        uint slot = i * WORKGROUP_SIZE + lid;
+        uint digit = 0xff;
+        if( slot < valid )
+        {
+            digit = (keys_in.data[tile_base + slot] >> shift) & 0xff;
+            atomicAdd(digit_counts[digit], 1);
+        }
+        entries[0][slot] = (digit << 16) | slot;
+    }
+    barrier();
+
+    // Published before the local sort, so that later tiles' look-back can
+    // get past this one early.
+    uint digit_count = digit_counts[lid];
+    atomicExchange(state.data[1 + tile * 256 + lid], digit_count | (tile == 0 ? FLAG_PREFIX : FLAG_AGGREGATE));
+
+    // Stable local sort by digit, splitting on one bit at a time, with each
+    // invocation owning a run of consecutive entries.
+    uint current = 0;
+    for( uint bit = 16; bit < 24; ++bit )
+    {
+        uint zeros = 0;
+        for( uint i = 0; i < ITEMS_PER_THREAD; ++i )
+        {
+            zeros += ((entries[current][lid * ITEMS_PER_THREAD + i] >> bit) & 1) ^ 1;
+        }
+        uint total_zeros;
+        uint zeros_before = workgroup_exclusive_sum(zeros, total_zeros);
+        uint ones_before = lid * ITEMS_PER_THREAD - zeros_before;
+
+        for( uint i = 0; i < ITEMS_PER_THREAD; ++i )
+        {
+            uint entry = entries[current][lid * ITEMS_PER_THREAD + i];
+            if( ((entry >> bit) & 1) == 0 )
+            {
+                entries[current ^ 1][zeros_before++] = entry;
+            }
+            else
+            {
+                entries[current ^ 1][total_zeros + ones_before++] = entry;
+            }
+        }
+        barrier();
+        current ^= 1;
+    }
+
+    uint tile_total;
+    digit_starts[lid] = workgroup_exclusive_sum(digit_count, tile_total);
+
+    // Each invocation looks back for its digit.
+    uint prefix = 0;
+    if( tile != 0 )
+    {
+        uint look = tile - 1;
+        while( true )
+        {
+            uint word = atomicOr(state.data[1 + look * 256 + lid], 0);
+            if( (word & FLAG_MASK) == 0 )
+            {
+                continue;
+            }
+            prefix += word & COUNT_MASK;
+            if( (word & FLAG_MASK) == FLAG_PREFIX )
+            {
+                break;
+            }
+            look--;
+        }
+        atomicExchange(state.data[1 + tile * 256 + lid], (prefix + digit_count) | FLAG_PREFIX);
+    }
+    digit_bases[lid] = offsets.data[lid] + prefix;
+    barrier();
+
+    for( uint i = 0; i < ITEMS_PER_THREAD; ++i )
+    {
+        uint position = i * WORKGROUP_SIZE + lid;
+        if( position < valid )
+        {
+            uint entry = entries[current][position];
+            uint digit = entry >> 16;
+            uint slot = entry & 0xffff;
+            uint destination = digit_bases[digit] + position - digit_starts[digit];
+            keys_out.data[destination] = keys_in.data[tile_base + slot];
+            if( has_values != 0 )
+            {
+                values_out.data[destination] = values_in.data[tile_base + slot];
+            }
+        }
+    }
+}
+)";
+
+struct ReduceParameters
+{
+    VkDeviceAddress source;
+    VkDeviceAddress result;
+    uint32_t count;
+};
+
+struct ScanParameters
+{
+    VkDeviceAddress source;
+    VkDeviceAddress destination;
+    VkDeviceAddress state;
+    uint32_t count;
+    uint32_t inclusive;
+};
+
+struct HistogramParameters
+{
+    VkDeviceAddress source;
+    VkDeviceAddress bins;
+    uint32_t count;
+    uint32_t shift;
+    uint32_t bin_count;
+};
+
+struct RadixHistogramParameters
+{
+    VkDeviceAddress keys;
+    VkDeviceAddress histograms;
+    uint32_t count;
+};
+
+struct RadixPrefixParameters
+{
+    VkDeviceAddress histograms;
+};
+
+struct OnesweepParameters
+{
+    VkDeviceAddress keys_in;
+    VkDeviceAddress keys_out;
+    VkDeviceAddress values_in;
+    VkDeviceAddress values_out;
+    VkDeviceAddress offsets;
+    VkDeviceAddress state;
+    uint32_t count;
+    uint32_t shift;
+    uint32_t has_values;
+};
+
+static void record_barrier(
+    VkCommandBuffer command_buffer,
+    VkPipelineStageFlags src_stages,
+    VkAccessFlags src_access,
+    VkPipelineStageFlags dst_stages,
+    VkAccessFlags dst_access)
+{
+    VkMemoryBarrier barrier;
+    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    barrier.pNext = nullptr;
+    barrier.srcAccessMask = src_access;
+    barrier.dstAccessMask = dst_access;
+    vkCmdPipelineBarrier(command_buffer, src_stages, dst_stages, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+}
+
+/*  Orders the fills of scratch and output words after earlier dispatches
+    that used them, and the dispatches that follow after the fills. */
+static void record_fill_barriers(VkCommandBuffer command_buffer, const std::function<void()>& fill)
+{
+    record_barrier(command_buffer,
+        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT,
+        VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT);
+    fill();
+    record_barrier(command_buffer,
+        VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT,
+        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+}
+
+static void record_compute_barrier(VkCommandBuffer command_buffer)
+{
+    record_barrier(command_buffer,
+        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT,
+        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+}
+
+static void check_buffer(const Buffer& buffer, uint32_t count)
+{
+    if( !(buffer.get_usage() & VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT_KHR) )
+    {
+        throw std::invalid_argument("Compute primitive buffers need VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT");
+    }
+    if( buffer.get_size() < VkDeviceSize(count) * sizeof(uint32_t) )
+    {
+        throw std::invalid_argument("Compute primitive buffer is smaller than its element count");
+    }
+}
+
+uint32_t reduce_reference(const std::vector<uint32_t>& values, ReduceOperation operation)
+{
+    switch( operation )
+    {
+    case ReduceOperation::SUM:
+        return std::accumulate(values.begin(), values.end(), 0u);
+    case ReduceOperation::MIN:
+        return values.empty() ? 0xffffffffu : *std::min_element(values.begin(), values.end());
+    default:
+        return values.empty() ? 0u : *std::max_element(values.begin(), values.end());
+    }
+}
+
+std::vector<uint32_t> scan_reference(const std::vector<uint32_t>& values, ScanMode mode)
+{
+    std::vector<uint32_t> result(values.size());
+    uint32_t running = 0;
+    for( size_t i = 0; i < values.size(); ++i )
+    {
+        result[i] = mode == ScanMode::INCLUSIVE ? running + values[i] : running;
+        running += values[i];
+    }
+    return result;
+}
+
+std::vector<uint32_t> histogram_reference(const std::vector<uint32_t>& values, uint32_t bin_count, uint32_t shift)
+{
+    std::vector<uint32_t> bins(bin_count, 0);
+    for( uint32_t value : values )
+    {
+        bins[(value >> shift) % bin_count]++;
+    }
+    return bins;
+}
+
+void sort_reference(std::vector<uint32_t>& keys, std::vector<uint32_t>* values)
+{
+    std::vector<uint32_t> order(keys.size());
+    std::iota(order.begin(), order.end(), 0u);
+    std::stable_sort(order.begin(), order.end(), [&keys](uint32_t a, uint32_t b) { return keys[a] < keys[b]; });
+
+    std::vector<uint32_t> sorted_keys(keys.size());
+    for( size_t i = 0; i < order.size(); ++i )
+    {
+        sorted_keys[i] = keys[order[i]];
+    }
+    keys.swap(sorted_keys);
+
+    if( values )
+    {
+        std::vector<uint32_t> sorted_values(values->size());
+        for( size_t i = 0; i < order.size(); ++i )
+        {
+            sorted_values[i] = (*values)[order[i]];
+        }
+        values->swap(sorted_values);
+    }
+}
+
+ComputePrimitives::ComputePrimitives(LogicalDevice& device, ShaderCache& shaders)
+    : device(device)
+{
+    if( !device.get_enabled_features().buffer_device_address )
+    {
+        throw std::runtime_error("Compute primitives need VK_KHR_buffer_device_address");
+    }
+
+    for( ComputePipeline& pipeline : pipelines )
+    {
+        pipeline.pipeline = VK_NULL_HANDLE;
+    }
+
+    struct KernelSource
+    {
+        const char* name;
+        const char* body;
+        uint32_t items;
+        const char* reduce_operation;
+    };
+    const KernelSource sources[KERNEL_COUNT] = {
+        { "reduce_sum", reduce_source, reduce_items, "0" },
+        { "reduce_min", reduce_source, reduce_items, "1" },
+        { "reduce_max", reduce_source, reduce_items, "2" },
+        { "scan", scan_source, scan_items, nullptr },
+        { "histogram", histogram_source, histogram_items, nullptr },
+        { "radix_histogram", radix_histogram_source, radix_histogram_items, nullptr },
+        { "radix_prefix", radix_prefix_source, 1, nullptr },
+        { "radix_onesweep", radix_onesweep_source, onesweep_items, nullptr },
+    };
+
+    // All compiled at once on the cache's threads.
+    std::vector<std::shared_future<std::vector<uint32_t>>> codes;
+    for( const KernelSource& kernel : sources )
+    {
+        ShaderSource source;
+        source.name = kernel.name;
+        source.text = std::string(kernel_prelude) + kernel.body;
+        source.language = ShaderLanguage::GLSL;
+        source.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+        source.entry_point = "main";
+        source.defines["WORKGROUP_SIZE"] = std::to_string(workgroup_size);
+        source.defines["ITEMS_PER_THREAD"] = std::to_string(kernel.items);
+        source.defines["MAX_BINS"] = std::to_string(max_histogram_bins);
+        if( kernel.reduce_operation )
+        {
+            source.defines["REDUCE_OPERATION"] = kernel.reduce_operation;
+        }
+        codes.push_back(shaders.request(source));
+    }
+
+    try
+    {
+        for( uint32_t kernel = 0; kernel < KERNEL_COUNT; ++kernel )
+        {
+            create_pipeline(static_cast<Kernel>(kernel), codes[kernel].get());
+        }
+    }
+    catch( ... )
+    {
+        for( ComputePipeline& pipeline : pipelines )
+        {
+            vkDestroyPipeline(device.get_device(), pipeline.pipeline, device.get_allocation_callbacks());
+        }
+        throw;
+    }
+}
+
+ComputePrimitives::~ComputePrimitives()
+{
+    for( ComputePipeline& pipeline : pipelines )
+    {
+        vkDestroyPipeline(device.get_device(), pipeline.pipeline, device.get_allocation_callbacks());
+    }
+}
+
+void ComputePrimitives::record_reduce(
+    VkCommandBuffer command_buffer,
+    Buffer& source,
+    Buffer& result,
+    uint32_t count,
+    ReduceOperation operation)
+{
+    check_buffer(source, count);
+    check_buffer(result, 1);
+
+    uint32_t identity = operation == ReduceOperation::MIN ? 0xffffffffu : 0u;
+    record_fill_barriers(command_buffer, [&]()
+    {
+        vkCmdFillBuffer(command_buffer, result.get_buffer(), 0, sizeof(uint32_t), identity);
+    });
+    if( count == 0 )
+    {
+        return;
+    }
+
+    ReduceParameters parameters;
+    parameters.source = source.get_device_address();
+    parameters.result = result.get_device_address();
+    parameters.count = count;
+
+    Kernel kernel = operation == ReduceOperation::SUM ? REDUCE_SUM
+        : operation == ReduceOperation::MIN ? REDUCE_MIN
+        : REDUCE_MAX;
+    dispatch(command_buffer, kernel, &parameters, get_group_count(count, workgroup_size * reduce_items));
+}
+
+void ComputePrimitives::record_scan(
+    VkCommandBuffer command_buffer,
+    Buffer& source,
+    Buffer& destination,
+    uint32_t count,
+    ScanMode mode)
+{
+    check_buffer(source, count);
+    check_buffer(destination, count);
+    if( count == 0 )
+    {
+        return;
+    }
+
+    uint32_t tiles = get_group_count(count, workgroup_size * scan_items);
+    VkDeviceSize state_size = (1 + VkDeviceSize(tiles) * 3) * sizeof(uint32_t);
+    Buffer& state = get_scratch(SCAN_STATE, state_size);
+
+    record_fill_barriers(command_buffer, [&]()
+    {
+        vkCmdFillBuffer(command_buffer, state.get_buffer(), 0, state_size, 0);
+    });
+
+    ScanParameters parameters;
+    parameters.source = source.get_device_address();
+    parameters.destination = destination.get_device_address();
+    parameters.state = state.get_device_address();
+    parameters.count = count;
+    parameters.inclusive = mode == ScanMode::INCLUSIVE ? 1 : 0;
+    dispatch(command_buffer, SCAN, &parameters, tiles);
+}
+
+void ComputePrimitives::record_histogram(
+    VkCommandBuffer command_buffer,
+    Buffer& source,
+    Buffer& bins,
+    uint32_t count,
+    uint32_t bin_count,
+    uint32_t shift)
+{
+    if( bin_count == 0 || bin_count > max_histogram_bins )
+    {
+        throw std::invalid_argument("Histogram bin count must be between 1 and max_histogram_bins");
+    }
+    if( shift >= 32 )
+    {
+        throw std::invalid_argument("Histogram shift must be below 32");
+    }
+    check_buffer(source, count);
+    check_buffer(bins, bin_count);
+
+    record_fill_barriers(command_buffer, [&]()
+    {
+        vkCmdFillBuffer(command_buffer, bins.get_buffer(), 0, bin_count * sizeof(uint32_t), 0);
+    });
+    if( count == 0 )
+    {
+        return;
+    }
+
+    HistogramParameters parameters;
+    parameters.source = source.get_device_address();
+    parameters.bins = bins.get_device_address();
+    parameters.count = count;
+    parameters.shift = shift;
+    parameters.bin_count = bin_count;
+    dispatch(command_buffer, HISTOGRAM, &parameters, get_group_count(count, workgroup_size * histogram_items));
+}
+
+void ComputePrimitives::record_sort(VkCommandBuffer command_buffer, Buffer& keys, uint32_t count)
+{
+    record_sort(command_buffer, keys, nullptr, count);
+}
+
+void ComputePrimitives::record_sort(VkCommandBuffer command_buffer, Buffer& keys, Buffer& values, uint32_t count)
+{
+    record_sort(command_buffer, keys, &values, count);
+}
+
+void ComputePrimitives::record_sort(VkCommandBuffer command_buffer, Buffer& keys, Buffer* values, uint32_t count)
+{
+    if( count > max_sort_count )
+    {
+        throw std::invalid_argument("Sort count exceeds max_sort_count");
+    }
+    check_buffer(keys, count);
+    if( values )
+    {
+        check_buffer(*values, count);
+    }
+    if( count <= 1 )
+    {
+        return;
+    }
+
+    uint32_t tiles = get_group_count(count, workgroup_size * onesweep_items);
+    VkDeviceSize pass_state_size = (1 + VkDeviceSize(tiles) * radix_digits) * sizeof(uint32_t);
+    VkDeviceSize histograms_size = radix_passes * radix_digits * sizeof(uint32_t);
+    VkDeviceSize array_size = VkDeviceSize(count) * sizeof(uint32_t);
+
+    Buffer& histograms = get_scratch(RADIX_HISTOGRAMS, histograms_size);
+    Buffer& state = get_scratch(RADIX_STATE, pass_state_size * radix_passes);
+    Buffer& temporary_keys = get_scratch(SORT_KEYS, array_size);
+    Buffer* temporary_values = values ? &get_scratch(SORT_VALUES, array_size) : nullptr;
+
+    record_fill_barriers(command_buffer, [&]()
+    {
+        vkCmdFillBuffer(command_buffer, histograms.get_buffer(), 0, histograms_size, 0);
+        vkCmdFillBuffer(command_buffer, state.get_buffer(), 0, pass_state_size * radix_passes, 0);
+    });
+
+    RadixHistogramParameters histogram_parameters;
+    histogram_parameters.keys = keys.get_device_address();
+    histogram_parameters.histograms = histograms.get_device_address();
+    histogram_parameters.count = count;
+    dispatch(command_buffer, RADIX_HISTOGRAM, &histogram_parameters,
+        get_group_count(count, workgroup_size * radix_histogram_items));
+    record_compute_barrier(command_buffer);
+
+    RadixPrefixParameters prefix_parameters;
+    prefix_parameters.histograms = histograms.get_device_address();
+    dispatch(command_buffer, RADIX_PREFIX, &prefix_parameters, radix_passes);
+
+    // An even number of passes between the buffers leaves the result where
+    // it started.
+    VkDeviceAddress key_addresses[2] = { keys.get_device_address(), temporary_keys.get_device_address() };
+    VkDeviceAddress value_addresses[2] = { 0, 0 };
+    if( values )
+    {
+        value_addresses[0] = values->get_device_address();
+        value_addresses[1] = temporary_values->get_device_address();
+    }
+
+    for( uint32_t pass = 0; pass < radix_passes; ++pass )
+    {
+        record_compute_barrier(command_buffer);
+
+        OnesweepParameters parameters;
+        parameters.keys_in = key_addresses[pass % 2];
+        parameters.keys_out = key_addresses[(pass + 1) % 2];
+        parameters.values_in = value_addresses[pass % 2];
+        parameters.values_out = value_addresses[(pass + 1) % 2];
+        parameters.offsets = histograms.get_device_address() + pass * radix_digits * sizeof(uint32_t);
+        parameters.state = state.get_device_address() + pass * pass_state_size;
+        parameters.count = count;
+        parameters.shift = pass * 8;
+        parameters.has_values = values ? 1 : 0;
+        dispatch(command_buffer, RADIX_ONESWEEP, &parameters, tiles);
+    }
+}
+
+void ComputePrimitives::create_pipeline(Kernel kernel, const std::vector<uint32_t>& code)
+{
+    // The push constant block is the whole layout.
+    std::vector<ShaderReflection> stages;
+    stages.push_back(reflect_spirv(code, "main"));
+    ReflectedLayout layout = merge_reflections(stages);
+
+    ComputePipeline& pipeline = pipelines[kernel];
+    pipeline.layout = device.get_layout_cache().get_pipeline_layout(layout).layout;
+    pipeline.push_constant_size = 0;
+    for( const VkPushConstantRange& range : layout.push_constants )
+    {
+        pipeline.push_constant_size = std::max(pipeline.push_constant_size, range.offset + range.size);
+    }
+
+    VkShaderModuleCreateInfo module_info;
+    module_info.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+    module_info.pNext = nullptr;
+    module_info.flags = 0;
+    module_info.codeSize = code.size() * sizeof(uint32_t);
+    module_info.pCode = code.data();
+
+    VkShaderModule module;
+    VkResult result = vkCreateShaderModule(device.get_device(), &module_info, device.get_allocation_callbacks(), &module);
+    if( result != VK_SUCCESS )
+    {
+        throw VulkanException(result, "Error while creating compute primitive shader module");
+    }
+
+    VkComputePipelineCreateInfo create_info;
+    create_info.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+    create_info.pNext = nullptr;
+    create_info.flags = 0;
+    create_info.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    create_info.stage.pNext = nullptr;
+    create_info.stage.flags = 0;
+    create_info.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+    create_info.stage.module = module;
+    create_info.stage.pName = "main";
+    create_info.stage.pSpecializationInfo = nullptr;
+    create_info.layout = pipeline.layout;
+    create_info.basePipelineHandle = VK_NULL_HANDLE;
+    create_info.basePipelineIndex = -1;
+
+    result = vkCreateComputePipelines(
+        device.get_device(), VK_NULL_HANDLE, 1, &create_info, device.get_allocation_callbacks(), &pipeline.pipeline);
+    vkDestroyShaderModule(device.get_device(), module, device.get_allocation_callbacks());
+    if( result != VK_SUCCESS )
+    {
+        pipeline.pipeline = VK_NULL_HANDLE;
+        throw VulkanException(result, "Error while creating compute primitive pipeline");
+    }
+}
+
+uint32_t ComputePrimitives::get_group_count(uint32_t count, uint32_t tile_size) const
+{
+    uint32_t groups = count / tile_size + (count % tile_size != 0 ? 1 : 0);
+    if( groups > device.get_properties().limits.maxComputeWorkGroupCount[0] )
+    {
+        throw std::invalid_argument("Compute primitive input has more tiles than one dispatch can run");
+    }
+    return groups;
+}
+
+Buffer& ComputePrimitives::get_scratch(Scratch scratch, VkDeviceSize size)
+{
+    std::unique_ptr<Buffer>& buffer = scratch_buffers[scratch];
+    if( buffer && buffer->get_size() >= size )
+    {
+        return *buffer;
+    }
+
+    // Command buffers recorded earlier may still use the old one.
+    if( buffer )
+    {
+        outgrown.push_back(std::move(buffer));
+    }
+    buffer = device.create_buffer(
+        size,
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT_KHR,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    return *buffer;
+}
+
+void ComputePrimitives::dispatch(VkCommandBuffer command_buffer, Kernel kernel, const void* parameters, uint32_t group_count)
+{
+    const ComputePipeline& pipeline = pipelines[kernel];
+    vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline.pipeline);
+    vkCmdPushConstants(command_buffer, pipeline.layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, pipeline.push_constant_size, parameters);
+    vkCmdDispatch(command_buffer, group_count, 1, 1);
+}
+
+}
@@ -0,0 +1,148 @@
+#pragma once
+
+#include "vulkan.h"
+#include "shaders.h"
+
+#include <map>
+#include <memory>
+#include <vector>
+
+namespace vulkan
+{
+
+enum class ReduceOperation
+{
+    SUM,
+    MIN,
+    MAX
+};
+
+enum class ScanMode
+{
+    EXCLUSIVE,
+    INCLUSIVE
+};
+
+/*  CPU versions of the GPU primitives, which tests compare against.  Sums
+    wrap around like the GPU's. */
+uint32_t reduce_reference(const std::vector<uint32_t>& values, ReduceOperation operation);
+std::vector<uint32_t> scan_reference(const std::vector<uint32_t>& values, ScanMode mode);
+std::vector<uint32_t> histogram_reference(const std::vector<uint32_t>& values, uint32_t bin_count, uint32_t shift);
+
+/*  Stable sort by key; values, if given, move with their keys. */
+void sort_reference(std::vector<uint32_t>& keys, std::vector<uint32_t>* values);
+
+/*  Data-parallel primitives on arrays of 32-bit unsigned integers:
+     - reduce: sum, min or max in one pass, with one atomic per workgroup.
+     - scan: prefix sum in one pass with decoupled look-back, where each
+       tile publishes its total and adds up its predecessors' totals while
+       they are still running, instead of a separate pass over tile sums.
+     - histogram: counts of (value >> shift) % bin_count, in workgroup
+       shared memory first.
+     - sort: LSD radix sort of keys or key/value pairs, 8 bits per pass, in
+       the onesweep arrangement: one histogram pass for all four digits,
+       then one pass per digit that ranks each tile locally and finds its
+       global offsets by decoupled look-back.
+    Tile indices are taken from an atomic counter in the order workgroups
+    start, so look-back only ever waits for workgroups that are running.
+
+    Kernels reach buffers by device address, so the device needs
+    VK_KHR_buffer_device_address and every buffer passed in needs
+    VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, as well as
+    VK_BUFFER_USAGE_TRANSFER_DST_BIT for the ones the primitive clears
+    first (reduce results and histogram bins).  The kernels are GLSL
+    compiled through the shader cache, so the first construction needs its
+    frontend.
+
+    record_* functions only record, the caller orders writes to the inputs
+    before and reads of the outputs after with barriers, as for any other
+    dispatch.  Buffer addresses are taken while recording, so a command
+    buffer has to be recorded again once the defragmenter moves one of its
+    buffers.  Scratch memory is shared between recordings, so command
+    buffers holding them have to execute in submission order on one queue;
+    outgrown scratch buffers are kept until the primitives are destroyed. */
+class ComputePrimitives
+{
+public:
+    ComputePrimitives(LogicalDevice& device, ShaderCache& shaders);
+    ~ComputePrimitives();
+
+    ComputePrimitives(const ComputePrimitives&) = delete;
+    ComputePrimitives& operator=(const ComputePrimitives&) = delete;
+
+    static const uint32_t max_histogram_bins = 2048;
+    static const uint32_t max_sort_count = (1u << 30) - 1;
+
+    /*  Writes the result to the first word of result. */
+    void record_reduce(
+        VkCommandBuffer command_buffer,
+        Buffer& source,
+        Buffer& result,
+        uint32_t count,
+        ReduceOperation operation);
+
+    /*  Source and destination may be the same buffer. */
+    void record_scan(
+        VkCommandBuffer command_buffer,
+        Buffer& source,
+        Buffer& destination,
+        uint32_t count,
+        ScanMode mode);
+
+    /*  Overwrites the first bin_count words of bins. */
+    void record_histogram(
+        VkCommandBuffer command_buffer,
+        Buffer& source,
+        Buffer& bins,
+        uint32_t count,
+        uint32_t bin_count,
+        uint32_t shift = 0);
+
+    /*  Sorts in place, ascending and stable. */
+    void record_sort(VkCommandBuffer command_buffer, Buffer& keys, uint32_t count);
+    void record_sort(VkCommandBuffer command_buffer, Buffer& keys, Buffer& values, uint32_t count);
+
+private:
+    enum Kernel
+    {
+        REDUCE_SUM,
+        REDUCE_MIN,
+        REDUCE_MAX,
+        SCAN,
+        HISTOGRAM,
+        RADIX_HISTOGRAM,
+        RADIX_PREFIX,
+        RADIX_ONESWEEP,
+        KERNEL_COUNT
+    };
+
+    enum Scratch
+    {
+        SCAN_STATE,
+        RADIX_HISTOGRAMS,
+        RADIX_STATE,
+        SORT_KEYS,
+        SORT_VALUES
+    };
+
+    struct ComputePipeline
+    {
+        VkPipeline pipeline;
+        VkPipelineLayout layout;
+        uint32_t push_constant_size;
+    };
+
+    void create_pipeline(Kernel kernel, const std::vector<uint32_t>& code);
+    uint32_t get_group_count(uint32_t count, uint32_t tile_size) const;
+    Buffer& get_scratch(Scratch scratch, VkDeviceSize size);
+
+    void dispatch(VkCommandBuffer command_buffer, Kernel kernel, const void* parameters, uint32_t group_count);
+    void record_sort(VkCommandBuffer command_buffer, Buffer& keys, Buffer* values, uint32_t count);
+
+    LogicalDevice& device;
+    ComputePipeline pipelines[KERNEL_COUNT];
+    std::map<Scratch, std::unique_ptr<Buffer>> scratch_buffers;
+    std::vector<std::unique_ptr<Buffer>> outgrown;
+};
+
+}
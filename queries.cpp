@@ -0,0 +1,339 @@
+#include "queries.h"
+
+namespace vulkan
+{
+
+// In the order vkGetQueryPoolResults writes them, which is bit order.
+static const VkQueryPipelineStatisticFlags statistic_flags =
+    VK_QUERY_PIPELINE_STATISTIC_INPUT_ASSEMBLY_VERTICES_BIT
+    | VK_QUERY_PIPELINE_STATISTIC_INPUT_ASSEMBLY_PRIMITIVES_BIT
+    | VK_QUERY_PIPELINE_STATISTIC_VERTEX_SHADER_INVOCATIONS_BIT
+    | VK_QUERY_PIPELINE_STATISTIC_CLIPPING_PRIMITIVES_BIT
+    | VK_QUERY_PIPELINE_STATISTIC_FRAGMENT_SHADER_INVOCATIONS_BIT
+    | VK_QUERY_PIPELINE_STATISTIC_COMPUTE_SHADER_INVOCATIONS_BIT;
+
+static const uint32_t statistic_count = 6;
+
+QueryResults::QueryResults()
+    : statistics_frame(0)
+    , gpu_frame_time(0.0)
+    , gpu_time_frame(0)
+    , missed_frames(0)
+    , missed_timestamps(0)
+{
+}
+
+void QueryResults::add_passes(
+    uint64_t frame_number,
+    const std::vector<std::string>& names,
+    VkResult occlusion_result,
+    const std::vector<uint64_t>& samples,
+    VkResult statistics_result,
+    const std::vector<uint64_t>& statistics)
+{
+    if( occlusion_result == VK_NOT_READY || statistics_result == VK_NOT_READY )
+    {
+        missed_frames++;
+        return;
+    }
+    if( occlusion_result != VK_SUCCESS )
+    {
+        throw VulkanException(occlusion_result, "Error while reading occlusion query results");
+    }
+    if( statistics_result != VK_SUCCESS )
+    {
+        throw VulkanException(statistics_result, "Error while reading pipeline statistics query results");
+    }
+
+    pass_statistics.clear();
+    for( size_t pass = 0; pass < names.size(); ++pass )
+    {
+        PassStatistics pass_result = {};
+        pass_result.name = names[pass];
+        pass_result.samples_passed = samples[pass];
+        if( !statistics.empty() )
+        {
+            const uint64_t* values = &statistics[pass * statistic_count];
+            pass_result.input_assembly_vertices = values[0];
+            pass_result.input_assembly_primitives = values[1];
+            pass_result.vertex_shader_invocations = values[2];
+            pass_result.clipping_primitives = values[3];
+            pass_result.fragment_shader_invocations = values[4];
+            pass_result.compute_shader_invocations = values[5];
+        }
+        pass_statistics.push_back(pass_result);
+    }
+    statistics_frame = frame_number;
+}
+
+void QueryResults::add_gpu_time(uint64_t frame_number, VkResult result, double milliseconds)
+{
+    if( result == VK_NOT_READY )
+    {
+        missed_timestamps++;
+        return;
+    }
+    if( result != VK_SUCCESS )
+    {
+        throw VulkanException(result, "Error while reading timestamp query results");
+    }
+
+    gpu_frame_time = milliseconds;
+    gpu_time_frame = frame_number;
+}
+
+const std::vector<PassStatistics>& QueryResults::get_pass_statistics() const
+{
+    return pass_statistics;
+}
+
+uint64_t QueryResults::get_statistics_frame() const
+{
+    return statistics_frame;
+}
+
+double QueryResults::get_gpu_frame_time() const
+{
+    return gpu_frame_time;
+}
+
+uint64_t QueryResults::get_gpu_time_frame() const
+{
+    return gpu_time_frame;
+}
+
+uint64_t QueryResults::get_missed_frames() const
+{
+    return missed_frames;
+}
+
+uint64_t QueryResults::get_missed_timestamps() const
+{
+    return missed_timestamps;
+}
+
+QueryManager::QueryManager(LogicalDevice& device, uint32_t frames_in_flight, uint32_t passes_per_frame)
+    : device(device)
+    , passes_per_frame(passes_per_frame)
+    , pipeline_statistics(device.get_enabled_features().pipeline_statistics_query)
+    , timestamps(false)
+    , timestamp_period(device.get_properties().limits.timestampPeriod)
+    , timestamp_mask(0)
+    , frame_number(0)
+    , dropped_passes(0)
+{
+    uint32_t family_count = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(device.get_physical_device(), &family_count, nullptr);
+    std::vector<VkQueueFamilyProperties> families(family_count);
+    vkGetPhysicalDeviceQueueFamilyProperties(device.get_physical_device(), &family_count, families.data());
+
+    uint32_t valid_bits = families[device.get_queue_family_index()].timestampValidBits;
+    if( valid_bits > 0 )
+    {
+        timestamps = true;
+        timestamp_mask = valid_bits >= 64 ? ~uint64_t(0) : (uint64_t(1) << valid_bits) - 1;
+    }
+
+    for( uint32_t i = 0; i < frames_in_flight; ++i )
+    {
+        Frame frame;
+        frame.occlusion_pool = create_pool(VK_QUERY_TYPE_OCCLUSION, passes_per_frame, 0);
+        frame.statistics_pool = pipeline_statistics
+            ? create_pool(VK_QUERY_TYPE_PIPELINE_STATISTICS, passes_per_frame, statistic_flags)
+            : VK_NULL_HANDLE;
+        frame.timestamp_pool = timestamps
+            ? create_pool(VK_QUERY_TYPE_TIMESTAMP, 2, 0)
+            : VK_NULL_HANDLE;
+        frame.number = 0;
+        frame.recorded = false;
+        frame.timed = false;
+        frames.push_back(frame);
+    }
+}
+
+QueryManager::~QueryManager()
+{
+    for( Frame& frame : frames )
+    {
+        vkDestroyQueryPool(device.get_device(), frame.occlusion_pool, device.get_allocation_callbacks());
+        vkDestroyQueryPool(device.get_device(), frame.statistics_pool, device.get_allocation_callbacks());
+        vkDestroyQueryPool(device.get_device(), frame.timestamp_pool, device.get_allocation_callbacks());
+    }
+}
+
+VkQueryPool QueryManager::create_pool(VkQueryType type, uint32_t count, VkQueryPipelineStatisticFlags statistics)
+{
+    VkQueryPoolCreateInfo create_info;
+    create_info.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+    create_info.pNext = nullptr;
+    create_info.flags = 0;
+    create_info.queryType = type;
+    create_info.queryCount = count;
+    create_info.pipelineStatistics = statistics;
+
+    VkQueryPool pool;
+    VkResult result = vkCreateQueryPool(device.get_device(), &create_info, device.get_allocation_callbacks(), &pool);
+    if( result != VK_SUCCESS )
+    {
+        throw VulkanException(result, "Error while creating query pool");
+    }
+    return pool;
+}
+
+void QueryManager::begin_frame(VkCommandBuffer command_buffer)
+{
+    Frame& frame = frames[frame_number % frames.size()];
+    if( frame.recorded )
+    {
+        read_results(frame);
+    }
+
+    vkCmdResetQueryPool(command_buffer, frame.occlusion_pool, 0, passes_per_frame);
+    if( pipeline_statistics )
+    {
+        vkCmdResetQueryPool(command_buffer, frame.statistics_pool, 0, passes_per_frame);
+    }
+    if( timestamps )
+    {
+        vkCmdResetQueryPool(command_buffer, frame.timestamp_pool, 0, 2);
+        vkCmdWriteTimestamp(command_buffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, frame.timestamp_pool, 0);
+    }
+
+    frame.pass_names.clear();
+    frame.number = frame_number++;
+    frame.recorded = true;
+    frame.timed = false;
+}
+
+void QueryManager::end_frame(VkCommandBuffer command_buffer)
+{
+    if( timestamps )
+    {
+        Frame& frame = frames[(frame_number - 1) % frames.size()];
+        vkCmdWriteTimestamp(command_buffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, frame.timestamp_pool, 1);
+        frame.timed = true;
+    }
+}
+
+uint32_t QueryManager::begin_pass(VkCommandBuffer command_buffer, const std::string& name)
+{
+    Frame& frame = frames[(frame_number - 1) % frames.size()];
+    if( frame.pass_names.size() == passes_per_frame )
+    {
+        dropped_passes++;
+        return no_pass;
+    }
+
+    uint32_t pass = static_cast<uint32_t>(frame.pass_names.size());
+    frame.pass_names.push_back(name);
+
+    vkCmdBeginQuery(command_buffer, frame.occlusion_pool, pass, 0);
+    if( pipeline_statistics )
+    {
+        vkCmdBeginQuery(command_buffer, frame.statistics_pool, pass, 0);
+    }
+    return pass;
+}
+
+void QueryManager::end_pass(VkCommandBuffer command_buffer, uint32_t pass)
+{
+    if( pass == no_pass )
+    {
+        return;
+    }
+
+    Frame& frame = frames[(frame_number - 1) % frames.size()];
+    if( pipeline_statistics )
+    {
+        vkCmdEndQuery(command_buffer, frame.statistics_pool, pass);
+    }
+    vkCmdEndQuery(command_buffer, frame.occlusion_pool, pass);
+}
+
+/*  Without VK_QUERY_RESULT_WAIT_BIT, so this never blocks.  If the GPU is
+    further behind than the number of frames in flight the frame is
+    counted as missed and the previous statistics stay.  Each pool is read
+    on its own, so one that is not ready does not hold back the others. */
+void QueryManager::read_results(Frame& frame)
+{
+    uint32_t pass_count = static_cast<uint32_t>(frame.pass_names.size());
+
+    std::vector<uint64_t> samples(pass_count);
+    std::vector<uint64_t> statistics(pipeline_statistics ? pass_count * statistic_count : 0);
+    VkResult occlusion_result = VK_SUCCESS;
+    VkResult statistics_result = VK_SUCCESS;
+    if( pass_count > 0 )
+    {
+        occlusion_result = vkGetQueryPoolResults(device.get_device(), frame.occlusion_pool, 0, pass_count,
+            samples.size() * sizeof(uint64_t), samples.data(), sizeof(uint64_t),
+            VK_QUERY_RESULT_64_BIT);
+    }
+    if( pass_count > 0 && pipeline_statistics )
+    {
+        statistics_result = vkGetQueryPoolResults(device.get_device(), frame.statistics_pool, 0, pass_count,
+            statistics.size() * sizeof(uint64_t), statistics.data(), statistic_count * sizeof(uint64_t),
+            VK_QUERY_RESULT_64_BIT);
+    }
+    results.add_passes(frame.number, frame.pass_names, occlusion_result, samples, statistics_result, statistics);
+
+    // Only frames that called end_frame() wrote their second timestamp.
+    if( timestamps && frame.timed )
+    {
+        uint64_t frame_timestamps[2] = {0, 0};
+        VkResult result = vkGetQueryPoolResults(device.get_device(), frame.timestamp_pool, 0, 2,
+            sizeof(frame_timestamps), frame_timestamps, sizeof(uint64_t),
+            VK_QUERY_RESULT_64_BIT);
+
+        // Timestamps wrap at timestampValidBits, the masked difference is
+        // right across one wrap.
+        uint64_t ticks = (frame_timestamps[1] - frame_timestamps[0]) & timestamp_mask;
+        results.add_gpu_time(frame.number, result, ticks * timestamp_period / 1e6);
+    }
+}
+
+bool QueryManager::has_pipeline_statistics() const
+{
+    return pipeline_statistics;
+}
+
+bool QueryManager::has_timestamps() const
+{
+    return timestamps;
+}
+
+const std::vector<PassStatistics>& QueryManager::get_pass_statistics() const
+{
+    return results.get_pass_statistics();
+}
+
+uint64_t QueryManager::get_statistics_frame() const
+{
+    return results.get_statistics_frame();
+}
+
+double QueryManager::get_gpu_frame_time() const
+{
+    return results.get_gpu_frame_time();
+}
+
+uint64_t QueryManager::get_gpu_time_frame() const
+{
+    return results.get_gpu_time_frame();
+}
+
+uint64_t QueryManager::get_missed_frames() const
+{
+    return results.get_missed_frames();
+}
+
+uint64_t QueryManager::get_missed_timestamps() const
+{
+    return results.get_missed_timestamps();
+}
+
+uint64_t QueryManager::get_dropped_passes() const
+{
+    return dropped_passes;
+}
+
+}
@@ -0,0 +1,153 @@
+#pragma once
+
+#include "vulkan.h"
+
+#include <string>
+#include <vector>
+
+namespace vulkan
+{
+
+/*  What one pass did on the GPU, read back from its queries.  The
+    pipeline statistics stay zero when the device lacks
+    pipelineStatisticsQuery. */
+struct PassStatistics
+{
+    std::string name;
+    uint64_t samples_passed;
+    uint64_t input_assembly_vertices;
+    uint64_t input_assembly_primitives;
+    uint64_t vertex_shader_invocations;
+    uint64_t clipping_primitives;
+    uint64_t fragment_shader_invocations;
+    uint64_t compute_shader_invocations;
+};
+
+/*  The newest results read back from a QueryManager's pools, and counts of
+    those that were not ready in time.  Pass results and GPU times come
+    from different pools and are taken on their own, so a frame that never
+    wrote its timestamps still reports its passes.  Needs no device. */
+class QueryResults
+{
+public:
+    QueryResults();
+
+    /*  Takes a frame's pass results, as read from the occlusion pool with
+        occlusion_result and the pipeline statistics pool with
+        statistics_result.  samples has one value per pass, statistics six
+        per pass in PassStatistics order, or none without pipeline
+        statistics.  If either pool was VK_NOT_READY the frame counts as
+        missed and the previous statistics stay; other errors throw. */
+    void add_passes(
+        uint64_t frame_number,
+        const std::vector<std::string>& names,
+        VkResult occlusion_result,
+        const std::vector<uint64_t>& samples,
+        VkResult statistics_result,
+        const std::vector<uint64_t>& statistics);
+
+    /*  Takes a frame's GPU time, as read from its timestamp pool with
+        result, the same way. */
+    void add_gpu_time(uint64_t frame_number, VkResult result, double milliseconds);
+
+    const std::vector<PassStatistics>& get_pass_statistics() const;
+    uint64_t get_statistics_frame() const;
+    double get_gpu_frame_time() const;
+    uint64_t get_gpu_time_frame() const;
+    uint64_t get_missed_frames() const;
+    uint64_t get_missed_timestamps() const;
+
+private:
+    std::vector<PassStatistics> pass_statistics;
+    uint64_t statistics_frame;
+    double gpu_frame_time;
+    uint64_t gpu_time_frame;
+    uint64_t missed_frames;
+    uint64_t missed_timestamps;
+};
+
+/*  Pools occlusion and pipeline statistics queries for a fixed number of
+    frames in flight.  Each frame gets its own query pools, which
+    begin_frame() resets with one vkCmdResetQueryPool apiece.  Results are
+    read without waiting when the frame's slot comes round again, by which
+    time the caller has waited on that frame's fence, so nothing stalls.
+
+    Passes are bracketed by begin_pass() / end_pass().  Occlusion queries
+    cannot nest, so neither can passes, and a pass containing draws has to
+    begin and end inside one subpass.
+
+    Where the queue supports timestamps, the GPU time of a frame is
+    measured from begin_frame() to end_frame(), for frames that call
+    end_frame(). */
+class QueryManager
+{
+public:
+    static const uint32_t no_pass = ~0u;
+
+    QueryManager(LogicalDevice& device, uint32_t frames_in_flight = 3, uint32_t passes_per_frame = 64);
+    ~QueryManager();
+
+    QueryManager(const QueryManager&) = delete;
+    QueryManager& operator=(const QueryManager&) = delete;
+
+    /*  Reads back the results of the frame that last used this slot and
+        resets the slot's pools.  Record it outside any render pass, before
+        the frame's first pass. */
+    void begin_frame(VkCommandBuffer command_buffer);
+
+    /*  Record after the frame's last pass, in the last command buffer. */
+    void end_frame(VkCommandBuffer command_buffer);
+
+    /*  Returns no_pass, and records nothing, once the frame is out of
+        queries. */
+    uint32_t begin_pass(VkCommandBuffer command_buffer, const std::string& name);
+    void end_pass(VkCommandBuffer command_buffer, uint32_t pass);
+
+    bool has_pipeline_statistics() const;
+    bool has_timestamps() const;
+
+    /*  Statistics of the newest frame whose results were available, and
+        the number of that frame counting from 0. */
+    const std::vector<PassStatistics>& get_pass_statistics() const;
+    uint64_t get_statistics_frame() const;
+
+    /*  GPU time in milliseconds of the newest frame whose timestamps were
+        available, and that frame's number; 0 without timestamps. */
+    double get_gpu_frame_time() const;
+    uint64_t get_gpu_time_frame() const;
+
+    /*  Frames whose pass results, or timestamps, were not ready in time,
+        and passes that did not get queries. */
+    uint64_t get_missed_frames() const;
+    uint64_t get_missed_timestamps() const;
+    uint64_t get_dropped_passes() const;
+
+private:
+    struct Frame
+    {
+        VkQueryPool occlusion_pool;
+        VkQueryPool statistics_pool;
+        VkQueryPool timestamp_pool;
+        std::vector<std::string> pass_names;
+        uint64_t number;
+        bool recorded;
+        bool timed;
+    };
+
+    VkQueryPool create_pool(VkQueryType type, uint32_t count, VkQueryPipelineStatisticFlags statistics);
+    void read_results(Frame& frame);
+
+    LogicalDevice& device;
+    uint32_t passes_per_frame;
+    bool pipeline_statistics;
+    bool timestamps;
+    double timestamp_period;
+    uint64_t timestamp_mask;
+    std::vector<Frame> frames;
+    uint64_t frame_number;
+
+    QueryResults results;
+    uint64_t dropped_passes;
+};
+
+}
@@ -0,0 +1,177 @@
+#include "queue.h"
+
+#include <iterator>
+
+namespace vulkan
+{
+
+Queue::Queue(VkQueue queue, uint32_t family_index)
+    : queue(queue)
+    , family_index(family_index)
+    , statistics()
+    , frame_submits(0)
+    , frame_command_buffers(0)
+{
+}
+
+VkQueue Queue::get_queue() const
+{
+    return queue;
+}
+
+uint32_t Queue::get_family_index() const
+{
+    return family_index;
+}
+
+void Queue::enqueue(const Submission& submission)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    pending.push_back(submission);
+}
+
+void Queue::flush(VkFence fence)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    VkResult result = submit_pending(nullptr, fence);
+    if( result != VK_SUCCESS )
+    {
+        throw VulkanException(result, "Error while submitting batched command buffers");
+    }
+}
+
+VkResult Queue::submit(const VkSubmitInfo& submit_info, VkFence fence)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return submit_pending(&submit_info, fence);
+}
+
+VkResult Queue::submit(std::vector<Submission>& submissions, VkFence fence)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    pending.insert(pending.end(),
+        std::make_move_iterator(submissions.begin()), std::make_move_iterator(submissions.end()));
+    submissions.clear();
+    return submit_pending(nullptr, fence);
+}
+
+void Queue::end_frame(VkFence fence)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    VkResult result = submit_pending(nullptr, fence);
+
+    statistics.frames++;
+    statistics.last_frame_submits = frame_submits;
+    statistics.last_frame_command_buffers = frame_command_buffers;
+    if( frame_submits > statistics.max_frame_submits )
+    {
+        statistics.max_frame_submits = frame_submits;
+    }
+    frame_submits = 0;
+    frame_command_buffers = 0;
+
+    if( result != VK_SUCCESS )
+    {
+        throw VulkanException(result, "Error while submitting batched command buffers");
+    }
+}
+
+void Queue::wait_idle()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    VkResult result = vkQueueWaitIdle(queue);
+    if( result != VK_SUCCESS )
+    {
+        throw VulkanException(result, "Error while waiting for queue to become idle");
+    }
+}
+
+SubmitStatistics Queue::get_statistics()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return statistics;
+}
+
+/*  Called with the mutex held.  A submission shares the previous
+    VkSubmitInfo unless it waits on semaphores or the previous one signals
+    some, which keeps the semaphore order intact. */
+VkResult Queue::submit_pending(const VkSubmitInfo* extra, VkFence fence)
+{
+    if( pending.empty() && !extra && fence == VK_NULL_HANDLE )
+    {
+        return VK_SUCCESS;
+    }
+
+    size_t wait_count = 0;
+    size_t command_buffer_count = 0;
+    size_t signal_count = 0;
+    for( auto& submission : pending )
+    {
+        wait_count += submission.wait_semaphores.size();
+        command_buffer_count += submission.command_buffers.size();
+        signal_count += submission.signal_semaphores.size();
+    }
+
+    // Reserved up front, the VkSubmitInfos point into these.
+    std::vector<VkSemaphore> wait_semaphores;
+    std::vector<VkPipelineStageFlags> wait_stages;
+    std::vector<VkCommandBuffer> command_buffers;
+    std::vector<VkSemaphore> signal_semaphores;
+    wait_semaphores.reserve(wait_count);
+    wait_stages.reserve(wait_count);
+    command_buffers.reserve(command_buffer_count);
+    signal_semaphores.reserve(signal_count);
+
+    std::vector<VkSubmitInfo> submit_infos;
+    for( auto& submission : pending )
+    {
+        if( submit_infos.empty()
+            || !submission.wait_semaphores.empty()
+            || submit_infos.back().signalSemaphoreCount > 0 )
+        {
+            VkSubmitInfo submit_info;
+            submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+            submit_info.pNext = nullptr;
+            submit_info.waitSemaphoreCount = 0;
+            submit_info.pWaitSemaphores = wait_semaphores.data() + wait_semaphores.size();
+            submit_info.pWaitDstStageMask = wait_stages.data() + wait_stages.size();
+            submit_info.commandBufferCount = 0;
+            submit_info.pCommandBuffers = command_buffers.data() + command_buffers.size();
+            submit_info.signalSemaphoreCount = 0;
+            submit_info.pSignalSemaphores = signal_semaphores.data() + signal_semaphores.size();
+            submit_infos.push_back(submit_info);
+        }
+
+        VkSubmitInfo& submit_info = submit_infos.back();
+        wait_semaphores.insert(wait_semaphores.end(),
+            submission.wait_semaphores.begin(), submission.wait_semaphores.end());
+        wait_stages.insert(wait_stages.end(),
+            submission.wait_stages.begin(), submission.wait_stages.end());
+        command_buffers.insert(command_buffers.end(),
+            submission.command_buffers.begin(), submission.command_buffers.end());
+        signal_semaphores.insert(signal_semaphores.end(),
+            submission.signal_semaphores.begin(), submission.signal_semaphores.end());
+        submit_info.waitSemaphoreCount += static_cast<uint32_t>(submission.wait_semaphores.size());
+        submit_info.commandBufferCount += static_cast<uint32_t>(submission.command_buffers.size());
+        submit_info.signalSemaphoreCount += static_cast<uint32_t>(submission.signal_semaphores.size());
+    }
+
+    if( extra )
+    {
+        submit_infos.push_back(*extra);
+        command_buffer_count += extra->commandBufferCount;
+    }
+    pending.clear();
+
+    VkResult result = vkQueueSubmit(queue,
+        static_cast<uint32_t>(submit_infos.size()), submit_infos.data(), fence);
+
+    statistics.submits++;
+    statistics.submit_infos += submit_infos.size();
+    statistics.command_buffers += command_buffer_count;
+    frame_submits++;
+    frame_command_buffers += static_cast<uint32_t>(command_buffer_count);
+    return result;
+}
+
+}
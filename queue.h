@@ -0,0 +1,86 @@
+#pragma once
+
+#include "vulkan.h"
+
+#include <mutex>
+#include <vector>
+
+namespace vulkan
+{
+
+/*  Work a producer hands to a Queue in one piece: semaphores to wait on
+    before its command buffers run, and semaphores to signal after. */
+struct Submission
+{
+    std::vector<VkSemaphore> wait_semaphores;
+    std::vector<VkPipelineStageFlags> wait_stages;
+    std::vector<VkCommandBuffer> command_buffers;
+    std::vector<VkSemaphore> signal_semaphores;
+};
+
+/*  vkQueueSubmit calls and the command buffers and VkSubmitInfos they
+    carried, for the last finished frame and in total. */
+struct SubmitStatistics
+{
+    uint64_t frames;
+    uint64_t submits;
+    uint64_t submit_infos;
+    uint64_t command_buffers;
+    uint32_t last_frame_submits;
+    uint32_t last_frame_command_buffers;
+    uint32_t max_frame_submits;
+};
+
+/*  Serializes access to a VkQueue, which Vulkan requires to be externally
+    synchronized, and batches submissions.  Producers on any thread
+    enqueue() their work during a frame; flush() then hands all of it to
+    the driver in a single vkQueueSubmit, merging consecutive submissions
+    into one VkSubmitInfo where no semaphore separates them.  Work runs in
+    the order it was enqueued. */
+class Queue
+{
+public:
+    Queue(VkQueue queue, uint32_t family_index);
+
+    Queue(const Queue&) = delete;
+    Queue& operator=(const Queue&) = delete;
+
+    VkQueue get_queue() const;
+    uint32_t get_family_index() const;
+
+    void enqueue(const Submission& submission);
+
+    /*  Submits everything enqueued so far.  The fence, if any, signals once
+        all of it has completed. */
+    void flush(VkFence fence = VK_NULL_HANDLE);
+
+    /*  Submits the enqueued work followed by submit_info in one call, for
+        callers that need their work on the GPU now.  Returns the result of
+        vkQueueSubmit. */
+    VkResult submit(const VkSubmitInfo& submit_info, VkFence fence);
+
+    /*  Submits the enqueued work followed by the submissions, which are
+        moved out of the vector, in one call. */
+    VkResult submit(std::vector<Submission>& submissions, VkFence fence);
+
+    /*  Flushes and closes the frame's counters. */
+    void end_frame(VkFence fence = VK_NULL_HANDLE);
+
+    void wait_idle();
+
+    SubmitStatistics get_statistics();
+
+private:
+    VkResult submit_pending(const VkSubmitInfo* extra, VkFence fence);
+
+    VkQueue queue;
+    uint32_t family_index;
+
+    std::mutex mutex;
+    std::vector<Submission> pending;
+    SubmitStatistics statistics;
+    uint32_t frame_submits;
+    uint32_t frame_command_buffers;
+};
+
+}
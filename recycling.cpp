@@ -0,0 +1,317 @@
+#include "recycling.h"
+
+namespace vulkan
+{
+
+static void clear_statistics(RecyclingStatistics& statistics)
+{
+    statistics.created = 0;
+    statistics.acquired = 0;
+    statistics.resets = 0;
+    statistics.in_use = 0;
+    statistics.high_water_mark = 0;
+}
+
+static void count_acquire(RecyclingStatistics& statistics)
+{
+    statistics.acquired++;
+    statistics.in_use++;
+    if( statistics.in_use > statistics.high_water_mark )
+    {
+        statistics.high_water_mark = statistics.in_use;
+    }
+}
+
+FencePool::FencePool(LogicalDevice& device)
+    : device(device)
+{
+    clear_statistics(statistics);
+}
+
+FencePool::~FencePool()
+{
+    for( VkFence fence : owned )
+    {
+        vkDestroyFence(device.get_device(), fence, device.get_allocation_callbacks());
+    }
+}
+
+VkFence FencePool::acquire()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    if( free.empty() && !released.empty() )
+    {
+        reset_released();
+    }
+
+    VkFence fence;
+    if( !free.empty() )
+    {
+        fence = free.back();
+        free.pop_back();
+    }
+    else
+    {
+        VkFenceCreateInfo fence_info;
+        fence_info.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+        fence_info.pNext = nullptr;
+        fence_info.flags = 0;
+
+        VkResult result = vkCreateFence(device.get_device(), &fence_info, device.get_allocation_callbacks(), &fence);
+        if( result != VK_SUCCESS )
+        {
+            throw VulkanException(result, "Error while creating pooled fence");
+        }
+        owned.push_back(fence);
+        statistics.created++;
+    }
+
+    count_acquire(statistics);
+    return fence;
+}
+
+void FencePool::release(VkFence fence)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    released.push_back(fence);
+    statistics.in_use--;
+}
+
+void FencePool::release(const std::vector<VkFence>& fences)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    released.insert(released.end(), fences.begin(), fences.end());
+    statistics.in_use -= static_cast<uint32_t>(fences.size());
+}
+
+RecyclingStatistics FencePool::get_statistics()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return statistics;
+}
+
+void FencePool::reset_released()
+{
+    VkResult result = vkResetFences(device.get_device(), static_cast<uint32_t>(released.size()), released.data());
+    if( result != VK_SUCCESS )
+    {
+        throw VulkanException(result, "Error while resetting pooled fences");
+    }
+    statistics.resets++;
+    free.insert(free.end(), released.begin(), released.end());
+    released.clear();
+}
+
+SemaphorePool::SemaphorePool(LogicalDevice& device)
+    : device(device)
+{
+    clear_statistics(statistics);
+}
+
+SemaphorePool::~SemaphorePool()
+{
+    for( VkSemaphore semaphore : owned )
+    {
+        vkDestroySemaphore(device.get_device(), semaphore, device.get_allocation_callbacks());
+    }
+}
+
+VkSemaphore SemaphorePool::acquire()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    VkSemaphore semaphore;
+    if( !free.empty() )
+    {
+        semaphore = free.back();
+        free.pop_back();
+    }
+    else
+    {
+        VkSemaphoreCreateInfo semaphore_info;
+        semaphore_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+        semaphore_info.pNext = nullptr;
+        semaphore_info.flags = 0;
+
+        VkResult result = vkCreateSemaphore(device.get_device(), &semaphore_info,
+            device.get_allocation_callbacks(), &semaphore);
+        if( result != VK_SUCCESS )
+        {
+            throw VulkanException(result, "Error while creating pooled semaphore");
+        }
+        owned.push_back(semaphore);
+        statistics.created++;
+    }
+
+    count_acquire(statistics);
+    return semaphore;
+}
+
+void SemaphorePool::release(VkSemaphore semaphore)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    free.push_back(semaphore);
+    statistics.in_use--;
+}
+
+RecyclingStatistics SemaphorePool::get_statistics()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return statistics;
+}
+
+EventPool::EventPool(LogicalDevice& device)
+    : device(device)
+{
+    clear_statistics(statistics);
+}
+
+EventPool::~EventPool()
+{
+    for( VkEvent event : owned )
+    {
+        vkDestroyEvent(device.get_device(), event, device.get_allocation_callbacks());
+    }
+}
+
+VkEvent EventPool::acquire()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    VkEvent event;
+    if( !free.empty() )
+    {
+        event = free.back();
+        free.pop_back();
+    }
+    else
+    {
+        VkEventCreateInfo event_info;
+        event_info.sType = VK_STRUCTURE_TYPE_EVENT_CREATE_INFO;
+        event_info.pNext = nullptr;
+        event_info.flags = 0;
+
+        VkResult result = vkCreateEvent(device.get_device(), &event_info, device.get_allocation_callbacks(), &event);
+        if( result != VK_SUCCESS )
+        {
+            throw VulkanException(result, "Error while creating pooled event");
+        }
+        owned.push_back(event);
+        statistics.created++;
+    }
+
+    count_acquire(statistics);
+    return event;
+}
+
+void EventPool::release(VkEvent event)
+{
+    VkResult result = vkResetEvent(device.get_device(), event);
+    if( result != VK_SUCCESS )
+    {
+        throw VulkanException(result, "Error while resetting pooled event");
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    free.push_back(event);
+    statistics.in_use--;
+    statistics.resets++;
+}
+
+RecyclingStatistics EventPool::get_statistics()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return statistics;
+}
+
+CommandBufferPool::CommandBufferPool(LogicalDevice& device)
+    : device(device)
+{
+    VkCommandPoolCreateInfo pool_info;
+    pool_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    pool_info.pNext = nullptr;
+    pool_info.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+    pool_info.queueFamilyIndex = device.get_queue_family_index();
+
+    VkResult result = vkCreateCommandPool(device.get_device(), &pool_info,
+        device.get_allocation_callbacks(), &command_pool);
+    if( result != VK_SUCCESS )
+    {
+        throw VulkanException(result, "Error while creating recycling command pool");
+    }
+
+    for( Level& level : levels )
+    {
+        level.used = 0;
+    }
+    clear_statistics(statistics);
+}
+
+CommandBufferPool::~CommandBufferPool()
+{
+    // Destroying the pool frees its command buffers.
+    vkDestroyCommandPool(device.get_device(), command_pool, device.get_allocation_callbacks());
+}
+
+VkCommandBuffer CommandBufferPool::acquire(VkCommandBufferLevel level)
+{
+    Level& pooled = levels[level == VK_COMMAND_BUFFER_LEVEL_SECONDARY ? 1 : 0];
+
+    if( pooled.used == pooled.command_buffers.size() )
+    {
+        VkCommandBufferAllocateInfo allocate_info;
+        allocate_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        allocate_info.pNext = nullptr;
+        allocate_info.commandPool = command_pool;
+        allocate_info.level = level;
+        allocate_info.commandBufferCount = 1;
+
+        VkCommandBuffer command_buffer;
+        VkResult result = vkAllocateCommandBuffers(device.get_device(), &allocate_info, &command_buffer);
+        if( result != VK_SUCCESS )
+        {
+            throw VulkanException(result, "Error while allocating pooled command buffer");
+        }
+        pooled.command_buffers.push_back(command_buffer);
+        statistics.created++;
+    }
+
+    count_acquire(statistics);
+    return pooled.command_buffers[pooled.used++];
+}
+
+void CommandBufferPool::reset()
+{
+    if( statistics.in_use == 0 )
+    {
+        return;
+    }
+
+    // Keeps the memory the command buffers grew to for the next frame,
+    // which will likely record about as much again.
+    VkResult result = vkResetCommandPool(device.get_device(), command_pool, 0);
+    if( result != VK_SUCCESS )
+    {
+        throw VulkanException(result, "Error while resetting recycling command pool");
+    }
+
+    for( Level& level : levels )
+    {
+        level.used = 0;
+    }
+    statistics.in_use = 0;
+    statistics.resets++;
+}
+
+VkCommandPool CommandBufferPool::get_command_pool() const
+{
+    return command_pool;
+}
+
+const RecyclingStatistics& CommandBufferPool::get_statistics() const
+{
+    return statistics;
+}
+
+}
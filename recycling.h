@@ -0,0 +1,146 @@
+#pragma once
+
+#include "vulkan.h"
+
+#include <mutex>
+#include <vector>
+
+namespace vulkan
+{
+
+/*  How much a pool had to go to the driver.  in_use counts objects handed
+    out and not given back yet, high_water_mark the most that ever were at
+    once, which is how many the pool ends up owning. */
+struct RecyclingStatistics
+{
+    uint64_t created;
+    uint64_t acquired;
+    uint64_t resets;
+    uint32_t in_use;
+    uint32_t high_water_mark;
+};
+
+/*  Hands out unsignaled fences.  Released fences may still be signaled;
+    they are reset all together with one vkResetFences call when the pool
+    runs out of clean ones.  Safe to use from any thread. */
+class FencePool
+{
+public:
+    explicit FencePool(LogicalDevice& device);
+    ~FencePool();
+
+    FencePool(const FencePool&) = delete;
+    FencePool& operator=(const FencePool&) = delete;
+
+    VkFence acquire();
+
+    /*  The fence must not be pending on a queue any more: either it was
+        never submitted or it has been waited for. */
+    void release(VkFence fence);
+    void release(const std::vector<VkFence>& fences);
+
+    RecyclingStatistics get_statistics();
+
+private:
+    void reset_released();
+
+    LogicalDevice& device;
+    std::mutex mutex;
+    std::vector<VkFence> owned;
+    std::vector<VkFence> free;
+    std::vector<VkFence> released;
+    RecyclingStatistics statistics;
+};
+
+/*  Hands out binary semaphores.  Safe to use from any thread. */
+class SemaphorePool
+{
+public:
+    explicit SemaphorePool(LogicalDevice& device);
+    ~SemaphorePool();
+
+    SemaphorePool(const SemaphorePool&) = delete;
+    SemaphorePool& operator=(const SemaphorePool&) = delete;
+
+    VkSemaphore acquire();
+
+    /*  Binary semaphores cannot be reset, so the semaphore must be
+        unsignaled with no signal or wait pending: the submission that
+        waited on it last must have completed. */
+    void release(VkSemaphore semaphore);
+
+    RecyclingStatistics get_statistics();
+
+private:
+    LogicalDevice& device;
+    std::mutex mutex;
+    std::vector<VkSemaphore> owned;
+    std::vector<VkSemaphore> free;
+    RecyclingStatistics statistics;
+};
+
+/*  Hands out unset events.  Events are reset from the host on release,
+    as there is no call to reset several at once.  Safe to use from any
+    thread. */
+class EventPool
+{
+public:
+    explicit EventPool(LogicalDevice& device);
+    ~EventPool();
+
+    EventPool(const EventPool&) = delete;
+    EventPool& operator=(const EventPool&) = delete;
+
+    VkEvent acquire();
+
+    /*  No command buffer using the event may still be pending. */
+    void release(VkEvent event);
+
+    RecyclingStatistics get_statistics();
+
+private:
+    LogicalDevice& device;
+    std::mutex mutex;
+    std::vector<VkEvent> owned;
+    std::vector<VkEvent> free;
+    RecyclingStatistics statistics;
+};
+
+/*  Command buffers allocated from a transient VkCommandPool and never
+    freed one by one: reset() recycles all of them with vkResetCommandPool.
+    Like the VkCommandPool, it belongs to one thread; keep one per thread
+    and frame in flight, and reset it once the frame's fence signaled. */
+class CommandBufferPool
+{
+public:
+    explicit CommandBufferPool(LogicalDevice& device);
+    ~CommandBufferPool();
+
+    CommandBufferPool(const CommandBufferPool&) = delete;
+    CommandBufferPool& operator=(const CommandBufferPool&) = delete;
+
+    /*  A command buffer in the initial state, ready for
+        vkBeginCommandBuffer. */
+    VkCommandBuffer acquire(VkCommandBufferLevel level = VK_COMMAND_BUFFER_LEVEL_PRIMARY);
+
+    /*  Returns every command buffer handed out since the last reset.  None
+        of them may still be pending. */
+    void reset();
+
+    VkCommandPool get_command_pool() const;
+    const RecyclingStatistics& get_statistics() const;
+
+private:
+    struct Level
+    {
+        std::vector<VkCommandBuffer> command_buffers;
+        size_t used;
+    };
+
+    LogicalDevice& device;
+    VkCommandPool command_pool;
+    Level levels[2];
+    RecyclingStatistics statistics;
+};
+
+}
@@ -0,0 +1,889 @@
+#include "reflection.h"
+#include "hash.h"
+
+#include <algorithm>
+#include <set>
+#include <stdexcept>
+
+namespace vulkan
+{
+
+static const uint32_t spirv_magic = 0x07230203;
+
+// From this version on, entry point interfaces list every global variable
+// the entry point uses, not just its inputs and outputs.
+static const uint32_t spirv_version_1_4 = 0x00010400;
+
+// The opcodes, decorations and enumerants of the SPIR-V specification that
+// reflection needs.
+static const uint32_t op_name = 5;
+static const uint32_t op_line = 8;
+static const uint32_t op_entry_point = 15;
+static const uint32_t op_type_bool = 20;
+static const uint32_t op_type_int = 21;
+static const uint32_t op_type_float = 22;
+static const uint32_t op_type_vector = 23;
+static const uint32_t op_type_matrix = 24;
+static const uint32_t op_type_image = 25;
+static const uint32_t op_type_sampler = 26;
+static const uint32_t op_type_sampled_image = 27;
+static const uint32_t op_type_array = 28;
+static const uint32_t op_type_runtime_array = 29;
+static const uint32_t op_type_struct = 30;
+static const uint32_t op_type_pointer = 32;
+static const uint32_t op_constant = 43;
+static const uint32_t op_spec_constant_true = 48;
+static const uint32_t op_spec_constant_false = 49;
+static const uint32_t op_spec_constant = 50;
+static const uint32_t op_function = 54;
+static const uint32_t op_function_end = 56;
+static const uint32_t op_function_call = 57;
+static const uint32_t op_variable = 59;
+static const uint32_t op_decorate = 71;
+static const uint32_t op_member_decorate = 72;
+static const uint32_t op_type_acceleration_structure = 5341;
+
+static const uint32_t decoration_spec_id = 1;
+static const uint32_t decoration_buffer_block = 3;
+static const uint32_t decoration_array_stride = 6;
+static const uint32_t decoration_matrix_stride = 7;
+static const uint32_t decoration_built_in = 11;
+static const uint32_t decoration_location = 30;
+static const uint32_t decoration_binding = 33;
+static const uint32_t decoration_descriptor_set = 34;
+static const uint32_t decoration_offset = 35;
+
+static const uint32_t storage_uniform_constant = 0;
+static const uint32_t storage_input = 1;
+static const uint32_t storage_uniform = 2;
+static const uint32_t storage_push_constant = 9;
+static const uint32_t storage_storage_buffer = 12;
+static const uint32_t storage_physical_storage_buffer = 5349;
+
+static const uint32_t dim_buffer = 5;
+static const uint32_t dim_subpass_data = 6;
+
+/*  The parts of a module reflection looks at, by result id. */
+struct SpirvModule
+{
+    struct EntryPoint
+    {
+        uint32_t execution_model;
+        uint32_t function;
+        std::string name;
+        std::vector<uint32_t> interface;
+    };
+
+    /*  The functions a function calls and the global variables its
+        instructions name. */
+    struct Function
+    {
+        std::vector<uint32_t> calls;
+        std::set<uint32_t> variables;
+    };
+
+    struct Variable
+    {
+        uint32_t id;
+        uint32_t pointer_type;
+        uint32_t storage_class;
+    };
+
+    std::map<uint32_t, std::string> names;
+    std::map<uint32_t, std::map<uint32_t, uint32_t>> decorations;
+    std::map<std::pair<uint32_t, uint32_t>, std::map<uint32_t, uint32_t>> member_decorations;
+    std::map<uint32_t, std::vector<uint32_t>> types;        // the whole instruction
+    std::map<uint32_t, uint32_t> constants;                 // the low word
+    std::vector<std::pair<uint32_t, uint32_t>> spec_constants;
+    uint32_t version;
+    std::vector<EntryPoint> entry_points;
+    std::vector<Variable> variables;
+    std::set<uint32_t> variable_ids;
+    std::map<uint32_t, Function> functions;
+
+    bool has_decoration(uint32_t id, uint32_t decoration) const
+    {
+        auto found = decorations.find(id);
+        return found != decorations.end() && found->second.count(decoration) != 0;
+    }
+
+    uint32_t get_decoration(uint32_t id, uint32_t decoration, uint32_t fallback = 0) const
+    {
+        auto found = decorations.find(id);
+        if( found == decorations.end() || found->second.count(decoration) == 0 )
+        {
+            return fallback;
+        }
+        return found->second.at(decoration);
+    }
+
+    uint32_t get_member_decoration(uint32_t id, uint32_t member, uint32_t decoration, uint32_t fallback = 0) const
+    {
+        auto found = member_decorations.find(std::make_pair(id, member));
+        if( found == member_decorations.end() || found->second.count(decoration) == 0 )
+        {
+            return fallback;
+        }
+        return found->second.at(decoration);
+    }
+
+    const std::vector<uint32_t>& get_type(uint32_t id) const
+    {
+        auto found = types.find(id);
+        if( found == types.end() )
+        {
+            throw std::invalid_argument("SPIR-V refers to an undeclared type");
+        }
+        return found->second;
+    }
+
+    /*  Array lengths have to be plain constants, not specialization
+        constants, to be reflected. */
+    uint32_t get_constant(uint32_t id) const
+    {
+        auto found = constants.find(id);
+        if( found == constants.end() )
+        {
+            throw std::invalid_argument("SPIR-V array length is not a constant");
+        }
+        return found->second;
+    }
+
+    std::string get_name(uint32_t id) const
+    {
+        auto found = names.find(id);
+        return found != names.end() ? found->second : std::string();
+    }
+
+    /*  The global variables the entry point uses.  Before SPIR-V 1.4 its
+        interface lists only inputs and outputs, and the others are found
+        by walking the functions it calls.  The walk takes every operand
+        that names a variable, so a literal that matches one's id can keep
+        an unused variable, but a used one is never missed. */
+    std::set<uint32_t> get_used_variables(const EntryPoint& entry_point) const
+    {
+        std::set<uint32_t> used(entry_point.interface.begin(), entry_point.interface.end());
+        if( version >= spirv_version_1_4 )
+        {
+            return used;
+        }
+
+        std::set<uint32_t> visited;
+        std::vector<uint32_t> pending(1, entry_point.function);
+        while( !pending.empty() )
+        {
+            uint32_t function_id = pending.back();
+            pending.pop_back();
+            auto found = functions.find(function_id);
+            if( found == functions.end() || !visited.insert(function_id).second )
+            {
+                continue;
+            }
+            used.insert(found->second.variables.begin(), found->second.variables.end());
+            pending.insert(pending.end(), found->second.calls.begin(), found->second.calls.end());
+        }
+        return used;
+    }
+};
+
+/*  A literal string starting at words[0], which is nul-terminated and
+    padded to whole words.  Returns the number of words it takes. */
+static size_t read_string(const uint32_t* words, size_t word_count, std::string& text)
+{
+    text.clear();
+    for( size_t i = 0; i < word_count; ++i )
+    {
+        for( uint32_t byte = 0; byte < 4; ++byte )
+        {
+            char c = static_cast<char>((words[i] >> (byte * 8)) & 0xff);
+            if( c == '\0' )
+            {
+                return i + 1;
+            }
+            text.push_back(c);
+        }
+    }
+    throw std::invalid_argument("SPIR-V string is not terminated");
+}
+
+static SpirvModule parse_spirv(const std::vector<uint32_t>& code)
+{
+    if( code.size() < 5 || code[0] != spirv_magic )
+    {
+        throw std::invalid_argument("Code is not SPIR-V");
+    }
+
+    SpirvModule module;
+    module.version = code[1];
+
+    // Global variables are all declared before the first function.
+    SpirvModule::Function* function = nullptr;
+    for( size_t i = 5; i < code.size(); )
+    {
+        uint32_t opcode = code[i] & 0xffff;
+        uint32_t word_count = code[i] >> 16;
+        if( word_count == 0 || i + word_count > code.size() )
+        {
+            throw std::invalid_argument("SPIR-V instruction runs past the end of the code");
+        }
+        const uint32_t* words = &code[i];
+
+        if( function != nullptr && opcode != op_line )
+        {
+            for( uint32_t word = 1; word < word_count; ++word )
+            {
+                if( module.variable_ids.count(words[word]) )
+                {
+                    function->variables.insert(words[word]);
+                }
+            }
+        }
+
+        switch( opcode )
+        {
+        case op_name:
+            if( word_count >= 3 )
+            {
+                read_string(words + 2, word_count - 2, module.names[words[1]]);
+            }
+            break;
+
+        case op_entry_point:
+            if( word_count >= 4 )
+            {
+                SpirvModule::EntryPoint entry_point;
+                entry_point.execution_model = words[1];
+                entry_point.function = words[2];
+                size_t name_words = read_string(words + 3, word_count - 3, entry_point.name);
+                entry_point.interface.assign(words + 3 + name_words, words + word_count);
+                module.entry_points.push_back(entry_point);
+            }
+            break;
+
+        case op_decorate:
+            if( word_count >= 3 )
+            {
+                module.decorations[words[1]][words[2]] = word_count >= 4 ? words[3] : 0;
+            }
+            break;
+
+        case op_member_decorate:
+            if( word_count >= 4 )
+            {
+                module.member_decorations[std::make_pair(words[1], words[2])][words[3]] = word_count >= 5 ? words[4] : 0;
+            }
+            break;
+
+        case op_type_bool:
+        case op_type_int:
+        case op_type_float:
+        case op_type_vector:
+        case op_type_matrix:
+        case op_type_image:
+        case op_type_sampler:
+        case op_type_sampled_image:
+        case op_type_array:
+        case op_type_runtime_array:
+        case op_type_struct:
+        case op_type_pointer:
+        case op_type_acceleration_structure:
+            if( word_count >= 2 )
+            {
+                module.types[words[1]].assign(words, words + word_count);
+            }
+            break;
+
+        case op_constant:
+            if( word_count >= 4 )
+            {
+                module.constants[words[2]] = words[3];
+            }
+            break;
+
+        case op_spec_constant_true:
+        case op_spec_constant_false:
+            if( word_count >= 3 )
+            {
+                module.spec_constants.push_back(std::make_pair(words[2], opcode == op_spec_constant_true ? 1u : 0u));
+            }
+            break;
+
+        case op_spec_constant:
+            if( word_count >= 4 )
+            {
+                module.spec_constants.push_back(std::make_pair(words[2], words[3]));
+            }
+            break;
+
+        case op_function:
+            if( word_count >= 3 )
+            {
+                function = &module.functions[words[2]];
+            }
+            break;
+
+        case op_function_end:
+            function = nullptr;
+            break;
+
+        case op_function_call:
+            if( function != nullptr && word_count >= 4 )
+            {
+                function->calls.push_back(words[3]);
+            }
+            break;
+
+        case op_variable:
+            // Variables inside functions are locals, not resources.
+            if( function == nullptr && word_count >= 4 )
+            {
+                SpirvModule::Variable variable;
+                variable.pointer_type = words[1];
+                variable.id = words[2];
+                variable.storage_class = words[3];
+                module.variables.push_back(variable);
+                module.variable_ids.insert(variable.id);
+            }
+            break;
+        }
+
+        i += word_count;
+    }
+    return module;
+}
+
+static VkShaderStageFlagBits get_stage(uint32_t execution_model)
+{
+    switch( execution_model )
+    {
+    case 0:
+        return VK_SHADER_STAGE_VERTEX_BIT;
+    case 1:
+        return VK_SHADER_STAGE_TESSELLATION_CONTROL_BIT;
+    case 2:
+        return VK_SHADER_STAGE_TESSELLATION_EVALUATION_BIT;
+    case 3:
+        return VK_SHADER_STAGE_GEOMETRY_BIT;
+    case 4:
+        return VK_SHADER_STAGE_FRAGMENT_BIT;
+    case 5:
+        return VK_SHADER_STAGE_COMPUTE_BIT;
+    default:
+        throw std::invalid_argument("SPIR-V entry point has an execution model reflection does not support");
+    }
+}
+
+/*  Size in bytes of a type laid out with explicit offsets and strides, as
+    push constant blocks are. */
+static uint32_t get_type_size(const SpirvModule& module, uint32_t type_id, uint32_t matrix_stride = 0)
+{
+    const std::vector<uint32_t>& type = module.get_type(type_id);
+    switch( type[0] & 0xffff )
+    {
+    case op_type_bool:
+        return 4;
+    case op_type_int:
+    case op_type_float:
+        return type[2] / 8;
+    case op_type_vector:
+        return type[3] * get_type_size(module, type[2]);
+    case op_type_matrix:
+        return type[3] * (matrix_stride != 0 ? matrix_stride : get_type_size(module, type[2]));
+    case op_type_array:
+    {
+        uint32_t stride = module.get_decoration(type_id, decoration_array_stride);
+        if( stride == 0 )
+        {
+            stride = get_type_size(module, type[2], matrix_stride);
+        }
+        return stride * module.get_constant(type[3]);
+    }
+    case op_type_pointer:
+        // Buffer references, as 64-bit device addresses.
+        return type[2] == storage_physical_storage_buffer ? 8 : 0;
+    case op_type_struct:
+    {
+        uint32_t size = 0;
+        for( uint32_t member = 0; member + 2 < type.size(); ++member )
+        {
+            uint32_t offset = module.get_member_decoration(type_id, member, decoration_offset);
+            uint32_t member_matrix_stride = module.get_member_decoration(type_id, member, decoration_matrix_stride);
+            size = std::max(size, offset + get_type_size(module, type[member + 2], member_matrix_stride));
+        }
+        return size;
+    }
+    default:
+        return 0;
+    }
+}
+
+static VkDescriptorType get_descriptor_type(const SpirvModule& module, const SpirvModule::Variable& variable, uint32_t type_id)
+{
+    const std::vector<uint32_t>& type = module.get_type(type_id);
+    uint32_t opcode = type[0] & 0xffff;
+
+    if( variable.storage_class == storage_storage_buffer )
+    {
+        return VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    }
+    if( variable.storage_class == storage_uniform )
+    {
+        // Before SPIR-V 1.3, storage buffers were Uniform BufferBlocks.
+        return module.has_decoration(type_id, decoration_buffer_block)
+            ? VK_DESCRIPTOR_TYPE_STORAGE_BUFFER
+            : VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+    }
+
+    switch( opcode )
+    {
+    case op_type_sampler:
+        return VK_DESCRIPTOR_TYPE_SAMPLER;
+    case op_type_sampled_image:
+        return VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    case op_type_acceleration_structure:
+        return VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR;
+    case op_type_image:
+    {
+        uint32_t dim = type[3];
+        uint32_t sampled = type[7];
+        if( dim == dim_subpass_data )
+        {
+            return VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
+        }
+        if( dim == dim_buffer )
+        {
+            return sampled == 2 ? VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER : VK_DESCRIPTOR_TYPE_UNIFORM_TEXEL_BUFFER;
+        }
+        return sampled == 2 ? VK_DESCRIPTOR_TYPE_STORAGE_IMAGE : VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+    }
+    default:
+        throw std::invalid_argument("SPIR-V descriptor has a type reflection does not support");
+    }
+}
+
+static VkFormat get_vertex_format(const SpirvModule& module, uint32_t type_id)
+{
+    static const VkFormat float_formats[4] = {
+        VK_FORMAT_R32_SFLOAT, VK_FORMAT_R32G32_SFLOAT, VK_FORMAT_R32G32B32_SFLOAT, VK_FORMAT_R32G32B32A32_SFLOAT };
+    static const VkFormat sint_formats[4] = {
+        VK_FORMAT_R32_SINT, VK_FORMAT_R32G32_SINT, VK_FORMAT_R32G32B32_SINT, VK_FORMAT_R32G32B32A32_SINT };
+    static const VkFormat uint_formats[4] = {
+        VK_FORMAT_R32_UINT, VK_FORMAT_R32G32_UINT, VK_FORMAT_R32G32B32_UINT, VK_FORMAT_R32G32B32A32_UINT };
+
+    const std::vector<uint32_t>* type = &module.get_type(type_id);
+    uint32_t components = 1;
+    if( ((*type)[0] & 0xffff) == op_type_vector )
+    {
+        components = (*type)[3];
+        type = &module.get_type((*type)[2]);
+    }
+
+    uint32_t opcode = (*type)[0] & 0xffff;
+    if( components > 4 || (opcode != op_type_float && opcode != op_type_int) || (*type)[2] != 32 )
+    {
+        return VK_FORMAT_UNDEFINED;
+    }
+    if( opcode == op_type_float )
+    {
+        return float_formats[components - 1];
+    }
+    return (*type)[3] ? sint_formats[components - 1] : uint_formats[components - 1];
+}
+
+static uint32_t get_vertex_format_size(VkFormat format)
+{
+    switch( format )
+    {
+    case VK_FORMAT_R32_SFLOAT:
+    case VK_FORMAT_R32_SINT:
+    case VK_FORMAT_R32_UINT:
+        return 4;
+    case VK_FORMAT_R32G32_SFLOAT:
+    case VK_FORMAT_R32G32_SINT:
+    case VK_FORMAT_R32G32_UINT:
+        return 8;
+    case VK_FORMAT_R32G32B32_SFLOAT:
+    case VK_FORMAT_R32G32B32_SINT:
+    case VK_FORMAT_R32G32B32_UINT:
+        return 12;
+    case VK_FORMAT_R32G32B32A32_SFLOAT:
+    case VK_FORMAT_R32G32B32A32_SINT:
+    case VK_FORMAT_R32G32B32A32_UINT:
+        return 16;
+    default:
+        return 0;
+    }
+}
+
+ShaderReflection reflect_spirv(const std::vector<uint32_t>& code, const std::string& entry_point)
+{
+    SpirvModule module = parse_spirv(code);
+
+    const SpirvModule::EntryPoint* entry = nullptr;
+    for( const SpirvModule::EntryPoint& candidate : module.entry_points )
+    {
+        if( candidate.name == entry_point || (entry_point.empty() && module.entry_points.size() == 1) )
+        {
+            entry = &candidate;
+        }
+    }
+    if( entry == nullptr )
+    {
+        throw std::invalid_argument("SPIR-V has no entry point " + entry_point);
+    }
+
+    ShaderReflection reflection;
+    reflection.entry_point = entry->name;
+    reflection.stage = get_stage(entry->execution_model);
+
+    // Modules with several entry points declare the resources of all of
+    // them, each entry point reflects only those it uses.
+    std::set<uint32_t> used = module.get_used_variables(*entry);
+
+    for( const SpirvModule::Variable& variable : module.variables )
+    {
+        if( !used.count(variable.id) )
+        {
+            continue;
+        }
+
+        const std::vector<uint32_t>& pointer = module.get_type(variable.pointer_type);
+        uint32_t type_id = pointer[3];
+
+        if( variable.storage_class == storage_push_constant )
+        {
+            uint32_t size = get_type_size(module, type_id);
+            uint32_t offset = size;
+            const std::vector<uint32_t>& block = module.get_type(type_id);
+            for( uint32_t member = 0; member + 2 < block.size(); ++member )
+            {
+                offset = std::min(offset, module.get_member_decoration(type_id, member, decoration_offset));
+            }
+
+            if( size == offset )
+            {
+                continue;
+            }
+
+            VkPushConstantRange range;
+            range.stageFlags = reflection.stage;
+            range.offset = offset;
+            range.size = size - offset;
+            reflection.push_constants.push_back(range);
+            continue;
+        }
+
+        if( variable.storage_class == storage_input && reflection.stage == VK_SHADER_STAGE_VERTEX_BIT )
+        {
+            bool in_interface = std::find(entry->interface.begin(), entry->interface.end(), variable.id) != entry->interface.end();
+            if( in_interface && !module.has_decoration(variable.id, decoration_built_in)
+                && module.has_decoration(variable.id, decoration_location) )
+            {
+                VertexInput input;
+                input.name = module.get_name(variable.id);
+                input.location = module.get_decoration(variable.id, decoration_location);
+                input.format = get_vertex_format(module, type_id);
+                reflection.inputs.push_back(input);
+            }
+            continue;
+        }
+
+        bool resource = variable.storage_class == storage_uniform_constant
+            || variable.storage_class == storage_uniform
+            || variable.storage_class == storage_storage_buffer;
+        if( !resource || !module.has_decoration(variable.id, decoration_binding) )
+        {
+            continue;
+        }
+
+        DescriptorBinding binding;
+        binding.name = module.get_name(variable.id);
+        binding.set = module.get_decoration(variable.id, decoration_descriptor_set);
+        binding.binding = module.get_decoration(variable.id, decoration_binding);
+        binding.count = 1;
+        binding.stages = reflection.stage;
+
+        // Arrays of descriptors, nested arrays multiply out.
+        while( true )
+        {
+            const std::vector<uint32_t>& type = module.get_type(type_id);
+            uint32_t opcode = type[0] & 0xffff;
+            if( opcode == op_type_runtime_array )
+            {
+                throw std::invalid_argument("Descriptor " + binding.name + " is a runtime-sized array");
+            }
+            if( opcode != op_type_array )
+            {
+                break;
+            }
+            binding.count *= module.get_constant(type[3]);
+            type_id = type[2];
+        }
+
+        if( binding.name.empty() )
+        {
+            // Anonymous blocks are known by their block name.
+            binding.name = module.get_name(type_id);
+        }
+        binding.type = get_descriptor_type(module, variable, type_id);
+        reflection.bindings.push_back(binding);
+    }
+
+    for( const std::pair<uint32_t, uint32_t>& spec_constant : module.spec_constants )
+    {
+        if( module.has_decoration(spec_constant.first, decoration_spec_id) )
+        {
+            SpecializationConstant constant;
+            constant.name = module.get_name(spec_constant.first);
+            constant.constant_id = module.get_decoration(spec_constant.first, decoration_spec_id);
+            constant.default_value = spec_constant.second;
+            reflection.specialization_constants.push_back(constant);
+        }
+    }
+
+    std::sort(reflection.inputs.begin(), reflection.inputs.end(),
+        [](const VertexInput& a, const VertexInput& b) { return a.location < b.location; });
+    return reflection;
+}
+
+ReflectedLayout merge_reflections(const std::vector<ShaderReflection>& stages)
+{
+    std::map<std::pair<uint32_t, uint32_t>, DescriptorBinding> bindings;
+    std::vector<VkPushConstantRange> push_constants;
+    VkShaderStageFlags seen_stages = 0;
+
+    for( const ShaderReflection& stage : stages )
+    {
+        if( seen_stages & stage.stage )
+        {
+            throw std::invalid_argument("Two reflections of the same shader stage in one pipeline");
+        }
+        seen_stages |= stage.stage;
+
+        for( const DescriptorBinding& binding : stage.bindings )
+        {
+            auto key = std::make_pair(binding.set, binding.binding);
+            auto found = bindings.find(key);
+            if( found == bindings.end() )
+            {
+                bindings[key] = binding;
+                continue;
+            }
+            if( found->second.type != binding.type || found->second.count != binding.count )
+            {
+                throw std::invalid_argument(
+                    "Stages disagree on descriptor set " + std::to_string(binding.set)
+                    + " binding " + std::to_string(binding.binding)
+                    + " (" + found->second.name + " and " + binding.name + ")");
+            }
+            found->second.stages |= binding.stages;
+        }
+
+        // A stage may appear in only one range, stages with the same block
+        // layout share theirs.
+        for( const VkPushConstantRange& range : stage.push_constants )
+        {
+            bool merged = false;
+            for( VkPushConstantRange& existing : push_constants )
+            {
+                if( existing.offset == range.offset && existing.size == range.size )
+                {
+                    existing.stageFlags |= range.stageFlags;
+                    merged = true;
+                    break;
+                }
+            }
+            if( !merged )
+            {
+                push_constants.push_back(range);
+            }
+        }
+    }
+
+    ReflectedLayout layout;
+    layout.push_constants = push_constants;
+    for( const auto& entry : bindings )
+    {
+        const DescriptorBinding& binding = entry.second;
+        if( layout.sets.size() <= binding.set )
+        {
+            layout.sets.resize(binding.set + 1);
+        }
+
+        VkDescriptorSetLayoutBinding layout_binding;
+        layout_binding.binding = binding.binding;
+        layout_binding.descriptorType = binding.type;
+        layout_binding.descriptorCount = binding.count;
+        layout_binding.stageFlags = binding.stages;
+        layout_binding.pImmutableSamplers = nullptr;
+        layout.sets[binding.set].push_back(layout_binding);
+    }
+    return layout;
+}
+
+VertexLayout make_vertex_layout(const ShaderReflection& vertex_stage, uint32_t binding)
+{
+    VertexLayout layout;
+    uint32_t offset = 0;
+    for( const VertexInput& input : vertex_stage.inputs )
+    {
+        uint32_t size = get_vertex_format_size(input.format);
+        if( size == 0 )
+        {
+            throw std::invalid_argument("Vertex input " + input.name + " has no vertex format");
+        }
+
+        VkVertexInputAttributeDescription attribute;
+        attribute.location = input.location;
+        attribute.binding = binding;
+        attribute.format = input.format;
+        attribute.offset = offset;
+        layout.attributes.push_back(attribute);
+        offset += size;
+    }
+
+    if( !layout.attributes.empty() )
+    {
+        VkVertexInputBindingDescription description;
+        description.binding = binding;
+        description.stride = offset;
+        description.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+        layout.bindings.push_back(description);
+    }
+    return layout;
+}
+
+LayoutCache::LayoutCache(LogicalDevice& device)
+    : device(device)
+    , statistics()
+{
+}
+
+LayoutCache::~LayoutCache()
+{
+    for( auto& entry : pipeline_layouts )
+    {
+        vkDestroyPipelineLayout(device.get_device(), entry.second, device.get_allocation_callbacks());
+    }
+    for( auto& entry : set_layouts )
+    {
+        vkDestroyDescriptorSetLayout(device.get_device(), entry.second, device.get_allocation_callbacks());
+    }
+}
+
+VkDescriptorSetLayout LayoutCache::get_descriptor_set_layout(const std::vector<VkDescriptorSetLayoutBinding>& bindings)
+{
+    std::vector<VkDescriptorSetLayoutBinding> sorted = bindings;
+    std::sort(sorted.begin(), sorted.end(),
+        [](const VkDescriptorSetLayoutBinding& a, const VkDescriptorSetLayoutBinding& b) { return a.binding < b.binding; });
+
+    std::vector<uint64_t> key;
+    for( const VkDescriptorSetLayoutBinding& binding : sorted )
+    {
+        key.push_back(binding.binding);
+        key.push_back(binding.descriptorType);
+        key.push_back(binding.descriptorCount);
+        key.push_back(binding.stageFlags);
+        key.push_back(binding.pImmutableSamplers != nullptr ? 1 : 0);
+        for( uint32_t i = 0; binding.pImmutableSamplers != nullptr && i < binding.descriptorCount; ++i )
+        {
+            key.push_back(get_handle_value(binding.pImmutableSamplers[i]));
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    auto found = set_layouts.find(key);
+    if( found != set_layouts.end() )
+    {
+        statistics.hits++;
+        return found->second;
+    }
+
+    VkDescriptorSetLayoutCreateInfo create_info;
+    create_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    create_info.pNext = nullptr;
+    create_info.flags = 0;
+    create_info.bindingCount = static_cast<uint32_t>(sorted.size());
+    create_info.pBindings = sorted.data();
+
+    VkDescriptorSetLayout set_layout;
+    VkResult result = vkCreateDescriptorSetLayout(device.get_device(), &create_info, device.get_allocation_callbacks(), &set_layout);
+    if( result != VK_SUCCESS )
+    {
+        throw VulkanException(result, "Error while creating descriptor set layout");
+    }
+
+    set_layouts[key] = set_layout;
+    statistics.descriptor_set_layouts++;
+    return set_layout;
+}
+
+VkPipelineLayout LayoutCache::get_pipeline_layout(
+    const std::vector<VkDescriptorSetLayout>& set_layouts,
+    const std::vector<VkPushConstantRange>& push_constants)
+{
+    std::vector<uint64_t> key;
+    key.push_back(set_layouts.size());
+    for( VkDescriptorSetLayout set_layout : set_layouts )
+    {
+        key.push_back(get_handle_value(set_layout));
+    }
+    for( const VkPushConstantRange& range : push_constants )
+    {
+        key.push_back(range.stageFlags);
+        key.push_back(range.offset);
+        key.push_back(range.size);
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    auto found = pipeline_layouts.find(key);
+    if( found != pipeline_layouts.end() )
+    {
+        statistics.hits++;
+        return found->second;
+    }
+
+    VkPipelineLayoutCreateInfo create_info;
+    create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    create_info.pNext = nullptr;
+    create_info.flags = 0;
+    create_info.setLayoutCount = static_cast<uint32_t>(set_layouts.size());
+    create_info.pSetLayouts = set_layouts.data();
+    create_info.pushConstantRangeCount = static_cast<uint32_t>(push_constants.size());
+    create_info.pPushConstantRanges = push_constants.data();
+
+    VkPipelineLayout layout;
+    VkResult result = vkCreatePipelineLayout(device.get_device(), &create_info, device.get_allocation_callbacks(), &layout);
+    if( result != VK_SUCCESS )
+    {
+        throw VulkanException(result, "Error while creating pipeline layout");
+    }
+
+    pipeline_layouts[key] = layout;
+    statistics.pipeline_layouts++;
+    return layout;
+}
+
+PipelineLayoutHandles LayoutCache::get_pipeline_layout(const ReflectedLayout& layout)
+{
+    PipelineLayoutHandles handles;
+    for( const std::vector<VkDescriptorSetLayoutBinding>& set : layout.sets )
+    {
+        handles.set_layouts.push_back(get_descriptor_set_layout(set));
+    }
+    handles.layout = get_pipeline_layout(handles.set_layouts, layout.push_constants);
+    return handles;
+}
+
+PipelineLayoutHandles LayoutCache::get_pipeline_layout(const std::vector<ShaderReflection>& stages)
+{
+    return get_pipeline_layout(merge_reflections(stages));
+}
+
+LayoutCacheStatistics LayoutCache::get_statistics()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return statistics;
+}
+
+}
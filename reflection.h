@@ -0,0 +1,120 @@
+#pragma once
+
+#include "vulkan.h"
+#include "variants.h"
+#include "dynamic.h"
+
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace vulkan
+{
+
+struct DescriptorBinding
+{
+    std::string name;
+    uint32_t set;
+    uint32_t binding;
+    VkDescriptorType type;
+    uint32_t count;
+    VkShaderStageFlags stages;
+};
+
+struct VertexInput
+{
+    std::string name;
+    uint32_t location;
+    VkFormat format;            // VK_FORMAT_UNDEFINED for matrices and 64-bit types
+};
+
+/*  What one entry point of a SPIR-V module expects of its pipeline. */
+struct ShaderReflection
+{
+    std::string entry_point;
+    VkShaderStageFlagBits stage;
+    std::vector<DescriptorBinding> bindings;
+    std::vector<VkPushConstantRange> push_constants;
+    std::vector<VertexInput> inputs;                    // vertex shaders only, by location
+    std::vector<SpecializationConstant> specialization_constants;
+};
+
+/*  Reads descriptor bindings, the push constant block, vertex inputs and
+    specialization constants out of SPIR-V, without a SPIR-V library.  With
+    an empty entry point the module must have only one.  Only the resources
+    the entry point uses are reflected: those in its interface from SPIR-V
+    1.4 on, those its functions name before.  Throws
+    std::invalid_argument on code that is not SPIR-V, an unknown entry
+    point, and runtime-sized descriptor arrays, whose size only the
+    application knows. */
+ShaderReflection reflect_spirv(const std::vector<uint32_t>& code, const std::string& entry_point = "");
+
+/*  The descriptor set and push constant layout of a pipeline, with sets
+    indexed by set number; sets no stage uses are empty. */
+struct ReflectedLayout
+{
+    std::vector<std::vector<VkDescriptorSetLayoutBinding>> sets;
+    std::vector<VkPushConstantRange> push_constants;
+};
+
+/*  Merges the stages of one pipeline: a binding used by several stages
+    gets all their stage flags.  Throws std::invalid_argument if stages
+    disagree on a binding's type or count, the mismatch that hand-written
+    layouts let through to validation or the GPU. */
+ReflectedLayout merge_reflections(const std::vector<ShaderReflection>& stages);
+
+/*  The vertex inputs interleaved in one vertex buffer at the binding, in
+    location order and tightly packed.  Throws std::invalid_argument for
+    inputs without a vertex format. */
+VertexLayout make_vertex_layout(const ShaderReflection& vertex_stage, uint32_t binding = 0);
+
+struct LayoutCacheStatistics
+{
+    uint64_t hits;
+    uint32_t descriptor_set_layouts;
+    uint32_t pipeline_layouts;
+};
+
+struct PipelineLayoutHandles
+{
+    VkPipelineLayout layout;
+    std::vector<VkDescriptorSetLayout> set_layouts;     // to allocate descriptor sets with
+};
+
+/*  Creates each distinct descriptor set layout and pipeline layout once
+    and keeps it as long as the device, so that pipelines reflected from
+    shaders that agree on a layout share the handles and stay compatible
+    for descriptor set binding.  Layouts are compared by content, with the
+    bindings in any order.  Owned by LogicalDevice; safe to use from any
+    thread. */
+class LayoutCache
+{
+public:
+    explicit LayoutCache(LogicalDevice& device);
+    ~LayoutCache();
+
+    LayoutCache(const LayoutCache&) = delete;
+    LayoutCache& operator=(const LayoutCache&) = delete;
+
+    VkDescriptorSetLayout get_descriptor_set_layout(const std::vector<VkDescriptorSetLayoutBinding>& bindings);
+    VkPipelineLayout get_pipeline_layout(
+        const std::vector<VkDescriptorSetLayout>& set_layouts,
+        const std::vector<VkPushConstantRange>& push_constants);
+
+    PipelineLayoutHandles get_pipeline_layout(const ReflectedLayout& layout);
+
+    /*  merge_reflections() of the stages, created. */
+    PipelineLayoutHandles get_pipeline_layout(const std::vector<ShaderReflection>& stages);
+
+    LayoutCacheStatistics get_statistics();
+
+private:
+    LogicalDevice& device;
+    std::mutex mutex;
+    std::map<std::vector<uint64_t>, VkDescriptorSetLayout> set_layouts;
+    std::map<std::vector<uint64_t>, VkPipelineLayout> pipeline_layouts;
+    LayoutCacheStatistics statistics;
+};
+
+}
@@ -0,0 +1,314 @@
+#include "resolution.h"
+#include "pool.h"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+namespace vulkan
+{
+
+static const uint32_t extent_granularity = 8;
+
+static uint32_t round_to_granularity(double size, uint32_t max_size)
+{
+    uint32_t rounded = static_cast<uint32_t>(std::lround(size / extent_granularity)) * extent_granularity;
+    return std::min(std::max(rounded, extent_granularity), max_size);
+}
+
+ResolutionController::ResolutionController(VkExtent2D output_extent, double target_ms, double min_scale, double max_scale)
+    : output_extent(output_extent)
+    , target_ms(target_ms)
+    , min_scale(min_scale)
+    , max_scale(max_scale)
+    , proportional_gain(0.2)
+    , integral_gain(0.15)
+    , derivative_gain(0.02)
+    , area(max_scale * max_scale)
+    , previous_error(0.0)
+    , previous_error_2(0.0)
+{
+    render_extent = get_extent_for_scale(max_scale);
+}
+
+void ResolutionController::set_gains(double proportional, double integral, double derivative)
+{
+    proportional_gain = proportional;
+    integral_gain = integral;
+    derivative_gain = derivative;
+}
+
+void ResolutionController::set_output_extent(VkExtent2D output_extent)
+{
+    this->output_extent = output_extent;
+    render_extent = get_extent_for_scale(get_scale());
+}
+
+void ResolutionController::set_target(double target_ms)
+{
+    this->target_ms = target_ms;
+}
+
+bool ResolutionController::update(double gpu_frame_ms)
+{
+    if( gpu_frame_ms <= 0.0 )
+    {
+        return false;
+    }
+
+    // Velocity form: the output is a change of area, so clamping the area
+    // also keeps the integral from winding up.
+    double error = (target_ms - gpu_frame_ms) / target_ms;
+    double change = proportional_gain * (error - previous_error)
+        + integral_gain * error
+        + derivative_gain * (error - 2.0 * previous_error + previous_error_2);
+    previous_error_2 = previous_error;
+    previous_error = error;
+
+    area = std::min(std::max(area + change, min_scale * min_scale), max_scale * max_scale);
+
+    VkExtent2D extent = get_extent_for_scale(std::sqrt(area));
+    if( extent.width == render_extent.width && extent.height == render_extent.height )
+    {
+        return false;
+    }
+    render_extent = extent;
+    return true;
+}
+
+VkExtent2D ResolutionController::get_render_extent() const
+{
+    return render_extent;
+}
+
+VkExtent2D ResolutionController::get_max_render_extent() const
+{
+    return get_extent_for_scale(max_scale);
+}
+
+double ResolutionController::get_scale() const
+{
+    return std::sqrt(area);
+}
+
+VkExtent2D ResolutionController::get_extent_for_scale(double scale) const
+{
+    // Rounding to the granularity must not go past the output at max_scale.
+    uint32_t max_width = std::max(static_cast<uint32_t>(output_extent.width * max_scale), 1u);
+    uint32_t max_height = std::max(static_cast<uint32_t>(output_extent.height * max_scale), 1u);
+    scale = std::min(scale, max_scale);
+
+    VkExtent2D extent;
+    extent.width = round_to_granularity(output_extent.width * scale, max_width);
+    extent.height = round_to_granularity(output_extent.height * scale, max_height);
+    return extent;
+}
+
+ScaledRenderTarget::ScaledRenderTarget(
+    LogicalDevice& device,
+    VkFormat format,
+    VkImageUsageFlags usage,
+    VkImageAspectFlags aspect,
+    VkExtent2D max_extent,
+    uint32_t frames_in_flight
+)
+    : device(device)
+    , format(format)
+    , usage(usage)
+    , aspect(aspect)
+    , max_extent(max_extent)
+    , frames_in_flight(frames_in_flight)
+    , allocation(nullptr)
+    , half(0)
+    , extent(max_extent)
+    , resize_pending(false)
+    , pending_extent(max_extent)
+    , generation(0)
+    , frame(0)
+{
+    image = create_image(max_extent);
+
+    VkMemoryRequirements requirements;
+    vkGetImageMemoryRequirements(device.get_device(), image, &requirements);
+
+    VkDeviceSize granularity = device.get_properties().limits.bufferImageGranularity;
+    requirements.alignment = std::max(requirements.alignment, granularity);
+    half_size = (requirements.size + requirements.alignment - 1) / requirements.alignment * requirements.alignment;
+    requirements.size = 2 * half_size;
+
+    // No move listener: the defragmenter must not pull the memory from
+    // under the aliasing images.
+    allocation = device.allocate(requirements, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, AllocationPriority::CRITICAL);
+    if( !allocation )
+    {
+        vkDestroyImage(device.get_device(), image, device.get_allocation_callbacks());
+        throw VulkanException(VK_ERROR_OUT_OF_DEVICE_MEMORY, "Error while allocating scaled render target memory");
+    }
+
+    VkResult result = vkBindImageMemory(device.get_device(), image, allocation->get_memory(), allocation->get_offset());
+    if( result != VK_SUCCESS )
+    {
+        vkDestroyImage(device.get_device(), image, device.get_allocation_callbacks());
+        device.free(allocation);
+        throw VulkanException(result, "Error while binding scaled render target memory");
+    }
+}
+
+ScaledRenderTarget::~ScaledRenderTarget()
+{
+    for( Retired& old : retired )
+    {
+        vkDestroyImage(device.get_device(), old.image, device.get_allocation_callbacks());
+    }
+    vkDestroyImage(device.get_device(), image, device.get_allocation_callbacks());
+    device.free(allocation);
+}
+
+void ScaledRenderTarget::begin_frame()
+{
+    ++frame;
+    for( size_t i = 0; i < retired.size(); )
+    {
+        if( frame - retired[i].frame > frames_in_flight )
+        {
+            vkDestroyImage(device.get_device(), retired[i].image, device.get_allocation_callbacks());
+            retired[i] = retired.back();
+            retired.pop_back();
+            continue;
+        }
+        ++i;
+    }
+
+    if( resize_pending )
+    {
+        switch_image();
+    }
+}
+
+bool ScaledRenderTarget::resize(VkExtent2D new_extent)
+{
+    if( new_extent.width > max_extent.width || new_extent.height > max_extent.height )
+    {
+        throw std::invalid_argument("Scaled render target extent exceeds its maximum");
+    }
+
+    // A later resize replaces one still waiting, or cancels it.
+    pending_extent = new_extent;
+    resize_pending = new_extent.width != extent.width || new_extent.height != extent.height;
+    return !resize_pending || switch_image();
+}
+
+bool ScaledRenderTarget::switch_image()
+{
+    // The image retired from the other half may still be read or written
+    // by a frame in flight, the new one must not alias it before then.
+    uint32_t other = 1 - half;
+    for( const Retired& old : retired )
+    {
+        if( old.half == other )
+        {
+            return false;
+        }
+    }
+
+    VkImage new_image = create_image(pending_extent);
+    VkDeviceSize offset = allocation->get_offset() + other * half_size;
+
+    VkMemoryRequirements requirements;
+    vkGetImageMemoryRequirements(device.get_device(), new_image, &requirements);
+    if( requirements.size > half_size
+        || !(requirements.memoryTypeBits & (1u << allocation->get_memory_type_index()))
+        || offset % requirements.alignment != 0 )
+    {
+        vkDestroyImage(device.get_device(), new_image, device.get_allocation_callbacks());
+        throw std::runtime_error("Scaled render target cannot alias its memory");
+    }
+
+    VkResult result = vkBindImageMemory(device.get_device(), new_image, allocation->get_memory(), offset);
+    if( result != VK_SUCCESS )
+    {
+        vkDestroyImage(device.get_device(), new_image, device.get_allocation_callbacks());
+        throw VulkanException(result, "Error while binding scaled render target memory");
+    }
+
+    Retired old;
+    old.image = image;
+    old.half = half;
+    old.frame = frame;
+    retired.push_back(old);
+
+    image = new_image;
+    half = other;
+    extent = pending_extent;
+    resize_pending = false;
+    generation++;
+    return true;
+}
+
+VkImage ScaledRenderTarget::get_image() const
+{
+    return image;
+}
+
+VkExtent2D ScaledRenderTarget::get_extent() const
+{
+    return extent;
+}
+
+uint32_t ScaledRenderTarget::get_generation() const
+{
+    return generation;
+}
+
+void ScaledRenderTarget::record_upscale(
+    VkCommandBuffer command_buffer,
+    VkImage output,
+    VkExtent2D output_extent) const
+{
+    VkImageBlit blit;
+    blit.srcSubresource.aspectMask = aspect;
+    blit.srcSubresource.mipLevel = 0;
+    blit.srcSubresource.baseArrayLayer = 0;
+    blit.srcSubresource.layerCount = 1;
+    blit.srcOffsets[0] = {0, 0, 0};
+    blit.srcOffsets[1] = {static_cast<int32_t>(extent.width), static_cast<int32_t>(extent.height), 1};
+    blit.dstSubresource = blit.srcSubresource;
+    blit.dstSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    blit.dstOffsets[0] = {0, 0, 0};
+    blit.dstOffsets[1] = {static_cast<int32_t>(output_extent.width), static_cast<int32_t>(output_extent.height), 1};
+
+    vkCmdBlitImage(command_buffer,
+        image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+        output, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+        1, &blit, VK_FILTER_LINEAR);
+}
+
+VkImage ScaledRenderTarget::create_image(VkExtent2D image_extent)
+{
+    VkImageCreateInfo create_info;
+    create_info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+    create_info.pNext = nullptr;
+    create_info.flags = 0;
+    create_info.imageType = VK_IMAGE_TYPE_2D;
+    create_info.format = format;
+    create_info.extent = {image_extent.width, image_extent.height, 1};
+    create_info.mipLevels = 1;
+    create_info.arrayLayers = 1;
+    create_info.samples = VK_SAMPLE_COUNT_1_BIT;
+    create_info.tiling = VK_IMAGE_TILING_OPTIMAL;
+    create_info.usage = usage | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+    create_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    create_info.queueFamilyIndexCount = 0;
+    create_info.pQueueFamilyIndices = nullptr;
+    create_info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+    VkImage new_image;
+    VkResult result = vkCreateImage(device.get_device(), &create_info, device.get_allocation_callbacks(), &new_image);
+    if( result != VK_SUCCESS )
+    {
+        throw VulkanException(result, "Error while creating scaled render target");
+    }
+    return new_image;
+}
+
+}
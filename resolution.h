@@ -0,0 +1,132 @@
+#pragma once
+
+#include "vulkan.h"
+
+#include <vector>
+
+namespace vulkan
+{
+
+/*  Picks the internal render resolution from measured GPU frame times.  A
+    PID controller in velocity form steers the rendered area, which GPU
+    time is roughly proportional to, so that frames take target_ms; the
+    scale applied to each axis is its square root.  Extents are rounded to
+    multiples of 8 pixels, so small corrections do not resize every frame;
+    only the extent at max_scale may fall between, so that it never
+    exceeds the output scaled by max_scale. */
+class ResolutionController
+{
+public:
+    ResolutionController(VkExtent2D output_extent, double target_ms, double min_scale = 0.5, double max_scale = 1.0);
+
+    /*  Gains on the frame time error relative to the target. */
+    void set_gains(double proportional, double integral, double derivative);
+
+    void set_output_extent(VkExtent2D output_extent);
+    void set_target(double target_ms);
+
+    /*  Feeds the GPU time of a finished frame, as from
+        QueryManager::get_gpu_frame_time().  Returns true if the render
+        extent changed.  Times of 0, from frames without timestamps, are
+        ignored. */
+    bool update(double gpu_frame_ms);
+
+    VkExtent2D get_render_extent() const;
+    VkExtent2D get_max_render_extent() const;
+    double get_scale() const;
+
+private:
+    VkExtent2D get_extent_for_scale(double scale) const;
+
+    VkExtent2D output_extent;
+    double target_ms;
+    double min_scale;
+    double max_scale;
+    double proportional_gain;
+    double integral_gain;
+    double derivative_gain;
+
+    double area;
+    double previous_error;
+    double previous_error_2;
+    VkExtent2D render_extent;
+};
+
+/*  A render target whose extent follows the ResolutionController without
+    new allocations.  Memory for two images of the largest extent is
+    allocated once, and resize() creates a VkImage of the new extent
+    aliasing the half the current image does not use.  The frames in
+    flight may still be using the image that last had that half, so the
+    switch waits until it was retired frames_in_flight frames ago, which
+    is also when it is destroyed.
+
+    The new image starts out in VK_IMAGE_LAYOUT_UNDEFINED with undefined
+    contents, and anything holding the old handle has to be updated, which
+    get_generation() tells. */
+class ScaledRenderTarget
+{
+public:
+    ScaledRenderTarget(
+        LogicalDevice& device,
+        VkFormat format,
+        VkImageUsageFlags usage,
+        VkImageAspectFlags aspect,
+        VkExtent2D max_extent,
+        uint32_t frames_in_flight = 3);
+    ~ScaledRenderTarget();
+
+    ScaledRenderTarget(const ScaledRenderTarget&) = delete;
+    ScaledRenderTarget& operator=(const ScaledRenderTarget&) = delete;
+
+    /*  Destroys images retired frames_in_flight frames ago, and makes a
+        switch resize() had to put off if it can now. */
+    void begin_frame();
+
+    /*  Switches to an image of the extent, which must not exceed the
+        maximum.  Returns false if the switch has to wait for a later
+        begin_frame(); the image keeps its extent until then. */
+    bool resize(VkExtent2D extent);
+
+    VkImage get_image() const;
+    VkExtent2D get_extent() const;
+    uint32_t get_generation() const;
+
+    /*  Scales the image onto the output (the swapchain image) with a linear
+        blit.  The image must be in TRANSFER_SRC_OPTIMAL and the output in
+        TRANSFER_DST_OPTIMAL, and the format must support blits. */
+    void record_upscale(
+        VkCommandBuffer command_buffer,
+        VkImage output,
+        VkExtent2D output_extent) const;
+
+private:
+    struct Retired
+    {
+        VkImage image;
+        uint32_t half;
+        uint64_t frame;
+    };
+
+    VkImage create_image(VkExtent2D extent);
+    bool switch_image();
+
+    LogicalDevice& device;
+    VkFormat format;
+    VkImageUsageFlags usage;
+    VkImageAspectFlags aspect;
+    VkExtent2D max_extent;
+    uint32_t frames_in_flight;
+
+    MemoryAllocation* allocation;
+    VkDeviceSize half_size;
+    VkImage image;
+    uint32_t half;
+    VkExtent2D extent;
+    bool resize_pending;
+    VkExtent2D pending_extent;
+    uint32_t generation;
+    uint64_t frame;
+    std::vector<Retired> retired;
+};
+
+}
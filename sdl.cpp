@@ -24,4 +24,43 @@ SDL_Window* get_vulkan_sdk_window()
     return window;
 }
 
+InputState sample_input(SDL_Window* window)
+{
+    SDL_PumpEvents();
+
+    InputState input = {};
+    input.timestamp_ns = get_time_ns();
+
+    // Relative motion is consumed even when it is dropped, so that it does
+    // not pile up while the window is in the background.
+    int dx;
+    int dy;
+    SDL_GetRelativeMouseState(&dx, &dy);
+
+    if( SDL_GetMouseFocus() == window )
+    {
+        input.mouse_buttons = SDL_GetMouseState(&input.mouse_x, &input.mouse_y);
+        input.mouse_dx = dx;
+        input.mouse_dy = dy;
+    }
+
+    if( SDL_GetKeyboardFocus() == window )
+    {
+        const Uint8* keys = SDL_GetKeyboardState(nullptr);
+        input.forward = keys[SDL_SCANCODE_W] != 0;
+        input.back = keys[SDL_SCANCODE_S] != 0;
+        input.left = keys[SDL_SCANCODE_A] != 0;
+        input.right = keys[SDL_SCANCODE_D] != 0;
+    }
+
+    return input;
+}
+
+uint64_t get_time_ns()
+{
+    static const Uint64 frequency = SDL_GetPerformanceFrequency();
+    Uint64 counter = SDL_GetPerformanceCounter();
+    return (counter / frequency) * 1000000000ull + (counter % frequency) * 1000000000ull / frequency;
+}
+
 }
\ No newline at end of file
@@ -1,3 +1,5 @@
+#pragma once
+
 #include <SDL2/SDL.h>
 
 #include <stdexcept>
@@ -17,4 +19,30 @@ public:
 
 SDL_Window* get_vulkan_sdk_window();
 
+/*  Input as it was at one instant.  Mouse position is in window
+    coordinates, relative motion is what accumulated since the previous
+    sample.  Keys and buttons read as released while the window does not
+    have focus. */
+struct InputState
+{
+    int mouse_x;
+    int mouse_y;
+    int mouse_dx;
+    int mouse_dy;
+    uint32_t mouse_buttons;
+    bool forward;
+    bool back;
+    bool left;
+    bool right;
+    uint64_t timestamp_ns;
+};
+
+/*  Pumps SDL's event queue and reads the current mouse and keyboard state
+    for the window.  Cheap enough to call right before a submit. */
+InputState sample_input(SDL_Window* window);
+
+/*  SDL's performance counter in nanoseconds, the clock of
+    InputState::timestamp_ns. */
+uint64_t get_time_ns();
+
 }
\ No newline at end of file
@@ -0,0 +1,341 @@
+#include "shaders.h"
+#include "hash.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+#ifdef _WIN32
+#include <process.h>
+#else
+#include <unistd.h>
+#endif
+
+#ifdef VULKAN_SHADERC
+#include <shaderc/shaderc.hpp>
+#endif
+
+namespace vulkan
+{
+
+static const uint32_t spirv_magic = 0x07230203;
+
+static long get_process_id()
+{
+#ifdef _WIN32
+    return _getpid();
+#else
+    return static_cast<long>(getpid());
+#endif
+}
+
+#ifdef VULKAN_SHADERC
+static shaderc_shader_kind get_shader_kind(VkShaderStageFlagBits stage)
+{
+    switch( stage )
+    {
+    case VK_SHADER_STAGE_VERTEX_BIT:
+        return shaderc_vertex_shader;
+    case VK_SHADER_STAGE_TESSELLATION_CONTROL_BIT:
+        return shaderc_tess_control_shader;
+    case VK_SHADER_STAGE_TESSELLATION_EVALUATION_BIT:
+        return shaderc_tess_evaluation_shader;
+    case VK_SHADER_STAGE_GEOMETRY_BIT:
+        return shaderc_geometry_shader;
+    case VK_SHADER_STAGE_FRAGMENT_BIT:
+        return shaderc_fragment_shader;
+    case VK_SHADER_STAGE_COMPUTE_BIT:
+        return shaderc_compute_shader;
+    default:
+        throw std::invalid_argument("Shader stage is not supported by the shaderc frontend");
+    }
+}
+
+// shaderc has no call for its own version, so the build passes it in, as
+// in -DVULKAN_SHADERC_VERSION=\"$(pkg-config --modversion shaderc)\".
+// Without it this file's build time stands in, which recompiles the cache
+// whenever the frontend is rebuilt against a library.
+#ifndef VULKAN_SHADERC_VERSION
+#define VULKAN_SHADERC_VERSION "built-" __DATE__ "-" __TIME__
+#endif
+
+ShaderFrontend create_shaderc_frontend()
+{
+    unsigned int spirv_version = 0, spirv_revision = 0;
+    shaderc_get_spv_version(&spirv_version, &spirv_revision);
+
+    ShaderFrontend frontend;
+    frontend.version = std::string("shaderc-") + VULKAN_SHADERC_VERSION
+        + "-spv" + std::to_string(spirv_version) + "." + std::to_string(spirv_revision)
+        + "-vulkan1.0-performance";
+    frontend.compile = [](const ShaderSource& source)
+    {
+        // shaderc::Compiler is safe to share, but cheap enough to make per
+        // compile, which keeps the frontend copyable.
+        shaderc::Compiler compiler;
+        shaderc::CompileOptions options;
+        options.SetSourceLanguage(
+            source.language == ShaderLanguage::HLSL ? shaderc_source_language_hlsl : shaderc_source_language_glsl);
+        options.SetTargetEnvironment(shaderc_target_env_vulkan, shaderc_env_version_vulkan_1_0);
+        options.SetOptimizationLevel(shaderc_optimization_level_performance);
+        for( const auto& define : source.defines )
+        {
+            options.AddMacroDefinition(define.first, define.second);
+        }
+
+        shaderc::SpvCompilationResult result = compiler.CompileGlslToSpv(
+            source.text, get_shader_kind(source.stage), source.name.c_str(), source.entry_point.c_str(), options);
+        if( result.GetCompilationStatus() != shaderc_compilation_status_success )
+        {
+            throw std::runtime_error("Error while compiling shader " + source.name + ":\n" + result.GetErrorMessage());
+        }
+        return std::vector<uint32_t>(result.cbegin(), result.cend());
+    };
+    return frontend;
+}
+#endif
+
+ShaderCache::ShaderCache(const std::string& directory, const ShaderFrontend& frontend, uint32_t thread_count)
+    : directory(directory)
+    , frontend(frontend)
+    , stopping(false)
+    , statistics()
+{
+    // With its parents, like mkdir -p.  A cache that cannot be written
+    // only costs every run its compiles, save() fails quietly then.
+    std::error_code error;
+    std::filesystem::create_directories(directory, error);
+
+    if( thread_count == 0 )
+    {
+        thread_count = std::max(std::thread::hardware_concurrency(), 1u);
+    }
+    for( uint32_t i = 0; i < thread_count; ++i )
+    {
+        workers.emplace_back(&ShaderCache::work, this);
+    }
+}
+
+ShaderCache::~ShaderCache()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for( std::thread& worker : workers )
+    {
+        worker.join();
+    }
+}
+
+bool ShaderCache::has_frontend() const
+{
+    return static_cast<bool>(frontend.compile);
+}
+
+std::string ShaderCache::get_key(const ShaderSource& source) const
+{
+    // Each string goes in with its length, so that moving text from one
+    // field to the next changes the key.
+    Hasher key;
+    auto add_string = [&key](const std::string& text)
+    {
+        key.add(text.size());
+        key.add_data(text.data(), text.size());
+    };
+
+    add_string(frontend.version);
+    key.add(static_cast<uint64_t>(source.language));
+    key.add(static_cast<uint64_t>(source.stage));
+    add_string(source.entry_point);
+    add_string(source.text);
+    key.add(source.defines.size());
+    for( const auto& define : source.defines )
+    {
+        add_string(define.first);
+        add_string(define.second);
+    }
+
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx.spv", static_cast<unsigned long long>(key.get_hash()));
+    return name;
+}
+
+std::shared_future<std::vector<uint32_t>> ShaderCache::request(const ShaderSource& source)
+{
+    std::string key = get_key(source);
+
+    std::unique_lock<std::mutex> lock(mutex);
+    auto found = shaders.find(key);
+    if( found != shaders.end() )
+    {
+        statistics.memory_hits++;
+        return found->second;
+    }
+
+    Job job;
+    job.source = source;
+    job.key = key;
+    std::shared_future<std::vector<uint32_t>> code = job.promise.get_future().share();
+    shaders[key] = code;
+    jobs.push_back(std::move(job));
+    lock.unlock();
+
+    wake.notify_one();
+    return code;
+}
+
+std::vector<uint32_t> ShaderCache::get(const ShaderSource& source)
+{
+    return request(source).get();
+}
+
+VkShaderModule ShaderCache::create_shader_module(LogicalDevice& device, const ShaderSource& source)
+{
+    std::vector<uint32_t> code = get(source);
+
+    VkShaderModuleCreateInfo module_info;
+    module_info.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+    module_info.pNext = nullptr;
+    module_info.flags = 0;
+    module_info.codeSize = code.size() * sizeof(uint32_t);
+    module_info.pCode = code.data();
+
+    VkShaderModule module;
+    VkResult result = vkCreateShaderModule(device.get_device(), &module_info, device.get_allocation_callbacks(), &module);
+    if( result != VK_SUCCESS )
+    {
+        throw VulkanException(result, "Error while creating shader module of " + source.name);
+    }
+    return module;
+}
+
+ShaderCacheStatistics ShaderCache::get_statistics() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return statistics;
+}
+
+bool ShaderCache::load(const std::string& key, std::vector<uint32_t>& code) const
+{
+    std::ifstream file(directory + "/" + key, std::ios::binary | std::ios::ate);
+    if( !file )
+    {
+        return false;
+    }
+
+    std::streamoff size = file.tellg();
+    if( size < static_cast<std::streamoff>(sizeof(uint32_t)) || size % sizeof(uint32_t) != 0 )
+    {
+        return false;
+    }
+
+    code.resize(static_cast<size_t>(size) / sizeof(uint32_t));
+    file.seekg(0);
+    file.read(reinterpret_cast<char*>(code.data()), size);
+
+    // Anything that is not whole SPIR-V is compiled again and overwritten.
+    return file && code[0] == spirv_magic;
+}
+
+void ShaderCache::save(const std::string& key, const std::vector<uint32_t>& code) const
+{
+    // Unique per process and thread, so that two processes or threads
+    // compiling the same source never write into one file.
+    std::ostringstream temporary_path;
+    temporary_path << directory << "/" << key
+        << "." << get_process_id() << "." << std::this_thread::get_id() << ".tmp";
+    std::string path = directory + "/" + key;
+    {
+        std::ofstream file(temporary_path.str(), std::ios::binary | std::ios::trunc);
+        file.write(reinterpret_cast<const char*>(code.data()), code.size() * sizeof(uint32_t));
+        if( !file )
+        {
+            // A cache that cannot be written only costs the next run a compile.
+            file.close();
+            std::remove(temporary_path.str().c_str());
+            return;
+        }
+    }
+
+    // Replaces a file another process wrote meanwhile, which std::rename
+    // refuses on Windows.
+    std::error_code error;
+    std::filesystem::rename(temporary_path.str(), path, error);
+    if( error )
+    {
+        std::remove(temporary_path.str().c_str());
+    }
+}
+
+std::vector<uint32_t> ShaderCache::compile(const ShaderSource& source, const std::string& key)
+{
+    std::vector<uint32_t> code;
+    if( load(key, code) )
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        statistics.disk_hits++;
+        return code;
+    }
+
+    if( !frontend.compile )
+    {
+        throw std::runtime_error("Shader " + source.name + " is not in the cache and there is no compiler");
+    }
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    code = frontend.compile(source);
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    if( code.empty() || code[0] != spirv_magic )
+    {
+        throw std::runtime_error("Shader compiler did not return SPIR-V for " + source.name);
+    }
+    save(key, code);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    statistics.compiled++;
+    statistics.compile_ms += ms;
+    return code;
+}
+
+void ShaderCache::work()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    while( true )
+    {
+        wake.wait(lock, [this]() { return stopping || !jobs.empty(); });
+        if( stopping )
+        {
+            break;
+        }
+
+        Job job = std::move(jobs.front());
+        jobs.pop_front();
+        lock.unlock();
+
+        try
+        {
+            job.promise.set_value(compile(job.source, job.key));
+            lock.lock();
+        }
+        catch( ... )
+        {
+            // Forgotten, so that a fixed source or a later request tries again.
+            lock.lock();
+            statistics.failed++;
+            shaders.erase(job.key);
+            job.promise.set_exception(std::current_exception());
+        }
+    }
+
+    // Waiters on the dropped jobs get broken promises.
+    jobs.clear();
+}
+
+}
@@ -0,0 +1,128 @@
+#pragma once
+
+#include "vulkan.h"
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace vulkan
+{
+
+enum class ShaderLanguage
+{
+    GLSL,
+    HLSL
+};
+
+struct ShaderSource
+{
+    std::string name;           // for error messages and #line directives
+    std::string text;
+    ShaderLanguage language;
+    VkShaderStageFlagBits stage;
+    std::string entry_point;
+    std::map<std::string, std::string> defines;
+};
+
+/*  Turns a source into optimized SPIR-V, or throws std::runtime_error
+    with the compiler's messages.  version names the compiler and its
+    settings, and goes into the cache keys, so that upgrading the compiler
+    recompiles everything.  compile is called from several threads at
+    once. */
+struct ShaderFrontend
+{
+    std::string version;
+    std::function<std::vector<uint32_t>(const ShaderSource&)> compile;
+};
+
+/*  A frontend over shaderc, which runs glslang and then spirv-opt for
+    performance.  Only there when built with -DVULKAN_SHADERC, and linked
+    with -lshaderc_combined, as the test-shaderc rule does.  Its version
+    holds VULKAN_SHADERC_VERSION when the build defines it, or else the
+    time shaders.cpp was built. */
+#ifdef VULKAN_SHADERC
+ShaderFrontend create_shaderc_frontend();
+#endif
+
+struct ShaderCacheStatistics
+{
+    uint64_t memory_hits;
+    uint64_t disk_hits;
+    uint64_t compiled;
+    uint64_t failed;
+    double compile_ms;
+};
+
+/*  Compiles shader sources on worker threads, keeping the SPIR-V in a
+    content-addressed directory: each file is named after a hash of the
+    source text, language, stage, entry point, defines and the frontend
+    version, so a run that has seen a source before only reads a file,
+    and stale files are never looked up again.  The directory is created
+    with its parents if missing.  Files are written aside and renamed, so
+    a crash or a second process never leaves half of one.
+    A frontend without compile only loads cached sources, which is how
+    builds ship without the compiler; its version has to be the one the
+    cache was filled with.
+
+    Requests for the same source while it compiles share one compile. */
+class ShaderCache
+{
+public:
+    ShaderCache(const std::string& directory, const ShaderFrontend& frontend, uint32_t thread_count = 0);
+    ~ShaderCache();
+
+    ShaderCache(const ShaderCache&) = delete;
+    ShaderCache& operator=(const ShaderCache&) = delete;
+
+    bool has_frontend() const;
+
+    /*  The name of the source's file in the directory, the same on every
+        run with the same frontend. */
+    std::string get_key(const ShaderSource& source) const;
+
+    /*  Starts loading or compiling the source.  The future throws what the
+        compile threw, and std::runtime_error if the source is not cached
+        and there is no frontend. */
+    std::shared_future<std::vector<uint32_t>> request(const ShaderSource& source);
+
+    /*  request(), waited for. */
+    std::vector<uint32_t> get(const ShaderSource& source);
+
+    /*  A shader module of the source, owned by the caller. */
+    VkShaderModule create_shader_module(LogicalDevice& device, const ShaderSource& source);
+
+    ShaderCacheStatistics get_statistics() const;
+
+private:
+    struct Job
+    {
+        ShaderSource source;
+        std::string key;
+        std::promise<std::vector<uint32_t>> promise;
+    };
+
+    bool load(const std::string& key, std::vector<uint32_t>& code) const;
+    void save(const std::string& key, const std::vector<uint32_t>& code) const;
+    std::vector<uint32_t> compile(const ShaderSource& source, const std::string& key);
+    void work();
+
+    std::string directory;
+    ShaderFrontend frontend;
+
+    mutable std::mutex mutex;
+    std::condition_variable wake;
+    std::deque<Job> jobs;
+    std::map<std::string, std::shared_future<std::vector<uint32_t>>> shaders;
+    bool stopping;
+    ShaderCacheStatistics statistics;
+    std::vector<std::thread> workers;
+};
+
+}
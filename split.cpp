@@ -0,0 +1,175 @@
+#include "split.h"
+#include "recycling.h"
+
+#include <stdexcept>
+
+namespace vulkan
+{
+
+SplitBarrierPlanner::SplitBarrierPlanner(uint32_t min_gap)
+    : min_gap(min_gap)
+{
+}
+
+void SplitBarrierPlanner::add_dependency(uint32_t producer, uint32_t consumer, const BarrierBatch& barriers)
+{
+    if( consumer <= producer )
+    {
+        throw std::invalid_argument("Pass dependency must point to a later pass");
+    }
+
+    for( PassDependency& dependency : dependencies )
+    {
+        if( dependency.producer == producer && dependency.consumer == consumer )
+        {
+            dependency.barriers.append(barriers);
+            return;
+        }
+    }
+
+    PassDependency dependency;
+    dependency.producer = producer;
+    dependency.consumer = consumer;
+    dependency.placement = consumer - producer - 1 >= min_gap
+        ? DependencyPlacement::SPLIT
+        : DependencyPlacement::BARRIER;
+    dependency.barriers = barriers;
+    dependency.event = VK_NULL_HANDLE;
+    dependencies.push_back(dependency);
+}
+
+void SplitBarrierPlanner::begin_pass(LogicalDevice& device, VkCommandBuffer command_buffer, uint32_t pass)
+{
+    BarrierBatch barriers;
+    std::vector<VkEvent> events;
+    std::vector<const PassDependency*> waits;
+
+    for( PassDependency& dependency : dependencies )
+    {
+        if( dependency.consumer != pass )
+        {
+            continue;
+        }
+        if( dependency.placement == DependencyPlacement::BARRIER )
+        {
+            barriers.append(dependency.barriers);
+            continue;
+        }
+        if( dependency.event == VK_NULL_HANDLE )
+        {
+            throw std::logic_error("Split barrier waited on before its producer ended");
+        }
+        events.push_back(dependency.event);
+        waits.push_back(&dependency);
+    }
+
+    if( !events.empty() )
+    {
+        if( device.get_enabled_features().synchronization2 )
+        {
+            // Each wait must repeat the dependency its event was set with.
+            std::vector<VkDependencyInfoKHR> dependency_infos;
+            for( const PassDependency* dependency : waits )
+            {
+                dependency_infos.push_back(dependency->barriers.get_dependency_info());
+            }
+            device.get_functions().cmd_wait_events2(command_buffer,
+                static_cast<uint32_t>(events.size()), events.data(), dependency_infos.data());
+        }
+        else
+        {
+            // srcStageMask has to be the union of the masks the events
+            // were set with.
+            VkPipelineStageFlags src_stages = 0;
+            LegacyBarriers legacy = {};
+            for( const PassDependency* dependency : waits )
+            {
+                LegacyBarriers own = {};
+                dependency->barriers.append_legacy(own);
+                src_stages |= to_legacy_stages(own.src_stages, true);
+                dependency->barriers.append_legacy(legacy);
+            }
+
+            vkCmdWaitEvents(command_buffer,
+                static_cast<uint32_t>(events.size()), events.data(),
+                src_stages, to_legacy_stages(legacy.dst_stages, false),
+                static_cast<uint32_t>(legacy.memory_barriers.size()), legacy.memory_barriers.data(),
+                static_cast<uint32_t>(legacy.buffer_barriers.size()), legacy.buffer_barriers.data(),
+                static_cast<uint32_t>(legacy.image_barriers.size()), legacy.image_barriers.data());
+        }
+    }
+
+    barriers.record(device, command_buffer);
+}
+
+void SplitBarrierPlanner::end_pass(LogicalDevice& device, VkCommandBuffer command_buffer, uint32_t pass)
+{
+    for( PassDependency& dependency : dependencies )
+    {
+        if( dependency.producer != pass || dependency.placement != DependencyPlacement::SPLIT )
+        {
+            continue;
+        }
+
+        // Merged once here, the wait reuses the same barriers.
+        dependency.barriers.merge();
+        dependency.event = device.get_event_pool().acquire();
+
+        if( device.get_enabled_features().synchronization2 )
+        {
+            VkDependencyInfoKHR dependency_info = dependency.barriers.get_dependency_info();
+            device.get_functions().cmd_set_event2(command_buffer, dependency.event, &dependency_info);
+        }
+        else
+        {
+            LegacyBarriers legacy = {};
+            dependency.barriers.append_legacy(legacy);
+            vkCmdSetEvent(command_buffer, dependency.event, to_legacy_stages(legacy.src_stages, true));
+        }
+    }
+}
+
+void SplitBarrierPlanner::release_events(LogicalDevice& device)
+{
+    for( PassDependency& dependency : dependencies )
+    {
+        if( dependency.event != VK_NULL_HANDLE )
+        {
+            device.get_event_pool().release(dependency.event);
+        }
+    }
+    dependencies.clear();
+}
+
+const std::vector<PassDependency>& SplitBarrierPlanner::get_dependencies() const
+{
+    return dependencies;
+}
+
+std::vector<const PassDependency*> SplitBarrierPlanner::get_signals(uint32_t pass) const
+{
+    std::vector<const PassDependency*> signals;
+    for( const PassDependency& dependency : dependencies )
+    {
+        if( dependency.producer == pass && dependency.placement == DependencyPlacement::SPLIT )
+        {
+            signals.push_back(&dependency);
+        }
+    }
+    return signals;
+}
+
+std::vector<const PassDependency*> SplitBarrierPlanner::get_waits(uint32_t pass) const
+{
+    std::vector<const PassDependency*> waits;
+    for( const PassDependency& dependency : dependencies )
+    {
+        if( dependency.consumer == pass )
+        {
+            waits.push_back(&dependency);
+        }
+    }
+    return waits;
+}
+
+}
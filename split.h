@@ -0,0 +1,74 @@
+#pragma once
+
+#include "vulkan.h"
+#include "barriers.h"
+
+#include <vector>
+
+namespace vulkan
+{
+
+enum class DependencyPlacement
+{
+    BARRIER,    // pipeline barrier right before the consumer
+    SPLIT       // event set after the producer, waited on before the consumer
+};
+
+/*  The barriers one pass needs after the writes of an earlier one. */
+struct PassDependency
+{
+    uint32_t producer;
+    uint32_t consumer;
+    DependencyPlacement placement;
+    BarrierBatch barriers;
+    VkEvent event;
+};
+
+/*  Places the dependencies between the passes of a command buffer.  A
+    dependency with enough independent passes between producer and
+    consumer becomes a split barrier: vkCmdSetEvent2KHR right after the
+    producer and vkCmdWaitEvents2KHR right before the consumer, so the
+    passes in between run without waiting for the producer to drain.
+    Others stay ordinary pipeline barriers.  Without synchronization2 the
+    Vulkan 1.0 vkCmdSetEvent / vkCmdWaitEvents are used.
+
+    Declare every dependency, then call end_pass() after recording each
+    producer and begin_pass() before each consumer.  Events come from the
+    device's EventPool; hand them back with release_events() once the
+    command buffer has completed. */
+class SplitBarrierPlanner
+{
+public:
+    /*  Dependencies need at least min_gap passes between producer and
+        consumer to be split; with none in between there is nothing to
+        overlap, and an event costs more than a barrier. */
+    explicit SplitBarrierPlanner(uint32_t min_gap = 1);
+
+    /*  Adds the barriers pass consumer needs after pass producer, which
+        must come earlier.  Dependencies between the same two passes are
+        combined.  Throws std::invalid_argument if consumer <= producer. */
+    void add_dependency(uint32_t producer, uint32_t consumer, const BarrierBatch& barriers);
+
+    /*  Waits for the split dependencies of the pass and records its
+        ordinary barriers. */
+    void begin_pass(LogicalDevice& device, VkCommandBuffer command_buffer, uint32_t pass);
+
+    /*  Sets the events of the split dependencies the pass produces. */
+    void end_pass(LogicalDevice& device, VkCommandBuffer command_buffer, uint32_t pass);
+
+    /*  Returns the events to the pool and forgets all dependencies. */
+    void release_events(LogicalDevice& device);
+
+    const std::vector<PassDependency>& get_dependencies() const;
+
+    /*  Dependencies whose event the pass sets, and the ones it waits on or
+        records a barrier for, in the order they were added. */
+    std::vector<const PassDependency*> get_signals(uint32_t pass) const;
+    std::vector<const PassDependency*> get_waits(uint32_t pass) const;
+
+private:
+    uint32_t min_gap;
+    std::vector<PassDependency> dependencies;
+};
+
+}
@@ -0,0 +1,257 @@
+#include "streaming.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace vulkan
+{
+
+Image* StreamedTexture::get_image() const
+{
+    return image.get();
+}
+
+uint32_t StreamedTexture::get_first_level() const
+{
+    return first_level;
+}
+
+uint32_t StreamedTexture::get_level_count() const
+{
+    return static_cast<uint32_t>(levels.size());
+}
+
+TextureStreamer::TextureStreamer(LogicalDevice& device, Uploader& uploader, uint32_t frames_in_flight)
+    : device(device)
+    , uploader(uploader)
+    , frames_in_flight(frames_in_flight)
+    , frame(0)
+    , levels_dropped(0)
+{
+    device.get_memory_governor().add_responder(PressureStage::DOWNGRADE_MIPS, this);
+}
+
+TextureStreamer::~TextureStreamer()
+{
+    device.get_memory_governor().remove_responder(this);
+}
+
+StreamedTexture* TextureStreamer::add(
+    VkFormat format,
+    VkExtent3D extent,
+    uint32_t array_layers,
+    VkImageUsageFlags usage,
+    std::vector<std::vector<char>> levels)
+{
+    if( levels.empty() )
+    {
+        throw std::invalid_argument("Streamed texture without levels");
+    }
+
+    std::unique_ptr<StreamedTexture> texture(new StreamedTexture());
+    texture->format = format;
+    texture->extent = extent;
+    texture->array_layers = array_layers;
+    texture->usage = usage;
+    texture->levels = std::move(levels);
+    texture->first_level = 0;
+    texture->heap_index = 0;
+    texture->resident_size = 0;
+    texture->drop_levels = 0;
+
+    StreamedTexture* added = texture.get();
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        textures.push_back(std::move(texture));
+    }
+
+    // Behind textures deferred before, as they are retried in order.
+    bool waiting = false;
+    for( const std::unique_ptr<StreamedTexture>& other : textures )
+    {
+        waiting |= other.get() != added && !other->image;
+    }
+    if( !waiting )
+    {
+        make_resident(*added, 0, AllocationPriority::DEFERRABLE);
+    }
+    return added;
+}
+
+void TextureStreamer::remove(StreamedTexture* texture)
+{
+    std::unique_ptr<StreamedTexture> removed;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto found = std::find_if(textures.begin(), textures.end(),
+            [texture](const std::unique_ptr<StreamedTexture>& t) { return t.get() == texture; });
+        if( found == textures.end() )
+        {
+            return;
+        }
+        removed = std::move(*found);
+        textures.erase(found);
+    }
+
+    if( removed->image )
+    {
+        retire(std::move(removed->image));
+    }
+}
+
+void TextureStreamer::retire(std::unique_ptr<Image> image)
+{
+    Retired old;
+    old.image = std::move(image);
+    old.frame = frame;
+    retired.push_back(std::move(old));
+}
+
+bool TextureStreamer::make_resident(StreamedTexture& texture, uint32_t first_level, AllocationPriority priority)
+{
+    VkExtent3D extent;
+    extent.width = std::max(1u, texture.extent.width >> first_level);
+    extent.height = std::max(1u, texture.extent.height >> first_level);
+    extent.depth = std::max(1u, texture.extent.depth >> first_level);
+    uint32_t level_count = static_cast<uint32_t>(texture.levels.size()) - first_level;
+
+    std::unique_ptr<Image> image = uploader.create_image(
+        texture.format, extent, level_count, texture.array_layers, texture.usage, priority);
+    if( !image )
+    {
+        return false;
+    }
+
+    for( uint32_t level = 0; level < level_count; ++level )
+    {
+        const std::vector<char>& data = texture.levels[first_level + level];
+        uploader.upload(*image, level, data.data(), data.size());
+    }
+    uploader.flush();
+
+    MemoryAllocation* allocation = image->get_allocation();
+    uint32_t heap_index = device.get_memory_properties().memoryTypes[allocation->get_memory_type_index()].heapIndex;
+
+    std::unique_ptr<Image> old;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        old = std::move(texture.image);
+        texture.image = std::move(image);
+        texture.first_level = first_level;
+        texture.heap_index = heap_index;
+        texture.resident_size = allocation->get_size();
+    }
+
+    if( old )
+    {
+        retire(std::move(old));
+    }
+    return true;
+}
+
+void TextureStreamer::begin_frame()
+{
+    ++frame;
+    retired.erase(
+        std::remove_if(retired.begin(), retired.end(),
+            [this](const Retired& old) { return frame - old.frame > frames_in_flight; }),
+        retired.end());
+
+    for( size_t i = 0; i < textures.size(); ++i )
+    {
+        StreamedTexture& texture = *textures[i];
+        uint32_t drop;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            drop = texture.drop_levels;
+            texture.drop_levels = 0;
+        }
+        if( drop == 0 || !texture.image )
+        {
+            continue;
+        }
+
+        // The smaller image replaces a larger one freed frames_in_flight
+        // frames later, so it must not wait for room.
+        uint32_t last_level = static_cast<uint32_t>(texture.levels.size()) - 1;
+        uint32_t first_level = std::min(texture.first_level + drop, last_level);
+        uint32_t dropped = first_level - texture.first_level;
+        if( dropped != 0 && make_resident(texture, first_level, AllocationPriority::CRITICAL) )
+        {
+            levels_dropped += dropped;
+        }
+    }
+
+    for( size_t i = 0; i < textures.size(); ++i )
+    {
+        StreamedTexture& texture = *textures[i];
+        if( !texture.image && !make_resident(texture, texture.first_level, AllocationPriority::DEFERRABLE) )
+        {
+            break;
+        }
+    }
+}
+
+VkDeviceSize TextureStreamer::relieve_pressure(uint32_t heap_index, VkDeviceSize bytes_needed)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    std::vector<StreamedTexture*> candidates;
+    for( const std::unique_ptr<StreamedTexture>& texture : textures )
+    {
+        if( texture->resident_size != 0 && texture->heap_index == heap_index
+            && texture->first_level + texture->drop_levels + 1 < texture->levels.size() )
+        {
+            candidates.push_back(texture.get());
+        }
+    }
+
+    // Each dropped level halves width and height, so the image shrinks to
+    // about a quarter of what it would be.
+    auto projected_size = [](const StreamedTexture* texture)
+    {
+        return texture->resident_size >> (2 * texture->drop_levels);
+    };
+    std::sort(candidates.begin(), candidates.end(),
+        [&projected_size](const StreamedTexture* a, const StreamedTexture* b)
+        {
+            return projected_size(a) > projected_size(b);
+        });
+
+    VkDeviceSize planned = 0;
+    for( StreamedTexture* texture : candidates )
+    {
+        if( planned >= bytes_needed )
+        {
+            break;
+        }
+        VkDeviceSize size = projected_size(texture);
+        planned += size - size / 4;
+        texture->drop_levels++;
+    }
+    return 0;
+}
+
+TextureStreamerStatistics TextureStreamer::get_statistics()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    TextureStreamerStatistics statistics = {};
+    statistics.textures = static_cast<uint32_t>(textures.size());
+    statistics.levels_dropped = levels_dropped;
+    for( const std::unique_ptr<StreamedTexture>& texture : textures )
+    {
+        if( texture->image )
+        {
+            statistics.resident++;
+            statistics.bytes_resident += texture->resident_size;
+        }
+        else
+        {
+            statistics.deferred++;
+        }
+    }
+    return statistics;
+}
+
+}
@@ -0,0 +1,125 @@
+#pragma once
+
+#include "vulkan.h"
+#include "upload.h"
+
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace vulkan
+{
+
+/*  A texture kept by a TextureStreamer, with its tightly packed texels for
+    every mip level of every layer.  The image is missing while the memory
+    governor defers its allocation, and lacks the most detailed levels of
+    the source once they were dropped under memory pressure. */
+class StreamedTexture
+{
+    friend class TextureStreamer;
+
+public:
+    StreamedTexture(const StreamedTexture&) = delete;
+    StreamedTexture& operator=(const StreamedTexture&) = delete;
+
+    /*  nullptr until the image is resident.  A new image replaces the old
+        one when levels are dropped, which its get_generation() tells. */
+    Image* get_image() const;
+
+    /*  The level of the source that is level 0 of the image. */
+    uint32_t get_first_level() const;
+    uint32_t get_level_count() const;
+
+private:
+    StreamedTexture() = default;
+
+    VkFormat format;
+    VkExtent3D extent;
+    uint32_t array_layers;
+    VkImageUsageFlags usage;
+    std::vector<std::vector<char>> levels;
+    uint32_t first_level;
+    std::unique_ptr<Image> image;
+
+    // Under the streamer's mutex, for relieve_pressure() on other threads.
+    uint32_t heap_index;
+    VkDeviceSize resident_size;
+    uint32_t drop_levels;
+};
+
+struct TextureStreamerStatistics
+{
+    uint32_t textures;
+    uint32_t resident;
+    uint32_t deferred;
+    uint64_t levels_dropped;
+    VkDeviceSize bytes_resident;
+};
+
+/*  Streams textures through an Uploader with deferrable allocations: one
+    the memory governor defers stays without an image and is tried again
+    each frame, in the order added, until it fits.
+
+    Registered with the governor at PressureStage::DOWNGRADE_MIPS.  Frames
+    in flight may still sample the images, so relieve_pressure() frees
+    nothing at once and returns 0; it marks the largest textures on the
+    heap to lose their most detailed level, and the next begin_frame()
+    replaces their images with smaller ones.  Replaced images are
+    destroyed frames_in_flight frames later.  The least detailed level is
+    always kept.
+
+    Everything but relieve_pressure() belongs to the thread that uses the
+    Uploader. */
+class TextureStreamer : public IMemoryPressureResponder
+{
+public:
+    TextureStreamer(LogicalDevice& device, Uploader& uploader, uint32_t frames_in_flight = 3);
+    ~TextureStreamer();
+
+    TextureStreamer(const TextureStreamer&) = delete;
+    TextureStreamer& operator=(const TextureStreamer&) = delete;
+
+    /*  Takes the texels of each level, tightly packed and level 0 first,
+        and makes the texture resident at once if the governor admits it. */
+    StreamedTexture* add(
+        VkFormat format,
+        VkExtent3D extent,
+        uint32_t array_layers,
+        VkImageUsageFlags usage,
+        std::vector<std::vector<char>> levels);
+
+    /*  The image is destroyed frames_in_flight frames later. */
+    void remove(StreamedTexture* texture);
+
+    /*  Destroys images retired frames_in_flight frames ago, drops the levels
+        relieve_pressure() asked for and retries deferred textures.  Call
+        once per frame. */
+    void begin_frame();
+
+    virtual VkDeviceSize relieve_pressure(uint32_t heap_index, VkDeviceSize bytes_needed);
+
+    TextureStreamerStatistics get_statistics();
+
+private:
+    struct Retired
+    {
+        std::unique_ptr<Image> image;
+        uint64_t frame;
+    };
+
+    /*  Creates and uploads the image from the first level on.  Returns
+        false if the governor deferred it. */
+    bool make_resident(StreamedTexture& texture, uint32_t first_level, AllocationPriority priority);
+    void retire(std::unique_ptr<Image> image);
+
+    LogicalDevice& device;
+    Uploader& uploader;
+    uint32_t frames_in_flight;
+    uint64_t frame;
+    std::vector<std::unique_ptr<StreamedTexture>> textures;
+    std::vector<Retired> retired;
+    uint64_t levels_dropped;
+    std::mutex mutex;
+};
+
+}
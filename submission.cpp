@@ -0,0 +1,236 @@
+#include "submission.h"
+
+#include <algorithm>
+
+namespace vulkan
+{
+
+// Submissions per vkQueueSubmit at most, so that a steady stream of work
+// does not keep the first of it waiting.
+static const size_t max_batch_size = 64;
+
+void LatencyHistogram::add(uint64_t microseconds)
+{
+    size_t bucket = 0;
+    while( bucket + 1 < buckets.size() && (microseconds >> (bucket + 1)) != 0 )
+    {
+        ++bucket;
+    }
+    buckets[bucket]++;
+    count++;
+    total_microseconds += microseconds;
+    if( microseconds > max_microseconds )
+    {
+        max_microseconds = microseconds;
+    }
+}
+
+uint64_t LatencyHistogram::get_percentile(double fraction) const
+{
+    uint64_t wanted = static_cast<uint64_t>(fraction * count);
+    uint64_t seen = 0;
+    for( size_t bucket = 0; bucket < buckets.size(); ++bucket )
+    {
+        seen += buckets[bucket];
+        if( seen > wanted || seen == count )
+        {
+            return std::min((uint64_t(2) << bucket) - 1, max_microseconds);
+        }
+    }
+    return max_microseconds;
+}
+
+SubmissionThread::SubmissionThread(Queue& queue)
+    : queue(queue)
+    , head(&stub)
+    , tail(&stub)
+    , enqueued_count(0)
+    , submitted_count(0)
+    , dequeued_count(0)
+    , sleeping(false)
+    , stopping(false)
+    , error(VK_SUCCESS)
+    , histogram()
+{
+    stub.next.store(nullptr);
+    stub.fence = VK_NULL_HANDLE;
+    thread = std::thread(&SubmissionThread::run, this);
+}
+
+SubmissionThread::~SubmissionThread()
+{
+    {
+        std::lock_guard<std::mutex> lock(wake_mutex);
+        stopping = true;
+    }
+    wake_condition.notify_one();
+    thread.join();
+}
+
+void SubmissionThread::submit(const Submission& submission, VkFence fence)
+{
+    check_error();
+
+    Packet* packet = new Packet;
+    packet->submission = submission;
+    packet->fence = fence;
+    packet->enqueued = std::chrono::steady_clock::now();
+    push(packet);
+
+    // Counted after linking, so a count the thread can see is never ahead
+    // of what it can pop.  Pairs with the sleeping check in run().
+    enqueued_count.fetch_add(1);
+    if( sleeping.load() )
+    {
+        std::lock_guard<std::mutex> lock(wake_mutex);
+        wake_condition.notify_one();
+    }
+}
+
+void SubmissionThread::drain()
+{
+    uint64_t target = enqueued_count.load();
+    {
+        std::unique_lock<std::mutex> lock(wake_mutex);
+        drained_condition.wait(lock, [&] { return submitted_count.load() >= target; });
+    }
+    check_error();
+}
+
+LatencyHistogram SubmissionThread::get_latency_histogram()
+{
+    std::lock_guard<std::mutex> lock(histogram_mutex);
+    return histogram;
+}
+
+void SubmissionThread::check_error()
+{
+    VkResult result = error.exchange(VK_SUCCESS);
+    if( result != VK_SUCCESS )
+    {
+        throw VulkanException(result, "Error while submitting on the submission thread");
+    }
+}
+
+/*  Vyukov's intrusive MPSC queue.  A producer swings head to its packet
+    and then links the previous head to it, so between the two steps the
+    list is briefly cut and pop() reports nothing. */
+void SubmissionThread::push(Packet* packet)
+{
+    packet->next.store(nullptr, std::memory_order_relaxed);
+    Packet* previous = head.exchange(packet, std::memory_order_acq_rel);
+    previous->next.store(packet, std::memory_order_release);
+}
+
+SubmissionThread::Packet* SubmissionThread::pop()
+{
+    Packet* first = tail;
+    Packet* next = first->next.load(std::memory_order_acquire);
+
+    if( first == &stub )
+    {
+        if( !next )
+        {
+            return nullptr;
+        }
+        tail = next;
+        first = next;
+        next = next->next.load(std::memory_order_acquire);
+    }
+
+    if( next )
+    {
+        tail = next;
+        return first;
+    }
+
+    if( first != head.load(std::memory_order_acquire) )
+    {
+        return nullptr;
+    }
+
+    // first is the last packet; put the stub behind it so it can be taken.
+    push(&stub);
+    next = first->next.load(std::memory_order_acquire);
+    if( next )
+    {
+        tail = next;
+        return first;
+    }
+    return nullptr;
+}
+
+void SubmissionThread::run()
+{
+    for( ;; )
+    {
+        Packet* packet = pop();
+        if( packet )
+        {
+            ++dequeued_count;
+            batch.push_back(std::move(packet->submission));
+            batch_enqueued.push_back(packet->enqueued);
+            VkFence fence = packet->fence;
+            delete packet;
+
+            // A fence covers everything up to its packet, so it ends the
+            // batch.
+            if( fence != VK_NULL_HANDLE || batch.size() >= max_batch_size )
+            {
+                submit_batch(fence);
+            }
+            continue;
+        }
+
+        if( !batch.empty() )
+        {
+            submit_batch(VK_NULL_HANDLE);
+            continue;
+        }
+
+        if( enqueued_count.load() != dequeued_count )
+        {
+            // A producer is between its two push steps.
+            std::this_thread::yield();
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(wake_mutex);
+        if( stopping )
+        {
+            break;
+        }
+        sleeping = true;
+        wake_condition.wait(lock, [&] { return enqueued_count.load() != dequeued_count || stopping; });
+        sleeping = false;
+    }
+}
+
+void SubmissionThread::submit_batch(VkFence fence)
+{
+    size_t count = batch.size();
+    VkResult result = queue.submit(batch, fence);
+    if( result != VK_SUCCESS )
+    {
+        VkResult expected = VK_SUCCESS;
+        error.compare_exchange_strong(expected, result);
+    }
+
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    {
+        std::lock_guard<std::mutex> lock(histogram_mutex);
+        for( auto& enqueued : batch_enqueued )
+        {
+            histogram.add(std::chrono::duration_cast<std::chrono::microseconds>(now - enqueued).count());
+        }
+    }
+    batch_enqueued.clear();
+
+    {
+        std::lock_guard<std::mutex> lock(wake_mutex);
+        submitted_count.fetch_add(count);
+    }
+    drained_condition.notify_all();
+}
+
+}
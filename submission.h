@@ -0,0 +1,102 @@
+#pragma once
+
+#include "vulkan.h"
+#include "queue.h"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace vulkan
+{
+
+/*  Enqueue-to-submit latencies in power of two buckets: bucket i counts
+    latencies of at least 2^i and less than 2^(i+1) microseconds, bucket 0
+    also those under a microsecond. */
+struct LatencyHistogram
+{
+    std::array<uint64_t, 24> buckets;
+    uint64_t count;
+    uint64_t total_microseconds;
+    uint64_t max_microseconds;
+
+    void add(uint64_t microseconds);
+
+    /*  Upper bound of the bucket holding the given fraction of samples,
+        e.g. 0.99 for the 99th percentile. */
+    uint64_t get_percentile(double fraction) const;
+};
+
+/*  Feeds a Queue from a thread of its own.  Workers hand recorded work to
+    submit(), which only links it into a lock-free multi-producer,
+    single-consumer list, so they never wait on each other or on the
+    driver.  The thread takes everything that has arrived and submits it
+    with as few vkQueueSubmit calls as the fences allow.  Create one per
+    Queue.
+
+    Errors from vkQueueSubmit are thrown from the next submit() or
+    drain(). */
+class SubmissionThread
+{
+public:
+    explicit SubmissionThread(Queue& queue);
+    ~SubmissionThread();
+
+    SubmissionThread(const SubmissionThread&) = delete;
+    SubmissionThread& operator=(const SubmissionThread&) = delete;
+
+    /*  The fence, if any, signals once this and all earlier submissions
+        have completed. */
+    void submit(const Submission& submission, VkFence fence = VK_NULL_HANDLE);
+
+    /*  Waits until everything submitted so far is in the driver's hands. */
+    void drain();
+
+    LatencyHistogram get_latency_histogram();
+
+private:
+    struct Packet
+    {
+        std::atomic<Packet*> next;
+        Submission submission;
+        VkFence fence;
+        std::chrono::steady_clock::time_point enqueued;
+    };
+
+    void push(Packet* packet);
+    Packet* pop();
+    void run();
+    void submit_batch(VkFence fence);
+    void check_error();
+
+    Queue& queue;
+
+    // Producers exchange head, the submission thread owns tail.
+    std::atomic<Packet*> head;
+    Packet* tail;
+    Packet stub;
+
+    std::atomic<uint64_t> enqueued_count;
+    std::atomic<uint64_t> submitted_count;
+    uint64_t dequeued_count;
+    std::atomic<bool> sleeping;
+    std::atomic<bool> stopping;
+    std::atomic<VkResult> error;
+    std::mutex wake_mutex;
+    std::condition_variable wake_condition;
+    std::condition_variable drained_condition;
+
+    std::vector<Submission> batch;
+    std::vector<std::chrono::steady_clock::time_point> batch_enqueued;
+
+    std::mutex histogram_mutex;
+    LatencyHistogram histogram;
+
+    std::thread thread;
+};
+
+}
@@ -1,9 +1,44 @@
 #include "vulkan.h"
+#include "memory.h"
+#include "pool.h"
+#include "upload.h"
+#include "streaming.h"
+#include "barriers.h"
+#include "layouts.h"
+#include "split.h"
+#include "queue.h"
+#include "submission.h"
+#include "queries.h"
+#include "frames.h"
+#include "breadcrumbs.h"
+#include "passcache.h"
+#include "limiter.h"
+#include "resolution.h"
+#include "recycling.h"
+#include "latch.h"
+#include "variants.h"
+#include "pipelines.h"
+#include "dynamic.h"
+#include "autotune.h"
+#include "reflection.h"
+#include "shaders.h"
+#include "primitives.h"
 #include "sdl.h"
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <random>
 #include <stdexcept>
 #include <vector>
 #include <string>
+#include <thread>
 #include <stdio.h>
 
 using namespace vulkan;
@@ -80,6 +115,7 @@ public:
 
     std::vector<LayerInfo> get_requested_layers() const;
     std::vector<ExtensionInfo> get_requested_extensions() const;
+    std::vector<ExtensionInfo> get_optional_extensions() const;
 };
 
 std::vector<LayerInfo> CreateLogicalDeviceParameters::get_requested_layers() const
@@ -92,33 +128,2769 @@ std::vector<ExtensionInfo> CreateLogicalDeviceParameters::get_requested_extensio
     return requested_extensions;
 }
 
+std::vector<ExtensionInfo> CreateLogicalDeviceParameters::get_optional_extensions() const
+{
+    return {
+        ExtensionInfo{VK_EXT_MEMORY_BUDGET_EXTENSION_NAME, 0},
+        ExtensionInfo{VK_KHR_BUFFER_DEVICE_ADDRESS_EXTENSION_NAME, 0},
+        ExtensionInfo{VK_KHR_COPY_COMMANDS_2_EXTENSION_NAME, 0},
+        ExtensionInfo{VK_KHR_FORMAT_FEATURE_FLAGS_2_EXTENSION_NAME, 0},
+        ExtensionInfo{VK_EXT_HOST_IMAGE_COPY_EXTENSION_NAME, 0},
+        ExtensionInfo{VK_KHR_SYNCHRONIZATION_2_EXTENSION_NAME, 0},
+        ExtensionInfo{VK_AMD_BUFFER_MARKER_EXTENSION_NAME, 0},
+        ExtensionInfo{VK_EXT_DEVICE_FAULT_EXTENSION_NAME, 0},
+        ExtensionInfo{VK_AMD_DEVICE_COHERENT_MEMORY_EXTENSION_NAME, 0},
+        ExtensionInfo{VK_KHR_PRESENT_ID_EXTENSION_NAME, 0},
+        ExtensionInfo{VK_KHR_PRESENT_WAIT_EXTENSION_NAME, 0},
+        ExtensionInfo{VK_KHR_PIPELINE_LIBRARY_EXTENSION_NAME, 0},
+        ExtensionInfo{VK_EXT_GRAPHICS_PIPELINE_LIBRARY_EXTENSION_NAME, 0},
+        ExtensionInfo{VK_EXT_EXTENDED_DYNAMIC_STATE_EXTENSION_NAME, 0},
+        ExtensionInfo{VK_EXT_EXTENDED_DYNAMIC_STATE_2_EXTENSION_NAME, 0},
+        ExtensionInfo{VK_EXT_EXTENDED_DYNAMIC_STATE_3_EXTENSION_NAME, 0},
+        ExtensionInfo{VK_EXT_VERTEX_INPUT_DYNAMIC_STATE_EXTENSION_NAME, 0},
+    };
+}
+
+
+template<typename Info>
+std::vector<Info> filter_by_name(
+    const std::vector<Info>& infos,
+    const std::vector<std::string>& names_vec)
+{
+    std::set<std::string> names;
+    for( const std::string& name : names_vec )
+    {
+        names.insert(name);
+    }
+
+    std::vector<Info> result_infos;
+    for( const Info& info : infos )
+    {
+        if( names.find(info.name) != names.end() )
+        {
+            result_infos.push_back(info);
+        }
+    }
+
+    return result_infos;
+}
+
+
+/*  Heaps that exist only in memory.  The budget shrinks when other_usage
+    grows, the way it does on a real device when another process allocates. */
+class FakeHeapBudgetSource : public IHeapBudgetSource
+{
+public:
+    std::vector<VkDeviceSize> sizes;
+    std::vector<VkDeviceSize> other_usage;
+
+    explicit FakeHeapBudgetSource(const std::vector<VkDeviceSize>& sizes)
+        : sizes(sizes)
+        , other_usage(sizes.size(), 0)
+    {
+    }
+
+    virtual std::vector<HeapBudget> get_heap_budgets()
+    {
+        std::vector<HeapBudget> budgets;
+        for( size_t i = 0; i < sizes.size(); ++i )
+        {
+            budgets.push_back(HeapBudget{sizes[i], sizes[i] - other_usage[i], 0});
+        }
+        return budgets;
+    }
+};
+
+/*  Stands in for a texture cache holding evictable memory. */
+class FakeCache : public IMemoryPressureResponder
+{
+public:
+    MemoryGovernor* governor;
+    VkDeviceSize held;
+
+    FakeCache(MemoryGovernor* governor, VkDeviceSize held)
+        : governor(governor)
+        , held(held)
+    {
+        governor->on_allocated(0, held);
+    }
+
+    virtual VkDeviceSize relieve_pressure(uint32_t heap_index, VkDeviceSize bytes_needed)
+    {
+        VkDeviceSize freed = std::min(held, bytes_needed);
+        held -= freed;
+        governor->on_freed(heap_index, freed);
+        return freed;
+    }
+};
+
+bool check(bool condition, const char* description)
+{
+    printf(" - %s: %s\n", description, condition ? "ok" : "FAILED");
+    return condition;
+}
+
+/*  Reports a test that could not run, and returns whether that passes.
+    Without shaderc, which the test-shaderc build links, or on a device
+    short of a feature, a test would otherwise pass having tested nothing,
+    so a skip fails unless VULKAN_TEST_ALLOW_SKIP is set. */
+bool skip(const std::string& reason)
+{
+    bool allowed = getenv("VULKAN_TEST_ALLOW_SKIP") != nullptr;
+    printf(" - skipped: %s%s\n", reason.c_str(), allowed ? "" : ", failing without VULKAN_TEST_ALLOW_SKIP");
+    return allowed;
+}
+
+/*  Drives a MemoryGovernor over a fake 256MB heap. */
+bool test_memory_governor_under_pressure()
+{
+    const VkDeviceSize MB = 1024 * 1024;
+
+    FakeHeapBudgetSource* source = new FakeHeapBudgetSource({256 * MB});
+    MemoryGovernor governor((std::unique_ptr<IHeapBudgetSource>(source)));
+    FakeCache cache(&governor, 96 * MB);
+    governor.add_responder(PressureStage::EVICT_CACHES, &cache);
+
+    bool passed = true;
+    printf("Memory governor under pressure:\n");
+
+    passed &= check(governor.admit(0, 96 * MB, AllocationPriority::NORMAL) == Admission::ADMITTED,
+        "allocation within budget admitted");
+    passed &= check(governor.admit(0, 96 * MB, AllocationPriority::DEFERRABLE) == Admission::DEFERRED,
+        "admitted bytes reserved until allocated");
+    governor.on_allocated(0, 96 * MB);
+
+    passed &= check(governor.admit(0, 64 * MB, AllocationPriority::DEFERRABLE) == Admission::DEFERRED,
+        "deferrable allocation over soft limit deferred");
+    passed &= check(cache.held == 96 * MB, "deferral leaves the cache alone");
+
+    passed &= check(governor.admit(0, 64 * MB, AllocationPriority::NORMAL) == Admission::ADMITTED,
+        "normal allocation over soft limit admitted after eviction");
+    passed &= check(cache.held < 96 * MB, "cache evicted to make room");
+    governor.on_allocated(0, 64 * MB);
+
+    source->other_usage[0] = 96 * MB;
+    governor.refresh_budgets();
+
+    passed &= check(governor.admit(0, 64 * MB, AllocationPriority::NORMAL) == Admission::DENIED,
+        "normal allocation denied once another process takes the heap");
+    passed &= check(governor.admit(0, 64 * MB, AllocationPriority::CRITICAL) == Admission::ADMITTED,
+        "critical allocation still attempted");
+    passed &= check(governor.get_available(0) == 0, "no headroom reported");
+    governor.cancel_admission(0, 64 * MB);
+
+    source->other_usage[0] = 0;
+    governor.refresh_budgets();
+    passed &= check(governor.get_available(0) > 64 * MB, "failed allocation gives its reservation back");
+
+    // A responder removed while relieving pressure on another thread is
+    // destroyed only once it is done.
+    class SlowResponder : public IMemoryPressureResponder
+    {
+    public:
+        std::atomic<bool> entered{false};
+        std::atomic<bool> left{false};
+
+        virtual VkDeviceSize relieve_pressure(uint32_t, VkDeviceSize)
+        {
+            entered = true;
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+            left = true;
+            return 0;
+        }
+    };
+
+    governor.remove_responder(&cache);
+    SlowResponder slow;
+    governor.add_responder(PressureStage::EVICT_CACHES, &slow);
+    std::thread relief([&governor]() { governor.relieve_pressure(0, MB); });
+    while( !slow.entered )
+    {
+        std::this_thread::yield();
+    }
+    governor.remove_responder(&slow);
+    passed &= check(slow.left, "removing a responder waits for relief in progress");
+    relief.join();
+
+    return passed;
+}
+
+/*  Handle values for tests that never reach the driver.  Non-dispatchable
+    handles are pointers or 64-bit integers depending on the platform. */
+template<typename Handle>
+Handle fake_handle(uintptr_t value)
+{
+    Handle handle = Handle();
+    std::memcpy(&handle, &value, std::min(sizeof(handle), sizeof(value)));
+    return handle;
+}
+
+VkImageSubresourceRange color_range(uint32_t mip, uint32_t mip_count)
+{
+    return VkImageSubresourceRange{VK_IMAGE_ASPECT_COLOR_BIT, mip, mip_count, 0, 1};
+}
+
+/*  Calls a HostAllocator through its callbacks the way a driver does. */
+bool test_host_allocator()
+{
+    HostAllocator allocator;
+    const VkAllocationCallbacks* callbacks = allocator.get_callbacks();
+    auto allocate = [callbacks](size_t size, size_t alignment, VkSystemAllocationScope scope)
+    {
+        return callbacks->pfnAllocation(callbacks->pUserData, size, alignment, scope);
+    };
+    auto reallocate = [callbacks](void* original, size_t size, size_t alignment, VkSystemAllocationScope scope)
+    {
+        return callbacks->pfnReallocation(callbacks->pUserData, original, size, alignment, scope);
+    };
+    auto free = [callbacks](void* memory)
+    {
+        callbacks->pfnFree(callbacks->pUserData, memory);
+    };
+    auto aligned = [](void* memory, uintptr_t alignment)
+    {
+        return memory != nullptr && reinterpret_cast<uintptr_t>(memory) % alignment == 0;
+    };
+
+    bool passed = true;
+    printf("Host allocator:\n");
+
+    void* small = allocate(100, 8, VK_SYSTEM_ALLOCATION_SCOPE_OBJECT);
+    memset(small, 0x5a, 100);
+    void* over_aligned = allocate(200, 256, VK_SYSTEM_ALLOCATION_SCOPE_OBJECT);
+    void* large = allocate(64 * 1024, 4096, VK_SYSTEM_ALLOCATION_SCOPE_OBJECT);
+    passed &= check(aligned(small, 16) && aligned(over_aligned, 256) && aligned(large, 4096),
+        "alignments above 16 honored in size classes and on the heap");
+
+    void* grown = reallocate(small, 3000, 8, VK_SYSTEM_ALLOCATION_SCOPE_OBJECT);
+    bool kept = true;
+    for( int i = 0; i < 100; ++i )
+    {
+        kept &= static_cast<unsigned char*>(grown)[i] == 0x5a;
+    }
+    void* shrunk = reallocate(grown, 1000, 8, VK_SYSTEM_ALLOCATION_SCOPE_OBJECT);
+    passed &= check(kept && shrunk == grown, "reallocation keeps the contents, shrinks in place");
+
+    HostAllocationStatistics object = allocator.get_statistics(VK_SYSTEM_ALLOCATION_SCOPE_OBJECT);
+    passed &= check(object.allocations == 4 && object.reallocations == 2 && object.frees == 1
+        && object.bytes_live == 1000 + 200 + 64 * 1024, "object scope counters");
+
+    free(shrunk);
+    free(over_aligned);
+    free(large);
+    void* reused = allocate(100, 8, VK_SYSTEM_ALLOCATION_SCOPE_OBJECT);
+    passed &= check(reused == small, "freed size class block handed out again");
+    free(reused);
+
+    object = allocator.get_statistics(VK_SYSTEM_ALLOCATION_SCOPE_OBJECT);
+    passed &= check(object.bytes_live == 0 && object.bytes_peak >= 3000 + 200 + 64 * 1024,
+        "live bytes back to zero, peak kept");
+
+    void* first = allocate(64, 8, VK_SYSTEM_ALLOCATION_SCOPE_COMMAND);
+    void* second = allocate(64, 8, VK_SYSTEM_ALLOCATION_SCOPE_COMMAND);
+    void* other_thread = nullptr;
+    std::thread([&]() { other_thread = allocate(64, 8, VK_SYSTEM_ALLOCATION_SCOPE_COMMAND); }).join();
+    passed &= check(second > first && other_thread != nullptr && other_thread != first && other_thread != second,
+        "command scope bumps through an arena per thread");
+    free(first);
+    void* third = allocate(64, 8, VK_SYSTEM_ALLOCATION_SCOPE_COMMAND);
+    passed &= check(third > second, "arena does not rewind while an allocation is alive");
+    free(second);
+    free(third);
+    free(other_thread);
+    void* rewound = allocate(64, 8, VK_SYSTEM_ALLOCATION_SCOPE_COMMAND);
+    passed &= check(rewound == first, "arena rewinds once everything was freed");
+    free(rewound);
+
+    callbacks->pfnInternalAllocation(callbacks->pUserData, 4096,
+        VK_INTERNAL_ALLOCATION_TYPE_EXECUTABLE, VK_SYSTEM_ALLOCATION_SCOPE_DEVICE);
+    HostAllocationStatistics command = allocator.get_statistics(VK_SYSTEM_ALLOCATION_SCOPE_COMMAND);
+    HostAllocationStatistics device = allocator.get_statistics(VK_SYSTEM_ALLOCATION_SCOPE_DEVICE);
+    object = allocator.get_statistics(VK_SYSTEM_ALLOCATION_SCOPE_OBJECT);
+    passed &= check(command.allocations == 5 && command.frees == 5 && command.bytes_live == 0
+        && object.allocations == 5 && device.allocations == 0 && device.internal_allocations == 1,
+        "counted per scope");
+
+    return passed;
+}
+
+/*  Sums the statistics of two made-up pools the way the defragmenter
+    reports a whole device. */
+bool test_pool_statistics_aggregation()
+{
+    const VkDeviceSize MB = 1024 * 1024;
+
+    PoolStatistics device_local = {};
+    device_local.block_count = 2;
+    device_local.allocation_count = 10;
+    device_local.bytes_reserved = 128 * MB;
+    device_local.bytes_used = 96 * MB;
+    device_local.largest_free_range = 16 * MB;
+
+    PoolStatistics host_visible = {};
+    host_visible.block_count = 1;
+    host_visible.allocation_count = 3;
+    host_visible.bytes_reserved = 64 * MB;
+    host_visible.bytes_used = 56 * MB;
+    host_visible.largest_free_range = 8 * MB;
+
+    bool passed = true;
+    printf("Pool statistics aggregation:\n");
+
+    PoolStatistics total = sum_pool_statistics({device_local, host_visible});
+    passed &= check(total.block_count == 3 && total.allocation_count == 13, "counts add up");
+    passed &= check(total.bytes_reserved == 192 * MB && total.bytes_used == 152 * MB, "bytes add up");
+    passed &= check(total.largest_free_range == 16 * MB, "largest free range is the largest of any pool");
+    passed &= check(total.fragmentation > 0.59f && total.fragmentation < 0.61f,
+        "fragmentation over all free space (16 of 40MB in one range)");
+
+    PoolStatistics full = {};
+    full.block_count = 1;
+    full.bytes_reserved = 64 * MB;
+    full.bytes_used = 64 * MB;
+    passed &= check(sum_pool_statistics({full}).fragmentation == 0.0f, "no free space is not fragmented");
+    passed &= check(sum_pool_statistics({}).block_count == 0, "no pools sum to nothing");
+
+    return passed;
+}
+
+/*  Feeds QueryResults the outcomes of reading a frame's query pools, one
+    pool at a time, and checks what it keeps. */
+bool test_query_results()
+{
+    std::vector<std::string> names = {"shadows", "opaque"};
+    std::vector<uint64_t> samples = {100, 2500};
+    std::vector<uint64_t> statistics(12);
+    for( size_t i = 0; i < statistics.size(); ++i )
+    {
+        statistics[i] = i + 1;
+    }
+
+    bool passed = true;
+    printf("Query result bookkeeping:\n");
+
+    QueryResults results;
+    results.add_passes(0, names, VK_SUCCESS, samples, VK_SUCCESS, statistics);
+    const std::vector<PassStatistics>& passes = results.get_pass_statistics();
+    passed &= check(passes.size() == 2 && passes[1].name == "opaque" && passes[1].samples_passed == 2500
+        && passes[1].input_assembly_vertices == 7 && passes[1].compute_shader_invocations == 12,
+        "pass results taken");
+
+    // A frame that never called end_frame() has no timestamps to read.
+    results.add_passes(1, names, VK_SUCCESS, {50, 60}, VK_SUCCESS, {});
+    passed &= check(results.get_statistics_frame() == 1 && results.get_missed_frames() == 0
+        && results.get_pass_statistics()[0].samples_passed == 50
+        && results.get_pass_statistics()[0].vertex_shader_invocations == 0,
+        "passes taken without timestamps or pipeline statistics");
+
+    results.add_gpu_time(1, VK_NOT_READY, 0.0);
+    passed &= check(results.get_missed_timestamps() == 1 && results.get_missed_frames() == 0,
+        "timestamps not ready counted on their own");
+
+    results.add_passes(2, names, VK_SUCCESS, samples, VK_NOT_READY, statistics);
+    passed &= check(results.get_missed_frames() == 1 && results.get_statistics_frame() == 1,
+        "statistics not ready keep the previous frame's");
+
+    results.add_gpu_time(2, VK_SUCCESS, 4.5);
+    passed &= check(results.get_gpu_frame_time() == 4.5 && results.get_gpu_time_frame() == 2,
+        "GPU time taken apart from the passes");
+
+    bool thrown = false;
+    try
+    {
+        results.add_passes(3, names, VK_ERROR_DEVICE_LOST, samples, VK_SUCCESS, statistics);
+    }
+    catch(VulkanException&)
+    {
+        thrown = true;
+    }
+    passed &= check(thrown && results.get_statistics_frame() == 1, "other errors thrown");
+
+    FrameStatistics frames;
+    frames.end_frame();
+    frames.record_fence_wait(2.0);
+    passed &= check(frames.get_fence_wait_histogram().count == 1, "fence wait before the first frame counted");
+
+    return passed;
+}
+
+/*  Records passes into a BreadcrumbLog and decodes the markers a hang
+    could leave behind. */
+bool test_breadcrumb_decoding()
+{
+    bool passed = true;
+    printf("Breadcrumb decoding:\n");
+
+    BreadcrumbLog log(2);
+    uint32_t frame = log.begin_command_list("frame");
+    uint32_t shadows = log.begin_pass(frame, "shadows");
+    uint32_t ended = 0;
+    passed &= check(log.end_pass(frame, ended) && ended == shadows, "end marker of a pass is its begin marker");
+    uint32_t lighting = log.begin_pass(frame, "lighting");
+    uint32_t tiles = log.begin_pass(frame, "tiles");
+    passed &= check(log.end_pass(frame, ended) && ended == tiles, "nested passes end innermost first");
+    passed &= check(log.end_pass(frame, ended) && ended == lighting && !log.end_pass(frame, ended),
+        "end without an open pass refused");
+
+    BreadcrumbTrail trail = log.decode(frame, 0, 0);
+    passed &= check(trail.command_list == "frame" && trail.last_completed_pass.empty() && trail.unfinished_pass.empty(),
+        "no markers written decode to nothing");
+
+    trail = log.decode(frame, lighting, shadows);
+    passed &= check(trail.last_completed_pass == "shadows" && trail.unfinished_pass == "lighting",
+        "hang inside the second pass");
+
+    trail = log.decode(frame, tiles, tiles);
+    passed &= check(trail.last_completed_pass == "tiles" && trail.unfinished_pass.empty(), "all begun passes ended");
+
+    trail = log.decode(frame, 9, 7);
+    passed &= check(trail.last_completed_pass.empty() && trail.unfinished_pass.empty(),
+        "markers of unrecorded passes ignored");
+
+    uint32_t upload = log.begin_command_list("upload");
+    uint32_t reused = log.begin_command_list("next frame");
+    trail = log.decode(reused, shadows, 0);
+    passed &= check(upload != frame && reused == frame && trail.command_list == "next frame"
+        && trail.unfinished_pass.empty(), "command lists reused round robin with their passes cleared");
+
+    return passed;
+}
+
+/*  Builds PassKeys from fake handles and runs PassRecordings through hits,
+    misses, invalidation and the retirement of old recordings. */
+bool test_pass_recordings()
+{
+    VkBuffer vertices = fake_handle<VkBuffer>(1);
+    VkImage albedo = fake_handle<VkImage>(2);
+
+    bool passed = true;
+    printf("Pass recordings:\n");
+
+    PassKey key;
+    key.add_resource(vertices);
+    key.add_resource(albedo);
+    key.add(0);
+
+    PassKey same;
+    same.add_resource(vertices);
+    same.add_resource(albedo);
+    same.add(0);
+
+    PassKey next_generation;
+    next_generation.add_resource(vertices);
+    next_generation.add_resource(albedo);
+    next_generation.add(1);
+
+    PassKey swapped;
+    swapped.add_resource(albedo);
+    swapped.add_resource(vertices);
+    swapped.add(0);
+
+    passed &= check(key.get_hash() == same.get_hash(), "same contents hash the same");
+    passed &= check(key.get_hash() != next_generation.get_hash(), "a new generation of a handle changes the hash");
+    passed &= check(key.get_hash() != swapped.get_hash(), "order of contents changes the hash");
+    passed &= check(key.get_resources().size() == 2
+        && key.get_resources()[0] == get_handle_value(vertices), "resources remembered");
+
+    VkCommandBuffer first = fake_handle<VkCommandBuffer>(10);
+    VkCommandBuffer second = fake_handle<VkCommandBuffer>(11);
+    VkCommandBuffer ui = fake_handle<VkCommandBuffer>(12);
+
+    PassRecordings recordings(2);
+    passed &= check(recordings.find("opaque", key.get_hash()) == VK_NULL_HANDLE, "first request misses");
+    recordings.add("opaque", key.get_hash(), key.get_resources(), first, 2.0);
+    recordings.find("ui", 7);
+    recordings.add("ui", 7, {}, ui, 1.0);
+
+    passed &= check(recordings.find("opaque", same.get_hash()) == first, "same key hits");
+    passed &= check(recordings.get_statistics().hits == 1 && recordings.get_statistics().misses == 2
+        && recordings.get_statistics().saved_ms == 2.0, "hit saves the recording time");
+
+    passed &= check(recordings.find("opaque", next_generation.get_hash()) == VK_NULL_HANDLE, "changed key misses");
+    recordings.add("opaque", next_generation.get_hash(), next_generation.get_resources(), second, 2.0);
+
+    // The first recording may still be executing in the two frames in
+    // flight after it was retired.
+    bool freed_early = !recordings.begin_frame().empty() || !recordings.begin_frame().empty();
+    std::vector<VkCommandBuffer> done = recordings.begin_frame();
+    passed &= check(!freed_early && done.size() == 1 && done[0] == first,
+        "replaced recording freed frames_in_flight frames later");
+
+    recordings.invalidate_resource(get_handle_value(albedo));
+    passed &= check(recordings.get_statistics().invalidations == 1
+        && recordings.find("ui", 7) == ui, "invalidation drops only the passes using the resource");
+    passed &= check(recordings.find("opaque", next_generation.get_hash()) == VK_NULL_HANDLE,
+        "invalidated pass recorded again");
+
+    recordings.clear();
+    recordings.begin_frame();
+    recordings.begin_frame();
+    done = recordings.begin_frame();
+    passed &= check(done.size() == 2 && recordings.get_statistics().invalidations == 2,
+        "clear retires every recording");
+    passed &= check(recordings.get_reuse_rate() > 0.33 && recordings.get_reuse_rate() < 0.34, "reuse rate");
+
+    return passed;
+}
+
+/*  Runs a PresentPacer against a fake display that shows present n at
+    16n ms, with a fake clock that a blocking wait moves to the vblank. */
+bool test_present_pacing()
+{
+    typedef std::chrono::steady_clock::time_point TimePoint;
+    TimePoint start = std::chrono::steady_clock::now();
+    double now_ms = 0.0;
+    auto at = [&](double ms)
+    {
+        return start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+            std::chrono::duration<double, std::milli>(ms));
+    };
+
+    uint32_t slow_presents = 0;
+    VkResult surface_result = VK_SUCCESS;
+    auto wait = [&](uint64_t present_id, uint64_t timeout_ns)
+    {
+        if( surface_result != VK_SUCCESS )
+        {
+            return surface_result;
+        }
+        double displayed_ms = 16.0 * present_id;
+        if( displayed_ms <= now_ms )
+        {
+            return VK_SUCCESS;
+        }
+        if( timeout_ns == 0 || slow_presents > 0 )
+        {
+            slow_presents -= timeout_ns > 0 ? 1 : 0;
+            return VK_TIMEOUT;
+        }
+        now_ms = displayed_ms;
+        return VK_SUCCESS;
+    };
+
+    bool passed = true;
+    printf("Present pacing:\n");
+
+    PresentPacer pacer(1, wait, [&] { return at(now_ms); });
+    passed &= check(pacer.get_start_delay_ms() == 0.0, "no delay without estimates");
+
+    pacer.add_present(1, at(0.0));
+    pacer.add_present(2, at(4.0));
+    now_ms = 5.0;
+    uint32_t depth = pacer.wait_for_presents();
+    passed &= check(depth == 2 && pacer.get_queued_count() == 1 && now_ms == 16.0,
+        "blocks until one frame is queued");
+    passed &= check(pacer.get_frame_to_display_ms() == 16.0, "frame to display measured");
+
+    pacer.add_present(3, at(16.0));
+    depth = pacer.wait_for_presents();
+    passed &= check(depth == 2 && pacer.get_display_interval_ms() == 16.0, "display interval measured");
+    passed &= check(pacer.get_frame_to_display_ms() == 28.0, "frame to display rises at once");
+
+    // Frame 4 can make the vblank at 64 ms, after frame 3's at 48 ms, and
+    // takes 28 ms to get there: start at 36 ms less the margin.
+    double delay = pacer.get_start_delay_ms();
+    passed &= check(delay > 2.99 && delay < 3.01, "start delayed just in time for the vblank");
+
+    pacer.add_present(4, at(32.0));
+    slow_presents = 3;
+    pacer.wait_for_presents();
+    passed &= check(slow_presents == 0 && now_ms == 48.0 && pacer.get_queued_count() == 1,
+        "timed out present kept and waited for");
+    passed &= check(pacer.get_frame_to_display_ms() == 32.0, "kept present measured when displayed");
+
+    pacer.add_present(5, at(48.0));
+    surface_result = VK_ERROR_OUT_OF_DATE_KHR;
+    depth = pacer.wait_for_presents();
+    passed &= check(depth == 0 && pacer.get_queued_count() == 0, "out of date swapchain drops the presents");
+
+    pacer.add_present(6, at(48.0));
+    surface_result = VK_ERROR_DEVICE_LOST;
+    bool thrown = false;
+    try
+    {
+        pacer.wait_for_presents();
+    }
+    catch(VulkanException&)
+    {
+        thrown = true;
+    }
+    passed &= check(thrown, "other errors thrown");
+
+    return passed;
+}
+
+/*  Steers a ResolutionController with a GPU whose frame time is
+    proportional to the rendered area, and checks that it settles on the
+    target and stays within its scales. */
+bool test_resolution_controller()
+{
+    VkExtent2D output = {1001, 563};
+    double full_ms = 16.0;
+    double target_ms = 10.0;
+
+    bool passed = true;
+    printf("Resolution controller:\n");
+
+    ResolutionController controller(output, target_ms, 0.5, 1.0);
+    VkExtent2D max_extent = controller.get_max_render_extent();
+    VkExtent2D extent = controller.get_render_extent();
+    passed &= check(max_extent.width <= output.width && max_extent.height <= output.height,
+        "max extent within the output");
+    passed &= check(extent.width == max_extent.width && extent.height == max_extent.height, "starts at max scale");
+    passed &= check(!controller.update(0.0) && controller.get_scale() == 1.0, "frames without timestamps ignored");
+
+    auto gpu_ms = [&](VkExtent2D rendered)
+    {
+        return full_ms * rendered.width * rendered.height / (output.width * output.height);
+    };
+
+    bool shrank = false;
+    bool within = true;
+    for( int i = 0; i < 200; ++i )
+    {
+        shrank |= controller.update(gpu_ms(controller.get_render_extent()));
+        extent = controller.get_render_extent();
+        within &= extent.width <= max_extent.width && extent.height <= max_extent.height
+            && extent.width % 8 == 0 && extent.height % 8 == 0;
+    }
+    double settled_ms = gpu_ms(controller.get_render_extent());
+    passed &= check(shrank && within, "slow frames shrink the extent in steps of 8 within the maximum");
+    passed &= check(settled_ms > target_ms * 0.95 && settled_ms < target_ms * 1.05, "settles on the target");
+
+    for( int i = 0; i < 200; ++i )
+    {
+        controller.update(target_ms * 4.0);
+    }
+    passed &= check(controller.get_scale() >= 0.5 && controller.get_scale() < 0.51, "held at min scale");
+
+    bool over = false;
+    for( int i = 0; i < 200; ++i )
+    {
+        controller.update(1.0);
+        extent = controller.get_render_extent();
+        over |= extent.width > max_extent.width || extent.height > max_extent.height;
+    }
+    extent = controller.get_render_extent();
+    passed &= check(!over && extent.width == max_extent.width && extent.height == max_extent.height,
+        "fast frames grow back to the maximum and no further");
+
+    return passed;
+}
+
+/*  Runs a ShaderCache with a fake frontend, whose SPIR-V is the magic
+    number and the source's length, through misses, memory and disk hits,
+    failures and the files written back. */
+bool test_shader_cache()
+{
+    const std::string root = "shader_cache_test";
+    const std::string directory = root + "/nested/spirv";
+    std::filesystem::remove_all(root);
+
+    std::atomic<uint32_t> compiles(0);
+    ShaderFrontend frontend;
+    frontend.version = "fake-1";
+    frontend.compile = [&compiles](const ShaderSource& source)
+    {
+        compiles++;
+        if( source.text.find("error") != std::string::npos )
+        {
+            throw std::runtime_error("Error while compiling shader " + source.name);
+        }
+        return std::vector<uint32_t>{0x07230203, static_cast<uint32_t>(source.text.size())};
+    };
+
+    ShaderSource source;
+    source.name = "test.comp";
+    source.text = "void main() {}";
+    source.language = ShaderLanguage::GLSL;
+    source.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+    source.entry_point = "main";
+
+    ShaderSource broken = source;
+    broken.text = "error";
+
+    auto cached_size = [&](const std::string& name)
+    {
+        std::error_code error;
+        uintmax_t size = std::filesystem::file_size(directory + "/" + name, error);
+        return error ? 0 : size;
+    };
+
+    bool passed = true;
+    printf("Shader cache:\n");
+
+    std::string key;
+    {
+        ShaderCache cache(directory, frontend, 2);
+        key = cache.get_key(source);
+        std::vector<uint32_t> code = cache.get(source);
+        passed &= check(code.size() == 2 && code[1] == source.text.size() && compiles == 1,
+            "miss compiled");
+        passed &= check(cached_size(key) == 2 * sizeof(uint32_t),
+            "compiled code written back into a new nested directory");
+
+        cache.get(source);
+        passed &= check(compiles == 1 && cache.get_statistics().memory_hits == 1, "second request hits memory");
+
+        bool thrown = false;
+        try
+        {
+            cache.get(broken);
+        }
+        catch(std::runtime_error&)
+        {
+            thrown = true;
+        }
+        try
+        {
+            cache.get(broken);
+        }
+        catch(std::runtime_error&)
+        {
+        }
+        passed &= check(thrown && compiles == 3 && cache.get_statistics().failed == 2,
+            "failed compile thrown and tried again");
+    }
+
+    {
+        ShaderCache cache(directory, frontend, 1);
+        cache.get(source);
+        passed &= check(compiles == 3 && cache.get_statistics().disk_hits == 1, "next run hits the disk");
+    }
+
+    {
+        ShaderFrontend loader;
+        loader.version = frontend.version;
+        ShaderCache cache(directory, loader, 1);
+        bool loaded = cache.get(source).size() == 2;
+        bool thrown = false;
+        try
+        {
+            ShaderSource other = source;
+            other.entry_point = "other";
+            cache.get(other);
+        }
+        catch(std::runtime_error&)
+        {
+            thrown = true;
+        }
+        passed &= check(loaded && thrown, "frontend without compiler loads cached sources only");
+    }
+
+    {
+        std::ofstream(directory + "/" + key, std::ios::binary | std::ios::trunc) << "junk";
+        ShaderCache cache(directory, frontend, 1);
+        cache.get(source);
+        passed &= check(compiles == 4 && cached_size(key) == 2 * sizeof(uint32_t),
+            "damaged file compiled again and overwritten");
+
+        ShaderFrontend upgraded = frontend;
+        upgraded.version = "fake-2";
+        passed &= check(ShaderCache(directory, upgraded, 1).get_key(source) != key, "frontend version in the key");
+    }
+
+    bool temporary_left = false;
+    for( const auto& entry : std::filesystem::directory_iterator(directory) )
+    {
+        temporary_left |= entry.path().extension() == ".tmp";
+    }
+    passed &= check(!temporary_left, "no temporary files left");
+
+    std::filesystem::remove_all(root);
+    return passed;
+}
+
+/*  A hand-assembled module with a vertex and a fragment entry point that
+    share a uniform block through a helper function, in the SPIR-V 1.0 and
+    1.4 forms of entry point interfaces. */
+static std::vector<uint32_t> make_two_stage_spirv(uint32_t version)
+{
+    std::vector<uint32_t> code = {0x07230203, version, 0, 34, 0};
+    auto op = [&code](uint32_t opcode, std::vector<uint32_t> words)
+    {
+        code.push_back(static_cast<uint32_t>(words.size() + 1) << 16 | opcode);
+        code.insert(code.end(), words.begin(), words.end());
+    };
+    auto text = [](const std::string& value)
+    {
+        std::vector<uint32_t> words(value.size() / 4 + 1, 0);
+        memcpy(words.data(), value.data(), value.size());
+        return words;
+    };
+    auto concat = [](std::vector<uint32_t> a, const std::vector<uint32_t>& b)
+    {
+        a.insert(a.end(), b.begin(), b.end());
+        return a;
+    };
+
+    bool interface_lists_globals = version >= 0x00010400;
+    op(17, {1});                                    // OpCapability Shader
+    op(14, {0, 1});                                 // OpMemoryModel Logical GLSL450
+    op(15, concat(concat({0, 21}, text("vs")),
+        interface_lists_globals ? std::vector<uint32_t>{16, 7} : std::vector<uint32_t>{16}));
+    op(15, concat(concat({4, 22}, text("fs")),
+        interface_lists_globals ? std::vector<uint32_t>{7, 10, 13} : std::vector<uint32_t>{}));
+    op(5, concat({7}, text("globals")));
+    op(5, concat({10}, text("albedo")));
+    op(5, concat({16}, text("position")));
+    op(71, {5, 2});                                 // Block
+    op(72, {5, 0, 35, 0});
+    op(71, {7, 34, 0});
+    op(71, {7, 33, 0});
+    op(71, {10, 34, 0});
+    op(71, {10, 33, 1});
+    op(71, {11, 2});
+    op(72, {11, 0, 35, 0});
+    op(71, {16, 30, 0});
+
+    op(19, {1});                                    // void
+    op(33, {2, 1});                                 // void()
+    op(21, {3, 32, 0});
+    op(22, {4, 32});
+    op(30, {5, 3});
+    op(32, {6, 2, 5});
+    op(59, {6, 7, 2});                              // uniform globals
+    op(25, {8, 4, 1, 0, 0, 0, 1, 0});               // sampled 2D image
+    op(32, {9, 0, 8});
+    op(59, {9, 10, 0});                             // albedo
+    op(30, {11, 4});
+    op(32, {12, 9, 11});
+    op(59, {12, 13, 9});                            // push constants
+    op(23, {14, 4, 4});
+    op(32, {15, 1, 14});
+    op(59, {15, 16, 1});                            // position
+    op(32, {17, 2, 3});
+    op(32, {18, 9, 4});
+    op(43, {3, 19, 0});
+
+    // The helper reads the uniform block for both entry points.
+    op(54, {1, 20, 0, 2});
+    op(248, {23});
+    op(65, {17, 24, 7, 19});
+    op(61, {3, 25, 24});
+    op(253, {});
+    op(56, {});
+
+    op(54, {1, 21, 0, 2});
+    op(248, {26});
+    op(57, {1, 27, 20});
+    op(61, {14, 28, 16});
+    op(253, {});
+    op(56, {});
+
+    op(54, {1, 22, 0, 2});
+    op(248, {29});
+    op(57, {1, 30, 20});
+    op(61, {8, 31, 10});
+    op(65, {18, 32, 13, 19});
+    op(61, {4, 33, 32});
+    op(253, {});
+    op(56, {});
+    return code;
+}
+
+bool test_spirv_reflection()
+{
+    bool passed = true;
+    printf("SPIR-V reflection:\n");
+
+    for( uint32_t version : {0x00010000u, 0x00010400u} )
+    {
+        std::string suffix = version >= 0x00010400 ? " (SPIR-V 1.4)" : " (SPIR-V 1.0)";
+        std::vector<uint32_t> code = make_two_stage_spirv(version);
+        ShaderReflection vertex = reflect_spirv(code, "vs");
+        ShaderReflection fragment = reflect_spirv(code, "fs");
+
+        passed &= check(vertex.stage == VK_SHADER_STAGE_VERTEX_BIT && vertex.bindings.size() == 1
+            && vertex.bindings[0].name == "globals" && vertex.bindings[0].binding == 0
+            && vertex.bindings[0].type == VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER && vertex.push_constants.empty(),
+            ("vertex stage has only the block its helper reads" + suffix).c_str());
+        passed &= check(vertex.inputs.size() == 1 && vertex.inputs[0].name == "position"
+            && vertex.inputs[0].format == VK_FORMAT_R32G32B32A32_SFLOAT, ("vertex input" + suffix).c_str());
+        passed &= check(fragment.stage == VK_SHADER_STAGE_FRAGMENT_BIT && fragment.bindings.size() == 2
+            && fragment.bindings[1].name == "albedo" && fragment.bindings[1].type == VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE
+            && fragment.push_constants.size() == 1 && fragment.push_constants[0].size == 4
+            && fragment.inputs.empty(), ("fragment stage has its own resources" + suffix).c_str());
+
+        VertexLayout vertex_layout = make_vertex_layout(vertex);
+        passed &= check(vertex_layout.bindings.size() == 1 && vertex_layout.bindings[0].stride == 16
+            && vertex_layout.attributes.size() == 1, ("vertex layout" + suffix).c_str());
+
+        ReflectedLayout layout = merge_reflections({vertex, fragment});
+        passed &= check(layout.sets.size() == 1 && layout.sets[0].size() == 2
+            && layout.sets[0][0].stageFlags == (VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT)
+            && layout.sets[0][1].stageFlags == VK_SHADER_STAGE_FRAGMENT_BIT
+            && layout.push_constants.size() == 1
+            && layout.push_constants[0].stageFlags == VK_SHADER_STAGE_FRAGMENT_BIT,
+            ("merged layout" + suffix).c_str());
+    }
+
+    ShaderReflection vertex = reflect_spirv(make_two_stage_spirv(0x00010400), "vs");
+    ShaderReflection fragment = reflect_spirv(make_two_stage_spirv(0x00010400), "fs");
+    fragment.bindings[0].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    bool thrown = false;
+    try
+    {
+        merge_reflections({vertex, fragment});
+    }
+    catch(std::invalid_argument&)
+    {
+        thrown = true;
+    }
+    passed &= check(thrown, "stages disagreeing on a binding type rejected");
+
+    thrown = false;
+    try
+    {
+        reflect_spirv(make_two_stage_spirv(0x00010400));
+    }
+    catch(std::invalid_argument&)
+    {
+        thrown = true;
+    }
+    passed &= check(thrown, "entry point required with several in the module");
+    return passed;
+}
+
+/*  Keeps the traces FrameStatistics reports. */
+class JankRecorder : public IJankListener
+{
+public:
+    std::vector<std::vector<FrameRecord>> traces;
+
+    virtual void on_jank(const std::vector<FrameRecord>& trace)
+    {
+        traces.push_back(trace);
+    }
+};
+
+/*  Steady frames and then one spike, judged once by present times and
+    once by CPU frame intervals as when running headless. */
+bool test_jank_detection()
+{
+    const uint64_t frame_ns = 16666667;
+    const uint32_t trace_length = 8;
+
+    bool passed = true;
+    printf("Jank detection:\n");
+
+    {
+        FrameStatistics frames(trace_length);
+        JankRecorder recorder;
+        frames.set_jank_listener(&recorder);
+
+        uint64_t present_time = 1000000000;
+        for( int i = 0; i < 30; ++i )
+        {
+            uint64_t frame = frames.begin_frame();
+            frames.end_frame();
+            present_time += frame_ns + (i % 3) * 100000;
+            frames.record_present(frame, present_time);
+        }
+        passed &= check(frames.get_jank_count() == 0 && recorder.traces.empty(), "steady presents are no jank");
+
+        uint64_t spike = frames.begin_frame();
+        frames.end_frame();
+        present_time += 3 * frame_ns;
+        frames.record_present(spike, present_time);
+        passed &= check(frames.get_jank_count() == 1 && recorder.traces.size() == 1, "present spike detected once");
+        passed &= check(recorder.traces.size() == 1 && recorder.traces[0].size() == trace_length + 1
+            && recorder.traces[0].back().number == spike && recorder.traces[0].back().jank
+            && recorder.traces[0].front().number == spike - trace_length,
+            "trace ends at the spike, preceded by trace_length frames");
+
+        for( int i = 0; i < 10; ++i )
+        {
+            uint64_t frame = frames.begin_frame();
+            present_time += frame_ns;
+            frames.record_present(frame, present_time);
+        }
+        passed &= check(frames.get_jank_count() == 1, "steady again after the spike");
+    }
+
+    {
+        // Generous thresholds, so that a late wake-up from sleep_for does
+        // not count.
+        FrameStatistics frames(trace_length);
+        JankRecorder recorder;
+        frames.set_jank_listener(&recorder);
+        frames.set_jank_threshold(3.0, 20.0);
+
+        for( int i = 0; i < 12; ++i )
+        {
+            frames.begin_frame();
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            frames.end_frame();
+        }
+        frames.begin_frame();
+        std::this_thread::sleep_for(std::chrono::milliseconds(60));
+        frames.end_frame();
+        frames.begin_frame();
+        passed &= check(frames.get_jank_count() == 1 && recorder.traces.size() == 1
+            && recorder.traces[0].back().frame_interval >= 60.0, "headless frame interval spike detected");
+    }
+
+    return passed;
+}
+
+/*  Feeds typical per-pass barriers into a BarrierBatch and checks what
+    merge() leaves. */
+bool test_barrier_merging()
+{
+    VkImage image = fake_handle<VkImage>(1);
+    VkBuffer buffer = fake_handle<VkBuffer>(2);
+
+    bool passed = true;
+    printf("Barrier merging:\n");
+
+    BarrierBatch batch;
+    batch.add_buffer_barrier(buffer, 0, VK_WHOLE_SIZE,
+        VK_PIPELINE_STAGE_2_TRANSFER_BIT_KHR, VK_ACCESS_2_TRANSFER_WRITE_BIT_KHR,
+        VK_PIPELINE_STAGE_2_VERTEX_INPUT_BIT_KHR, VK_ACCESS_2_VERTEX_ATTRIBUTE_READ_BIT_KHR);
+    batch.add_memory_barrier(
+        VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT_KHR, VK_ACCESS_2_SHADER_WRITE_BIT_KHR,
+        VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT_KHR, VK_ACCESS_2_INDIRECT_COMMAND_READ_BIT_KHR);
+    batch.add_buffer_barrier(buffer, 0, VK_WHOLE_SIZE,
+        VK_PIPELINE_STAGE_2_TRANSFER_BIT_KHR, VK_ACCESS_2_TRANSFER_WRITE_BIT_KHR,
+        VK_PIPELINE_STAGE_2_TRANSFER_BIT_KHR, VK_ACCESS_2_TRANSFER_READ_BIT_KHR,
+        0, 1);
+    batch.merge();
+    passed &= check(batch.get_memory_barriers().size() == 1
+        && batch.get_memory_barriers()[0].dstAccessMask
+            == (VK_ACCESS_2_VERTEX_ATTRIBUTE_READ_BIT_KHR | VK_ACCESS_2_INDIRECT_COMMAND_READ_BIT_KHR),
+        "buffer and memory barriers folded into one global barrier");
+    passed &= check(batch.get_buffer_barriers().size() == 1,
+        "queue ownership transfer kept");
+
+    batch.clear();
+    batch.add_image_barrier(image, color_range(0, 1),
+        VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+        VK_PIPELINE_STAGE_2_NONE_KHR, 0,
+        VK_PIPELINE_STAGE_2_COPY_BIT_KHR, VK_ACCESS_2_TRANSFER_WRITE_BIT_KHR);
+    batch.add_image_barrier(image, color_range(0, 1),
+        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+        VK_PIPELINE_STAGE_2_COPY_BIT_KHR, VK_ACCESS_2_TRANSFER_WRITE_BIT_KHR,
+        VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT_KHR, VK_ACCESS_2_SHADER_SAMPLED_READ_BIT_KHR);
+    batch.merge();
+    passed &= check(batch.get_image_barriers().size() == 1
+        && batch.get_image_barriers()[0].oldLayout == VK_IMAGE_LAYOUT_UNDEFINED
+        && batch.get_image_barriers()[0].newLayout == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+        "chained transitions collapsed");
+
+    batch.clear();
+    for( uint32_t mip = 0; mip < 4; ++mip )
+    {
+        batch.add_image_barrier(image, color_range(mip, 1),
+            VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+            VK_PIPELINE_STAGE_2_BLIT_BIT_KHR, VK_ACCESS_2_TRANSFER_READ_BIT_KHR,
+            VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT_KHR, VK_ACCESS_2_SHADER_SAMPLED_READ_BIT_KHR);
+    }
+    batch.merge();
+    passed &= check(batch.get_image_barriers().size() == 1
+        && batch.get_image_barriers()[0].subresourceRange.levelCount == 4,
+        "per-mip transitions joined");
+    passed &= check(batch.get_image_barriers()[0].dstStageMask == VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT_KHR,
+        "stages left alone without narrowing");
+
+    batch.set_stage_narrowing(true);
+    batch.merge();
+    passed &= check(batch.get_image_barriers()[0].dstStageMask
+            == (VK_PIPELINE_STAGE_2_PRE_RASTERIZATION_SHADERS_BIT_KHR | VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT_KHR
+                | VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT_KHR),
+        "ALL_COMMANDS narrowed to the shader stages only");
+
+    // Mip 0, then the rest of a 4 mip image, as a mipmap generator might.
+    VkImageSubresourceRange rest = color_range(1, VK_REMAINING_MIP_LEVELS);
+    batch.clear();
+    batch.set_stage_narrowing(false);
+    for( const VkImageSubresourceRange& range : {color_range(0, 1), rest} )
+    {
+        batch.add_image_barrier(image, range,
+            VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+            VK_PIPELINE_STAGE_2_COPY_BIT_KHR, VK_ACCESS_2_TRANSFER_WRITE_BIT_KHR,
+            VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT_KHR, VK_ACCESS_2_SHADER_SAMPLED_READ_BIT_KHR);
+    }
+    batch.merge();
+    passed &= check(batch.get_image_barriers().size() == 2
+        && batch.get_image_barriers()[1].subresourceRange.levelCount == VK_REMAINING_MIP_LEVELS,
+        "unresolved REMAINING range not joined");
+
+    batch.clear();
+    for( const VkImageSubresourceRange& range : {color_range(0, 1), resolve_range(rest, 4, 1)} )
+    {
+        batch.add_image_barrier(image, range,
+            VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+            VK_PIPELINE_STAGE_2_COPY_BIT_KHR, VK_ACCESS_2_TRANSFER_WRITE_BIT_KHR,
+            VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT_KHR, VK_ACCESS_2_SHADER_SAMPLED_READ_BIT_KHR);
+    }
+    batch.merge();
+    passed &= check(batch.get_image_barriers().size() == 1
+        && batch.get_image_barriers()[0].subresourceRange.levelCount == 4,
+        "resolved REMAINING range joined");
+
+    passed &= check(to_legacy_stages(VK_PIPELINE_STAGE_2_NONE_KHR, true) == VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT
+        && to_legacy_stages(VK_PIPELINE_STAGE_2_COPY_BIT_KHR, false) == VK_PIPELINE_STAGE_TRANSFER_BIT
+        && to_legacy_access(VK_ACCESS_2_SHADER_SAMPLED_READ_BIT_KHR) == VK_ACCESS_SHADER_READ_BIT,
+        "Vulkan 1.0 fallback masks");
+
+    return passed;
+}
+
+/*  Declares dependencies between the passes of a frame and checks which
+    become split barriers and where they signal and wait. */
+bool test_split_barrier_placement()
+{
+    VkImage image = fake_handle<VkImage>(1);
+    VkBuffer buffer = fake_handle<VkBuffer>(2);
+
+    bool passed = true;
+    printf("Split barrier placement:\n");
+
+    BarrierBatch shadow_map;
+    shadow_map.add_image_barrier(image, color_range(0, 1),
+        VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+        VK_PIPELINE_STAGE_2_LATE_FRAGMENT_TESTS_BIT_KHR, VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT_KHR,
+        VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT_KHR, VK_ACCESS_2_SHADER_SAMPLED_READ_BIT_KHR);
+
+    BarrierBatch particles;
+    particles.add_buffer_barrier(buffer, 0, VK_WHOLE_SIZE,
+        VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT_KHR, VK_ACCESS_2_SHADER_WRITE_BIT_KHR,
+        VK_PIPELINE_STAGE_2_VERTEX_INPUT_BIT_KHR, VK_ACCESS_2_VERTEX_ATTRIBUTE_READ_BIT_KHR);
+
+    // Pass 0 renders shadows, 1 simulates particles, 2 and 3 are
+    // independent, 4 lights with the shadows and 2 draws the particles.
+    SplitBarrierPlanner planner;
+    planner.add_dependency(0, 4, shadow_map);
+    planner.add_dependency(1, 2, particles);
+    planner.add_dependency(0, 4, particles);
+
+    passed &= check(planner.get_dependencies().size() == 2,
+        "dependencies between the same passes combined");
+    passed &= check(planner.get_dependencies()[0].placement == DependencyPlacement::SPLIT
+        && planner.get_dependencies()[0].barriers.get_image_barriers().size() == 1
+        && planner.get_dependencies()[0].barriers.get_buffer_barriers().size() == 1,
+        "dependency across independent passes split");
+    passed &= check(planner.get_dependencies()[1].placement == DependencyPlacement::BARRIER,
+        "dependency on the previous pass kept as a barrier");
+
+    passed &= check(planner.get_signals(0).size() == 1 && planner.get_signals(0)[0]->consumer == 4,
+        "event set right after the producer");
+    passed &= check(planner.get_signals(1).empty() && planner.get_signals(3).empty(),
+        "no event set for barriers");
+    passed &= check(planner.get_waits(4).size() == 1 && planner.get_waits(4)[0]->producer == 0
+        && planner.get_waits(2).size() == 1 && planner.get_waits(3).empty(),
+        "waits placed right before the consumers");
+
+    SplitBarrierPlanner cautious(3);
+    cautious.add_dependency(0, 3, shadow_map);
+    cautious.add_dependency(0, 4, shadow_map);
+    passed &= check(cautious.get_dependencies()[0].placement == DependencyPlacement::BARRIER
+        && cautious.get_dependencies()[1].placement == DependencyPlacement::SPLIT,
+        "split only with the minimum gap of passes in between");
+
+    bool rejected = false;
+    try
+    {
+        cautious.add_dependency(2, 2, particles);
+    }
+    catch(std::invalid_argument&)
+    {
+        rejected = true;
+    }
+    passed &= check(rejected, "dependency on the same pass rejected");
+
+    return passed;
+}
+
+/*  Times uploads into a device-local buffer with each mode the device
+    allows and prints the bandwidth. */
+void benchmark_uploads(LogicalDevice& device)
+{
+    const VkDeviceSize size = 64 * 1024 * 1024;
+    const int repeats = 8;
+    std::vector<char> data(size, 1);
+
+    Uploader uploader(device);
+    std::vector<UploadMode> modes = {UploadMode::STAGING};
+    if( device.has_unified_memory() )
+    {
+        modes.push_back(UploadMode::DIRECT);
+    }
+
+    printf("Upload bandwidth (%s memory, default %s):\n",
+        device.has_unified_memory() ? "unified" : "discrete",
+        uploader.get_mode() == UploadMode::DIRECT ? "direct" : "staging");
+
+    for( UploadMode mode : modes )
+    {
+        uploader.set_mode(mode);
+        std::unique_ptr<Buffer> buffer = uploader.create_buffer(size, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        for( int i = 0; i < repeats; ++i )
+        {
+            uploader.upload(*buffer, 0, data.data(), size);
+            uploader.flush();
+        }
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+        printf(" - %s: %.1f MB/s\n",
+            mode == UploadMode::DIRECT ? "direct" : "staging",
+            repeats * size / (1024.0 * 1024.0) / elapsed.count());
+    }
+}
+
+/*  Streams a mipmapped texture through a heap without headroom, then
+    relieves pressure until only its least detailed level is left. */
+bool test_texture_streaming(LogicalDevice& device)
+{
+    printf("Texture streaming:\n");
+
+    MemoryGovernor& governor = device.get_memory_governor();
+    Uploader uploader(device);
+    bool passed = true;
+    {
+        TextureStreamer streamer(device, uploader, 2);
+
+        std::vector<std::vector<char>> levels;
+        for( uint32_t size = 256; size >= 1; size /= 2 )
+        {
+            levels.emplace_back(size * size * 4, static_cast<char>(size));
+        }
+
+        // With no headroom at all every deferrable allocation waits.
+        governor.set_soft_limit(0.0f);
+        StreamedTexture* texture = streamer.add(
+            VK_FORMAT_R8G8B8A8_UNORM, VkExtent3D{256, 256, 1}, 1, VK_IMAGE_USAGE_SAMPLED_BIT, levels);
+        passed &= check(!texture->get_image() && streamer.get_statistics().deferred == 1,
+            "texture deferred without headroom");
+        streamer.begin_frame();
+        passed &= check(!texture->get_image(), "deferred texture waits while there is no room");
+
+        governor.set_soft_limit(0.9f);
+        streamer.begin_frame();
+        passed &= check(texture->get_image() && texture->get_image()->get_mip_levels() == 9,
+            "deferred texture resident once there is room");
+
+        MemoryAllocation* allocation = texture->get_image()->get_allocation();
+        uint32_t heap_index = device.get_memory_properties().memoryTypes[allocation->get_memory_type_index()].heapIndex;
+        uint32_t generation = texture->get_image()->get_generation();
+        governor.relieve_pressure(heap_index, 1);
+        passed &= check(texture->get_image()->get_generation() == generation, "image kept until the next frame");
+
+        streamer.begin_frame();
+        passed &= check(texture->get_first_level() == 1 && texture->get_image()->get_extent().width == 128
+            && texture->get_image()->get_mip_levels() == 8 && streamer.get_statistics().levels_dropped == 1,
+            "most detailed level dropped under pressure");
+
+        for( int i = 0; i < 10; ++i )
+        {
+            governor.relieve_pressure(heap_index, 1);
+            streamer.begin_frame();
+        }
+        passed &= check(texture->get_first_level() == 8 && texture->get_image()->get_mip_levels() == 1,
+            "least detailed level kept");
+
+        streamer.remove(texture);
+        passed &= check(streamer.get_statistics().textures == 0, "texture removed");
+    }
+    return passed;
+}
+
+/*  Times creating and destroying fences, semaphores and command buffers
+    against acquiring and releasing them from the recycling pools, and
+    prints the rates. */
+void benchmark_recycling(LogicalDevice& device)
+{
+    const int iterations = 10000;
+    const int batch = 16;
+
+    auto rate = [](std::chrono::steady_clock::time_point start)
+    {
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        return iterations * batch / elapsed.count();
+    };
+
+    VkFenceCreateInfo fence_info;
+    fence_info.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+    fence_info.pNext = nullptr;
+    fence_info.flags = 0;
+
+    VkSemaphoreCreateInfo semaphore_info;
+    semaphore_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+    semaphore_info.pNext = nullptr;
+    semaphore_info.flags = 0;
+
+    std::vector<VkFence> fences(batch);
+    std::vector<VkSemaphore> semaphores(batch);
+    std::vector<VkCommandBuffer> command_buffers(batch);
+
+    printf("Sync object throughput (objects/s, create+destroy vs. recycle):\n");
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for( int i = 0; i < iterations; ++i )
+    {
+        for( VkFence& fence : fences )
+        {
+            vkCreateFence(device.get_device(), &fence_info, device.get_allocation_callbacks(), &fence);
+        }
+        for( VkFence fence : fences )
+        {
+            vkDestroyFence(device.get_device(), fence, device.get_allocation_callbacks());
+        }
+    }
+    double created = rate(start);
+
+    FencePool& fence_pool = device.get_fence_pool();
+    start = std::chrono::steady_clock::now();
+    for( int i = 0; i < iterations; ++i )
+    {
+        for( VkFence& fence : fences )
+        {
+            fence = fence_pool.acquire();
+        }
+        fence_pool.release(fences);
+    }
+    printf(" - fences: %.0f vs. %.0f\n", created, rate(start));
+
+    start = std::chrono::steady_clock::now();
+    for( int i = 0; i < iterations; ++i )
+    {
+        for( VkSemaphore& semaphore : semaphores )
+        {
+            vkCreateSemaphore(device.get_device(), &semaphore_info, device.get_allocation_callbacks(), &semaphore);
+        }
+        for( VkSemaphore semaphore : semaphores )
+        {
+            vkDestroySemaphore(device.get_device(), semaphore, device.get_allocation_callbacks());
+        }
+    }
+    created = rate(start);
+
+    SemaphorePool& semaphore_pool = device.get_semaphore_pool();
+    start = std::chrono::steady_clock::now();
+    for( int i = 0; i < iterations; ++i )
+    {
+        for( VkSemaphore& semaphore : semaphores )
+        {
+            semaphore = semaphore_pool.acquire();
+        }
+        for( VkSemaphore semaphore : semaphores )
+        {
+            semaphore_pool.release(semaphore);
+        }
+    }
+    printf(" - semaphores: %.0f vs. %.0f\n", created, rate(start));
+
+    CommandBufferPool command_buffer_pool(device);
+
+    VkCommandBufferAllocateInfo allocate_info;
+    allocate_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    allocate_info.pNext = nullptr;
+    allocate_info.commandPool = command_buffer_pool.get_command_pool();
+    allocate_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    allocate_info.commandBufferCount = 1;
+
+    start = std::chrono::steady_clock::now();
+    for( int i = 0; i < iterations; ++i )
+    {
+        for( VkCommandBuffer& command_buffer : command_buffers )
+        {
+            vkAllocateCommandBuffers(device.get_device(), &allocate_info, &command_buffer);
+        }
+        vkFreeCommandBuffers(device.get_device(), allocate_info.commandPool, batch, command_buffers.data());
+    }
+    created = rate(start);
+
+    start = std::chrono::steady_clock::now();
+    for( int i = 0; i < iterations; ++i )
+    {
+        for( VkCommandBuffer& command_buffer : command_buffers )
+        {
+            command_buffer = command_buffer_pool.acquire();
+        }
+        command_buffer_pool.reset();
+    }
+    printf(" - command buffers: %.0f vs. %.0f\n", created, rate(start));
+
+    RecyclingStatistics statistics = fence_pool.get_statistics();
+    printf("Fence pool: %llu created, %llu acquired, %llu batched resets, high water mark %u\n",
+        static_cast<unsigned long long>(statistics.created),
+        static_cast<unsigned long long>(statistics.acquired),
+        static_cast<unsigned long long>(statistics.resets),
+        statistics.high_water_mark);
+}
+
+
+/*  Submits frames that take a few milliseconds to record, each starting
+    with a timestamp, and compares the age of the latched input when the
+    GPU began the frame with the age it would have had if it had been
+    written when recording began.  Every frame's timestamp was written
+    after its input was latched and before its fence wait returned, and
+    the intersection of those windows over all frames relates the GPU
+    clock to the host's. */
+bool test_late_latch_latency(LogicalDevice& device, SDL_Window* window)
+{
+    struct CameraConstants
+    {
+        float cursor[2];
+        float motion[2];
+        uint64_t input_timestamp_ns;
+    };
+
+    const uint32_t frames = 60;
+    const std::chrono::milliseconds recording_time(4);
+
+    printf("Late latch:\n");
+
+    uint32_t family_count = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(device.get_physical_device(), &family_count, nullptr);
+    std::vector<VkQueueFamilyProperties> families(family_count);
+    vkGetPhysicalDeviceQueueFamilyProperties(device.get_physical_device(), &family_count, families.data());
+
+    uint32_t valid_bits = families[device.get_queue_family_index()].timestampValidBits;
+    if( valid_bits == 0 )
+    {
+        return skip("no timestamps on the queue");
+    }
+    uint64_t timestamp_mask = valid_bits >= 64 ? ~uint64_t(0) : (uint64_t(1) << valid_bits) - 1;
+
+    VkQueryPoolCreateInfo pool_info;
+    pool_info.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+    pool_info.pNext = nullptr;
+    pool_info.flags = 0;
+    pool_info.queryType = VK_QUERY_TYPE_TIMESTAMP;
+    pool_info.queryCount = 1;
+    pool_info.pipelineStatistics = 0;
+
+    VkQueryPool query_pool;
+    VkResult result = vkCreateQueryPool(device.get_device(), &pool_info, device.get_allocation_callbacks(), &query_pool);
+    if( result != VK_SUCCESS )
+    {
+        throw VulkanException(result, "Error while creating late latch query pool");
+    }
+
+    LateLatch latch(device, window, sizeof(CameraConstants));
+    CommandBufferPool command_buffers(device);
+    VkFence fence = device.get_fence_pool().acquire();
+
+    VkCommandBufferBeginInfo begin_info;
+    begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    begin_info.pNext = nullptr;
+    begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    begin_info.pInheritanceInfo = nullptr;
+
+    // Host times in the clock of sdl::get_time_ns().
+    std::vector<uint64_t> record_start_ns(frames);
+    std::vector<uint64_t> input_ns(frames);
+    std::vector<uint64_t> latched_ns(frames);
+    std::vector<uint64_t> done_ns(frames);
+    std::vector<uint64_t> gpu_ticks(frames);
+    bool consistent = true;
+
+    for( uint32_t frame = 0; frame < frames; ++frame )
+    {
+        latch.begin_recording();
+        record_start_ns[frame] = sdl::get_time_ns();
+
+        VkCommandBuffer command_buffer = command_buffers.acquire();
+        vkBeginCommandBuffer(command_buffer, &begin_info);
+        vkCmdResetQueryPool(command_buffer, query_pool, 0, 1);
+        vkCmdWriteTimestamp(command_buffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, query_pool, 0);
+        std::this_thread::sleep_for(recording_time);
+        vkEndCommandBuffer(command_buffer);
+
+        VkSubmitInfo submit_info = {};
+        submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        submit_info.commandBufferCount = 1;
+        submit_info.pCommandBuffers = &command_buffer;
+
+        latch.submit(frame, [&](const sdl::InputState& input, void* constants)
+        {
+            CameraConstants* camera = static_cast<CameraConstants*>(constants);
+            camera->cursor[0] = static_cast<float>(input.mouse_x);
+            camera->cursor[1] = static_cast<float>(input.mouse_y);
+            camera->motion[0] = static_cast<float>(input.mouse_dx);
+            camera->motion[1] = static_cast<float>(input.mouse_dy);
+            camera->input_timestamp_ns = input.timestamp_ns;
+            input_ns[frame] = input.timestamp_ns;
+            latched_ns[frame] = sdl::get_time_ns();
+        }, submit_info, fence);
+
+        vkWaitForFences(device.get_device(), 1, &fence, VK_TRUE, UINT64_MAX);
+        done_ns[frame] = sdl::get_time_ns();
+        vkResetFences(device.get_device(), 1, &fence);
+        command_buffers.reset();
+
+        result = vkGetQueryPoolResults(device.get_device(), query_pool, 0, 1, sizeof(uint64_t), &gpu_ticks[frame],
+            sizeof(uint64_t), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT);
+        if( result != VK_SUCCESS )
+        {
+            throw VulkanException(result, "Error while reading late latch timestamps");
+        }
+
+        consistent &= input_ns[frame] == latch.get_latched_input().timestamp_ns;
+    }
+    device.get_fence_pool().release(fence);
+    vkDestroyQueryPool(device.get_device(), query_pool, device.get_allocation_callbacks());
+
+    // Bounds on the host time of the first frame's timestamp, from every
+    // frame's GPU time since then.
+    std::vector<double> gpu_ns(frames);
+    double earliest = 0.0;
+    double latest = 0.0;
+    for( uint32_t frame = 0; frame < frames; ++frame )
+    {
+        gpu_ns[frame] = ((gpu_ticks[frame] - gpu_ticks[0]) & timestamp_mask)
+            * static_cast<double>(device.get_properties().limits.timestampPeriod);
+        double after = static_cast<double>(latched_ns[frame]) - gpu_ns[frame];
+        double before = static_cast<double>(done_ns[frame]) - gpu_ns[frame];
+        earliest = frame == 0 ? after : std::max(earliest, after);
+        latest = frame == 0 ? before : std::min(latest, before);
+    }
+    double first_ns = (earliest + latest) / 2;
+    double uncertainty_ms = (latest - earliest) / 2e6;
+
+    double input_age_ms = 0.0;
+    double record_time_input_age_ms = 0.0;
+    bool younger = true;
+    for( uint32_t frame = 0; frame < frames; ++frame )
+    {
+        double began_ns = first_ns + gpu_ns[frame];
+        double age_ms = (began_ns - input_ns[frame]) / 1e6;
+        double record_time_age_ms = (began_ns - record_start_ns[frame]) / 1e6;
+        younger &= age_ms > -uncertainty_ms && age_ms < record_time_age_ms;
+        input_age_ms += age_ms / frames;
+        record_time_input_age_ms += record_time_age_ms / frames;
+    }
+
+    const LateLatchStatistics& statistics = latch.get_statistics();
+    printf(" - %llu frames: input %.2f ms old when the GPU began, %.2f ms if written at record time"
+        " (clocks related within %.2f ms); at submit %.2f ms and %.2f ms\n",
+        static_cast<unsigned long long>(statistics.frames), input_age_ms, record_time_input_age_ms,
+        uncertainty_ms, statistics.input_age_ms, statistics.record_time_input_age_ms);
+
+    bool passed = true;
+    passed &= check(consistent, "constants written from the latched input");
+    passed &= check(earliest <= latest, "GPU timestamps fit between each latch and fence");
+    passed &= check(earliest <= latest && younger,
+        "GPU began after the latch, with younger input than if written at record time");
+    return passed;
+}
+
+
+/*  The smallest possible shaders for the pipeline benchmarks: position
+    in, white out. */
+static const uint32_t benchmark_vertex_code[] = {
+    0x07230203, 0x00010000, 0x00000000, 0x0000000f, 0x00000000, 0x00020011,
+    0x00000001, 0x0003000e, 0x00000000, 0x00000001, 0x0007000f, 0x00000000,
+    0x00000001, 0x6e69616d, 0x00000000, 0x00000002, 0x00000003, 0x00040047,
+    0x00000002, 0x0000001e, 0x00000000, 0x00040047, 0x00000003, 0x0000000b,
+    0x00000000, 0x00020013, 0x00000004, 0x00030021, 0x00000005, 0x00000004,
+    0x00030016, 0x00000006, 0x00000020, 0x00040017, 0x00000007, 0x00000006,
+    0x00000003, 0x00040017, 0x00000008, 0x00000006, 0x00000004, 0x00040020,
+    0x00000009, 0x00000001, 0x00000007, 0x00040020, 0x0000000a, 0x00000003,
+    0x00000008, 0x0004003b, 0x00000009, 0x00000002, 0x00000001, 0x0004003b,
+    0x0000000a, 0x00000003, 0x00000003, 0x0004002b, 0x00000006, 0x0000000b,
+    0x3f800000, 0x00050036, 0x00000004, 0x00000001, 0x00000000, 0x00000005,
+    0x000200f8, 0x0000000c, 0x0004003d, 0x00000007, 0x0000000d, 0x00000002,
+    0x00050050, 0x00000008, 0x0000000e, 0x0000000d, 0x0000000b, 0x0003003e,
+    0x00000003, 0x0000000e, 0x000100fd, 0x00010038,
+};
+static const uint32_t benchmark_fragment_code[] = {
+    0x07230203, 0x00010000, 0x00000000, 0x0000000e, 0x00000000, 0x00020011,
+    0x00000001, 0x0003000e, 0x00000000, 0x00000001, 0x0006000f, 0x00000004,
+    0x00000001, 0x6e69616d, 0x00000000, 0x00000002, 0x00030010, 0x00000001,
+    0x00000007, 0x00040047, 0x00000002, 0x0000001e, 0x00000000, 0x00020013,
+    0x00000004, 0x00030021, 0x00000005, 0x00000004, 0x00030016, 0x00000006,
+    0x00000020, 0x00040017, 0x00000008, 0x00000006, 0x00000004, 0x00040020,
+    0x0000000a, 0x00000003, 0x00000008, 0x0004003b, 0x0000000a, 0x00000002,
+    0x00000003, 0x0004002b, 0x00000006, 0x0000000b, 0x3f800000, 0x0007002c,
+    0x00000008, 0x0000000c, 0x0000000b, 0x0000000b, 0x0000000b, 0x0000000b,
+    0x00050036, 0x00000004, 0x00000001, 0x00000000, 0x00000005, 0x000200f8,
+    0x0000000d, 0x0003003e, 0x00000002, 0x0000000c, 0x000100fd, 0x00010038,
+};
+
+static VkShaderModule create_benchmark_module(LogicalDevice& device, const uint32_t* code, size_t size)
+{
+    VkShaderModuleCreateInfo create_info;
+    create_info.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+    create_info.pNext = nullptr;
+    create_info.flags = 0;
+    create_info.codeSize = size;
+    create_info.pCode = code;
+
+    VkShaderModule module;
+    VkResult result = vkCreateShaderModule(device.get_device(), &create_info, device.get_allocation_callbacks(), &module);
+    if( result != VK_SUCCESS )
+    {
+        throw VulkanException(result, "Error while creating benchmark shader");
+    }
+    return module;
+}
+
+/*  The layout both benchmark shaders reflect to, kept by the layout cache. */
+static VkPipelineLayout get_benchmark_layout(LogicalDevice& device)
+{
+    std::vector<ShaderReflection> stages;
+    stages.push_back(reflect_spirv(std::vector<uint32_t>(
+        benchmark_vertex_code, benchmark_vertex_code + sizeof(benchmark_vertex_code) / 4)));
+    stages.push_back(reflect_spirv(std::vector<uint32_t>(
+        benchmark_fragment_code, benchmark_fragment_code + sizeof(benchmark_fragment_code) / 4)));
+    return device.get_layout_cache().get_pipeline_layout(stages).layout;
+}
+
+/*  A color and a depth attachment, both cleared, in one subpass. */
+static VkRenderPass create_benchmark_render_pass(LogicalDevice& device)
+{
+    VkAttachmentDescription attachments[2] = {};
+    attachments[0].format = VK_FORMAT_B8G8R8A8_UNORM;
+    attachments[0].samples = VK_SAMPLE_COUNT_1_BIT;
+    attachments[0].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+    attachments[0].storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+    attachments[0].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+    attachments[0].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    attachments[0].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    attachments[0].finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+    attachments[1] = attachments[0];
+    attachments[1].format = VK_FORMAT_D16_UNORM;
+    attachments[1].storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    attachments[1].finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+    VkAttachmentReference color_reference = {0, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL};
+    VkAttachmentReference depth_reference = {1, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL};
+
+    VkSubpassDescription subpass = {};
+    subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+    subpass.colorAttachmentCount = 1;
+    subpass.pColorAttachments = &color_reference;
+    subpass.pDepthStencilAttachment = &depth_reference;
+
+    VkRenderPassCreateInfo render_pass_info = {};
+    render_pass_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+    render_pass_info.attachmentCount = 2;
+    render_pass_info.pAttachments = attachments;
+    render_pass_info.subpassCount = 1;
+    render_pass_info.pSubpasses = &subpass;
+
+    VkRenderPass render_pass;
+    VkResult result = vkCreateRenderPass(device.get_device(), &render_pass_info, device.get_allocation_callbacks(), &render_pass);
+    if( result != VK_SUCCESS )
+    {
+        throw VulkanException(result, "Error while creating benchmark render pass");
+    }
+    return render_pass;
+}
+
+/*  Counts the pipelines a material permutation matrix needs, and the time
+    to compile them, with everything baked and with extended dynamic
+    state. */
+void benchmark_dynamic_state(LogicalDevice& device)
+{
+    VkShaderModule vertex_module = create_benchmark_module(device, benchmark_vertex_code, sizeof(benchmark_vertex_code));
+    VkShaderModule fragment_module = create_benchmark_module(device, benchmark_fragment_code, sizeof(benchmark_fragment_code));
+
+    VkPipelineLayout layout = get_benchmark_layout(device);
+
+    VkRenderPass render_pass = create_benchmark_render_pass(device);
+
+    // Position, position + normal, position + normal + uv.
+    std::vector<VertexLayout> vertex_layouts(3);
+    for( uint32_t i = 0; i < vertex_layouts.size(); ++i )
+    {
+        VkVertexInputAttributeDescription position = {0, 0, VK_FORMAT_R32G32B32_SFLOAT, 0};
+        VkVertexInputAttributeDescription normal = {1, 0, VK_FORMAT_R32G32B32_SFLOAT, 12};
+        VkVertexInputAttributeDescription uv = {2, 0, VK_FORMAT_R32G32_SFLOAT, 24};
+        const uint32_t strides[] = {12, 24, 32};
+
+        vertex_layouts[i].bindings.push_back({0, strides[i], VK_VERTEX_INPUT_RATE_VERTEX});
+        vertex_layouts[i].attributes.push_back(position);
+        if( i >= 1 )
+        {
+            vertex_layouts[i].attributes.push_back(normal);
+        }
+        if( i >= 2 )
+        {
+            vertex_layouts[i].attributes.push_back(uv);
+        }
+    }
+
+    const VkCullModeFlags cull_modes[] = {VK_CULL_MODE_NONE, VK_CULL_MODE_BACK_BIT};
+    const VkPrimitiveTopology topologies[] = {
+        VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST, VK_PRIMITIVE_TOPOLOGY_TRIANGLE_STRIP, VK_PRIMITIVE_TOPOLOGY_LINE_LIST};
+
+    // Every combination of cull mode, topology, depth (off, test + write,
+    // test only), blend (opaque, alpha, additive) and vertex layout.
+    std::vector<RasterState> permutations;
+    for( size_t i = 0; i < 2 * 3 * 3 * 3 * vertex_layouts.size(); ++i )
+    {
+        size_t depth = i / 6 % 3;
+        size_t blend = i / 18 % 3;
+
+        RasterState state = get_default_raster_state();
+        state.cull_mode = cull_modes[i % 2];
+        state.topology = topologies[i / 2 % 3];
+        state.depth_test = depth != 0;
+        state.depth_write = depth == 1;
+        state.blend = blend != 0;
+        state.src_color_factor = blend == 1 ? VK_BLEND_FACTOR_SRC_ALPHA : VK_BLEND_FACTOR_ONE;
+        state.dst_color_factor = blend == 1 ? VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA : VK_BLEND_FACTOR_ONE;
+        state.vertex_layout = vertex_layouts[i / 54];
+        permutations.push_back(state);
+    }
+
+    printf("Pipelines for %zu material permutations:\n", permutations.size());
+
+    for( PipelineStateMode mode : {PipelineStateMode::BAKED, PipelineStateMode::DYNAMIC} )
+    {
+        PipelineStateConfig config(device, mode);
+        std::map<uint64_t, VkPipeline> pipelines;
+
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        for( const RasterState& state : permutations )
+        {
+            uint64_t key = config.get_pipeline_key(state);
+            if( pipelines.count(key) )
+            {
+                continue;
+            }
+
+            VkPipelineShaderStageCreateInfo stages[2] = {};
+            stages[0].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+            stages[0].stage = VK_SHADER_STAGE_VERTEX_BIT;
+            stages[0].module = vertex_module;
+            stages[0].pName = "main";
+            stages[1] = stages[0];
+            stages[1].stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+            stages[1].module = fragment_module;
+
+            VkPipelineViewportStateCreateInfo viewport = {};
+            viewport.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+            viewport.viewportCount = 1;
+            viewport.scissorCount = 1;
+
+            VkPipelineMultisampleStateCreateInfo multisample = {};
+            multisample.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+            multisample.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+
+            VkGraphicsPipelineCreateInfo create_info = {};
+            create_info.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+            create_info.stageCount = 2;
+            create_info.pStages = stages;
+            create_info.pViewportState = &viewport;
+            create_info.pMultisampleState = &multisample;
+            create_info.layout = layout;
+            create_info.renderPass = render_pass;
+            create_info.subpass = 0;
+            create_info.basePipelineIndex = -1;
+
+            PipelineStateInfo info;
+            info.dynamic_states = {VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR};
+            config.describe(state, info, create_info);
+
+            VkPipeline pipeline;
+            VkResult result = vkCreateGraphicsPipelines(
+                device.get_device(), VK_NULL_HANDLE, 1, &create_info, device.get_allocation_callbacks(), &pipeline);
+            if( result != VK_SUCCESS )
+            {
+                throw VulkanException(result, "Error while creating benchmark pipeline");
+            }
+            pipelines[key] = pipeline;
+        }
+        std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+
+        printf(" - %s: %zu pipelines in %.1f ms", mode == PipelineStateMode::BAKED ? "baked" : "dynamic",
+            pipelines.size(), elapsed.count());
+        if( mode == PipelineStateMode::DYNAMIC )
+        {
+            printf(" (rasterization %s, primitive restart %s, blend %s, vertex input %s)",
+                config.has_dynamic_rasterization() ? "dynamic" : "baked",
+                config.has_dynamic_primitive_restart() ? "dynamic" : "baked",
+                config.has_dynamic_blend() ? "dynamic" : "baked",
+                config.has_dynamic_vertex_input() ? "dynamic" : "baked");
+        }
+        printf("\n");
+
+        for( auto& entry : pipelines )
+        {
+            vkDestroyPipeline(device.get_device(), entry.second, device.get_allocation_callbacks());
+        }
+    }
+
+    vkDestroyRenderPass(device.get_device(), render_pass, device.get_allocation_callbacks());
+    vkDestroyShaderModule(device.get_device(), fragment_module, device.get_allocation_callbacks());
+    vkDestroyShaderModule(device.get_device(), vertex_module, device.get_allocation_callbacks());
+}
+
+/*  Gets pipelines for every combination of four options per part through
+    a GraphicsPipelineLibrary, once fast-linking them from libraries and
+    once compiling them monolithically, and checks the parts are compiled
+    once and the optimized pipelines are swapped in by begin_frame().  The
+    library half is skipped without VK_EXT_graphics_pipeline_library. */
+bool test_pipeline_library(LogicalDevice& device)
+{
+    const uint32_t frames_in_flight = 2;
+
+    VkShaderModule vertex_module = create_benchmark_module(device, benchmark_vertex_code, sizeof(benchmark_vertex_code));
+    VkShaderModule fragment_module = create_benchmark_module(device, benchmark_fragment_code, sizeof(benchmark_fragment_code));
+    VkPipelineLayout layout = get_benchmark_layout(device);
+    VkRenderPass render_pass = create_benchmark_render_pass(device);
+
+    VkPipelineShaderStageCreateInfo vertex_stage = {};
+    vertex_stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    vertex_stage.stage = VK_SHADER_STAGE_VERTEX_BIT;
+    vertex_stage.module = vertex_module;
+    vertex_stage.pName = "main";
+    VkPipelineShaderStageCreateInfo fragment_stage = vertex_stage;
+    fragment_stage.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+    fragment_stage.module = fragment_module;
+
+    // Vertex input: three strides by three topologies.
+    const uint32_t strides[] = {12, 24, 32};
+    const VkPrimitiveTopology topologies[] = {
+        VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST, VK_PRIMITIVE_TOPOLOGY_TRIANGLE_STRIP, VK_PRIMITIVE_TOPOLOGY_LINE_LIST};
+    VkVertexInputAttributeDescription position = {0, 0, VK_FORMAT_R32G32B32_SFLOAT, 0};
+    VkVertexInputBindingDescription bindings[3];
+    VkPipelineVertexInputStateCreateInfo vertex_inputs[3] = {};
+    VkPipelineInputAssemblyStateCreateInfo input_assemblies[3] = {};
+    for( uint32_t i = 0; i < 3; ++i )
+    {
+        bindings[i] = {0, strides[i], VK_VERTEX_INPUT_RATE_VERTEX};
+        vertex_inputs[i].sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+        vertex_inputs[i].vertexBindingDescriptionCount = 1;
+        vertex_inputs[i].pVertexBindingDescriptions = &bindings[i];
+        vertex_inputs[i].vertexAttributeDescriptionCount = 1;
+        vertex_inputs[i].pVertexAttributeDescriptions = &position;
+        input_assemblies[i].sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+        input_assemblies[i].topology = topologies[i];
+    }
+
+    // Pre-rasterization: no culling or back faces culled.
+    VkPipelineRasterizationStateCreateInfo rasterizations[2] = {};
+    for( uint32_t i = 0; i < 2; ++i )
+    {
+        rasterizations[i].sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+        rasterizations[i].polygonMode = VK_POLYGON_MODE_FILL;
+        rasterizations[i].cullMode = i == 0 ? VK_CULL_MODE_NONE : VK_CULL_MODE_BACK_BIT;
+        rasterizations[i].frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
+        rasterizations[i].lineWidth = 1.0f;
+    }
+    VkPipelineViewportStateCreateInfo viewport = {};
+    viewport.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+    viewport.viewportCount = 1;
+    viewport.scissorCount = 1;
+    const VkDynamicState dynamic_states[] = {VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR};
+    VkPipelineDynamicStateCreateInfo dynamic = {};
+    dynamic.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+    dynamic.dynamicStateCount = 2;
+    dynamic.pDynamicStates = dynamic_states;
+
+    // Fragment shader: depth off, test + write, test only.
+    VkPipelineDepthStencilStateCreateInfo depth_stencils[3] = {};
+    for( uint32_t i = 0; i < 3; ++i )
+    {
+        depth_stencils[i].sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+        depth_stencils[i].depthTestEnable = i != 0;
+        depth_stencils[i].depthWriteEnable = i == 1;
+        depth_stencils[i].depthCompareOp = VK_COMPARE_OP_LESS_OR_EQUAL;
+    }
+    VkPipelineMultisampleStateCreateInfo multisample = {};
+    multisample.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+    multisample.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+
+    // Fragment output: opaque, alpha, additive.
+    VkPipelineColorBlendAttachmentState blend_attachments[3] = {};
+    VkPipelineColorBlendStateCreateInfo color_blends[3] = {};
+    for( uint32_t i = 0; i < 3; ++i )
+    {
+        blend_attachments[i].blendEnable = i != 0;
+        blend_attachments[i].srcColorBlendFactor = i == 1 ? VK_BLEND_FACTOR_SRC_ALPHA : VK_BLEND_FACTOR_ONE;
+        blend_attachments[i].dstColorBlendFactor = i == 1 ? VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA : VK_BLEND_FACTOR_ONE;
+        blend_attachments[i].colorBlendOp = VK_BLEND_OP_ADD;
+        blend_attachments[i].srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+        blend_attachments[i].dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;
+        blend_attachments[i].alphaBlendOp = VK_BLEND_OP_ADD;
+        blend_attachments[i].colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT
+            | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+        color_blends[i].sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+        color_blends[i].attachmentCount = 1;
+        color_blends[i].pAttachments = &blend_attachments[i];
+    }
 
-template<typename Info>
-std::vector<Info> filter_by_name(
-    const std::vector<Info>& infos,
-    const std::vector<std::string>& names_vec)
+    const size_t count = 9 * 2 * 3 * 3;
+    auto get_description = [&](size_t i)
+    {
+        size_t input = i % 9;
+        size_t cull = i / 9 % 2;
+        size_t depth = i / 18 % 3;
+        size_t blend = i / 54;
+
+        GraphicsPipelineDescription description;
+        description.layout = layout;
+        description.parts[0].key = input;
+        description.parts[0].describe =
+            [&, input](VkGraphicsPipelineCreateInfo& info, std::vector<VkPipelineShaderStageCreateInfo>&)
+        {
+            info.pVertexInputState = &vertex_inputs[input % 3];
+            info.pInputAssemblyState = &input_assemblies[input / 3];
+        };
+        description.parts[1].key = cull;
+        description.parts[1].describe =
+            [&, cull](VkGraphicsPipelineCreateInfo& info, std::vector<VkPipelineShaderStageCreateInfo>& stages)
+        {
+            stages.push_back(vertex_stage);
+            info.pViewportState = &viewport;
+            info.pRasterizationState = &rasterizations[cull];
+            info.pDynamicState = &dynamic;
+            info.renderPass = render_pass;
+            info.subpass = 0;
+        };
+        description.parts[2].key = depth;
+        description.parts[2].describe =
+            [&, depth](VkGraphicsPipelineCreateInfo& info, std::vector<VkPipelineShaderStageCreateInfo>& stages)
+        {
+            stages.push_back(fragment_stage);
+            info.pDepthStencilState = &depth_stencils[depth];
+            info.pMultisampleState = &multisample;
+            info.renderPass = render_pass;
+            info.subpass = 0;
+        };
+        description.parts[3].key = blend;
+        description.parts[3].describe =
+            [&, blend](VkGraphicsPipelineCreateInfo& info, std::vector<VkPipelineShaderStageCreateInfo>&)
+        {
+            info.pColorBlendState = &color_blends[blend];
+            info.pMultisampleState = &multisample;
+            info.renderPass = render_pass;
+            info.subpass = 0;
+        };
+        return description;
+    };
+
+    bool passed = true;
+    printf("Pipeline library for %zu permutations:\n", count);
+
+    for( bool use_libraries : {true, false} )
+    {
+        GraphicsPipelineLibrary library(device, frames_in_flight, use_libraries);
+        if( use_libraries && !library.uses_libraries() )
+        {
+            printf(" - fast-linked: no VK_EXT_graphics_pipeline_library\n");
+            continue;
+        }
+
+        std::vector<VkPipeline> pipelines(count);
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        for( size_t i = 0; i < count; ++i )
+        {
+            pipelines[i] = library.get(get_description(i));
+        }
+        std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+
+        bool cached = true;
+        for( size_t i = 0; i < count; ++i )
+        {
+            cached &= pipelines[i] != VK_NULL_HANDLE && library.get(get_description(i)) == pipelines[i];
+        }
+        PipelineLibraryStatistics statistics = library.get_statistics();
+
+        if( !use_libraries )
+        {
+            printf(" - monolithic: %zu pipelines in %.1f ms\n", count, elapsed.count());
+            passed &= check(!library.uses_libraries() && statistics.monolithic == count
+                && statistics.fast_links == 0 && statistics.parts_compiled == 0 && cached,
+                "monolithic fallback compiles each pipeline once");
+            continue;
+        }
+
+        printf(" - fast-linked: %zu pipelines in %.1f ms, %llu parts compiled in %.1f ms, links %.1f ms\n",
+            count, elapsed.count(), static_cast<unsigned long long>(statistics.parts_compiled),
+            statistics.part_ms, statistics.fast_link_ms);
+        passed &= check(statistics.parts_compiled == 9 + 2 + 3 + 3 && statistics.fast_links == count
+            && statistics.monolithic == 0 && cached, "parts compiled once, each combination fast-linked once");
+
+        library.wait_for_optimization();
+        statistics = library.get_statistics();
+        printf(" - optimized in the background: %llu pipelines in %.1f ms, %llu failed\n",
+            static_cast<unsigned long long>(statistics.optimized), statistics.optimize_ms,
+            static_cast<unsigned long long>(statistics.failed_optimizations));
+        passed &= check(statistics.optimized + statistics.failed_optimizations == count,
+            "every fast-linked pipeline optimized or given up on");
+
+        bool kept = true;
+        for( size_t i = 0; i < count; ++i )
+        {
+            kept &= library.get(get_description(i)) == pipelines[i];
+        }
+        passed &= check(kept, "fast-linked pipelines used until begin_frame");
+
+        library.begin_frame();
+        uint64_t swapped = 0;
+        for( size_t i = 0; i < count; ++i )
+        {
+            swapped += library.get(get_description(i)) != pipelines[i];
+        }
+        passed &= check(swapped == statistics.optimized, "optimized pipelines swapped in by begin_frame");
+
+        // Destroys the fast-linked pipelines they replaced.
+        for( uint32_t i = 0; i <= frames_in_flight; ++i )
+        {
+            library.begin_frame();
+        }
+    }
+
+    vkDestroyRenderPass(device.get_device(), render_pass, device.get_allocation_callbacks());
+    vkDestroyShaderModule(device.get_device(), fragment_module, device.get_allocation_callbacks());
+    vkDestroyShaderModule(device.get_device(), vertex_module, device.get_allocation_callbacks());
+    return passed;
+}
+
+/*  Several threads hand fenced empty submissions to one SubmissionThread
+    at once; each must reach the queue, in its own fence's time. */
+bool test_submission_thread(LogicalDevice& device)
 {
-    std::set<std::string> names;
-    for( const std::string& name : names_vec )
+    const uint32_t thread_count = 4;
+    const uint32_t submissions_per_thread = 64;
+
+    printf("Submission thread:\n");
+
+    FencePool& fence_pool = device.get_fence_pool();
+    std::vector<std::vector<VkFence>> fences(thread_count);
+    for( std::vector<VkFence>& thread_fences : fences )
     {
-        names.insert(name);
+        for( uint32_t i = 0; i < submissions_per_thread; ++i )
+        {
+            thread_fences.push_back(fence_pool.acquire());
+        }
     }
 
-    std::vector<Info> result_infos;
-    for( const Info& info : infos )
+    bool passed = true;
     {
-        if( names.find(info.name) != names.end() )
+        SubmissionThread submission_thread(device.get_submit_queue());
+
+        std::vector<std::thread> producers;
+        for( uint32_t t = 0; t < thread_count; ++t )
         {
-            result_infos.push_back(info);
+            producers.emplace_back([&submission_thread, &fences, t]()
+            {
+                for( VkFence fence : fences[t] )
+                {
+                    submission_thread.submit(Submission(), fence);
+                }
+            });
+        }
+        for( std::thread& producer : producers )
+        {
+            producer.join();
+        }
+        submission_thread.drain();
+
+        LatencyHistogram histogram = submission_thread.get_latency_histogram();
+        uint64_t bucketed = 0;
+        for( uint64_t bucket : histogram.buckets )
+        {
+            bucketed += bucket;
         }
+        passed &= check(histogram.count == thread_count * submissions_per_thread && bucketed == histogram.count,
+            "every submission in the latency histogram");
+        printf("   enqueue to submit: %llu us mean, %llu us 99th percentile\n",
+            static_cast<unsigned long long>(histogram.total_microseconds / std::max<uint64_t>(histogram.count, 1)),
+            static_cast<unsigned long long>(histogram.get_percentile(0.99)));
     }
 
-    return result_infos;
+    bool signaled = true;
+    for( std::vector<VkFence>& thread_fences : fences )
+    {
+        VkResult result = vkWaitForFences(device.get_device(), static_cast<uint32_t>(thread_fences.size()),
+            thread_fences.data(), VK_TRUE, 5000000000ull);
+        signaled &= result == VK_SUCCESS;
+        if( result == VK_SUCCESS )
+        {
+            fence_pool.release(thread_fences);
+        }
+    }
+    passed &= check(signaled, "every fence signaled");
+
+    return passed;
+}
+
+/*  Resolves trackers of three command buffers against an image last read
+    by the fragment shader, and checks the prelude barriers and the state
+    each one publishes. */
+bool test_layout_resolve(LogicalDevice& device)
+{
+    std::unique_ptr<Image> image = device.create_image(VK_FORMAT_R8G8B8A8_UNORM, VkExtent3D{16, 16, 1}, 1, 1,
+        VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    VkImageSubresourceRange range = image->get_full_range();
+    const ImageSubresourceState fragment_read = {VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+        VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT_KHR, VK_ACCESS_2_SHADER_SAMPLED_READ_BIT_KHR};
+
+    bool passed = true;
+    printf("Layout tracker resolve:\n");
+
+    image->set_state(range, fragment_read);
+    LayoutTracker reader;
+    BarrierBatch barriers;
+    BarrierBatch prelude;
+    reader.use(*image, range, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+        VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT_KHR, VK_ACCESS_2_SHADER_SAMPLED_READ_BIT_KHR, barriers);
+    reader.resolve(prelude);
+    prelude.merge();
+    ImageSubresourceState state = image->get_state(0, 0);
+    passed &= check(barriers.is_empty() && prelude.is_empty(), "read after reads needs no barrier");
+    passed &= check(state.stages == (VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT_KHR | VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT_KHR),
+        "earlier readers kept in the published state");
+
+    LayoutTracker writer;
+    writer.use(*image, range, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+        VK_PIPELINE_STAGE_2_COPY_BIT_KHR, VK_ACCESS_2_TRANSFER_WRITE_BIT_KHR, barriers);
+    writer.resolve(prelude);
+    prelude.merge();
+    passed &= check(prelude.get_image_barriers().size() == 1
+        && prelude.get_image_barriers()[0].srcStageMask == state.stages
+        && prelude.get_image_barriers()[0].newLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+        "later writer waits for every reader");
+    passed &= check(image->get_state(0, 0).layout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+        "writer's state published");
+
+    // A read, then a write ordered by a barrier in the same command buffer.
+    image->set_state(range, fragment_read);
+    prelude.clear();
+    barriers.clear();
+    LayoutTracker read_then_write;
+    read_then_write.use(*image, range, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+        VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT_KHR, VK_ACCESS_2_SHADER_SAMPLED_READ_BIT_KHR, barriers);
+    read_then_write.use(*image, range, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+        VK_PIPELINE_STAGE_2_COPY_BIT_KHR, VK_ACCESS_2_TRANSFER_WRITE_BIT_KHR, barriers);
+    read_then_write.resolve(prelude);
+    prelude.merge();
+    passed &= check(prelude.get_memory_barriers().size() == 1
+        && prelude.get_memory_barriers()[0].srcStageMask == VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT_KHR
+        && prelude.get_memory_barriers()[0].dstStageMask == VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT_KHR,
+        "earlier readers finish before a command buffer that writes after reading");
+
+    return passed;
+}
+
+/*  A hand-assembled compute shader that does nothing, with specialization
+    constants 0 and 1 declared. */
+static std::vector<uint32_t> make_specialized_compute_spirv()
+{
+    std::vector<uint32_t> code = {0x07230203, 0x00010000, 0, 8, 0};
+    auto op = [&code](uint32_t opcode, std::vector<uint32_t> words)
+    {
+        code.push_back(static_cast<uint32_t>(words.size() + 1) << 16 | opcode);
+        code.insert(code.end(), words.begin(), words.end());
+    };
+
+    op(17, {1});                                    // OpCapability Shader
+    op(14, {0, 1});                                 // OpMemoryModel Logical GLSL450
+    op(15, {5, 1, 0x6e69616d, 0});                  // OpEntryPoint GLCompute "main"
+    op(16, {1, 17, 1, 1, 1});                       // LocalSize 1 1 1
+    op(71, {5, 1, 0});                              // SpecId 0
+    op(71, {6, 1, 1});                              // SpecId 1
+    op(19, {2});                                    // void
+    op(33, {3, 2});                                 // void()
+    op(21, {4, 32, 0});                             // uint
+    op(50, {4, 5, 0});                              // OpSpecConstant
+    op(50, {4, 6, 0});
+    op(54, {2, 1, 0, 3});
+    op(248, {7});
+    op(253, {});
+    op(56, {});
+    return code;
+}
+
+/*  Creates variants of a compute module through a factory that counts its
+    calls and can be made to fail, from one thread, several threads at
+    once and precompile(). */
+bool test_shader_variants(LogicalDevice& device)
+{
+    printf("Shader variants:\n");
+
+    VkPipelineLayoutCreateInfo layout_info = {};
+    layout_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    VkPipelineLayout layout;
+    VkResult result = vkCreatePipelineLayout(device.get_device(), &layout_info, device.get_allocation_callbacks(), &layout);
+    if( result != VK_SUCCESS )
+    {
+        throw VulkanException(result, "Error while creating variant test pipeline layout");
+    }
+
+    std::atomic<uint32_t> creates(0);
+    std::atomic<bool> failing(false);
+    ShaderVariantManager::PipelineFactory factory =
+        [&](VkShaderModule module, const VkSpecializationInfo& specialization, VkPipelineCache pipeline_cache)
+    {
+        creates++;
+        // Long enough for concurrent requests of one variant to overlap.
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        if( static_cast<const uint32_t*>(specialization.pData)[1] == 7 && failing.exchange(false) )
+        {
+            throw std::runtime_error("Injected pipeline failure");
+        }
+
+        VkComputePipelineCreateInfo create_info = {};
+        create_info.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+        create_info.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+        create_info.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+        create_info.stage.module = module;
+        create_info.stage.pName = "main";
+        create_info.stage.pSpecializationInfo = &specialization;
+        create_info.layout = layout;
+        create_info.basePipelineIndex = -1;
+
+        VkPipeline pipeline;
+        VkResult result = vkCreateComputePipelines(
+            device.get_device(), pipeline_cache, 1, &create_info, device.get_allocation_callbacks(), &pipeline);
+        if( result != VK_SUCCESS )
+        {
+            throw VulkanException(result, "Error while creating variant test pipeline");
+        }
+        return pipeline;
+    };
+
+    bool passed = true;
+    {
+        ShaderVariantManager variants(device, make_specialized_compute_spirv(), {{"quality", 0, 1}, {"mode", 1, 0}}, factory);
+
+        std::vector<uint32_t> high = variants.make_variant({{"quality", 2}});
+        passed &= check(high == std::vector<uint32_t>{2, 0}, "defaults for the constants not named");
+        VkPipeline pipeline = variants.get(high);
+        VkPipeline again = variants.get(variants.make_variant({{"mode", 0}, {"quality", 2}}));
+        passed &= check(pipeline != VK_NULL_HANDLE && again == pipeline && creates == 1, "same tuple created once");
+
+        std::vector<uint32_t> concurrent = variants.make_variant({{"mode", 3}});
+        std::vector<VkPipeline> pipelines(8, VK_NULL_HANDLE);
+        std::vector<std::thread> threads;
+        for( size_t i = 0; i < pipelines.size(); ++i )
+        {
+            threads.emplace_back([&variants, &pipelines, &concurrent, i]()
+            {
+                pipelines[i] = variants.get(concurrent);
+            });
+        }
+        for( std::thread& thread : threads )
+        {
+            thread.join();
+        }
+        bool same = pipelines[0] != VK_NULL_HANDLE && pipelines[0] != pipeline;
+        for( VkPipeline other : pipelines )
+        {
+            same &= other == pipelines[0];
+        }
+        passed &= check(same && creates == 2, "concurrent requests create one pipeline");
+
+        variants.precompile({high, concurrent, {0, 4}, {1, 4}, {2, 4}, {3, 4}}, 3);
+        VariantStatistics statistics = variants.get_statistics();
+        passed &= check(creates == 6 && statistics.pipelines == 6 && statistics.misses == 6 && statistics.hits == 10,
+            "precompile creates only the variants not created yet");
+
+        std::vector<uint32_t> broken = variants.make_variant({{"mode", 7}});
+        failing = true;
+        bool thrown = false;
+        try
+        {
+            variants.get(broken);
+        }
+        catch(std::runtime_error&)
+        {
+            thrown = true;
+        }
+        passed &= check(thrown && variants.get_statistics().pipelines == 6, "factory failure reaches the caller");
+        passed &= check(variants.get(broken) != VK_NULL_HANDLE && creates == 8 && variants.get_statistics().pipelines == 7,
+            "failed variant created again on the next request");
+    }
+
+    vkDestroyPipelineLayout(device.get_device(), layout, device.get_allocation_callbacks());
+    return passed;
+}
+
+ShaderFrontend get_shader_frontend()
+{
+#ifdef VULKAN_SHADERC
+    return create_shaderc_frontend();
+#else
+    return ShaderFrontend();
+#endif
+}
+
+/*  Where the device tests cache compiled shaders, out of the working
+    directory. */
+std::string get_shader_cache_directory()
+{
+    return (std::filesystem::temp_directory_path() / "vulkan_test_shaders").string();
+}
+
+/*  Records with the callback into a one-time command buffer, submits it
+    and waits for it to finish. */
+void run_commands(
+    LogicalDevice& device,
+    CommandBufferPool& command_pool,
+    const std::function<void(VkCommandBuffer)>& record)
+{
+    command_pool.reset();
+    VkCommandBuffer command_buffer = command_pool.acquire();
+
+    VkCommandBufferBeginInfo begin_info;
+    begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    begin_info.pNext = nullptr;
+    begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    begin_info.pInheritanceInfo = nullptr;
+
+    VkResult result = vkBeginCommandBuffer(command_buffer, &begin_info);
+    if( result != VK_SUCCESS )
+    {
+        throw VulkanException(result, "Error while beginning test command buffer");
+    }
+
+    record(command_buffer);
+
+    result = vkEndCommandBuffer(command_buffer);
+    if( result != VK_SUCCESS )
+    {
+        throw VulkanException(result, "Error while ending test command buffer");
+    }
+
+    VkSubmitInfo submit_info = {};
+    submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submit_info.commandBufferCount = 1;
+    submit_info.pCommandBuffers = &command_buffer;
+
+    VkFence fence = device.get_fence_pool().acquire();
+    result = device.get_submit_queue().submit(submit_info, fence);
+    if( result == VK_SUCCESS )
+    {
+        result = vkWaitForFences(device.get_device(), 1, &fence, VK_TRUE, UINT64_MAX);
+    }
+    device.get_fence_pool().release(fence);
+    if( result != VK_SUCCESS )
+    {
+        throw VulkanException(result, "Error while running test commands");
+    }
+}
+
+/*  Makes compute shader writes visible to the host. */
+void record_host_read_barrier(VkCommandBuffer command_buffer)
+{
+    VkMemoryBarrier barrier;
+    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    barrier.pNext = nullptr;
+    barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+    vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_HOST_BIT,
+        0, 1, &barrier, 0, nullptr, 0, nullptr);
+}
+
+/*  Runs each compute primitive over host-visible buffers, at sizes below,
+    around and well above one tile, and compares with the CPU references.
+    Skipped when the device lacks buffer device address or the kernels
+    can be neither compiled nor loaded. */
+bool test_compute_primitives(LogicalDevice& device)
+{
+    printf("Compute primitives:\n");
+
+    ShaderCache shaders(get_shader_cache_directory(), get_shader_frontend());
+    std::unique_ptr<ComputePrimitives> primitives;
+    try
+    {
+        primitives.reset(new ComputePrimitives(device, shaders));
+    }
+    catch(std::runtime_error& e)
+    {
+        return skip(e.what());
+    }
+
+    const VkBufferUsageFlags usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT
+        | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+    const VkMemoryPropertyFlags properties = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+
+    CommandBufferPool command_pool(device);
+    std::mt19937 random(1234);
+    bool passed = true;
+
+    {
+        std::unique_ptr<Buffer> pinned = device.create_buffer(16, usage, properties);
+        passed &= check(!pinned->get_allocation()->is_movable(), "buffers with device addresses not moved");
+    }
+
+    for( uint32_t count : {1u, 1000u, 2049u, (1u << 20) + 123} )
+    {
+        // Sort keys repeat a lot, so that an unstable pass shows in the
+        // values, but differ in every digit.
+        std::vector<uint32_t> values(count);
+        std::vector<uint32_t> keys(count);
+        std::vector<uint32_t> payload(count);
+        for( uint32_t i = 0; i < count; ++i )
+        {
+            values[i] = random();
+            keys[i] = values[i] & 0x81422418;
+            payload[i] = i;
+        }
+
+        VkDeviceSize size = count * sizeof(uint32_t);
+        std::unique_ptr<Buffer> source = device.create_buffer(size, usage, properties);
+        std::unique_ptr<Buffer> output = device.create_buffer(
+            std::max<VkDeviceSize>(size, ComputePrimitives::max_histogram_bins * sizeof(uint32_t)), usage, properties);
+        std::unique_ptr<Buffer> key_buffer = device.create_buffer(size, usage, properties);
+        std::unique_ptr<Buffer> value_buffer = device.create_buffer(size, usage, properties);
+
+        uint32_t* source_data = static_cast<uint32_t*>(device.map(source->get_allocation()));
+        uint32_t* output_data = static_cast<uint32_t*>(device.map(output->get_allocation()));
+        uint32_t* key_data = static_cast<uint32_t*>(device.map(key_buffer->get_allocation()));
+        uint32_t* value_data = static_cast<uint32_t*>(device.map(value_buffer->get_allocation()));
+        memcpy(source_data, values.data(), size);
+
+        bool reduced = true;
+        for( ReduceOperation operation : {ReduceOperation::SUM, ReduceOperation::MIN, ReduceOperation::MAX} )
+        {
+            run_commands(device, command_pool, [&](VkCommandBuffer command_buffer)
+            {
+                primitives->record_reduce(command_buffer, *source, *output, count, operation);
+                record_host_read_barrier(command_buffer);
+            });
+            reduced &= output_data[0] == reduce_reference(values, operation);
+        }
+
+        bool scanned = true;
+        for( ScanMode mode : {ScanMode::EXCLUSIVE, ScanMode::INCLUSIVE} )
+        {
+            run_commands(device, command_pool, [&](VkCommandBuffer command_buffer)
+            {
+                primitives->record_scan(command_buffer, *source, *output, count, mode);
+                record_host_read_barrier(command_buffer);
+            });
+            scanned &= std::vector<uint32_t>(output_data, output_data + count) == scan_reference(values, mode);
+        }
+
+        run_commands(device, command_pool, [&](VkCommandBuffer command_buffer)
+        {
+            primitives->record_histogram(command_buffer, *source, *output, count, 256, 8);
+            record_host_read_barrier(command_buffer);
+        });
+        bool counted = std::vector<uint32_t>(output_data, output_data + 256) == histogram_reference(values, 256, 8);
+
+        std::vector<uint32_t> sorted_keys = keys;
+        std::vector<uint32_t> sorted_payload = payload;
+        sort_reference(sorted_keys, &sorted_payload);
+
+        memcpy(key_data, keys.data(), size);
+        run_commands(device, command_pool, [&](VkCommandBuffer command_buffer)
+        {
+            primitives->record_sort(command_buffer, *key_buffer, count);
+            record_host_read_barrier(command_buffer);
+        });
+        bool sorted = std::vector<uint32_t>(key_data, key_data + count) == sorted_keys;
+
+        memcpy(key_data, keys.data(), size);
+        memcpy(value_data, payload.data(), size);
+        run_commands(device, command_pool, [&](VkCommandBuffer command_buffer)
+        {
+            primitives->record_sort(command_buffer, *key_buffer, *value_buffer, count);
+            record_host_read_barrier(command_buffer);
+        });
+        sorted &= std::vector<uint32_t>(key_data, key_data + count) == sorted_keys
+            && std::vector<uint32_t>(value_data, value_data + count) == sorted_payload;
+
+        std::string prefix = std::to_string(count) + " elements: ";
+        passed &= check(reduced, (prefix + "sum, min and max").c_str());
+        passed &= check(scanned, (prefix + "exclusive and inclusive scan").c_str());
+        passed &= check(counted, (prefix + "histogram").c_str());
+        passed &= check(sorted, (prefix + "stable key and key/value sort").c_str());
+    }
+
+    return passed;
+}
+
+/*  Times each compute primitive over device-local buffers with timestamp
+    queries and prints the rates. */
+void benchmark_compute_primitives(LogicalDevice& device)
+{
+    const uint32_t count = 1 << 22;
+    const uint32_t repetitions = 5;
+
+    uint32_t family_count = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(device.get_physical_device(), &family_count, nullptr);
+    std::vector<VkQueueFamilyProperties> families(family_count);
+    vkGetPhysicalDeviceQueueFamilyProperties(device.get_physical_device(), &family_count, families.data());
+
+    uint32_t valid_bits = families[device.get_queue_family_index()].timestampValidBits;
+    if( valid_bits == 0 )
+    {
+        return;
+    }
+    uint64_t timestamp_mask = valid_bits >= 64 ? ~uint64_t(0) : (uint64_t(1) << valid_bits) - 1;
+
+    ShaderCache shaders(get_shader_cache_directory(), get_shader_frontend());
+    std::unique_ptr<ComputePrimitives> primitives;
+    try
+    {
+        primitives.reset(new ComputePrimitives(device, shaders));
+    }
+    catch(std::runtime_error&)
+    {
+        return;
+    }
+
+    const VkBufferUsageFlags usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT
+        | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+    VkDeviceSize size = count * sizeof(uint32_t);
+    std::unique_ptr<Buffer> source = device.create_buffer(size, usage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    std::unique_ptr<Buffer> output = device.create_buffer(size, usage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    std::unique_ptr<Buffer> values = device.create_buffer(size, usage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+    std::vector<uint32_t> data(count);
+    std::mt19937 random(1234);
+    for( uint32_t& value : data )
+    {
+        value = random();
+    }
+    Uploader uploader(device);
+    uploader.upload(*source, 0, data.data(), size);
+    uploader.flush();
+
+    VkQueryPoolCreateInfo pool_info;
+    pool_info.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+    pool_info.pNext = nullptr;
+    pool_info.flags = 0;
+    pool_info.queryType = VK_QUERY_TYPE_TIMESTAMP;
+    pool_info.queryCount = repetitions * 2;
+    pool_info.pipelineStatistics = 0;
+
+    VkQueryPool query_pool;
+    VkResult result = vkCreateQueryPool(device.get_device(), &pool_info, device.get_allocation_callbacks(), &query_pool);
+    if( result != VK_SUCCESS )
+    {
+        throw VulkanException(result, "Error while creating benchmark query pool");
+    }
+
+    VkMemoryBarrier barrier;
+    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    barrier.pNext = nullptr;
+    barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT
+        | VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+
+    const char* names[] = {"reduce", "scan", "histogram", "sort", "key/value sort"};
+    std::function<void(VkCommandBuffer)> operations[] = {
+        [&](VkCommandBuffer command_buffer)
+        {
+            primitives->record_reduce(command_buffer, *source, *output, count, ReduceOperation::SUM);
+        },
+        [&](VkCommandBuffer command_buffer)
+        {
+            primitives->record_scan(command_buffer, *source, *output, count, ScanMode::EXCLUSIVE);
+        },
+        [&](VkCommandBuffer command_buffer)
+        {
+            primitives->record_histogram(command_buffer, *source, *output, count, 256);
+        },
+        [&](VkCommandBuffer command_buffer)
+        {
+            // Sorting a copy keeps every repetition's input random.
+            VkBufferCopy region = {0, 0, size};
+            vkCmdCopyBuffer(command_buffer, source->get_buffer(), output->get_buffer(), 1, &region);
+            vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                0, 1, &barrier, 0, nullptr, 0, nullptr);
+            primitives->record_sort(command_buffer, *output, count);
+        },
+        [&](VkCommandBuffer command_buffer)
+        {
+            VkBufferCopy region = {0, 0, size};
+            vkCmdCopyBuffer(command_buffer, source->get_buffer(), output->get_buffer(), 1, &region);
+            vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                0, 1, &barrier, 0, nullptr, 0, nullptr);
+            primitives->record_sort(command_buffer, *output, *values, count);
+        },
+    };
+
+    printf("Compute primitives over %u elements on %s:\n", count, device.get_properties().deviceName);
+
+    CommandBufferPool command_pool(device);
+    try
+    {
+        for( size_t operation = 0; operation < 5; ++operation )
+        {
+            run_commands(device, command_pool, [&](VkCommandBuffer command_buffer)
+            {
+                vkCmdResetQueryPool(command_buffer, query_pool, 0, repetitions * 2);
+
+                // One unmeasured run warms caches and clocks.
+                operations[operation](command_buffer);
+
+                for( uint32_t i = 0; i < repetitions; ++i )
+                {
+                    vkCmdPipelineBarrier(command_buffer,
+                        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT,
+                        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT,
+                        0, 1, &barrier, 0, nullptr, 0, nullptr);
+                    vkCmdWriteTimestamp(command_buffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, query_pool, i * 2);
+                    operations[operation](command_buffer);
+                    vkCmdWriteTimestamp(command_buffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, query_pool, i * 2 + 1);
+                }
+            });
+
+            std::vector<uint64_t> timestamps(repetitions * 2);
+            result = vkGetQueryPoolResults(device.get_device(), query_pool, 0, repetitions * 2,
+                timestamps.size() * sizeof(uint64_t), timestamps.data(), sizeof(uint64_t),
+                VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT);
+            if( result != VK_SUCCESS )
+            {
+                throw VulkanException(result, "Error while reading benchmark timestamps");
+            }
+
+            std::vector<double> times;
+            for( uint32_t i = 0; i < repetitions; ++i )
+            {
+                uint64_t ticks = (timestamps[i * 2 + 1] - timestamps[i * 2]) & timestamp_mask;
+                times.push_back(ticks * device.get_properties().limits.timestampPeriod / 1e6);
+            }
+            std::nth_element(times.begin(), times.begin() + times.size() / 2, times.end());
+            double ms = times[times.size() / 2];
+
+            printf(" - %s: %.2f ms, %.0f Melements/s\n", names[operation], ms, count / ms / 1e3);
+        }
+    }
+    catch( ... )
+    {
+        vkDestroyQueryPool(device.get_device(), query_pool, device.get_allocation_callbacks());
+        throw;
+    }
+
+    vkDestroyQueryPool(device.get_device(), query_pool, device.get_allocation_callbacks());
 }
 
+/*  Tunes a kernel without resources, reloads the database it wrote, and
+    checks that a changed kernel is tuned again.  Skipped when the kernel
+    can be neither compiled nor loaded, or the queue has no timestamps. */
+bool test_workgroup_tuner(LogicalDevice& device)
+{
+    printf("Workgroup tuner:\n");
+
+    auto get_source = [](const std::string& added)
+    {
+        ShaderSource source;
+        source.name = "tuner_test.comp";
+        source.text =
+            "#version 450\n"
+            "layout(local_size_x_id = 0, local_size_y_id = 1, local_size_z_id = 2) in;\n"
+            "shared uint total;\n"
+            "void main() { atomicAdd(total, " + added + "); }\n";
+        source.language = ShaderLanguage::GLSL;
+        source.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+        source.entry_point = "main";
+        return source;
+    };
+
+    ShaderCache shaders(get_shader_cache_directory(), get_shader_frontend());
+    ComputeKernel kernel;
+    std::vector<uint32_t> changed_code;
+    try
+    {
+        kernel.code = shaders.get(get_source("gl_LocalInvocationIndex"));
+        changed_code = shaders.get(get_source("1u"));
+    }
+    catch(std::runtime_error& e)
+    {
+        return skip(e.what());
+    }
+
+    VkPipelineLayoutCreateInfo layout_info = {};
+    layout_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    VkPipelineLayout layout;
+    VkResult result = vkCreatePipelineLayout(device.get_device(), &layout_info, device.get_allocation_callbacks(), &layout);
+    if( result != VK_SUCCESS )
+    {
+        throw VulkanException(result, "Error while creating tuner test pipeline layout");
+    }
+
+    uint32_t max_invocations = device.get_properties().limits.maxComputeWorkGroupInvocations;
+    kernel.name = "tuner_test";
+    kernel.entry_point = "main";
+    kernel.layout = layout;
+    kernel.candidates = {{max_invocations * 2, 1, 1}, {32, 1, 1}, {64, 1, 1}, {8, 8, 1}};
+    kernel.dispatch = [](VkCommandBuffer command_buffer, const WorkgroupSize&)
+    {
+        vkCmdDispatch(command_buffer, 64, 1, 1);
+    };
+
+    const std::string database_path = (std::filesystem::temp_directory_path() / "workgroup_test.db").string();
+    remove(database_path.c_str());
+
+    bool passed = true;
+    {
+        WorkgroupTuner tuner(device, database_path);
+
+        ComputeKernel unusable = kernel;
+        unusable.name = "unusable";
+        unusable.candidates = {{max_invocations * 2, 1, 1}};
+        bool thrown = false;
+        try
+        {
+            tuner.register_kernel(unusable);
+        }
+        catch(std::invalid_argument&)
+        {
+            thrown = true;
+        }
+        passed &= check(thrown, "kernel without a usable size refused");
+
+        tuner.register_kernel(kernel);
+        WorkgroupSize untuned = tuner.get_workgroup_size("tuner_test");
+        passed &= check(!tuner.is_tuned("tuner_test") && untuned.x == 32,
+            "first usable candidate while untuned");
+
+        if( tuner.tune() == 0 )
+        {
+            vkDestroyPipelineLayout(device.get_device(), layout, device.get_allocation_callbacks());
+            return skip("no timestamps on the queue") && passed;
+        }
+
+        WorkgroupSize size = tuner.get_workgroup_size("tuner_test");
+        double ms = tuner.get_time("tuner_test");
+        passed &= check(tuner.is_tuned("tuner_test") && size.x * size.y * size.z <= max_invocations,
+            "tuned to a size within the limits");
+        passed &= check(ms >= 0.0 && ms < 1000.0, "time of the tuned size measured");
+
+        VkPipeline pipeline = tuner.create_pipeline("tuner_test");
+        passed &= check(pipeline != VK_NULL_HANDLE, "pipeline of the tuned size created");
+        vkDestroyPipeline(device.get_device(), pipeline, device.get_allocation_callbacks());
+    }
+
+    {
+        WorkgroupTuner reloaded(device, database_path);
+        reloaded.register_kernel(kernel);
+        passed &= check(reloaded.is_tuned("tuner_test") && reloaded.tune() == 0, "tuned size loaded from the database");
+
+        ComputeKernel changed = kernel;
+        changed.code = changed_code;
+        reloaded.register_kernel(changed);
+        passed &= check(!reloaded.is_tuned("tuner_test") && reloaded.tune() == 1, "changed kernel tuned again");
+    }
+
+    remove(database_path.c_str());
+    vkDestroyPipelineLayout(device.get_device(), layout, device.get_allocation_callbacks());
+    return passed;
+}
 
 int main(int argc, char** args)
 {
+    bool passed = true;
+    passed &= test_memory_governor_under_pressure();
+    passed &= test_pool_statistics_aggregation();
+    passed &= test_host_allocator();
+    passed &= test_query_results();
+    passed &= test_jank_detection();
+    passed &= test_barrier_merging();
+    passed &= test_split_barrier_placement();
+    passed &= test_breadcrumb_decoding();
+    passed &= test_pass_recordings();
+    passed &= test_present_pacing();
+    passed &= test_resolution_controller();
+    passed &= test_shader_cache();
+    passed &= test_spirv_reflection();
+
     try
     {
         SDL_Window* window = get_vulkan_sdk_window();
@@ -158,9 +2930,38 @@ int main(int argc, char** args)
         std::vector<ExtensionInfo> device_extension_infos =
             filter_by_name<ExtensionInfo>(extension_infos, {VK_KHR_SWAPCHAIN_EXTENSION_NAME});
 
-        physical_device.create_logical_device(
+        LogicalDevice device = physical_device.create_logical_device(
             CreateLogicalDeviceParameters(layer_infos, device_extension_infos));
 
+        benchmark_uploads(device);
+        passed &= test_texture_streaming(device);
+        benchmark_recycling(device);
+        passed &= test_submission_thread(device);
+        passed &= test_late_latch_latency(device, window);
+        benchmark_dynamic_state(device);
+        passed &= test_pipeline_library(device);
+        passed &= test_layout_resolve(device);
+        passed &= test_shader_variants(device);
+        passed &= test_compute_primitives(device);
+        benchmark_compute_primitives(device);
+        passed &= test_workgroup_tuner(device);
+
+        SubmitStatistics submit_statistics = device.get_submit_queue().get_statistics();
+        printf("Queue submits: %llu carrying %llu command buffers\n",
+            static_cast<unsigned long long>(submit_statistics.submits),
+            static_cast<unsigned long long>(submit_statistics.command_buffers));
+
+        const char* scope_names[] = {"command", "object", "cache", "device", "instance"};
+        printf("Driver host allocations:\n");
+        for( int scope = VK_SYSTEM_ALLOCATION_SCOPE_COMMAND; scope <= VK_SYSTEM_ALLOCATION_SCOPE_INSTANCE; ++scope )
+        {
+            HostAllocationStatistics statistics =
+                instance.get_host_allocator().get_statistics(static_cast<VkSystemAllocationScope>(scope));
+            printf(" - %s: %llu allocations, %llu bytes peak\n", scope_names[scope],
+                static_cast<unsigned long long>(statistics.allocations),
+                static_cast<unsigned long long>(statistics.bytes_peak));
+        }
+
         Surface surface = instance.create_surface(window);
 
         printf( "Is surface supported: %d\n", physical_device.is_surface_supported(surface) );
@@ -168,17 +2969,20 @@ int main(int argc, char** args)
     catch(VulkanException& e)
     {
         printf("Vulkan exception with error code: %d (%s) message: %s\n", e.code(), e.enum_name().c_str(), e.what());
+        passed = false;
     }
     catch(std::runtime_error& e)
     {
         printf("Runtime error: %s\n", e.what());
+        passed = false;
     }
     catch(...)
     {
         printf( "Had to have been thrown\n" );
+        passed = false;
     }
 
     SDL_Quit();
-    return 0;
+    return passed ? 0 : 1;
 }
 
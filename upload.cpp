@@ -0,0 +1,327 @@
+#include "upload.h"
+#include "queue.h"
+
+#include <algorithm>
+#include <string.h>
+
+namespace vulkan
+{
+
+Uploader::Uploader(LogicalDevice& device)
+    : device(device)
+    , mode(device.has_unified_memory() ? UploadMode::DIRECT : UploadMode::STAGING)
+    , recording(false)
+{
+    VkResult result;
+
+    VkCommandPoolCreateInfo pool_info;
+    pool_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    pool_info.pNext = nullptr;
+    pool_info.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT | VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+    pool_info.queueFamilyIndex = device.get_queue_family_index();
+
+    result = vkCreateCommandPool(device.get_device(), &pool_info, device.get_allocation_callbacks(), &command_pool);
+    if( result != VK_SUCCESS )
+    {
+        throw VulkanException(result, "Error while creating upload command pool");
+    }
+
+    VkCommandBufferAllocateInfo allocate_info;
+    allocate_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    allocate_info.pNext = nullptr;
+    allocate_info.commandPool = command_pool;
+    allocate_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    allocate_info.commandBufferCount = 1;
+
+    result = vkAllocateCommandBuffers(device.get_device(), &allocate_info, &command_buffer);
+    if( result != VK_SUCCESS )
+    {
+        throw VulkanException(result, "Error while allocating upload command buffer");
+    }
+
+    VkFenceCreateInfo fence_info;
+    fence_info.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+    fence_info.pNext = nullptr;
+    fence_info.flags = 0;
+
+    result = vkCreateFence(device.get_device(), &fence_info, device.get_allocation_callbacks(), &fence);
+    if( result != VK_SUCCESS )
+    {
+        throw VulkanException(result, "Error while creating upload fence");
+    }
+}
+
+Uploader::~Uploader()
+{
+    flush();
+    vkDestroyFence(device.get_device(), fence, device.get_allocation_callbacks());
+    vkDestroyCommandPool(device.get_device(), command_pool, device.get_allocation_callbacks());
+}
+
+UploadMode Uploader::get_mode() const
+{
+    return mode;
+}
+
+void Uploader::set_mode(UploadMode mode)
+{
+    this->mode = mode;
+}
+
+std::unique_ptr<Buffer> Uploader::create_buffer(
+    VkDeviceSize size,
+    VkBufferUsageFlags usage,
+    AllocationPriority priority)
+{
+    VkMemoryPropertyFlags properties = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+    if( mode == UploadMode::DIRECT )
+    {
+        properties |= VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
+    }
+
+    return device.create_buffer(size, usage | VK_BUFFER_USAGE_TRANSFER_DST_BIT, properties, priority);
+}
+
+std::unique_ptr<Image> Uploader::create_image(
+    VkFormat format,
+    VkExtent3D extent,
+    uint32_t mip_levels,
+    uint32_t array_layers,
+    VkImageUsageFlags usage,
+    AllocationPriority priority)
+{
+    usage |= VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+
+    // Host copies need the usage bit, which not every format supports.
+    if( mode == UploadMode::DIRECT && device.get_enabled_features().host_image_copy )
+    {
+        VkImageFormatProperties format_properties;
+        VkResult result = vkGetPhysicalDeviceImageFormatProperties(
+            device.get_physical_device(), format,
+            extent.depth > 1 ? VK_IMAGE_TYPE_3D : VK_IMAGE_TYPE_2D,
+            VK_IMAGE_TILING_OPTIMAL, usage | VK_IMAGE_USAGE_HOST_TRANSFER_BIT_EXT, 0,
+            &format_properties);
+
+        if( result == VK_SUCCESS )
+        {
+            usage |= VK_IMAGE_USAGE_HOST_TRANSFER_BIT_EXT;
+        }
+    }
+
+    return device.create_image(
+        format, extent, mip_levels, array_layers, usage,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, priority);
+}
+
+bool Uploader::is_host_visible(MemoryAllocation* allocation) const
+{
+    const VkPhysicalDeviceMemoryProperties& memory_properties = device.get_memory_properties();
+    return memory_properties.memoryTypes[allocation->get_memory_type_index()].propertyFlags
+        & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
+}
+
+VkCommandBuffer Uploader::get_command_buffer()
+{
+    if( !recording )
+    {
+        VkCommandBufferBeginInfo begin_info;
+        begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        begin_info.pNext = nullptr;
+        begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+        begin_info.pInheritanceInfo = nullptr;
+
+        VkResult result = vkBeginCommandBuffer(command_buffer, &begin_info);
+        if( result != VK_SUCCESS )
+        {
+            throw VulkanException(result, "Error while beginning upload command buffer");
+        }
+        recording = true;
+    }
+
+    return command_buffer;
+}
+
+Buffer& Uploader::create_staging_buffer(const void* data, VkDeviceSize size)
+{
+    std::unique_ptr<Buffer> staging = device.create_buffer(
+        size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+
+    memcpy(device.map(staging->get_allocation()), data, size);
+
+    staging_buffers.push_back(std::move(staging));
+    return *staging_buffers.back();
+}
+
+void Uploader::upload(Buffer& buffer, VkDeviceSize offset, const void* data, VkDeviceSize size)
+{
+    if( mode == UploadMode::DIRECT && is_host_visible(buffer.get_allocation()) )
+    {
+        char* mapped = static_cast<char*>(device.map(buffer.get_allocation()));
+        memcpy(mapped + offset, data, size);
+        device.flush(buffer.get_allocation());
+        return;
+    }
+
+    Buffer& staging = create_staging_buffer(data, size);
+
+    VkBufferCopy region;
+    region.srcOffset = 0;
+    region.dstOffset = offset;
+    region.size = size;
+    vkCmdCopyBuffer(get_command_buffer(), staging.get_buffer(), buffer.get_buffer(), 1, &region);
+}
+
+void Uploader::upload(Image& image, uint32_t mip_level, const void* data, VkDeviceSize size)
+{
+    VkExtent3D extent = image.get_extent();
+    extent.width = std::max(1u, extent.width >> mip_level);
+    extent.height = std::max(1u, extent.height >> mip_level);
+    extent.depth = std::max(1u, extent.depth >> mip_level);
+
+    VkImageSubresourceRange range = image.get_full_range();
+    range.baseMipLevel = mip_level;
+    range.levelCount = 1;
+
+    VkImageSubresourceLayers layers;
+    layers.aspectMask = range.aspectMask;
+    layers.mipLevel = mip_level;
+    layers.baseArrayLayer = 0;
+    layers.layerCount = image.get_array_layers();
+
+    if( mode == UploadMode::DIRECT && (image.get_usage() & VK_IMAGE_USAGE_HOST_TRANSFER_BIT_EXT) )
+    {
+        const DeviceFunctions& functions = device.get_functions();
+        VkResult result;
+
+        // GENERAL is always a valid host copy layout.  The previous contents
+        // of the level are overwritten, so its old layout does not matter.
+        VkHostImageLayoutTransitionInfoEXT transition;
+        transition.sType = VK_STRUCTURE_TYPE_HOST_IMAGE_LAYOUT_TRANSITION_INFO_EXT;
+        transition.pNext = nullptr;
+        transition.image = image.get_image();
+        transition.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        transition.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+        transition.subresourceRange = range;
+
+        result = functions.transition_image_layout(device.get_device(), 1, &transition);
+        if( result != VK_SUCCESS )
+        {
+            throw VulkanException(result, "Error while transitioning image layout on the host");
+        }
+
+        VkMemoryToImageCopyEXT region;
+        region.sType = VK_STRUCTURE_TYPE_MEMORY_TO_IMAGE_COPY_EXT;
+        region.pNext = nullptr;
+        region.pHostPointer = data;
+        region.memoryRowLength = 0;
+        region.memoryImageHeight = 0;
+        region.imageSubresource = layers;
+        region.imageOffset = VkOffset3D{0, 0, 0};
+        region.imageExtent = extent;
+
+        VkCopyMemoryToImageInfoEXT copy_info;
+        copy_info.sType = VK_STRUCTURE_TYPE_COPY_MEMORY_TO_IMAGE_INFO_EXT;
+        copy_info.pNext = nullptr;
+        copy_info.flags = 0;
+        copy_info.dstImage = image.get_image();
+        copy_info.dstImageLayout = VK_IMAGE_LAYOUT_GENERAL;
+        copy_info.regionCount = 1;
+        copy_info.pRegions = &region;
+
+        result = functions.copy_memory_to_image(device.get_device(), &copy_info);
+        if( result != VK_SUCCESS )
+        {
+            throw VulkanException(result, "Error while copying memory to image on the host");
+        }
+
+        image.set_state(range, ImageSubresourceState{VK_IMAGE_LAYOUT_GENERAL, 0, 0});
+        return;
+    }
+
+    Buffer& staging = create_staging_buffer(data, size);
+    VkCommandBuffer commands = get_command_buffer();
+
+    VkImageMemoryBarrier barrier;
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.pNext = nullptr;
+    barrier.srcAccessMask = 0;
+    barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = image.get_image();
+    barrier.subresourceRange = range;
+
+    vkCmdPipelineBarrier(commands,
+        VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+        0, nullptr, 0, nullptr, 1, &barrier);
+
+    VkBufferImageCopy region;
+    region.bufferOffset = 0;
+    region.bufferRowLength = 0;
+    region.bufferImageHeight = 0;
+    region.imageSubresource = layers;
+    region.imageOffset = VkOffset3D{0, 0, 0};
+    region.imageExtent = extent;
+
+    vkCmdCopyBufferToImage(commands,
+        staging.get_buffer(), image.get_image(), VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+    vkCmdPipelineBarrier(commands,
+        VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0,
+        0, nullptr, 0, nullptr, 1, &barrier);
+
+    image.set_state(range, ImageSubresourceState{VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, 0, 0});
+}
+
+void Uploader::flush()
+{
+    if( !recording )
+    {
+        return;
+    }
+
+    VkResult result;
+
+    result = vkEndCommandBuffer(command_buffer);
+    recording = false;
+    if( result != VK_SUCCESS )
+    {
+        throw VulkanException(result, "Error while ending upload command buffer");
+    }
+
+    VkSubmitInfo submit_info;
+    submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submit_info.pNext = nullptr;
+    submit_info.waitSemaphoreCount = 0;
+    submit_info.pWaitSemaphores = nullptr;
+    submit_info.pWaitDstStageMask = nullptr;
+    submit_info.commandBufferCount = 1;
+    submit_info.pCommandBuffers = &command_buffer;
+    submit_info.signalSemaphoreCount = 0;
+    submit_info.pSignalSemaphores = nullptr;
+
+    result = device.get_submit_queue().submit(submit_info, fence);
+    if( result != VK_SUCCESS )
+    {
+        throw VulkanException(result, "Error while submitting uploads");
+    }
+
+    result = vkWaitForFences(device.get_device(), 1, &fence, VK_TRUE, UINT64_MAX);
+    if( result != VK_SUCCESS )
+    {
+        throw VulkanException(result, "Error while waiting for uploads");
+    }
+
+    vkResetFences(device.get_device(), 1, &fence);
+    staging_buffers.clear();
+}
+
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include "vulkan.h"
+#include "buffer.h"
+#include "image.h"
+
+#include <memory>
+#include <vector>
+
+namespace vulkan
+{
+
+/*  STAGING copies data through a host-visible buffer and a transfer command.
+    DIRECT writes into the resource from the host: mapped memory for
+    buffers, VK_EXT_host_image_copy for images. */
+enum class UploadMode
+{
+    STAGING,
+    DIRECT,
+};
+
+/*  Gets data from the host into buffers and images.  Picks DIRECT on devices
+    with unified memory (integrated GPUs, lavapipe) where staging is a
+    wasted copy, STAGING otherwise.  Create upload targets through the
+    Uploader so they land in memory the chosen mode can write. */
+class Uploader
+{
+public:
+    explicit Uploader(LogicalDevice& device);
+    ~Uploader();
+
+    UploadMode get_mode() const;
+
+    /*  Overrides the mode chosen for the device, e.g. to compare the two. */
+    void set_mode(UploadMode mode);
+
+    std::unique_ptr<Buffer> create_buffer(
+        VkDeviceSize size,
+        VkBufferUsageFlags usage,
+        AllocationPriority priority = AllocationPriority::NORMAL);
+
+    std::unique_ptr<Image> create_image(
+        VkFormat format,
+        VkExtent3D extent,
+        uint32_t mip_levels,
+        uint32_t array_layers,
+        VkImageUsageFlags usage,
+        AllocationPriority priority = AllocationPriority::NORMAL);
+
+    /*  Writes size bytes at offset into the buffer.  Falls back to staging
+        when the buffer's memory is not host-visible. */
+    void upload(Buffer& buffer, VkDeviceSize offset, const void* data, VkDeviceSize size);
+
+    /*  Writes tightly packed texels for one mip level of every layer.  The
+        image ends up in SHADER_READ_ONLY_OPTIMAL when staged, or GENERAL when
+        copied from the host. */
+    void upload(Image& image, uint32_t mip_level, const void* data, VkDeviceSize size);
+
+    /*  Submits the staged copies recorded so far and waits for them.  Direct
+        writes need no flush. */
+    void flush();
+
+private:
+    VkCommandBuffer get_command_buffer();
+    Buffer& create_staging_buffer(const void* data, VkDeviceSize size);
+    bool is_host_visible(MemoryAllocation* allocation) const;
+
+    LogicalDevice& device;
+    UploadMode mode;
+    VkCommandPool command_pool;
+    VkCommandBuffer command_buffer;
+    VkFence fence;
+    bool recording;
+    std::vector<std::unique_ptr<Buffer>> staging_buffers;
+};
+
+}
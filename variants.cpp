@@ -0,0 +1,223 @@
+#include "variants.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <stdexcept>
+#include <thread>
+
+namespace vulkan
+{
+
+ShaderVariantManager::ShaderVariantManager(
+    LogicalDevice& device,
+    const std::vector<uint32_t>& code,
+    const std::vector<SpecializationConstant>& constants,
+    const PipelineFactory& factory
+)
+    : device(device)
+    , constants(constants)
+    , factory(factory)
+    , module(VK_NULL_HANDLE)
+    , pipeline_cache(VK_NULL_HANDLE)
+    , statistics()
+{
+    for( uint32_t i = 0; i < constants.size(); ++i )
+    {
+        VkSpecializationMapEntry entry;
+        entry.constantID = constants[i].constant_id;
+        entry.offset = i * sizeof(uint32_t);
+        entry.size = sizeof(uint32_t);
+        map_entries.push_back(entry);
+    }
+
+    VkShaderModuleCreateInfo module_info;
+    module_info.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+    module_info.pNext = nullptr;
+    module_info.flags = 0;
+    module_info.codeSize = code.size() * sizeof(uint32_t);
+    module_info.pCode = code.data();
+
+    VkResult result = vkCreateShaderModule(device.get_device(), &module_info, device.get_allocation_callbacks(), &module);
+    if( result != VK_SUCCESS )
+    {
+        throw VulkanException(result, "Error while creating variant shader module");
+    }
+
+    VkPipelineCacheCreateInfo cache_info;
+    cache_info.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+    cache_info.pNext = nullptr;
+    cache_info.flags = 0;
+    cache_info.initialDataSize = 0;
+    cache_info.pInitialData = nullptr;
+
+    result = vkCreatePipelineCache(device.get_device(), &cache_info, device.get_allocation_callbacks(), &pipeline_cache);
+    if( result != VK_SUCCESS )
+    {
+        vkDestroyShaderModule(device.get_device(), module, device.get_allocation_callbacks());
+        throw VulkanException(result, "Error while creating variant pipeline cache");
+    }
+}
+
+ShaderVariantManager::~ShaderVariantManager()
+{
+    for( auto& entry : pipelines )
+    {
+        // Failed variants were removed, so every entry left holds a pipeline.
+        vkDestroyPipeline(device.get_device(), entry.second.get(), device.get_allocation_callbacks());
+    }
+    vkDestroyPipelineCache(device.get_device(), pipeline_cache, device.get_allocation_callbacks());
+    vkDestroyShaderModule(device.get_device(), module, device.get_allocation_callbacks());
+}
+
+std::vector<uint32_t> ShaderVariantManager::make_variant(const std::map<std::string, uint32_t>& values) const
+{
+    std::vector<uint32_t> variant;
+    size_t used = 0;
+    for( const SpecializationConstant& constant : constants )
+    {
+        auto found = values.find(constant.name);
+        if( found != values.end() )
+        {
+            variant.push_back(found->second);
+            used++;
+        }
+        else
+        {
+            variant.push_back(constant.default_value);
+        }
+    }
+
+    if( used != values.size() )
+    {
+        throw std::invalid_argument("Variant sets a specialization constant the shader does not declare");
+    }
+    return variant;
+}
+
+VkPipeline ShaderVariantManager::get(const std::vector<uint32_t>& variant)
+{
+    if( variant.size() != constants.size() )
+    {
+        throw std::invalid_argument("Variant does not have a value for every specialization constant");
+    }
+
+    std::promise<VkPipeline> promise;
+    std::unique_lock<std::mutex> lock(mutex);
+    auto found = pipelines.find(variant);
+    if( found != pipelines.end() )
+    {
+        // Waits outside the lock if another thread is still creating it.
+        statistics.hits++;
+        std::shared_future<VkPipeline> pipeline = found->second;
+        lock.unlock();
+        return pipeline.get();
+    }
+    statistics.misses++;
+    pipelines[variant] = promise.get_future().share();
+    lock.unlock();
+
+    try
+    {
+        VkPipeline pipeline = create(variant);
+        promise.set_value(pipeline);
+        return pipeline;
+    }
+    catch( ... )
+    {
+        // Forgotten, so that a later request tries again.
+        lock.lock();
+        pipelines.erase(variant);
+        lock.unlock();
+        promise.set_exception(std::current_exception());
+        throw;
+    }
+}
+
+void ShaderVariantManager::precompile(const std::vector<std::vector<uint32_t>>& variants, uint32_t thread_count)
+{
+    if( thread_count == 0 )
+    {
+        thread_count = std::max(std::thread::hardware_concurrency(), 1u);
+    }
+    thread_count = std::min(thread_count, static_cast<uint32_t>(variants.size()));
+
+    std::atomic<size_t> next(0);
+    std::mutex error_mutex;
+    std::exception_ptr error;
+
+    auto work = [&]()
+    {
+        for( size_t i = next++; i < variants.size(); i = next++ )
+        {
+            try
+            {
+                get(variants[i]);
+            }
+            catch( ... )
+            {
+                std::lock_guard<std::mutex> lock(error_mutex);
+                if( !error )
+                {
+                    error = std::current_exception();
+                }
+            }
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for( uint32_t i = 0; i < thread_count; ++i )
+    {
+        threads.emplace_back(work);
+    }
+    for( std::thread& thread : threads )
+    {
+        thread.join();
+    }
+
+    if( error )
+    {
+        std::rethrow_exception(error);
+    }
+}
+
+VkShaderModule ShaderVariantManager::get_module() const
+{
+    return module;
+}
+
+VkPipelineCache ShaderVariantManager::get_pipeline_cache() const
+{
+    return pipeline_cache;
+}
+
+VariantStatistics ShaderVariantManager::get_statistics() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return statistics;
+}
+
+VkPipeline ShaderVariantManager::create(const std::vector<uint32_t>& variant)
+{
+    VkSpecializationInfo specialization;
+    specialization.mapEntryCount = static_cast<uint32_t>(map_entries.size());
+    specialization.pMapEntries = map_entries.data();
+    specialization.dataSize = variant.size() * sizeof(uint32_t);
+    specialization.pData = variant.data();
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    VkPipeline pipeline = factory(module, specialization, pipeline_cache);
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    if( pipeline == VK_NULL_HANDLE )
+    {
+        throw std::runtime_error("Pipeline factory did not create a variant");
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    statistics.pipelines++;
+    statistics.compile_ms += ms;
+    return pipeline;
+}
+
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include "vulkan.h"
+
+#include <functional>
+#include <future>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace vulkan
+{
+
+/*  A 32-bit specialization constant of the module, which covers bool
+    (as VkBool32), int, uint and float. */
+struct SpecializationConstant
+{
+    std::string name;
+    uint32_t constant_id;
+    uint32_t default_value;
+};
+
+struct VariantStatistics
+{
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t pipelines;
+    double compile_ms;
+};
+
+/*  Feature permutations of one SPIR-V module, expressed as specialization
+    constants instead of separately compiled shaders.  A variant is the
+    tuple of values of all declared constants, in declaration order, and
+    each distinct tuple gets one pipeline, created on first use by the
+    factory and kept until the manager is destroyed.
+
+    The factory creates the pipeline from the module, setting the given
+    specialization info on every stage that uses the constants, through the
+    given pipeline cache.  It is called from several threads at once by
+    precompile(), and from any thread calling get(), which is thread safe;
+    concurrent requests for the same variant create it once. */
+class ShaderVariantManager
+{
+public:
+    using PipelineFactory = std::function<VkPipeline(
+        VkShaderModule module,
+        const VkSpecializationInfo& specialization,
+        VkPipelineCache pipeline_cache)>;
+
+    ShaderVariantManager(
+        LogicalDevice& device,
+        const std::vector<uint32_t>& code,
+        const std::vector<SpecializationConstant>& constants,
+        const PipelineFactory& factory);
+    ~ShaderVariantManager();
+
+    ShaderVariantManager(const ShaderVariantManager&) = delete;
+    ShaderVariantManager& operator=(const ShaderVariantManager&) = delete;
+
+    /*  The defaults with the named constants overridden. */
+    std::vector<uint32_t> make_variant(const std::map<std::string, uint32_t>& values) const;
+
+    VkPipeline get(const std::vector<uint32_t>& variant);
+
+    /*  Creates the variants not created yet on up to thread_count threads,
+        by default one per core, and returns when all are done. */
+    void precompile(const std::vector<std::vector<uint32_t>>& variants, uint32_t thread_count = 0);
+
+    VkShaderModule get_module() const;
+    VkPipelineCache get_pipeline_cache() const;
+    VariantStatistics get_statistics() const;
+
+private:
+    VkPipeline create(const std::vector<uint32_t>& variant);
+
+    LogicalDevice& device;
+    std::vector<SpecializationConstant> constants;
+    std::vector<VkSpecializationMapEntry> map_entries;
+    PipelineFactory factory;
+
+    VkShaderModule module;
+    VkPipelineCache pipeline_cache;
+
+    mutable std::mutex mutex;
+    std::map<std::vector<uint32_t>, std::shared_future<VkPipeline>> pipelines;
+    VariantStatistics statistics;
+};
+
+}
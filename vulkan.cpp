@@ -1,4 +1,10 @@
 #include "vulkan.h"
+#include "pool.h"
+#include "buffer.h"
+#include "image.h"
+#include "queue.h"
+#include "recycling.h"
+#include "reflection.h"
 
 #include <algorithm>
 #include "stdlib.h"
@@ -31,13 +37,20 @@ std::string VulkanException::enum_name() const
 
 PhysicalDevice::PhysicalDevice(
     VkPhysicalDevice physical_device,
-    uint32_t queue_family_index
+    uint32_t queue_family_index,
+    const std::shared_ptr<HostAllocator>& host_allocator
 )
 : physical_device(physical_device)
 , queue_family_index(queue_family_index)
+, host_allocator(host_allocator)
 {
 }
 
+std::vector<ExtensionInfo> IRequestLayerAndExtensions::get_optional_extensions() const
+{
+    return std::vector<ExtensionInfo>();
+}
+
 bool PhysicalDevice::is_surface_supported(const Surface& surface)
 {
     // Make sure the surface is compatible with the queue family and gpu
@@ -176,6 +189,7 @@ struct NamesArray
 };
 
 Instance::Instance(const ICreateInstanceParameters& parameters)
+: host_allocator(std::make_shared<HostAllocator>())
 {
     NamesArray<LayerInfo> requested_layer_names(parameters.get_requested_layers());
     NamesArray<ExtensionInfo> requested_extension_names(parameters.get_requested_extensions());
@@ -195,7 +209,7 @@ Instance::Instance(const ICreateInstanceParameters& parameters)
     app_info.pEngineName = engine_name.c_str();
     app_info.engineVersion = engine_version;
 
-    app_info.apiVersion = VK_API_VERSION_1_0;
+    app_info.apiVersion = VK_API_VERSION_1_1;
 
     VkInstanceCreateInfo create_info;
     create_info.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
@@ -209,7 +223,7 @@ Instance::Instance(const ICreateInstanceParameters& parameters)
     create_info.enabledLayerCount = requested_layer_names.count;
     create_info.ppEnabledLayerNames = requested_layer_names.c_strings;
 
-    VkResult result = vkCreateInstance(&create_info, nullptr, &instance);
+    VkResult result = vkCreateInstance(&create_info, host_allocator->get_callbacks(), &instance);
     if( result != VK_SUCCESS )
     {
         throw VulkanException(result, "Error while creating vulkan instance");
@@ -218,6 +232,14 @@ Instance::Instance(const ICreateInstanceParameters& parameters)
 
 Instance::~Instance()
 {
+    // The callbacks belong to host_allocator, which is destroyed after this
+    // body runs.
+    vkDestroyInstance(instance, host_allocator->get_callbacks());
+}
+
+HostAllocator& Instance::get_host_allocator()
+{
+    return *host_allocator;
 }
 
 PhysicalDevice Instance::select_gpu()
@@ -250,13 +272,720 @@ PhysicalDevice Instance::select_gpu()
     int index = 0;
     VkPhysicalDevice selected = physicalDevices[index];
     delete[] physicalDevices;
-    return PhysicalDevice(selected, index);
+    return PhysicalDevice(selected, index, host_allocator);
+}
+
+LogicalDevice::LogicalDevice(
+    VkDevice device,
+    VkPhysicalDevice physical_device,
+    uint32_t queue_family_index,
+    const std::set<std::string>& enabled_extensions,
+    const DeviceFeatures& enabled_features,
+    const std::shared_ptr<HostAllocator>& host_allocator
+)
+: device(device)
+, physical_device(physical_device)
+, queue_family_index(queue_family_index)
+, enabled_extensions(enabled_extensions)
+, enabled_features(enabled_features)
+, functions()
+, host_allocator(host_allocator)
+{
+    vkGetDeviceQueue(device, queue_family_index, 0, &queue);
+    submit_queue.reset(new Queue(queue, queue_family_index));
+    fence_pool.reset(new FencePool(*this));
+    semaphore_pool.reset(new SemaphorePool(*this));
+    event_pool.reset(new EventPool(*this));
+    layout_cache.reset(new LayoutCache(*this));
+
+    if( enabled_features.buffer_device_address )
+    {
+        functions.get_buffer_device_address = reinterpret_cast<PFN_vkGetBufferDeviceAddressKHR>(
+            vkGetDeviceProcAddr(device, "vkGetBufferDeviceAddressKHR"));
+    }
+
+    if( enabled_features.host_image_copy )
+    {
+        functions.copy_memory_to_image = reinterpret_cast<PFN_vkCopyMemoryToImageEXT>(
+            vkGetDeviceProcAddr(device, "vkCopyMemoryToImageEXT"));
+        functions.transition_image_layout = reinterpret_cast<PFN_vkTransitionImageLayoutEXT>(
+            vkGetDeviceProcAddr(device, "vkTransitionImageLayoutEXT"));
+    }
+
+    if( enabled_features.synchronization2 )
+    {
+        functions.cmd_pipeline_barrier2 = reinterpret_cast<PFN_vkCmdPipelineBarrier2KHR>(
+            vkGetDeviceProcAddr(device, "vkCmdPipelineBarrier2KHR"));
+        functions.cmd_set_event2 = reinterpret_cast<PFN_vkCmdSetEvent2KHR>(
+            vkGetDeviceProcAddr(device, "vkCmdSetEvent2KHR"));
+        functions.cmd_wait_events2 = reinterpret_cast<PFN_vkCmdWaitEvents2KHR>(
+            vkGetDeviceProcAddr(device, "vkCmdWaitEvents2KHR"));
+    }
+
+    if( enabled_features.buffer_marker )
+    {
+        functions.cmd_write_buffer_marker = reinterpret_cast<PFN_vkCmdWriteBufferMarkerAMD>(
+            vkGetDeviceProcAddr(device, "vkCmdWriteBufferMarkerAMD"));
+    }
+
+    if( enabled_features.device_fault )
+    {
+        functions.get_device_fault_info = reinterpret_cast<PFN_vkGetDeviceFaultInfoEXT>(
+            vkGetDeviceProcAddr(device, "vkGetDeviceFaultInfoEXT"));
+    }
+
+    if( enabled_features.present_wait )
+    {
+        functions.wait_for_present = reinterpret_cast<PFN_vkWaitForPresentKHR>(
+            vkGetDeviceProcAddr(device, "vkWaitForPresentKHR"));
+    }
+
+    if( enabled_features.extended_dynamic_state )
+    {
+        functions.cmd_set_cull_mode = reinterpret_cast<PFN_vkCmdSetCullModeEXT>(
+            vkGetDeviceProcAddr(device, "vkCmdSetCullModeEXT"));
+        functions.cmd_set_front_face = reinterpret_cast<PFN_vkCmdSetFrontFaceEXT>(
+            vkGetDeviceProcAddr(device, "vkCmdSetFrontFaceEXT"));
+        functions.cmd_set_primitive_topology = reinterpret_cast<PFN_vkCmdSetPrimitiveTopologyEXT>(
+            vkGetDeviceProcAddr(device, "vkCmdSetPrimitiveTopologyEXT"));
+        functions.cmd_set_depth_test_enable = reinterpret_cast<PFN_vkCmdSetDepthTestEnableEXT>(
+            vkGetDeviceProcAddr(device, "vkCmdSetDepthTestEnableEXT"));
+        functions.cmd_set_depth_write_enable = reinterpret_cast<PFN_vkCmdSetDepthWriteEnableEXT>(
+            vkGetDeviceProcAddr(device, "vkCmdSetDepthWriteEnableEXT"));
+        functions.cmd_set_depth_compare_op = reinterpret_cast<PFN_vkCmdSetDepthCompareOpEXT>(
+            vkGetDeviceProcAddr(device, "vkCmdSetDepthCompareOpEXT"));
+    }
+
+    if( enabled_features.extended_dynamic_state2 )
+    {
+        functions.cmd_set_primitive_restart_enable = reinterpret_cast<PFN_vkCmdSetPrimitiveRestartEnableEXT>(
+            vkGetDeviceProcAddr(device, "vkCmdSetPrimitiveRestartEnableEXT"));
+    }
+
+    if( enabled_features.extended_dynamic_state3 )
+    {
+        functions.cmd_set_color_blend_enable = reinterpret_cast<PFN_vkCmdSetColorBlendEnableEXT>(
+            vkGetDeviceProcAddr(device, "vkCmdSetColorBlendEnableEXT"));
+        functions.cmd_set_color_blend_equation = reinterpret_cast<PFN_vkCmdSetColorBlendEquationEXT>(
+            vkGetDeviceProcAddr(device, "vkCmdSetColorBlendEquationEXT"));
+        functions.cmd_set_color_write_mask = reinterpret_cast<PFN_vkCmdSetColorWriteMaskEXT>(
+            vkGetDeviceProcAddr(device, "vkCmdSetColorWriteMaskEXT"));
+    }
+
+    if( enabled_features.vertex_input_dynamic_state )
+    {
+        functions.cmd_set_vertex_input = reinterpret_cast<PFN_vkCmdSetVertexInputEXT>(
+            vkGetDeviceProcAddr(device, "vkCmdSetVertexInputEXT"));
+    }
+
+    vkGetPhysicalDeviceProperties(physical_device, &properties);
+    vkGetPhysicalDeviceMemoryProperties(physical_device, &memory_properties);
+
+    // vkGetPhysicalDeviceMemoryProperties2 is core in 1.1, the budget
+    // extension can only be queried through it.
+    bool memory_budget_enabled =
+        is_extension_enabled(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME)
+        && properties.apiVersion >= VK_API_VERSION_1_1;
+
+    memory_governor.reset(new MemoryGovernor(std::unique_ptr<IHeapBudgetSource>(
+        new DeviceHeapBudgetSource(physical_device, memory_budget_enabled))));
+}
+
+LogicalDevice::~LogicalDevice()
+{
+    vkDeviceWaitIdle(device);
+
+    layout_cache.reset();
+    event_pool.reset();
+    semaphore_pool.reset();
+    fence_pool.reset();
+    memory_pools.clear();
+
+    // Every object created on the device has been released above.  The
+    // device goes with the same callbacks it was created with, before
+    // host_allocator is destroyed.
+    vkDestroyDevice(device, get_allocation_callbacks());
+}
+
+VkDevice LogicalDevice::get_device() const
+{
+    return device;
+}
+
+VkPhysicalDevice LogicalDevice::get_physical_device() const
+{
+    return physical_device;
+}
+
+uint32_t LogicalDevice::get_queue_family_index() const
+{
+    return queue_family_index;
+}
+
+VkQueue LogicalDevice::get_queue() const
+{
+    return queue;
+}
+
+const VkAllocationCallbacks* LogicalDevice::get_allocation_callbacks() const
+{
+    return host_allocator->get_callbacks();
+}
+
+HostAllocator& LogicalDevice::get_host_allocator()
+{
+    return *host_allocator;
+}
+
+Queue& LogicalDevice::get_submit_queue()
+{
+    return *submit_queue;
+}
+
+FencePool& LogicalDevice::get_fence_pool()
+{
+    return *fence_pool;
+}
+
+SemaphorePool& LogicalDevice::get_semaphore_pool()
+{
+    return *semaphore_pool;
+}
+
+EventPool& LogicalDevice::get_event_pool()
+{
+    return *event_pool;
+}
+
+LayoutCache& LogicalDevice::get_layout_cache()
+{
+    return *layout_cache;
+}
+
+const VkPhysicalDeviceProperties& LogicalDevice::get_properties() const
+{
+    return properties;
+}
+
+const VkPhysicalDeviceMemoryProperties& LogicalDevice::get_memory_properties() const
+{
+    return memory_properties;
+}
+
+/*  Memory is unified when some host-visible device-local type lives on a heap
+    as big as the biggest device-local heap.  That rules out the 256MB BAR
+    window of discrete cards, which is too small to put resources in. */
+static bool is_unified_memory(const VkPhysicalDeviceMemoryProperties& memory_properties)
+{
+    VkDeviceSize largest_device_heap = 0;
+    for( uint32_t i = 0; i < memory_properties.memoryHeapCount; ++i )
+    {
+        if( memory_properties.memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT )
+        {
+            largest_device_heap = std::max(largest_device_heap, memory_properties.memoryHeaps[i].size);
+        }
+    }
+
+    VkMemoryPropertyFlags wanted =
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
+
+    for( uint32_t i = 0; i < memory_properties.memoryTypeCount; ++i )
+    {
+        const VkMemoryType& type = memory_properties.memoryTypes[i];
+        if( (type.propertyFlags & wanted) == wanted
+            && memory_properties.memoryHeaps[type.heapIndex].size >= largest_device_heap )
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool LogicalDevice::has_unified_memory() const
+{
+    return is_unified_memory(memory_properties);
+}
+
+bool PhysicalDevice::has_unified_memory()
+{
+    VkPhysicalDeviceMemoryProperties memory_properties;
+    vkGetPhysicalDeviceMemoryProperties(physical_device, &memory_properties);
+    return is_unified_memory(memory_properties);
+}
+
+bool LogicalDevice::is_extension_enabled(const std::string& name) const
+{
+    return enabled_extensions.find(name) != enabled_extensions.end();
+}
+
+const DeviceFeatures& LogicalDevice::get_enabled_features() const
+{
+    return enabled_features;
+}
+
+const DeviceFunctions& LogicalDevice::get_functions() const
+{
+    return functions;
+}
+
+uint32_t LogicalDevice::find_memory_type(
+    uint32_t memory_type_bits,
+    VkMemoryPropertyFlags properties) const
+{
+    for( uint32_t i = 0; i < memory_properties.memoryTypeCount; ++i )
+    {
+        if( (memory_type_bits & (1u << i))
+            && (memory_properties.memoryTypes[i].propertyFlags & properties) == properties )
+        {
+            return i;
+        }
+    }
+
+    throw std::runtime_error("No memory type with the requested properties");
+}
+
+DeviceMemory LogicalDevice::allocate_memory(
+    VkDeviceSize size,
+    uint32_t memory_type_index,
+    AllocationPriority priority)
+{
+    uint32_t heap_index = memory_properties.memoryTypes[memory_type_index].heapIndex;
+
+    DeviceMemory result;
+    result.memory = VK_NULL_HANDLE;
+    result.size = size;
+    result.memory_type_index = memory_type_index;
+
+    Admission admission = memory_governor->admit(heap_index, size, priority);
+    if( admission == Admission::DEFERRED )
+    {
+        return result;
+    }
+
+    if( admission == Admission::DENIED )
+    {
+        throw VulkanException(VK_ERROR_OUT_OF_DEVICE_MEMORY,
+            "Memory governor denied allocation over heap budget");
+    }
+
+    // Pool blocks can end up backing any buffer, so with device addresses
+    // enabled every allocation has to allow them.
+    VkMemoryAllocateFlagsInfo flags_info;
+    flags_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_FLAGS_INFO;
+    flags_info.pNext = nullptr;
+    flags_info.flags = VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT_KHR;
+    flags_info.deviceMask = 0;
+
+    VkMemoryAllocateInfo allocate_info;
+    allocate_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    allocate_info.pNext = enabled_features.buffer_device_address ? &flags_info : nullptr;
+    allocate_info.allocationSize = size;
+    allocate_info.memoryTypeIndex = memory_type_index;
+
+    VkResult vk_result = vkAllocateMemory(device, &allocate_info, host_allocator->get_callbacks(), &result.memory);
+    if( vk_result == VK_ERROR_OUT_OF_DEVICE_MEMORY )
+    {
+        // The budget was off, give the responders a chance and try once more.
+        memory_governor->relieve_pressure(heap_index, size);
+        vk_result = vkAllocateMemory(device, &allocate_info, host_allocator->get_callbacks(), &result.memory);
+    }
+
+    if( vk_result != VK_SUCCESS )
+    {
+        memory_governor->cancel_admission(heap_index, size);
+        throw VulkanException(vk_result, "Error while allocating device memory");
+    }
+
+    memory_governor->on_allocated(heap_index, size);
+    return result;
 }
 
-LogicalDevice::LogicalDevice(VkDevice device, uint32_t queue_family_index)
-    : device(device)
-    , queue_family_index(queue_family_index)
+void LogicalDevice::free_memory(const DeviceMemory& memory)
 {
+    if( memory.memory == VK_NULL_HANDLE )
+    {
+        return;
+    }
+
+    vkFreeMemory(device, memory.memory, host_allocator->get_callbacks());
+    memory_governor->on_freed(
+        memory_properties.memoryTypes[memory.memory_type_index].heapIndex, memory.size);
+}
+
+MemoryGovernor& LogicalDevice::get_memory_governor()
+{
+    return *memory_governor;
+}
+
+MemoryAllocation* LogicalDevice::allocate(
+    const VkMemoryRequirements& requirements,
+    VkMemoryPropertyFlags properties,
+    AllocationPriority priority,
+    IAllocationMoveListener* listener)
+{
+    uint32_t memory_type_index = find_memory_type(requirements.memoryTypeBits, properties);
+
+    MemoryPool* pool;
+    {
+        std::unique_lock<std::mutex> lock(memory_pools_mutex);
+        std::unique_ptr<MemoryPool>& entry = memory_pools[memory_type_index];
+        if( !entry )
+        {
+            // Keep blocks small enough that a few of them fit in small heaps.
+            VkDeviceSize heap_size = memory_properties.memoryHeaps[
+                memory_properties.memoryTypes[memory_type_index].heapIndex].size;
+            VkDeviceSize block_size = std::min<VkDeviceSize>(64 * 1024 * 1024, heap_size / 8);
+            entry.reset(new MemoryPool(*this, memory_type_index, block_size));
+        }
+        pool = entry.get();
+    }
+
+    return pool->allocate(requirements.size, requirements.alignment, priority, listener);
+}
+
+void LogicalDevice::free(MemoryAllocation* allocation)
+{
+    MemoryPool* pool;
+    {
+        std::unique_lock<std::mutex> lock(memory_pools_mutex);
+        pool = memory_pools.at(allocation->get_memory_type_index()).get();
+    }
+
+    pool->free(allocation);
+}
+
+std::unique_ptr<Buffer> LogicalDevice::create_buffer(
+    VkDeviceSize size,
+    VkBufferUsageFlags usage,
+    VkMemoryPropertyFlags properties,
+    AllocationPriority priority)
+{
+    if( (usage & VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT_KHR) && !enabled_features.buffer_device_address )
+    {
+        throw VulkanException(VK_ERROR_FEATURE_NOT_PRESENT,
+            "Buffer device address requested but not enabled on the device");
+    }
+
+    std::unique_ptr<Buffer> buffer(new Buffer(*this, size, usage));
+    if( !buffer->bind(properties, priority) )
+    {
+        return nullptr;
+    }
+    return buffer;
+}
+
+void* LogicalDevice::map(MemoryAllocation* allocation)
+{
+    MemoryPool* pool;
+    {
+        std::unique_lock<std::mutex> lock(memory_pools_mutex);
+        pool = memory_pools.at(allocation->get_memory_type_index()).get();
+    }
+
+    return pool->map(allocation);
+}
+
+void LogicalDevice::flush(MemoryAllocation* allocation)
+{
+    MemoryPool* pool;
+    {
+        std::unique_lock<std::mutex> lock(memory_pools_mutex);
+        pool = memory_pools.at(allocation->get_memory_type_index()).get();
+    }
+
+    pool->flush(allocation);
+}
+
+std::unique_ptr<Image> LogicalDevice::create_image(
+    VkFormat format,
+    VkExtent3D extent,
+    uint32_t mip_levels,
+    uint32_t array_layers,
+    VkImageUsageFlags usage,
+    VkMemoryPropertyFlags properties,
+    AllocationPriority priority)
+{
+    if( (usage & VK_IMAGE_USAGE_HOST_TRANSFER_BIT_EXT) && !enabled_features.host_image_copy )
+    {
+        throw VulkanException(VK_ERROR_FEATURE_NOT_PRESENT,
+            "Host image copy requested but not enabled on the device");
+    }
+
+    std::unique_ptr<Image> image(new Image(*this, format, extent, mip_levels, array_layers, usage));
+    if( !image->bind(properties, priority) )
+    {
+        return nullptr;
+    }
+    return image;
+}
+
+std::vector<MemoryPool*> LogicalDevice::get_memory_pools()
+{
+    std::unique_lock<std::mutex> lock(memory_pools_mutex);
+    std::vector<MemoryPool*> pools;
+    for( std::pair<const uint32_t, std::unique_ptr<MemoryPool>>& entry : memory_pools )
+    {
+        pools.push_back(entry.second.get());
+    }
+    return pools;
+}
+
+/*  The pNext chain of feature structs for the optional features in
+    DeviceFeatures.  Only structs whose extension is in the set get linked,
+    so the same chain serves to query support and to enable. */
+struct FeatureChain
+{
+    VkPhysicalDeviceFeatures2 features;
+    VkPhysicalDeviceBufferDeviceAddressFeaturesKHR buffer_device_address;
+    VkPhysicalDeviceHostImageCopyFeaturesEXT host_image_copy;
+    VkPhysicalDeviceSynchronization2FeaturesKHR synchronization2;
+    VkPhysicalDeviceFaultFeaturesEXT device_fault;
+    VkPhysicalDeviceCoherentMemoryFeaturesAMD device_coherent_memory;
+    VkPhysicalDevicePresentIdFeaturesKHR present_id;
+    VkPhysicalDevicePresentWaitFeaturesKHR present_wait;
+    VkPhysicalDeviceGraphicsPipelineLibraryFeaturesEXT graphics_pipeline_library;
+    VkPhysicalDeviceExtendedDynamicStateFeaturesEXT extended_dynamic_state;
+    VkPhysicalDeviceExtendedDynamicState2FeaturesEXT extended_dynamic_state2;
+    VkPhysicalDeviceExtendedDynamicState3FeaturesEXT extended_dynamic_state3;
+    VkPhysicalDeviceVertexInputDynamicStateFeaturesEXT vertex_input_dynamic_state;
+
+    // VK_AMD_buffer_marker has no feature struct, the extension is enough.
+    bool buffer_marker;
+
+    explicit FeatureChain(const std::set<std::string>& extensions)
+    {
+        features = {};
+        features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+        void** next = &features.pNext;
+
+        buffer_device_address = {};
+        buffer_device_address.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_BUFFER_DEVICE_ADDRESS_FEATURES_KHR;
+        if( extensions.count(VK_KHR_BUFFER_DEVICE_ADDRESS_EXTENSION_NAME) )
+        {
+            *next = &buffer_device_address;
+            next = &buffer_device_address.pNext;
+        }
+
+        host_image_copy = {};
+        host_image_copy.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_HOST_IMAGE_COPY_FEATURES_EXT;
+        if( extensions.count(VK_EXT_HOST_IMAGE_COPY_EXTENSION_NAME) )
+        {
+            *next = &host_image_copy;
+            next = &host_image_copy.pNext;
+        }
+
+        synchronization2 = {};
+        synchronization2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SYNCHRONIZATION_2_FEATURES_KHR;
+        if( extensions.count(VK_KHR_SYNCHRONIZATION_2_EXTENSION_NAME) )
+        {
+            *next = &synchronization2;
+            next = &synchronization2.pNext;
+        }
+
+        device_fault = {};
+        device_fault.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FAULT_FEATURES_EXT;
+        if( extensions.count(VK_EXT_DEVICE_FAULT_EXTENSION_NAME) )
+        {
+            *next = &device_fault;
+            next = &device_fault.pNext;
+        }
+
+        device_coherent_memory = {};
+        device_coherent_memory.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_COHERENT_MEMORY_FEATURES_AMD;
+        if( extensions.count(VK_AMD_DEVICE_COHERENT_MEMORY_EXTENSION_NAME) )
+        {
+            *next = &device_coherent_memory;
+            next = &device_coherent_memory.pNext;
+        }
+
+        present_id = {};
+        present_id.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_ID_FEATURES_KHR;
+        if( extensions.count(VK_KHR_PRESENT_ID_EXTENSION_NAME) )
+        {
+            *next = &present_id;
+            next = &present_id.pNext;
+        }
+
+        present_wait = {};
+        present_wait.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_WAIT_FEATURES_KHR;
+        if( extensions.count(VK_KHR_PRESENT_WAIT_EXTENSION_NAME) )
+        {
+            *next = &present_wait;
+            next = &present_wait.pNext;
+        }
+
+        // Libraries are created through VK_KHR_pipeline_library, which
+        // has to be enabled as well.
+        graphics_pipeline_library = {};
+        graphics_pipeline_library.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_GRAPHICS_PIPELINE_LIBRARY_FEATURES_EXT;
+        if( extensions.count(VK_EXT_GRAPHICS_PIPELINE_LIBRARY_EXTENSION_NAME)
+            && extensions.count(VK_KHR_PIPELINE_LIBRARY_EXTENSION_NAME) )
+        {
+            *next = &graphics_pipeline_library;
+            next = &graphics_pipeline_library.pNext;
+        }
+
+        extended_dynamic_state = {};
+        extended_dynamic_state.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTENDED_DYNAMIC_STATE_FEATURES_EXT;
+        if( extensions.count(VK_EXT_EXTENDED_DYNAMIC_STATE_EXTENSION_NAME) )
+        {
+            *next = &extended_dynamic_state;
+            next = &extended_dynamic_state.pNext;
+        }
+
+        extended_dynamic_state2 = {};
+        extended_dynamic_state2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTENDED_DYNAMIC_STATE_2_FEATURES_EXT;
+        if( extensions.count(VK_EXT_EXTENDED_DYNAMIC_STATE_2_EXTENSION_NAME) )
+        {
+            *next = &extended_dynamic_state2;
+            next = &extended_dynamic_state2.pNext;
+        }
+
+        extended_dynamic_state3 = {};
+        extended_dynamic_state3.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTENDED_DYNAMIC_STATE_3_FEATURES_EXT;
+        if( extensions.count(VK_EXT_EXTENDED_DYNAMIC_STATE_3_EXTENSION_NAME) )
+        {
+            *next = &extended_dynamic_state3;
+            next = &extended_dynamic_state3.pNext;
+        }
+
+        vertex_input_dynamic_state = {};
+        vertex_input_dynamic_state.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VERTEX_INPUT_DYNAMIC_STATE_FEATURES_EXT;
+        if( extensions.count(VK_EXT_VERTEX_INPUT_DYNAMIC_STATE_EXTENSION_NAME) )
+        {
+            *next = &vertex_input_dynamic_state;
+            next = &vertex_input_dynamic_state.pNext;
+        }
+
+        buffer_marker = extensions.count(VK_AMD_BUFFER_MARKER_EXTENSION_NAME) != 0;
+    }
+
+    /*  Fills in the structs from the device.  vkGetPhysicalDeviceFeatures2
+        needs 1.1, older devices report only core features. */
+    void query(VkPhysicalDevice physical_device)
+    {
+        VkPhysicalDeviceProperties properties;
+        vkGetPhysicalDeviceProperties(physical_device, &properties);
+        if( properties.apiVersion >= VK_API_VERSION_1_1 )
+        {
+            vkGetPhysicalDeviceFeatures2(physical_device, &features);
+        }
+        else
+        {
+            vkGetPhysicalDeviceFeatures(physical_device, &features.features);
+        }
+    }
+
+    DeviceFeatures get_device_features() const
+    {
+        DeviceFeatures device_features = {};
+        device_features.pipeline_statistics_query = features.features.pipelineStatisticsQuery;
+        device_features.buffer_device_address = buffer_device_address.bufferDeviceAddress;
+        device_features.host_image_copy = host_image_copy.hostImageCopy;
+        device_features.synchronization2 = synchronization2.synchronization2;
+        device_features.buffer_marker = buffer_marker;
+        device_features.device_fault = device_fault.deviceFault;
+        device_features.device_coherent_memory = device_coherent_memory.deviceCoherentMemory;
+        device_features.present_id = present_id.presentId;
+        device_features.present_wait = present_wait.presentWait;
+        device_features.graphics_pipeline_library = graphics_pipeline_library.graphicsPipelineLibrary;
+        device_features.extended_dynamic_state = extended_dynamic_state.extendedDynamicState;
+        device_features.extended_dynamic_state2 = extended_dynamic_state2.extendedDynamicState2;
+        device_features.extended_dynamic_state3 =
+            extended_dynamic_state3.extendedDynamicState3ColorBlendEnable
+            && extended_dynamic_state3.extendedDynamicState3ColorBlendEquation
+            && extended_dynamic_state3.extendedDynamicState3ColorWriteMask;
+        device_features.vertex_input_dynamic_state = vertex_input_dynamic_state.vertexInputDynamicState;
+        return device_features;
+    }
+
+    /*  Clears everything but the features this library uses, so that
+        enabling the chain does not also turn on costly ones like
+        robustBufferAccess. */
+    void keep_only(const DeviceFeatures& device_features)
+    {
+        features.features = VkPhysicalDeviceFeatures();
+        features.features.pipelineStatisticsQuery = device_features.pipeline_statistics_query;
+
+        buffer_device_address.bufferDeviceAddress = device_features.buffer_device_address;
+        buffer_device_address.bufferDeviceAddressCaptureReplay = VK_FALSE;
+        buffer_device_address.bufferDeviceAddressMultiDevice = VK_FALSE;
+
+        host_image_copy.hostImageCopy = device_features.host_image_copy;
+
+        synchronization2.synchronization2 = device_features.synchronization2;
+
+        device_fault.deviceFault = device_features.device_fault;
+        device_fault.deviceFaultVendorBinary = VK_FALSE;
+
+        device_coherent_memory.deviceCoherentMemory = device_features.device_coherent_memory;
+
+        present_id.presentId = device_features.present_id;
+        present_wait.presentWait = device_features.present_wait;
+        graphics_pipeline_library.graphicsPipelineLibrary = device_features.graphics_pipeline_library;
+
+        extended_dynamic_state.extendedDynamicState = device_features.extended_dynamic_state;
+
+        extended_dynamic_state2.extendedDynamicState2 = device_features.extended_dynamic_state2;
+        extended_dynamic_state2.extendedDynamicState2LogicOp = VK_FALSE;
+        extended_dynamic_state2.extendedDynamicState2PatchControlPoints = VK_FALSE;
+
+        // Of the many states in the struct, only the blend ones are used.
+        void* extended_dynamic_state3_next = extended_dynamic_state3.pNext;
+        extended_dynamic_state3 = {};
+        extended_dynamic_state3.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTENDED_DYNAMIC_STATE_3_FEATURES_EXT;
+        extended_dynamic_state3.pNext = extended_dynamic_state3_next;
+        extended_dynamic_state3.extendedDynamicState3ColorBlendEnable = device_features.extended_dynamic_state3;
+        extended_dynamic_state3.extendedDynamicState3ColorBlendEquation = device_features.extended_dynamic_state3;
+        extended_dynamic_state3.extendedDynamicState3ColorWriteMask = device_features.extended_dynamic_state3;
+
+        vertex_input_dynamic_state.vertexInputDynamicState = device_features.vertex_input_dynamic_state;
+    }
+};
+
+std::vector<ExtensionInfo> PhysicalDevice::get_device_extension_infos()
+{
+    VkResult result;
+
+    uint32_t num_properties = 0;
+    result = vkEnumerateDeviceExtensionProperties(physical_device, nullptr, &num_properties, nullptr);
+    if( result != VK_SUCCESS )
+    {
+        throw VulkanException(result, "Error getting number of device extensions");
+    }
+
+    std::vector<VkExtensionProperties> properties(num_properties);
+    result = vkEnumerateDeviceExtensionProperties(
+        physical_device, nullptr, &num_properties, properties.data());
+    if( result != VK_SUCCESS )
+    {
+        throw VulkanException(result, "Error getting list of device extensions");
+    }
+
+    std::vector<ExtensionInfo> infos;
+    for( VkExtensionProperties& property : properties )
+    {
+        ExtensionInfo info;
+        info.name = property.extensionName;
+        info.specVersion = property.specVersion;
+        infos.push_back(info);
+    }
+
+    return infos;
+}
+
+DeviceFeatures PhysicalDevice::get_supported_features()
+{
+    std::set<std::string> extension_names;
+    for( ExtensionInfo& info : get_device_extension_infos() )
+    {
+        extension_names.insert(info.name);
+    }
+
+    FeatureChain chain(extension_names);
+    chain.query(physical_device);
+    return chain.get_device_features();
 }
 
 LogicalDevice PhysicalDevice::create_logical_device(
@@ -297,9 +1026,11 @@ LogicalDevice PhysicalDevice::create_logical_device(
     }
 
     std::set<std::string> found_extension_names;
+    std::set<std::string> available_extension_names;
     for( size_t i = 0; i < num_device_extension_properties; ++i )
     {
         std::string extension_name(extension_properties[i].extensionName);
+        available_extension_names.insert(extension_name);
         if( requested_extension_name_set.find(extension_name) != requested_extension_name_set.end() )
         {
             found_extension_names.insert(extension_name);
@@ -325,6 +1056,16 @@ LogicalDevice PhysicalDevice::create_logical_device(
         throw std::runtime_error("Not all extensions found:" + not_found_names_str);
     }
 
+    for( ExtensionInfo& info : parameters.get_optional_extensions() )
+    {
+        if( available_extension_names.find(info.name) != available_extension_names.end()
+            && requested_extension_name_set.find(info.name) == requested_extension_name_set.end() )
+        {
+            requested_extension_name_set.insert(info.name);
+            requested_extensions.push_back(info);
+        }
+    }
+
     NamesArray<LayerInfo> requested_layer_names(parameters.get_requested_layers());
     NamesArray<ExtensionInfo> requested_extension_names(requested_extensions);
 
@@ -348,20 +1089,39 @@ LogicalDevice PhysicalDevice::create_logical_device(
     create_info.enabledExtensionCount = requested_extension_names.count;
     create_info.ppEnabledExtensionNames = requested_extension_names.c_strings;
 
-    create_info.pNext = nullptr;
-    create_info.pEnabledFeatures = nullptr;
+    // Turn on the optional features the device supports among those whose
+    // extensions are being enabled.
+    FeatureChain feature_chain(requested_extension_name_set);
+    feature_chain.query(physical_device);
+    DeviceFeatures enabled_features = feature_chain.get_device_features();
+    feature_chain.keep_only(enabled_features);
+
+    // Core features go in pEnabledFeatures when there is no chain to
+    // carry them, that works on 1.0 devices too.
+    if( feature_chain.features.pNext )
+    {
+        create_info.pNext = &feature_chain.features;
+        create_info.pEnabledFeatures = nullptr;
+    }
+    else
+    {
+        create_info.pNext = nullptr;
+        create_info.pEnabledFeatures = &feature_chain.features.features;
+    }
     create_info.flags = 0;
 
     VkDevice device;
 
-    result = vkCreateDevice(physical_device, &create_info, nullptr, &device);
+    result = vkCreateDevice(physical_device, &create_info, host_allocator->get_callbacks(), &device);
     if( result != VK_SUCCESS )
     {
         throw VulkanException(result, "Error while creating logical devive");
     }
 
     delete[] extension_properties;
-    return LogicalDevice(device, queue_family_index);
+    return LogicalDevice(
+        device, physical_device, queue_family_index, requested_extension_name_set, enabled_features,
+        host_allocator);
 }
 
 template<typename ... Args>
@@ -384,12 +1144,19 @@ Surface Instance::create_surface(SDL_Window* window)
         throw std::runtime_error(string_format("SDL could not create surface with window: %p", window));
     }
 
-    return Surface(surface);
+    return Surface(instance, surface);
+}
+
+Surface::Surface(VkInstance instance, VkSurfaceKHR surface)
+    : instance(instance)
+    , surface(surface)
+{
 }
 
-Surface::Surface(VkSurfaceKHR surface)
-    : surface(surface)
+Surface::~Surface()
 {
+    // SDL creates the surface without allocation callbacks.
+    vkDestroySurfaceKHR(instance, surface, nullptr);
 }
 
 }
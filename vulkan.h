@@ -1,6 +1,13 @@
+#pragma once
+
 #include <SDL2/SDL_vulkan.h>
 #include <vulkan/vulkan.h>
 
+#include "memory.h"
+#include "allocator.h"
+
+#include <memory>
+#include <mutex>
 #include <stdexcept>
 #include <string>
 #include <vector>
@@ -70,27 +77,227 @@ private:
 };
 
 /*  Class representing a surface rendered to by a device.  Interally represented
-    as a VkInstance */
+    as a VkSurfaceKHR, destroyed with the Surface, which has to happen before
+    its Instance is destroyed. */
 class Surface
 {
     friend class Instance;
     friend class PhysicalDevice;
 
-    Surface(VkSurfaceKHR surface);
+public:
+    Surface(const Surface&) = delete;
+    Surface& operator=(const Surface&) = delete;
+    ~Surface();
+
+private:
+    Surface(VkInstance instance, VkSurfaceKHR surface);
 
+    VkInstance instance;
     VkSurfaceKHR surface;
 };
 
+/*  A block of device memory as handed out by LogicalDevice::allocate_memory().
+    Remembers its size and type so it can be accounted for when freed. */
+struct DeviceMemory
+{
+    VkDeviceMemory memory;
+    VkDeviceSize size;
+    uint32_t memory_type_index;
+};
+
+class MemoryPool;
+class MemoryAllocation;
+class IAllocationMoveListener;
+class Buffer;
+class Image;
+class Queue;
+class FencePool;
+class SemaphorePool;
+class EventPool;
+class LayoutCache;
+
+/*  Optional device features this library knows how to use.  Apart from the
+    core ones, each depends on an extension, which has to be among the
+    requested or optional extensions when the LogicalDevice is created. */
+struct DeviceFeatures
+{
+    bool pipeline_statistics_query; // core
+    bool buffer_device_address; // VK_KHR_buffer_device_address
+    bool host_image_copy;       // VK_EXT_host_image_copy
+    bool synchronization2;      // VK_KHR_synchronization2
+    bool buffer_marker;         // VK_AMD_buffer_marker
+    bool device_fault;          // VK_EXT_device_fault
+    bool device_coherent_memory; // VK_AMD_device_coherent_memory
+    bool present_id;            // VK_KHR_present_id
+    bool present_wait;          // VK_KHR_present_wait
+    bool graphics_pipeline_library; // VK_EXT_graphics_pipeline_library + VK_KHR_pipeline_library
+    bool extended_dynamic_state;    // VK_EXT_extended_dynamic_state
+    bool extended_dynamic_state2;   // VK_EXT_extended_dynamic_state2
+    bool extended_dynamic_state3;   // VK_EXT_extended_dynamic_state3, blend enable, equation and write mask
+    bool vertex_input_dynamic_state; // VK_EXT_vertex_input_dynamic_state
+};
+
+/*  Entry points of enabled device extensions, loaded with vkGetDeviceProcAddr
+    when the LogicalDevice is created.  Null when the extension is not enabled. */
+struct DeviceFunctions
+{
+    PFN_vkGetBufferDeviceAddressKHR get_buffer_device_address;
+    PFN_vkCopyMemoryToImageEXT copy_memory_to_image;
+    PFN_vkTransitionImageLayoutEXT transition_image_layout;
+    PFN_vkCmdPipelineBarrier2KHR cmd_pipeline_barrier2;
+    PFN_vkCmdSetEvent2KHR cmd_set_event2;
+    PFN_vkCmdWaitEvents2KHR cmd_wait_events2;
+    PFN_vkCmdWriteBufferMarkerAMD cmd_write_buffer_marker;
+    PFN_vkGetDeviceFaultInfoEXT get_device_fault_info;
+    PFN_vkWaitForPresentKHR wait_for_present;
+    PFN_vkCmdSetCullModeEXT cmd_set_cull_mode;
+    PFN_vkCmdSetFrontFaceEXT cmd_set_front_face;
+    PFN_vkCmdSetPrimitiveTopologyEXT cmd_set_primitive_topology;
+    PFN_vkCmdSetDepthTestEnableEXT cmd_set_depth_test_enable;
+    PFN_vkCmdSetDepthWriteEnableEXT cmd_set_depth_write_enable;
+    PFN_vkCmdSetDepthCompareOpEXT cmd_set_depth_compare_op;
+    PFN_vkCmdSetPrimitiveRestartEnableEXT cmd_set_primitive_restart_enable;
+    PFN_vkCmdSetColorBlendEnableEXT cmd_set_color_blend_enable;
+    PFN_vkCmdSetColorBlendEquationEXT cmd_set_color_blend_equation;
+    PFN_vkCmdSetColorWriteMaskEXT cmd_set_color_write_mask;
+    PFN_vkCmdSetVertexInputEXT cmd_set_vertex_input;
+};
+
 /*  Wrapper for VkDevice, generated by the PhysicalDevice by calling
-    create_logical_device() */
+    create_logical_device().  Subsystems keep references to it, so it can
+    be neither copied nor moved. */
 class LogicalDevice
 {
     friend class PhysicalDevice;
 
+public:
+    LogicalDevice(const LogicalDevice&) = delete;
+    LogicalDevice& operator=(const LogicalDevice&) = delete;
+    ~LogicalDevice();
+
+    VkDevice get_device() const;
+    VkPhysicalDevice get_physical_device() const;
+    uint32_t get_queue_family_index() const;
+    VkQueue get_queue() const;
+
+    /*  The queue from get_queue(), wrapped so that threads can submit to it
+        safely.  All submissions should go through it. */
+    Queue& get_submit_queue();
+
+    /*  Fences, binary semaphores and events to acquire and release instead
+        of creating and destroying them.  They live as long as the device. */
+    FencePool& get_fence_pool();
+    SemaphorePool& get_semaphore_pool();
+    EventPool& get_event_pool();
+
+    /*  Descriptor set and pipeline layouts, created once per distinct
+        layout and shared.  They live as long as the device. */
+    LayoutCache& get_layout_cache();
+
+    const VkPhysicalDeviceProperties& get_properties() const;
+    const VkPhysicalDeviceMemoryProperties& get_memory_properties() const;
+
+    /*  Host allocation callbacks to pass to every vkCreate* / vkDestroy*
+        call on this device. */
+    const VkAllocationCallbacks* get_allocation_callbacks() const;
+    HostAllocator& get_host_allocator();
+
+    /*  True when device-local memory is also host-visible across the
+        device's main heap, as on integrated GPUs and software rasterizers.
+        Uploads can then write resources directly instead of staging. */
+    bool has_unified_memory() const;
+
+    bool is_extension_enabled(const std::string& name) const;
+    const DeviceFeatures& get_enabled_features() const;
+    const DeviceFunctions& get_functions() const;
+
+    /*  Returns the index of a memory type allowed by memory_type_bits with all
+        the requested property flags.  Throws if there is none. */
+    uint32_t find_memory_type(uint32_t memory_type_bits, VkMemoryPropertyFlags properties) const;
+
+    /*  Allocates device memory after checking with the memory governor.
+        Returns a DeviceMemory with a null handle if a deferrable allocation
+        was postponed, throws a VulkanException if it was denied or the
+        driver is out of memory even after the governor made room. */
+    DeviceMemory allocate_memory(
+        VkDeviceSize size,
+        uint32_t memory_type_index,
+        AllocationPriority priority = AllocationPriority::NORMAL);
+
+    void free_memory(const DeviceMemory& memory);
+
+    MemoryGovernor& get_memory_governor();
+
+    /*  Suballocates from the memory pool for the first memory type that fits
+        requirements and has the property flags.  Pass a listener to let the
+        defragmenter move the allocation.  Returns nullptr if a deferrable
+        allocation was postponed. */
+    MemoryAllocation* allocate(
+        const VkMemoryRequirements& requirements,
+        VkMemoryPropertyFlags properties,
+        AllocationPriority priority = AllocationPriority::NORMAL,
+        IAllocationMoveListener* listener = nullptr);
+
+    void free(MemoryAllocation* allocation);
+
+    /*  Host pointer to a host-visible allocation, valid until it is freed. */
+    void* map(MemoryAllocation* allocation);
+
+    /*  Makes host writes to the allocation visible to the device.  Does
+        nothing for host-coherent memory. */
+    void flush(MemoryAllocation* allocation);
+
+    std::vector<MemoryPool*> get_memory_pools();
+
+    /*  Creates a buffer and binds it to memory from the pools.  Buffers are
+        movable by the defragmenter.  Returns nullptr if a deferrable
+        allocation was postponed. */
+    std::unique_ptr<Buffer> create_buffer(
+        VkDeviceSize size,
+        VkBufferUsageFlags usage,
+        VkMemoryPropertyFlags properties,
+        AllocationPriority priority = AllocationPriority::NORMAL);
+
+    /*  Creates an optimally tiled 2D (or 3D when extent.depth > 1) image
+        bound to memory from the pools.  Images are not moved by the
+        defragmenter.  Returns nullptr if a deferrable allocation was
+        postponed. */
+    std::unique_ptr<Image> create_image(
+        VkFormat format,
+        VkExtent3D extent,
+        uint32_t mip_levels,
+        uint32_t array_layers,
+        VkImageUsageFlags usage,
+        VkMemoryPropertyFlags properties,
+        AllocationPriority priority = AllocationPriority::NORMAL);
+
 private:
-    LogicalDevice(VkDevice device, uint32_t queue_family_index);
+    LogicalDevice(
+        VkDevice device,
+        VkPhysicalDevice physical_device,
+        uint32_t queue_family_index,
+        const std::set<std::string>& enabled_extensions,
+        const DeviceFeatures& enabled_features,
+        const std::shared_ptr<HostAllocator>& host_allocator);
+
     VkDevice device;
+    VkPhysicalDevice physical_device;
     uint32_t queue_family_index;
+    std::set<std::string> enabled_extensions;
+    DeviceFeatures enabled_features;
+    DeviceFunctions functions;
+    std::shared_ptr<HostAllocator> host_allocator;
+    VkQueue queue;
+    std::unique_ptr<Queue> submit_queue;
+    std::unique_ptr<FencePool> fence_pool;
+    std::unique_ptr<SemaphorePool> semaphore_pool;
+    std::unique_ptr<EventPool> event_pool;
+    std::unique_ptr<LayoutCache> layout_cache;
+    VkPhysicalDeviceProperties properties;
+    VkPhysicalDeviceMemoryProperties memory_properties;
+    std::unique_ptr<MemoryGovernor> memory_governor;
+    std::map<uint32_t, std::unique_ptr<MemoryPool>> memory_pools;
+    std::mutex memory_pools_mutex;
 };
 
 /*  Mimics the structure pointed to by VkExtensionProperties, except that it
@@ -117,6 +324,10 @@ class IRequestLayerAndExtensions
 public:
     virtual std::vector<LayerInfo> get_requested_layers() const = 0;
     virtual std::vector<ExtensionInfo> get_requested_extensions() const = 0;
+
+    /*  Extensions that are enabled if the device has them but are not
+        required.  Defaults to none. */
+    virtual std::vector<ExtensionInfo> get_optional_extensions() const;
 };
 
 /*  Wrapper for VkPhysicalDevice, stores a VkPhysical device as well
@@ -137,13 +348,26 @@ public:
 
     bool is_surface_supported(const Surface& surface);
 
+    /*  True when the device has host-visible device-local memory across its
+        main heap, see LogicalDevice::has_unified_memory(). */
+    bool has_unified_memory();
+
+    /*  Gets the list of extensions the device offers. */
+    std::vector<ExtensionInfo> get_device_extension_infos();
+
+    /*  Reports which of the optional features the device supports.  A
+        feature counts only if its extension is available too. */
+    DeviceFeatures get_supported_features();
+
 private:
     PhysicalDevice(
         VkPhysicalDevice physical_device,
-        uint32_t queue_family_index);
+        uint32_t queue_family_index,
+        const std::shared_ptr<HostAllocator>& host_allocator);
 
     VkPhysicalDevice physical_device;
     uint32_t queue_family_index;
+    std::shared_ptr<HostAllocator> host_allocator;
 };
 
 /*  This class is establishes requirements and requested options when
@@ -163,12 +387,19 @@ class Instance
 {
 public:
     explicit Instance(const ICreateInstanceParameters& parameters);
+    Instance(const Instance&) = delete;
+    Instance& operator=(const Instance&) = delete;
     virtual ~Instance();
 
     PhysicalDevice select_gpu();
     Surface create_surface(SDL_Window* window);
 
+    /*  Supplies the host allocation callbacks of the instance and of all
+        devices created from it. */
+    HostAllocator& get_host_allocator();
+
 private:
+    std::shared_ptr<HostAllocator> host_allocator;
     VkInstance instance;
 };
 